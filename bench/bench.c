@@ -0,0 +1,688 @@
+#define _DEFAULT_SOURCE
+
+// Benchmark driver. Starts the mock Ollama server, then measures
+// english_compile and english_compile_stream in-process (sequentially and
+// from several threads, sharing the default context or each on a handle of
+// its own, and many at once on one thread's event loop) and the english CLI
+// end to end. Results are written as JSON so that runs can be compared over
+// time.
+
+#include "../include/english.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CONCURRENCY_LEVELS 16
+#define MAX_PATH_LENGTH 1024
+#define BENCH_PROMPT "A function that returns the sum of a list of integers"
+#define BENCH_LANGUAGE "python"
+
+// Command line settings
+typedef struct {
+    const char *mock_path;
+    const char *cli_path;
+    const char *output_path;
+    int requests;
+    int cli_runs;
+    int concurrency[MAX_CONCURRENCY_LEVELS];
+    int concurrency_count;
+    int latency;
+    int token_rate;
+    long response_bytes;
+    double error_rate;
+    int server_parallel;
+} bench_options_t;
+
+// Latencies and failures of one scenario
+typedef struct {
+    const char *name;
+    int concurrency;
+    int requests;
+    int failures;
+    double seconds;
+    double speedup;      // Throughput over the sequential compile, 0 for the CLI
+    double *latencies;   // Milliseconds, one per request
+} bench_result_t;
+
+// Work shared by the threads of a concurrent scenario
+typedef struct {
+    bench_result_t *result;
+    pthread_mutex_t lock;
+    int next;
+    const char *endpoint;  // Endpoint of each thread's own handle, NULL to share the default context
+} bench_work_t;
+
+// One compile of the async scenario
+typedef struct bench_loop bench_loop_t;
+typedef struct {
+    bench_loop_t *loop;
+    int index;
+    double started;
+} bench_call_t;
+
+// A poll() loop driving the compiles of the async scenario on one thread
+struct bench_loop {
+    english_async_t *async;
+    struct pollfd *fds;
+    int fd_count;
+    int fd_capacity;
+    long timeout_ms;         // As last set by the timer callback, -1 for none
+    double timer_started;
+    bench_result_t *result;
+    bench_call_t *calls;
+    int next;                // The next request to start
+};
+
+static void print_usage(void) {
+    printf("Usage: bench --mock PATH [options]\n\n");
+    printf("Options:\n");
+    printf("  --mock PATH            The mock_ollama executable (required)\n");
+    printf("  --cli PATH             Also benchmark this english executable end to end\n");
+    printf("  --output FILE          Write the JSON results to FILE (default: stdout)\n");
+    printf("  --requests N           Requests per in-process scenario (default: 200)\n");
+    printf("  --cli-runs N           CLI invocations (default: 20)\n");
+    printf("  --concurrency LIST     Comma-separated thread counts (default: 1,4,16)\n");
+    printf("  --latency MS           Mock delay before the first token (default: 0)\n");
+    printf("  --token-rate N         Mock tokens per second, 0 for unlimited (default: 0)\n");
+    printf("  --response-bytes N     Mock bytes of code per response (default: 2048)\n");
+    printf("  --error-rate P         Mock fraction of failed requests (default: 0)\n");
+    printf("  --server-parallel N    Mock requests generated at once, 0 for unlimited (default: 0)\n");
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const double *sorted, int count, double p) {
+    if (count == 0) {
+        return 0;
+    }
+    int rank = (int)(p / 100.0 * count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[(rank > count ? count : rank) - 1];
+}
+
+// Start the mock server and return its port, or 0 on failure
+static int start_mock(const bench_options_t *options, pid_t *pid) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return 0;
+    }
+    
+    char latency[32];
+    char token_rate[32];
+    char response_bytes[32];
+    char error_rate[32];
+    char parallel[32];
+    snprintf(latency, sizeof(latency), "%d", options->latency);
+    snprintf(token_rate, sizeof(token_rate), "%d", options->token_rate);
+    snprintf(response_bytes, sizeof(response_bytes), "%ld", options->response_bytes);
+    snprintf(error_rate, sizeof(error_rate), "%g", options->error_rate);
+    snprintf(parallel, sizeof(parallel), "%d", options->server_parallel);
+    
+    *pid = fork();
+    if (*pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(options->mock_path, options->mock_path, "--latency", latency, "--token-rate", token_rate,
+              "--response-bytes", response_bytes, "--error-rate", error_rate, "--parallel", parallel, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    
+    // The mock announces its port once it is listening
+    int port = 0;
+    FILE *announce = fdopen(fds[0], "r");
+    if (*pid < 0 || announce == NULL || fscanf(announce, "port %d", &port) != 1) {
+        port = 0;
+    }
+    if (announce != NULL) {
+        fclose(announce);
+    } else {
+        close(fds[0]);
+    }
+    return port;
+}
+
+// Point HOME at a scratch directory whose config selects the mock endpoint,
+// and write the description the CLI compiles there
+static bool make_home(char *home, size_t home_size, const char *endpoint) {
+    snprintf(home, home_size, "/tmp/english-bench-XXXXXX");
+    if (mkdtemp(home) == NULL) {
+        return false;
+    }
+    
+    char path[MAX_PATH_LENGTH + 64];
+    snprintf(path, sizeof(path), "%s/.english", home);
+    if (mkdir(path, 0700) != 0) {
+        return false;
+    }
+    
+    snprintf(path, sizeof(path), "%s/.english/config.txt", home);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    fprintf(file, "endpoint=%s\n", endpoint);
+    fclose(file);
+    
+    snprintf(path, sizeof(path), "%s/prompt.eng", home);
+    file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    fprintf(file, "%s\n", BENCH_PROMPT);
+    fclose(file);
+    
+    return setenv("HOME", home, 1) == 0;
+}
+
+static void remove_home(const char *home) {
+    char path[MAX_PATH_LENGTH + 64];
+    snprintf(path, sizeof(path), "%s/prompt.eng", home);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/.english/config.txt", home);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/.english", home);
+    rmdir(path);
+    rmdir(home);
+}
+
+static bool discard_chunk(const char *chunk, size_t length, void *userdata) {
+    (void)chunk;
+    (void)length;
+    (void)userdata;
+    return true;
+}
+
+// Time one in-process compile, on a context or else the default one; returns
+// false if it failed
+static bool timed_compile(english_context_t *context, bool stream, double *milliseconds) {
+    double started = now_seconds();
+    bool success;
+    if (stream) {
+        success = english_compile_stream(BENCH_PROMPT, BENCH_LANGUAGE, discard_chunk, NULL);
+    } else {
+        char *code = context != NULL ? english_context_compile(context, BENCH_PROMPT, BENCH_LANGUAGE, NULL) :
+                     english_compile(BENCH_PROMPT, BENCH_LANGUAGE, NULL);
+        success = code != NULL;
+        free(code);
+    }
+    *milliseconds = (now_seconds() - started) * 1000.0;
+    return success;
+}
+
+static void *compile_worker(void *arg) {
+    bench_work_t *work = (bench_work_t *)arg;
+    
+    // A handle of the thread's own, set up the way separate users of the library would
+    english_context_t *context = NULL;
+    bool ready = true;
+    if (work->endpoint != NULL) {
+        context = english_context_new();
+        ready = context != NULL && english_context_set_endpoint(context, work->endpoint);
+        if (ready) {
+            english_context_set_cache_enabled(context, false);
+            english_context_set_verbose(context, false);
+        }
+    }
+    
+    for (;;) {
+        pthread_mutex_lock(&work->lock);
+        int index = work->next < work->result->requests ? work->next++ : -1;
+        pthread_mutex_unlock(&work->lock);
+        if (index < 0) {
+            break;
+        }
+        
+        if (!ready || !timed_compile(context, false, &work->result->latencies[index])) {
+            pthread_mutex_lock(&work->lock);
+            work->result->failures++;
+            pthread_mutex_unlock(&work->lock);
+        }
+    }
+    
+    english_context_free(context);
+    return NULL;
+}
+
+// Run requests compiles sequentially, or spread over threads when concurrency > 1
+// or each thread has a handle of its own for endpoint
+static bool run_library(bench_result_t *result, const char *name, int requests, int concurrency, bool stream,
+                        const char *endpoint) {
+    result->name = name;
+    result->concurrency = concurrency;
+    result->requests = requests;
+    result->latencies = calloc(requests > 0 ? requests : 1, sizeof(double));
+    if (result->latencies == NULL) {
+        return false;
+    }
+    
+    double started = now_seconds();
+    if (concurrency <= 1 && endpoint == NULL) {
+        for (int i = 0; i < requests; i++) {
+            if (!timed_compile(NULL, stream, &result->latencies[i])) {
+                result->failures++;
+            }
+        }
+    } else {
+        bench_work_t work = { result, PTHREAD_MUTEX_INITIALIZER, 0, endpoint };
+        pthread_t threads[256];
+        int count = concurrency < 256 ? concurrency : 256;
+        for (int i = 0; i < count; i++) {
+            pthread_create(&threads[i], NULL, compile_worker, &work);
+        }
+        for (int i = 0; i < count; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    result->seconds = now_seconds() - started;
+    return true;
+}
+
+// Watch a descriptor for the events the compiles want, or stop watching it
+static void loop_watch(int fd, int events, void *userdata) {
+    bench_loop_t *loop = (bench_loop_t *)userdata;
+    int i = 0;
+    while (i < loop->fd_count && loop->fds[i].fd != fd) {
+        i++;
+    }
+    
+    if (events == 0) {
+        if (i < loop->fd_count) {
+            loop->fds[i] = loop->fds[--loop->fd_count];
+        }
+        return;
+    }
+    
+    if (i == loop->fd_count) {
+        if (loop->fd_count == loop->fd_capacity) {
+            int capacity = loop->fd_capacity > 0 ? loop->fd_capacity * 2 : 64;
+            struct pollfd *fds = realloc(loop->fds, capacity * sizeof(struct pollfd));
+            if (fds == NULL) {
+                return;
+            }
+            loop->fds = fds;
+            loop->fd_capacity = capacity;
+        }
+        loop->fds[loop->fd_count++].fd = fd;
+    }
+    loop->fds[i].events = (short)(((events & ENGLISH_ASYNC_READ) ? POLLIN : 0) |
+                                  ((events & ENGLISH_ASYNC_WRITE) ? POLLOUT : 0));
+    loop->fds[i].revents = 0;
+}
+
+static void loop_timer(long timeout_ms, void *userdata) {
+    bench_loop_t *loop = (bench_loop_t *)userdata;
+    loop->timeout_ms = timeout_ms;
+    loop->timer_started = now_seconds();
+}
+
+static void start_call(bench_loop_t *loop);
+
+static void call_done(english_async_job_t *job, char *code, size_t length, void *userdata) {
+    (void)job;
+    (void)length;
+    bench_call_t *call = (bench_call_t *)userdata;
+    bench_loop_t *loop = call->loop;
+    loop->result->latencies[call->index] = (now_seconds() - call->started) * 1000.0;
+    if (code == NULL) {
+        loop->result->failures++;
+    }
+    free(code);
+    
+    if (loop->next < loop->result->requests) {
+        start_call(loop);
+    }
+}
+
+static void start_call(bench_loop_t *loop) {
+    bench_call_t *call = &loop->calls[loop->next];
+    call->loop = loop;
+    call->index = loop->next++;
+    call->started = now_seconds();
+    if (english_async_compile(loop->async, BENCH_PROMPT, BENCH_LANGUAGE, NULL, call_done, call) == NULL) {
+        loop->result->failures++;
+    }
+}
+
+// Keep concurrency compiles outstanding on one thread until requests are done
+static bool run_async(bench_result_t *result, int requests, int concurrency) {
+    result->name = "async";
+    result->concurrency = concurrency;
+    result->requests = requests;
+    result->latencies = calloc(requests > 0 ? requests : 1, sizeof(double));
+    bench_loop_t loop = { NULL, NULL, 0, 0, -1, 0, result, calloc(requests > 0 ? requests : 1,
+                          sizeof(bench_call_t)), 0 };
+    english_context_t *context = english_context_new();
+    if (result->latencies == NULL || loop.calls == NULL || context == NULL) {
+        free(loop.calls);
+        english_context_free(context);
+        return false;
+    }
+    english_context_set_cache_enabled(context, false);
+    loop.async = english_async_new(context, loop_watch, loop_timer, &loop);
+    
+    double started = now_seconds();
+    for (int i = 0; i < concurrency && loop.next < requests && loop.async != NULL; i++) {
+        start_call(&loop);
+    }
+    
+    while (loop.async != NULL && english_async_pending(loop.async) > 0) {
+        int wait = 1000;
+        if (loop.timeout_ms >= 0) {
+            double left = loop.timeout_ms - (now_seconds() - loop.timer_started) * 1000.0;
+            wait = left > 0 ? (int)left + 1 : 0;
+        }
+        int ready = poll(loop.fds, loop.fd_count, wait);
+        
+        // The callbacks change the descriptor set, so take the ready ones first
+        int count = 0;
+        struct pollfd *fired = ready > 0 ? malloc(ready * sizeof(struct pollfd)) : NULL;
+        for (int i = 0; i < loop.fd_count && fired != NULL && count < ready; i++) {
+            if (loop.fds[i].revents != 0) {
+                fired[count++] = loop.fds[i];
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            int events = ((fired[i].revents & POLLIN) ? ENGLISH_ASYNC_READ : 0) |
+                         ((fired[i].revents & POLLOUT) ? ENGLISH_ASYNC_WRITE : 0) |
+                         ((fired[i].revents & (POLLERR | POLLHUP)) ? ENGLISH_ASYNC_ERROR : 0);
+            english_async_socket_ready(loop.async, fired[i].fd, events);
+        }
+        free(fired);
+        
+        if (loop.timeout_ms >= 0 && (now_seconds() - loop.timer_started) * 1000.0 >= loop.timeout_ms) {
+            loop.timeout_ms = -1;
+            english_async_timeout(loop.async);
+        }
+    }
+    result->seconds = now_seconds() - started;
+    if (loop.async == NULL) {
+        result->failures = requests;
+    }
+    
+    english_async_free(loop.async);
+    english_context_free(context);
+    free(loop.fds);
+    free(loop.calls);
+    return true;
+}
+
+// Run the CLI end to end; returns the peak RSS of the children in KB
+static long run_cli(bench_result_t *result, const char *cli_path, const char *home, int runs) {
+    result->name = "cli_compile";
+    result->concurrency = 1;
+    result->requests = runs;
+    result->latencies = calloc(runs > 0 ? runs : 1, sizeof(double));
+    if (result->latencies == NULL) {
+        return 0;
+    }
+    
+    char prompt_path[MAX_PATH_LENGTH + 64];
+    snprintf(prompt_path, sizeof(prompt_path), "%s/prompt.eng", home);
+    
+    long peak_rss = 0;
+    double started = now_seconds();
+    for (int i = 0; i < runs; i++) {
+        double run_started = now_seconds();
+        pid_t pid = fork();
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            execl(cli_path, cli_path, "compile", BENCH_LANGUAGE, "--file", prompt_path,
+                  "--no-cache", "--no-daemon", (char *)NULL);
+            _exit(127);
+        }
+        
+        int status = 0;
+        struct rusage usage;
+        if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) {
+            result->failures++;
+            continue;
+        }
+        result->latencies[i] = (now_seconds() - run_started) * 1000.0;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            result->failures++;
+        }
+        if (usage.ru_maxrss > peak_rss) {
+            peak_rss = usage.ru_maxrss;
+        }
+    }
+    result->seconds = now_seconds() - started;
+    return peak_rss;
+}
+
+// Write one scenario; its latencies must be sorted
+static void write_result(FILE *out, const bench_result_t *result, bool last) {
+    double total = 0;
+    for (int i = 0; i < result->requests; i++) {
+        total += result->latencies[i];
+    }
+    int n = result->requests;
+    
+    fprintf(out, "    {\n");
+    fprintf(out, "      \"name\": \"%s\",\n", result->name);
+    fprintf(out, "      \"concurrency\": %d,\n", result->concurrency);
+    fprintf(out, "      \"requests\": %d,\n", n);
+    fprintf(out, "      \"failures\": %d,\n", result->failures);
+    fprintf(out, "      \"seconds\": %.6f,\n", result->seconds);
+    fprintf(out, "      \"requests_per_second\": %.2f,\n", result->seconds > 0 ? n / result->seconds : 0.0);
+    if (result->speedup > 0) {
+        fprintf(out, "      \"speedup\": %.2f,\n", result->speedup);
+    }
+    fprintf(out, "      \"latency_ms\": { \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f }\n",
+            n > 0 ? total / n : 0.0, percentile(result->latencies, n, 50), percentile(result->latencies, n, 95),
+            percentile(result->latencies, n, 99), n > 0 ? result->latencies[n - 1] : 0.0);
+    fprintf(out, "    }%s\n", last ? "" : ",");
+}
+
+// Print one line per scenario for people watching the run
+static void print_summary(const bench_result_t *results, int count) {
+    fprintf(stderr, "%-16s %5s %8s %9s %8s %9s %9s %9s\n", "scenario", "conc", "failed", "req/s", "speedup",
+            "p50 ms", "p95 ms", "p99 ms");
+    for (int i = 0; i < count; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(stderr, "%-16s %5d %8d %9.1f %8.2f %9.3f %9.3f %9.3f\n", r->name, r->concurrency, r->failures,
+                r->seconds > 0 ? r->requests / r->seconds : 0.0, r->speedup,
+                percentile(r->latencies, r->requests, 50), percentile(r->latencies, r->requests, 95),
+                percentile(r->latencies, r->requests, 99));
+    }
+}
+
+static bool parse_concurrency(const char *list, bench_options_t *options) {
+    options->concurrency_count = 0;
+    char *copy = strdup(list);
+    char *save = NULL;
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        int level = atoi(item);
+        if (level < 1 || options->concurrency_count == MAX_CONCURRENCY_LEVELS) {
+            free(copy);
+            return false;
+        }
+        options->concurrency[options->concurrency_count++] = level;
+    }
+    free(copy);
+    return options->concurrency_count > 0;
+}
+
+int main(int argc, char *argv[]) {
+    bench_options_t options = {
+        NULL, NULL, NULL, 200, 20, { 1, 4, 16 }, 3, 0, 0, 2048, 0.0, 0
+    };
+    
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            print_usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "--mock") == 0) {
+            options.mock_path = argv[++i];
+        } else if (strcmp(argv[i], "--cli") == 0) {
+            options.cli_path = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0) {
+            options.output_path = argv[++i];
+        } else if (strcmp(argv[i], "--requests") == 0) {
+            options.requests = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cli-runs") == 0) {
+            options.cli_runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--concurrency") == 0) {
+            if (!parse_concurrency(argv[++i], &options)) {
+                fprintf(stderr, "Error: Invalid concurrency list %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            options.latency = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--token-rate") == 0) {
+            options.token_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--response-bytes") == 0) {
+            options.response_bytes = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--error-rate") == 0) {
+            options.error_rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--server-parallel") == 0) {
+            options.server_parallel = atoi(argv[++i]);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    
+    if (options.mock_path == NULL || options.requests < 1) {
+        print_usage();
+        return 1;
+    }
+    
+    pid_t mock_pid;
+    int port = start_mock(&options, &mock_pid);
+    if (port == 0) {
+        fprintf(stderr, "Error: Could not start %s\n", options.mock_path);
+        return 1;
+    }
+    
+    char endpoint[128];
+    snprintf(endpoint, sizeof(endpoint), "http://127.0.0.1:%d/api/generate", port);
+    
+    char home[MAX_PATH_LENGTH];
+    if (!make_home(home, sizeof(home), endpoint)) {
+        fprintf(stderr, "Error: Could not create a scratch home directory\n");
+        kill(mock_pid, SIGTERM);
+        return 1;
+    }
+    
+    bench_result_t results[3 * MAX_CONCURRENCY_LEVELS + 3];
+    memset(results, 0, sizeof(results));
+    int count = 0;
+    
+    // In-process scenarios never touch the on-disk cache
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        kill(mock_pid, SIGTERM);
+        remove_home(home);
+        return 1;
+    }
+    english_set_cache_enabled(false);
+    
+    run_library(&results[count++], "compile", options.requests, 1, false, NULL);
+    run_library(&results[count++], "compile_stream", options.requests, 1, true, NULL);
+    for (int i = 0; i < options.concurrency_count; i++) {
+        if (options.concurrency[i] > 1) {
+            run_library(&results[count++], "compile_threads", options.requests, options.concurrency[i], false,
+                        NULL);
+        }
+    }
+    
+    // Threads on handles of their own should scale linearly up to the
+    // server's parallelism
+    for (int i = 0; i < options.concurrency_count; i++) {
+        run_library(&results[count++], "handle_threads", options.requests, options.concurrency[i], false,
+                    endpoint);
+    }
+    
+    // The same concurrency from a single thread's event loop
+    for (int i = 0; i < options.concurrency_count; i++) {
+        run_async(&results[count++], options.requests, options.concurrency[i]);
+    }
+    
+    english_cleanup();
+    
+    double base = results[0].seconds > 0 ? results[0].requests / results[0].seconds : 0;
+    for (int i = 0; i < count && base > 0; i++) {
+        results[i].speedup = results[i].seconds > 0 ? results[i].requests / results[i].seconds / base : 0;
+    }
+    
+    struct rusage self_usage;
+    getrusage(RUSAGE_SELF, &self_usage);
+    
+    long cli_peak_rss = 0;
+    if (options.cli_path != NULL) {
+        cli_peak_rss = run_cli(&results[count++], options.cli_path, home, options.cli_runs);
+    }
+    
+    kill(mock_pid, SIGTERM);
+    waitpid(mock_pid, NULL, 0);
+    remove_home(home);
+    
+    for (int i = 0; i < count; i++) {
+        qsort(results[i].latencies, results[i].requests, sizeof(double), compare_doubles);
+    }
+    print_summary(results, count);
+    
+    FILE *out = stdout;
+    if (options.output_path != NULL) {
+        out = fopen(options.output_path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Error: Could not open output file %s\n", options.output_path);
+            return 1;
+        }
+    }
+    
+    fprintf(out, "{\n");
+    fprintf(out, "  \"timestamp\": %ld,\n", (long)time(NULL));
+    fprintf(out, "  \"mock\": { \"latency_ms\": %d, \"token_rate\": %d, \"response_bytes\": %ld, \"error_rate\": %g, "
+            "\"parallel\": %d },\n", options.latency, options.token_rate, options.response_bytes, options.error_rate,
+            options.server_parallel);
+    fprintf(out, "  \"peak_rss_kb\": { \"library\": %ld, \"cli\": %ld },\n", self_usage.ru_maxrss, cli_peak_rss);
+    fprintf(out, "  \"results\": [\n");
+    for (int i = 0; i < count; i++) {
+        write_result(out, &results[i], i == count - 1);
+        free(results[i].latencies);
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+    
+    if (out != stdout) {
+        fclose(out);
+        fprintf(stderr, "Results written to %s\n", options.output_path);
+    }
+    
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        failures += results[i].failures;
+    }
+    // Failures only count against the run when none were injected
+    return failures > 0 && options.error_rate == 0 ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Micro-benchmark of the code fence extractor. It first checks fence_next and
+// fence_extract against a set of known responses, then times them on
+// synthetic responses of several sizes next to the strstr-and-copy extraction
+// they replaced.
+
+#include "../include/fence.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A response and the blocks fence_next must find in it
+typedef struct {
+    const char *name;
+    const char *text;
+    int blocks;
+    const char *first_language;
+    const char *first_code;
+    const char *extracted;      // What fence_extract returns
+} fence_case_t;
+
+static const fence_case_t cases[] = {
+    { "single block", "Here:\n```python\nprint(1)\n```\nDone.", 1, "python", "print(1)\n", "print(1)\n" },
+    { "no language", "```\nx\n```", 1, "", "x\n", "x\n" },
+    { "file name", "```c main.c\nint x;\n```", 1, "c", "int x;\n", "int x;\n" },
+    { "two blocks", "```js\na\n```\ntext\n```css\nb\n```\n", 2, "js", "a\n", "a\n" },
+    { "unterminated", "```go\nfunc f() {}\n", 1, "go", "func f() {}\n", "func f() {}\n" },
+    { "backticks in code", "```py\ns = \"```x\"\n```", 1, "py", "s = \"```x\"\n", "s = \"```x\"\n" },
+    { "fence ends line", "```c\nint x;```\n", 1, "c", "int x;", "int x;" },
+    { "indented close", "```sh\necho\n   ```", 1, "sh", "echo\n", "echo\n" },
+    { "longer fence", "````md\n```\ninner\n```\n````", 1, "md", "```\ninner\n```\n", "```\ninner\n```\n" },
+    { "inline code", "Use ```x``` here\nCode: y = 1", 0, NULL, NULL, "y = 1" },
+    { "code marker", "Code:\n  z = 2", 0, NULL, NULL, "z = 2" },
+    { "plain", "a = 1\n", 0, NULL, NULL, "a = 1\n" },
+};
+
+static bool span_equals(const char *span, size_t length, const char *expected) {
+    return strlen(expected) == length && memcmp(span, expected, length) == 0;
+}
+
+// Check the extractor against every case; returns the number of failures
+static int self_check(void) {
+    int failures = 0;
+    
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const fence_case_t *c = &cases[i];
+        size_t length = strlen(c->text);
+        size_t offset = 0;
+        int count = 0;
+        bool ok = true;
+        fence_block_t block;
+        
+        while (fence_next(c->text, length, &offset, &block)) {
+            if (count == 0 && (c->blocks == 0 ||
+                               !span_equals(block.language, block.language_length, c->first_language) ||
+                               !span_equals(block.code, block.code_length, c->first_code))) {
+                ok = false;
+            }
+            count++;
+        }
+        ok = ok && count == c->blocks;
+        
+        size_t code_length;
+        const char *code = fence_extract(c->text, length, &code_length);
+        ok = ok && span_equals(code, code_length, c->extracted);
+        
+        if (!ok) {
+            fprintf(stderr, "FAIL: %s\n", c->name);
+            failures++;
+        }
+    }
+    
+    return failures;
+}
+
+// The extraction fence_extract replaced: several scans and a temporary copy
+static char *legacy_extract(const char *content) {
+    const char *start = strstr(content, "```");
+    if (start != NULL) {
+        const char *newline = strchr(start + 3, '\n');
+        if (newline != NULL) {
+            const char *code_start = newline + 1;
+            const char *code_end = strstr(code_start, "```");
+            size_t length = code_end != NULL ? (size_t)(code_end - code_start) : strlen(code_start);
+            char *temp = malloc(length + 1);
+            strncpy(temp, code_start, length);
+            temp[length] = '\0';
+            char *output = malloc(length + 1);
+            strncpy(output, temp, length + 1);
+            free(temp);
+            return output;
+        }
+    }
+    size_t length = strlen(content);
+    char *output = malloc(length + 1);
+    memcpy(output, content, length + 1);
+    return output;
+}
+
+// A response with a preamble, the given number of blocks of code and commentary
+static char *make_response(size_t code_bytes, int blocks, size_t *length) {
+    const char *line = "    total = total + values[index]  # accumulate\n";
+    size_t line_length = strlen(line);
+    size_t capacity = code_bytes + blocks * 64 + 256;
+    char *text = malloc(capacity);
+    size_t size = 0;
+    
+    size += sprintf(text + size, "Here is the code you asked for:\n\n");
+    for (int b = 0; b < blocks; b++) {
+        size += sprintf(text + size, "```python part%d.py\n", b);
+        for (size_t written = 0; written + line_length <= code_bytes / blocks; written += line_length) {
+            memcpy(text + size, line, line_length);
+            size += line_length;
+        }
+        size += sprintf(text + size, "```\n\n");
+    }
+    size += sprintf(text + size, "This sums the list.");
+    
+    *length = size;
+    return text;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keeps the compiler from discarding the work being timed
+static volatile size_t sink;
+
+static void run_size(size_t code_bytes, int blocks) {
+    size_t length;
+    char *text = make_response(code_bytes, blocks, &length);
+    int iterations = (int)(256 * 1024 * 1024 / length) + 1;
+    
+    double start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        char *output = legacy_extract(text);
+        sink += output[0];
+        free(output);
+    }
+    double legacy = now_seconds() - start;
+    
+    start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        size_t code_length;
+        sink += fence_extract(text, length, &code_length)[0] + code_length;
+    }
+    double first = now_seconds() - start;
+    
+    start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        size_t offset = 0;
+        fence_block_t block;
+        while (fence_next(text, length, &offset, &block)) {
+            sink += block.code_length;
+        }
+    }
+    double all = now_seconds() - start;
+    
+    double megabytes = (double)length * iterations / (1024 * 1024);
+    printf("%10zu %7d %14.0f %14.0f %14.0f\n", length, blocks, megabytes / legacy, megabytes / first,
+           megabytes / all);
+    free(text);
+}
+
+int main(void) {
+    int failures = self_check();
+    if (failures > 0) {
+        fprintf(stderr, "%d of %zu extractor checks failed\n", failures, sizeof(cases) / sizeof(cases[0]));
+        return 1;
+    }
+    printf("All %zu extractor checks passed\n\n", sizeof(cases) / sizeof(cases[0]));
+    
+    printf("%10s %7s %14s %14s %14s\n", "BYTES", "BLOCKS", "LEGACY MB/S", "FIRST MB/S", "ALL MB/S");
+    run_size(1024, 1);
+    run_size(64 * 1024, 1);
+    run_size(64 * 1024, 8);
+    run_size(1024 * 1024, 1);
+    run_size(1024 * 1024, 32);
+    return 0;
+}
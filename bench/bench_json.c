@@ -0,0 +1,379 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Micro-benchmark of the JSON decoder. It first checks json_decoder_feed
+// against a set of known answers, fed whole, split at every byte and one byte
+// at a time, then times it on synthetic Ollama answers of several sizes next
+// to the json-c parse it replaced, and measures how much memory each needs.
+
+#include "../include/json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <json-c/json.h>
+
+// Bytes handed to the decoder at a time, about what CURL delivers
+#define FEED_SIZE 16384
+
+// An answer and what the decoder must read from it
+typedef struct {
+    const char *name;
+    const char *text;
+    bool valid;
+    const char *response;       // Top-level "response" strings, joined
+    const char *error;
+    bool done;
+    long long eval_count;
+} json_case_t;
+
+static const json_case_t cases[] = {
+    { "plain", "{\"response\":\"print(1)\",\"done\":true,\"eval_count\":12}", true, "print(1)", "", true, 12 },
+    { "escapes", "{\"response\":\"a\\n\\t\\\"q\\\"\\\\\\/b\"}", true, "a\n\t\"q\"\\/b", "", false, 0 },
+    { "unicode", "{\"response\":\"\\u00e9 \\ud83c\\udf89 \\u20AC\"}", true, "\xc3\xa9 \xf0\x9f\x8e\x89 \xe2\x82\xac", "", false, 0 },
+    { "lone surrogate", "{\"response\":\"\\ud83cx\\udf89\"}", true, "\xef\xbf\xbdx\xef\xbf\xbd", "", false, 0 },
+    { "raw utf-8", "{\"response\":\"h\xc3\xa9llo\"}", true, "h\xc3\xa9llo", "", false, 0 },
+    { "nested", "{\"context\":[1,2,[3]],\"meta\":{\"response\":\"no\",\"done\":true},\"response\":\"yes\"}",
+      true, "yes", "", false, 0 },
+    { "ndjson", "{\"response\":\"a\",\"done\":false}\n{\"response\":\"b\",\"done\":true,\"eval_count\":-3}\n",
+      true, "ab", "", true, -3 },
+    { "error", "{\"error\":\"model 'x' not found\"}", true, "", "model 'x' not found", false, 0 },
+    { "spacing", " { \"done\" : false , \"x\" : null , \"n\" : 1.5e3 , \"response\" : \"\" } ", true, "", "", false, 0 },
+    { "empty object", "{}", true, "", "", false, 0 },
+    { "cut short", "{\"response\":\"abc", false, NULL, NULL, false, 0 },
+    { "bare word", "{\"response\":abc}", false, NULL, NULL, false, 0 },
+    { "top-level array", "[1,2]", false, NULL, NULL, false, 0 },
+    { "trailing comma", "{\"a\":1,}", false, NULL, NULL, false, 0 },
+    { "mismatched", "{\"a\":[1}", false, NULL, NULL, false, 0 },
+    { "bad escape", "{\"response\":\"\\x\"}", false, NULL, NULL, false, 0 },
+};
+
+// A growable byte buffer
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} buffer_t;
+
+static void buffer_append(buffer_t *buffer, const char *data, size_t length) {
+    if (buffer->size + length + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 256;
+        while (capacity < buffer->size + length + 1) {
+            capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+    buffer->data[buffer->size] = '\0';
+}
+
+static void buffer_append_text(buffer_t *buffer, const char *text) {
+    buffer_append(buffer, text, strlen(text));
+}
+
+// What the request reads from an answer
+typedef struct {
+    buffer_t response;
+    buffer_t error;
+    bool done;
+    long long eval_count;
+} answer_t;
+
+static bool read_answer(const json_value_t *value, void *userdata) {
+    answer_t *answer = (answer_t *)userdata;
+    if (value->depth != 1) {
+        return true;
+    }
+    if (value->kind == JSON_STRING && json_is_key(value, "response")) {
+        buffer_append(&answer->response, value->data, value->length);
+    } else if (value->kind == JSON_STRING && json_is_key(value, "error")) {
+        buffer_append(&answer->error, value->data, value->length);
+    } else if (value->kind == JSON_TRUE && json_is_key(value, "done")) {
+        answer->done = true;
+    } else if (value->kind == JSON_NUMBER && json_is_key(value, "eval_count")) {
+        answer->eval_count = json_get_int(value);
+    }
+    return true;
+}
+
+static void free_answer(answer_t *answer) {
+    free(answer->response.data);
+    free(answer->error.data);
+}
+
+static bool buffer_equals(const buffer_t *buffer, const char *expected) {
+    size_t length = strlen(expected);
+    return buffer->size == length && (length == 0 || memcmp(buffer->data, expected, length) == 0);
+}
+
+// Decode a case fed in pieces of at most step bytes, with the first cut at split
+static bool check_feed(const json_case_t *c, size_t split, size_t step) {
+    answer_t answer;
+    memset(&answer, 0, sizeof(answer));
+    json_decoder_t decoder;
+    json_decoder_init(&decoder, read_answer, &answer);
+    
+    size_t length = strlen(c->text);
+    bool valid = json_decoder_feed(&decoder, c->text, split);
+    for (size_t offset = split; valid && offset < length; offset += step) {
+        size_t piece = length - offset < step ? length - offset : step;
+        valid = json_decoder_feed(&decoder, c->text + offset, piece);
+    }
+    valid = valid && json_decoder_finish(&decoder);
+    
+    bool ok = valid == c->valid;
+    if (ok && c->valid) {
+        ok = buffer_equals(&answer.response, c->response) && buffer_equals(&answer.error, c->error) &&
+             answer.done == c->done && answer.eval_count == c->eval_count;
+    }
+    free_answer(&answer);
+    return ok;
+}
+
+static bool write_buffer(const char *data, size_t length, void *target) {
+    buffer_append((buffer_t *)target, data, length);
+    return true;
+}
+
+// Encode every byte value and a string longer than the decoder's scratch, and decode them back
+static bool check_round_trip(void) {
+    char text[4096];
+    size_t length = 0;
+    for (int i = 1; i < 256; i++) {
+        text[length++] = (char)i;
+    }
+    while (length < sizeof(text)) {
+        text[length] = length % 97 == 0 ? '\n' : length % 89 == 0 ? '"' : (char)('a' + length % 26);
+        length++;
+    }
+    
+    buffer_t encoded = { NULL, 0, 0 };
+    buffer_append_text(&encoded, "{\"response\":");
+    json_write_string(text, length, write_buffer, &encoded);
+    buffer_append_text(&encoded, "}");
+    
+    answer_t answer;
+    memset(&answer, 0, sizeof(answer));
+    bool ok = json_decode(encoded.data, encoded.size, read_answer, &answer) && answer.response.size == length &&
+              memcmp(answer.response.data, text, length) == 0;
+    free_answer(&answer);
+    free(encoded.data);
+    return ok;
+}
+
+// Check the decoder against every case; returns the number of failures
+static int self_check(void) {
+    int failures = 0;
+    
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const json_case_t *c = &cases[i];
+        size_t length = strlen(c->text);
+        bool ok = check_feed(c, length, length) && check_feed(c, 0, 1);
+        for (size_t split = 0; ok && split <= length; split++) {
+            ok = check_feed(c, split, length);
+        }
+        if (!ok) {
+            fprintf(stderr, "FAIL: %s\n", c->name);
+            failures++;
+        }
+    }
+    
+    if (!check_round_trip()) {
+        fprintf(stderr, "FAIL: round trip\n");
+        failures++;
+    }
+    return failures;
+}
+
+// An Ollama answer with code_bytes of generated code, whole or as one line
+// per token. Tokens are written already escaped, so building the answer never
+// holds more than the answer itself and the peak RSS it leaves is its size.
+static char *make_answer(size_t code_bytes, bool streaming, size_t *length) {
+    static const struct {
+        const char *escaped;
+        size_t code_length;
+    } tokens[] = {
+        { "    total", 9 }, { " =", 2 }, { " total", 6 }, { " +", 2 }, { " values", 7 }, { "[index", 6 },
+        { "]", 1 }, { "  #", 3 }, { " \\\"sum\\\"", 6 }, { "\\n", 1 }
+    };
+    const char *header = "{\"model\":\"llama3\",\"created_at\":\"2024-05-01T12:00:00.000000Z\",\"response\":\"";
+    buffer_t answer = { NULL, 0, 0 };
+    size_t code_length = 0;
+    
+    buffer_append_text(&answer, header);
+    for (size_t i = 0; code_length < code_bytes; i++) {
+        size_t token = i % (sizeof(tokens) / sizeof(tokens[0]));
+        buffer_append_text(&answer, tokens[token].escaped);
+        if (streaming) {
+            buffer_append_text(&answer, "\",\"done\":false}\n");
+            buffer_append_text(&answer, header);
+        }
+        code_length += tokens[token].code_length;
+    }
+    
+    // Ollama returns the conversation's tokens with the last object, about one per four bytes
+    char number[64];
+    buffer_append_text(&answer, "\",\"done\":true,\"context\":[");
+    for (size_t i = 0; i < code_length / 4; i++) {
+        int written = snprintf(number, sizeof(number), "%s%zu", i > 0 ? "," : "", 1000 + i * 7919 % 120000);
+        buffer_append(&answer, number, written);
+    }
+    buffer_append_text(&answer, "],\"total_duration\":5043500667,\"load_duration\":5025959,\"prompt_eval_count\":26,"
+                       "\"prompt_eval_duration\":325953000,\"eval_count\":290,\"eval_duration\":4709213000}\n");
+    
+    *length = answer.size;
+    return answer.data;
+}
+
+// The parse the decoder replaced: a json-c tree of the buffered answer, one
+// per line when streaming, and a copy of its "response"
+static size_t parse_json_c(const char *text, bool streaming, buffer_t *response) {
+    const char *line = text;
+    size_t objects = 0;
+    while (*line != '\0') {
+        const char *end = streaming ? strchr(line, '\n') : NULL;
+        end = end != NULL ? end : line + strlen(line);
+        
+        char *copy = strndup(line, end - line);
+        json_object *object = json_tokener_parse(copy);
+        json_object *value;
+        if (object != NULL && json_object_object_get_ex(object, "response", &value)) {
+            buffer_append(response, json_object_get_string(value), json_object_get_string_len(value));
+        }
+        objects += object != NULL;
+        json_object_put(object);
+        free(copy);
+        
+        line = *end == '\n' ? end + 1 : end;
+    }
+    return objects;
+}
+
+// The decoder, fed as CURL would feed it
+static size_t parse_decoder(const char *text, size_t length, buffer_t *response) {
+    answer_t answer;
+    memset(&answer, 0, sizeof(answer));
+    json_decoder_t decoder;
+    json_decoder_init(&decoder, read_answer, &answer);
+    for (size_t offset = 0; offset < length; offset += FEED_SIZE) {
+        json_decoder_feed(&decoder, text + offset, length - offset < FEED_SIZE ? length - offset : FEED_SIZE);
+    }
+    
+    *response = answer.response;
+    free(answer.error.data);
+    return json_decoder_finish(&decoder);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Growth of the peak RSS while one answer is parsed and its code kept, in a
+// child process of its own. A child starts from its parent's peak, so this
+// runs before any timing.
+static long measure_memory(size_t code_bytes, bool streaming, bool decoder) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        size_t length;
+        char *text = make_answer(code_bytes, streaming, &length);
+        buffer_t response = { NULL, 0, 0 };
+        long before = peak_rss_kb();
+        if (decoder) {
+            parse_decoder(text, length, &response);
+        } else {
+            parse_json_c(text, streaming, &response);
+        }
+        long growth = peak_rss_kb() - before;
+        ssize_t written = write(fds[1], &growth, sizeof(growth));
+        _exit(written == sizeof(growth) ? 0 : 1);
+    }
+    
+    close(fds[1]);
+    long growth = -1;
+    if (pid < 0 || read(fds[0], &growth, sizeof(growth)) != sizeof(growth)) {
+        growth = -1;
+    }
+    close(fds[0]);
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+    return growth;
+}
+
+// Keeps the compiler from discarding the work being timed
+static volatile size_t sink;
+
+static void run_size(size_t code_bytes, bool streaming, const long memory[2]) {
+    size_t length;
+    char *text = make_answer(code_bytes, streaming, &length);
+    int iterations = (int)(64 * 1024 * 1024 / length) + 1;
+    
+    double start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        buffer_t response = { NULL, 0, 0 };
+        sink += parse_json_c(text, streaming, &response) + response.size;
+        free(response.data);
+    }
+    double json_c = now_seconds() - start;
+    
+    start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        buffer_t response = { NULL, 0, 0 };
+        sink += parse_decoder(text, length, &response) + response.size;
+        free(response.data);
+    }
+    double decoder = now_seconds() - start;
+    
+    double megabytes = (double)length * iterations / (1024 * 1024);
+    printf("%10zu %10zu %13.0f %13.0f %11ld %11ld\n", code_bytes, length, megabytes / json_c, megabytes / decoder,
+           memory[0], memory[1]);
+    free(text);
+}
+
+int main(void) {
+    int failures = self_check();
+    if (failures > 0) {
+        fprintf(stderr, "%d of %zu decoder checks failed\n", failures, sizeof(cases) / sizeof(cases[0]) + 1);
+        return 1;
+    }
+    printf("All %zu decoder checks passed\n", sizeof(cases) / sizeof(cases[0]) + 1);
+    
+    static const size_t sizes[] = { 1024, 64 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+    enum { SIZE_COUNT = sizeof(sizes) / sizeof(sizes[0]) };
+    long memory[2][SIZE_COUNT][2];
+    for (int streaming = 0; streaming <= 1; streaming++) {
+        for (size_t i = 0; i < SIZE_COUNT; i++) {
+            memory[streaming][i][0] = measure_memory(sizes[i], streaming, false);
+            memory[streaming][i][1] = measure_memory(sizes[i], streaming, true);
+        }
+    }
+    
+    for (int streaming = 0; streaming <= 1; streaming++) {
+        printf("\n%s answers (peak RSS growth in KB, input excluded)\n", streaming ? "Streamed" : "Whole");
+        printf("%10s %10s %13s %13s %11s %11s\n", "CODE", "BYTES", "JSON-C MB/S", "DECODER MB/S", "JSON-C KB",
+               "DECODER KB");
+        for (size_t i = 0; i < SIZE_COUNT; i++) {
+            run_size(sizes[i], streaming, memory[streaming][i]);
+        }
+    }
+    return 0;
+}
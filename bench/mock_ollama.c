@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+
+// A stand-in for Ollama's /api/generate endpoint, used by the benchmarks.
+// It answers every request with a fenced block of filler code, streamed as
+// NDJSON chunks or sent as one JSON object depending on the request's
+// "stream" field, with configurable latency, token rate, size and errors.
+// Like Ollama, it can be limited to a number of requests generated at once,
+// queueing the rest.
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_HEADER_SIZE 16384
+
+// Behaviour of the mock, set from the command line
+typedef struct {
+    int port;
+    int latency_ms;          // Delay before the first token
+    int token_rate;          // Tokens per second, 0 for unlimited
+    int token_bytes;         // Bytes of code per token
+    size_t response_bytes;   // Bytes of code per response
+    double error_rate;       // Fraction of requests answered with HTTP 500
+    int parallel;            // Requests generated at once, 0 for unlimited (OLLAMA_NUM_PARALLEL)
+} mock_options_t;
+
+static mock_options_t options = { 0, 0, 0, 4, 2048, 0.0, 0 };
+
+// Generation slots in use, when their number is limited
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slot_free = PTHREAD_COND_INITIALIZER;
+static int slots_busy = 0;
+
+// The code every response carries, JSON-escaped once at startup
+static char *escaped_code;
+static size_t escaped_code_length;
+
+static void print_usage(void) {
+    printf("Usage: mock_ollama [options]\n\n");
+    printf("Options:\n");
+    printf("  --port N               Listen on 127.0.0.1:N (default: any free port)\n");
+    printf("  --latency MS           Delay before the first token (default: 0)\n");
+    printf("  --token-rate N         Tokens per second, 0 for unlimited (default: 0)\n");
+    printf("  --token-bytes N        Bytes of code per token (default: 4)\n");
+    printf("  --response-bytes N     Bytes of code per response (default: 2048)\n");
+    printf("  --error-rate P         Fraction of requests that fail with HTTP 500 (default: 0)\n");
+    printf("  --parallel N           Requests generated at once, the rest queue; 0 for unlimited (default: 0)\n");
+    printf("\nThe chosen port is printed as 'port N' on stdout once the mock is listening.\n");
+}
+
+static void sleep_ms(double ms) {
+    if (ms <= 0) {
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ms / 1000);
+    ts.tv_nsec = (long)((ms - ts.tv_sec * 1000.0) * 1e6);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static bool send_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// Build the escaped response: a python fence around lines of filler
+static bool build_code(void) {
+    const char *open_fence = "```python\\n";
+    const char *close_fence = "\\n```";
+    const char *line = "x = x + 1  # filler\\n";
+    size_t line_length = strlen(line);
+    
+    // Escaped newlines take two bytes but count as one byte of code
+    size_t lines = (options.response_bytes + (line_length - 1) - 1) / (line_length - 1);
+    escaped_code_length = strlen(open_fence) + lines * line_length + strlen(close_fence);
+    escaped_code = malloc(escaped_code_length + 1);
+    if (escaped_code == NULL) {
+        return false;
+    }
+    
+    char *p = escaped_code;
+    p += sprintf(p, "%s", open_fence);
+    for (size_t i = 0; i < lines; i++) {
+        memcpy(p, line, line_length);
+        p += line_length;
+    }
+    sprintf(p, "%s", close_fence);
+    return true;
+}
+
+// Whether a request body asks for a streaming response (Ollama's default)
+static bool wants_stream(const char *body) {
+    const char *key = strstr(body, "\"stream\"");
+    if (key == NULL) {
+        return true;
+    }
+    key += strlen("\"stream\"");
+    key += strspn(key, " \t\r\n:");
+    return strncmp(key, "false", 5) != 0;
+}
+
+// Number of bytes of escaped code in the next token, never splitting an escape
+static size_t token_length(size_t offset) {
+    size_t length = 0;
+    for (int i = 0; i < options.token_bytes && offset + length < escaped_code_length; i++) {
+        length += escaped_code[offset + length] == '\\' ? 2 : 1;
+    }
+    return length;
+}
+
+static bool send_chunk(int fd, const char *data, size_t length) {
+    char size_line[32];
+    int size_length = snprintf(size_line, sizeof(size_line), "%zx\r\n", length);
+    return send_all(fd, size_line, size_length) && send_all(fd, data, length) && send_all(fd, "\r\n", 2);
+}
+
+static bool send_streaming(int fd) {
+    const char *headers = "HTTP/1.1 200 OK\r\nContent-Type: application/x-ndjson\r\nTransfer-Encoding: chunked\r\n\r\n";
+    if (!send_all(fd, headers, strlen(headers))) {
+        return false;
+    }
+    
+    char chunk[256];
+    double token_ms = options.token_rate > 0 ? 1000.0 / options.token_rate : 0;
+    size_t offset = 0;
+    while (offset < escaped_code_length) {
+        size_t length = token_length(offset);
+        int chunk_length = snprintf(chunk, sizeof(chunk),
+                                    "{\"model\":\"mock\",\"response\":\"%.*s\",\"done\":false}\n",
+                                    (int)length, escaped_code + offset);
+        if (!send_chunk(fd, chunk, chunk_length)) {
+            return false;
+        }
+        offset += length;
+        sleep_ms(token_ms);
+    }
+    
+    const char *final = "{\"model\":\"mock\",\"response\":\"\",\"done\":true,\"eval_count\":0}\n";
+    return send_chunk(fd, final, strlen(final)) && send_all(fd, "0\r\n\r\n", 5);
+}
+
+static bool send_complete(int fd) {
+    size_t tokens = 0;
+    for (size_t offset = 0; offset < escaped_code_length; offset += token_length(offset)) {
+        tokens++;
+    }
+    if (options.token_rate > 0) {
+        sleep_ms(tokens * 1000.0 / options.token_rate);
+    }
+    
+    const char *prefix = "{\"model\":\"mock\",\"response\":\"";
+    const char *suffix = "\",\"done\":true,\"eval_count\":0}";
+    size_t body_length = strlen(prefix) + escaped_code_length + strlen(suffix);
+    
+    char headers[128];
+    int headers_length = snprintf(headers, sizeof(headers),
+                                  "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n",
+                                  body_length);
+    return send_all(fd, headers, headers_length) && send_all(fd, prefix, strlen(prefix)) &&
+           send_all(fd, escaped_code, escaped_code_length) && send_all(fd, suffix, strlen(suffix));
+}
+
+static bool send_error(int fd) {
+    const char *body = "{\"error\":\"injected failure\"}";
+    char response[256];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 500 Internal Server Error\r\nContent-Type: application/json\r\n"
+                          "Content-Length: %zu\r\n\r\n%s", strlen(body), body);
+    return send_all(fd, response, length);
+}
+
+// Wait for a generation slot, as a request does when Ollama's parallel slots are busy
+static void acquire_slot(void) {
+    if (options.parallel <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&slot_lock);
+    while (slots_busy >= options.parallel) {
+        pthread_cond_wait(&slot_free, &slot_lock);
+    }
+    slots_busy++;
+    pthread_mutex_unlock(&slot_lock);
+}
+
+static void release_slot(void) {
+    if (options.parallel <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&slot_lock);
+    slots_busy--;
+    pthread_cond_signal(&slot_free);
+    pthread_mutex_unlock(&slot_lock);
+}
+
+// Serve requests on one keep-alive connection until the client closes it
+static void *serve_connection(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    unsigned int seed = (unsigned int)time(NULL) ^ (unsigned int)fd;
+    char *buffer = malloc(MAX_HEADER_SIZE);
+    size_t buffered = 0;
+    
+    while (buffer != NULL) {
+        // Read until the end of the request headers
+        char *header_end;
+        while ((header_end = memmem(buffer, buffered, "\r\n\r\n", 4)) == NULL) {
+            if (buffered == MAX_HEADER_SIZE) {
+                goto done;
+            }
+            ssize_t count = recv(fd, buffer + buffered, MAX_HEADER_SIZE - buffered, 0);
+            if (count <= 0) {
+                goto done;
+            }
+            buffered += count;
+        }
+        
+        size_t header_length = header_end + 4 - buffer;
+        size_t content_length = 0;
+        for (char *line = buffer; line < header_end; line = strstr(line, "\r\n") + 2) {
+            if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                content_length = strtoul(line + 15, NULL, 10);
+            }
+        }
+        
+        // Read the whole body; prompts may be much larger than the header buffer
+        char *body = malloc(content_length + 1);
+        if (body == NULL) {
+            goto done;
+        }
+        size_t have = buffered - header_length < content_length ? buffered - header_length : content_length;
+        memcpy(body, buffer + header_length, have);
+        while (have < content_length) {
+            ssize_t count = recv(fd, body + have, content_length - have, 0);
+            if (count <= 0) {
+                free(body);
+                goto done;
+            }
+            have += count;
+        }
+        body[content_length] = '\0';
+        
+        // Keep any pipelined bytes for the next request
+        size_t consumed = header_length + content_length;
+        if (consumed < buffered) {
+            memmove(buffer, buffer + consumed, buffered - consumed);
+            buffered -= consumed;
+        } else {
+            buffered = 0;
+        }
+        
+        bool stream = wants_stream(body);
+        free(body);
+        
+        // The whole answer is generated in one slot
+        acquire_slot();
+        sleep_ms(options.latency_ms);
+        
+        bool sent;
+        if (options.error_rate > 0 && rand_r(&seed) < options.error_rate * ((double)RAND_MAX + 1)) {
+            sent = send_error(fd);
+        } else if (stream) {
+            sent = send_streaming(fd);
+        } else {
+            sent = send_complete(fd);
+        }
+        release_slot();
+        if (!sent) {
+            break;
+        }
+    }
+    
+done:
+    free(buffer);
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            print_usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "--port") == 0) {
+            options.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            options.latency_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--token-rate") == 0) {
+            options.token_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--token-bytes") == 0) {
+            options.token_bytes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--response-bytes") == 0) {
+            options.response_bytes = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--error-rate") == 0) {
+            options.error_rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--parallel") == 0) {
+            options.parallel = atoi(argv[++i]);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    
+    if (options.token_bytes < 1 || options.token_bytes > 64) {
+        fprintf(stderr, "Error: --token-bytes must be between 1 and 64\n");
+        return 1;
+    }
+    if (!build_code()) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)options.port);
+    
+    socklen_t address_length = sizeof(address);
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, 512) != 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&address, &address_length) != 0) {
+        fprintf(stderr, "Error: Could not listen on port %d: %s\n", options.port, strerror(errno));
+        return 1;
+    }
+    
+    printf("port %d\n", ntohs(address.sin_port));
+    fflush(stdout);
+    
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        
+        pthread_t thread;
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attributes, serve_connection, (void *)(intptr_t)fd) != 0) {
+            close(fd);
+        }
+        pthread_attr_destroy(&attributes);
+    }
+    
+    close(listen_fd);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @brief A region allocator: memory is handed out from large blocks and
+ * released all at once by arena_reset or arena_free
+ */
+typedef struct arena arena_t;
+
+/**
+ * @brief What an arena handed out since it was created or last reset
+ */
+typedef struct {
+    size_t allocations;       // Calls to arena_alloc and arena_grow
+    size_t bytes;             // Bytes handed out, including copies made by arena_grow
+    size_t heap_allocations;  // Blocks the arena had to malloc
+    size_t capacity;          // Bytes in all of its blocks
+} arena_usage_t;
+
+/**
+ * @brief Create an empty arena
+ * @return The arena, or NULL if out of memory
+ */
+arena_t *arena_new(void);
+
+/**
+ * @brief Allocate from the arena
+ * @param arena The arena
+ * @param size Number of bytes
+ * @return Memory aligned for any type, or NULL if out of memory
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Resize an allocation, in place when it was the arena's latest one
+ * @param arena The arena
+ * @param ptr The allocation, or NULL
+ * @param old_size Its current size
+ * @param new_size The size wanted
+ * @return The resized allocation, or NULL if out of memory (ptr stays valid)
+ */
+void *arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t new_size);
+
+/**
+ * @brief Copy a string into the arena
+ * @param arena The arena
+ * @param text The string
+ * @return The copy, or NULL if out of memory
+ */
+char *arena_strdup(arena_t *arena, const char *text);
+
+/**
+ * @brief Release everything allocated from the arena but keep its memory
+ *
+ * An arena that needed several blocks is consolidated into one block of
+ * their combined size, so the next request of a similar size needs no
+ * malloc at all.
+ *
+ * @param arena The arena
+ */
+void arena_reset(arena_t *arena);
+
+/**
+ * @brief Get what the arena handed out since it was created or last reset
+ * @param arena The arena
+ * @param usage Receives the counts
+ */
+void arena_get_usage(const arena_t *arena, arena_usage_t *usage);
+
+/**
+ * @brief Free the arena and all of its memory
+ * @param arena The arena, or NULL
+ */
+void arena_free(arena_t *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,126 @@
+#ifndef BALANCER_H
+#define BALANCER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Most endpoints the balancer spreads requests over
+ */
+#define BALANCER_MAX_ENDPOINTS 16
+
+/**
+ * @brief Size of a buffer that holds any endpoint's URL
+ */
+#define BALANCER_MAX_URL_LENGTH 1024
+
+/**
+ * @brief How a transfer to an endpoint ended
+ */
+typedef enum {
+    BALANCER_SUCCESS,    // The endpoint answered
+    BALANCER_FAILURE,    // Connection error or an overloaded server (HTTP 429 or 5xx)
+    BALANCER_CANCELLED   // Lost to a hedged duplicate; says nothing about the endpoint
+} balancer_outcome_t;
+
+/**
+ * @brief A set of endpoints with what has been learned about them
+ *
+ * Every function may be called from several threads at once.
+ */
+typedef struct balancer balancer_t;
+
+/**
+ * @brief Create a balancer without endpoints
+ * @return The balancer, or NULL if out of memory
+ */
+balancer_t *balancer_new(void);
+
+/**
+ * @brief Free a balancer created with balancer_new
+ * @param balancer The balancer; the default one is left alone
+ */
+void balancer_free(balancer_t *balancer);
+
+/**
+ * @brief Get the process-wide balancer, holding the endpoints of english_set_ollama_endpoint
+ * @return The default balancer
+ */
+balancer_t *balancer_get_default(void);
+
+/**
+ * @brief Replace the endpoints requests are spread over
+ *
+ * Transfers in flight keep their endpoint's index: an endpoint that stays
+ * keeps its index and what was learned about it, and one that leaves the
+ * list is retired rather than moved, so its transfers still release it.
+ * Setting the same list again changes nothing.
+ *
+ * @param balancer The balancer
+ * @param list One URL, or several separated by commas
+ * @return true if at least one endpoint was set, false otherwise
+ */
+bool balancer_set_endpoints(balancer_t *balancer, const char *list);
+
+/**
+ * @brief Get the number of configured endpoints
+ * @param balancer The balancer
+ * @return The number of endpoints
+ */
+size_t balancer_count(balancer_t *balancer);
+
+/**
+ * @brief List the indexes of the configured endpoints, in the order they were given
+ * @param balancer The balancer
+ * @param indexes Receives up to BALANCER_MAX_ENDPOINTS indexes
+ * @return The number of endpoints
+ */
+size_t balancer_list(balancer_t *balancer, int *indexes);
+
+/**
+ * @brief Choose an endpoint for a new transfer and count it as in flight
+ *
+ * Endpoints in rotation are preferred by fewest transfers in flight, then by
+ * lowest recent latency. Endpoints taken out of rotation after errors are
+ * only used once their cool-down has passed, or when nothing else is left.
+ *
+ * @param balancer The balancer
+ * @param exclude An endpoint not to choose (the one already tried), or -1
+ * @return The endpoint's index, or -1 if there is no other endpoint
+ */
+int balancer_acquire(balancer_t *balancer, int exclude);
+
+/**
+ * @brief Copy the URL of an endpoint
+ * @param balancer The balancer
+ * @param index The endpoint's index
+ * @param url Receives the URL; BALANCER_MAX_URL_LENGTH bytes
+ * @return url, which is empty for an unknown index
+ */
+const char *balancer_url(balancer_t *balancer, int index, char *url);
+
+/**
+ * @brief Report how a transfer to an endpoint ended
+ * @param balancer The balancer
+ * @param index The endpoint's index, as returned by balancer_acquire
+ * @param outcome How the transfer ended
+ * @param first_byte_ms Milliseconds until its first response byte (BALANCER_SUCCESS only)
+ */
+void balancer_release(balancer_t *balancer, int index, balancer_outcome_t outcome, double first_byte_ms);
+
+/**
+ * @brief Set which percentile of the observed time to first byte triggers a hedged request
+ * @param balancer The balancer
+ * @param percentile Between 1 and 99.9, or 0 to disable hedging
+ */
+void balancer_set_hedge_percentile(balancer_t *balancer, double percentile);
+
+/**
+ * @brief Get how long a transfer may go without a first byte before it is hedged
+ * @param balancer The balancer
+ * @return Milliseconds, or a negative value when hedging is disabled, there is
+ * only one endpoint or too few latencies have been observed
+ */
+double balancer_hedge_delay_ms(balancer_t *balancer);
+
+#endif /* BALANCER_H */
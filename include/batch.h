@@ -0,0 +1,48 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+
+/**
+ * @brief Default number of requests in flight when neither -j nor OLLAMA_NUM_PARALLEL is set
+ */
+#define BATCH_DEFAULT_PARALLEL 4
+
+/**
+ * @brief Compile every job of a JSON Lines file from a single process
+ *
+ * Each line is an object with "language", "output" and either "input"
+ * (path of an English description) or "text" (the description inline).
+ * Requests run concurrently through one CURL multi handle, with at most
+ * max_parallel in flight, and each output is written as soon as its job
+ * completes. A per-job summary is printed at the end.
+ *
+ * @param jobs_file Path of the JSON Lines job file
+ * @param max_parallel Maximum number of requests in flight
+ * @return The number of failed jobs, or -1 if the job file could not be read
+ */
+int batch_run(const char *jobs_file, int max_parallel);
+
+/**
+ * @brief Compile one description to several languages concurrently
+ *
+ * Every target's request is in flight at once, so the wall time is that of
+ * the slowest target rather than the sum. Each result is written to
+ * output_dir/name.EXT as soon as it arrives, EXT being the usual extension
+ * of the language, and its status is printed as it finishes.
+ *
+ * @param text The English description, shared by every target
+ * @param languages Target languages separated by commas (e.g. "python,go,typescript")
+ * @param output_dir Directory of the output files, created if missing
+ * @param name Base name of the output files
+ * @return The number of failed targets, or -1 if the targets could not be run
+ */
+int batch_fan_out(const char *text, const char *languages, const char *output_dir, const char *name);
+
+/**
+ * @brief Get the default parallelism, honouring Ollama's OLLAMA_NUM_PARALLEL
+ * @return The number of requests to keep in flight
+ */
+int batch_default_parallel(void);
+
+#endif /* BATCH_H */
@@ -0,0 +1,36 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief A growing heap string
+ *
+ * A zeroed buffer is empty and ready to use. Its data is kept NUL-terminated,
+ * so it can be handed out as a string, and is released with free.
+ */
+typedef struct {
+    char *data;        // The bytes, followed by a zero byte, or NULL while empty
+    size_t size;       // Length of the contents in bytes
+    size_t capacity;   // Bytes allocated for data
+} buffer_t;
+
+/**
+ * @brief Append bytes to a buffer
+ * @param buffer The buffer
+ * @param data The bytes to append
+ * @param length Number of bytes
+ * @return true on success, false if out of memory
+ */
+bool buffer_append(buffer_t *buffer, const void *data, size_t length);
+
+/**
+ * @brief Append a NUL-terminated string to a buffer
+ * @param buffer The buffer
+ * @param text The string to append
+ * @return true on success, false if out of memory
+ */
+bool buffer_append_string(buffer_t *buffer, const char *text);
+
+#endif /* BUFFER_H */
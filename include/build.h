@@ -0,0 +1,47 @@
+#ifndef BUILD_H
+#define BUILD_H
+
+#include <stdbool.h>
+
+/**
+ * @brief Project file read when none is given
+ */
+#define BUILD_DEFAULT_PROJECT "english.json"
+
+/**
+ * @brief Suffix of the state file kept next to the project file
+ */
+#define BUILD_STATE_SUFFIX ".state"
+
+/**
+ * @brief Build the stale targets of a project, in dependency order
+ *
+ * The project file is a JSON object whose "targets" array lists objects with
+ * "input" (path of an English description), "language", "output" and
+ * optionally "name" (the input path unless given) and "depends" (an array
+ * of names of other targets). A top-level "language" is the default of
+ * targets that have none. Paths are relative to the project file.
+ *
+ * The generated code of a target's dependencies is given to the model with
+ * its description, so it can use what they define. A target is rebuilt when
+ * the hash of its prompt, model, endpoints, routing rules and output settings
+ * differs from the one in the state file, or its output is missing or was
+ * changed since. Since the prompt holds the dependencies' code, a dependency
+ * that is regenerated to the same code leaves its dependents up to date.
+ *
+ * Up to max_parallel targets compile at once through one CURL multi handle.
+ * Of the targets whose dependencies are done, the one with the longest chain
+ * of estimated work ahead of it starts first. A failed target stops only
+ * the targets that depend on it.
+ *
+ * @param project_file Path of the project file
+ * @param names Targets to build along with what they depend on, or NULL for all
+ * @param name_count Number of names
+ * @param max_parallel Maximum number of requests in flight
+ * @param force Rebuild every target, stale or not
+ * @return The number of targets that failed or were skipped, or -1 if the
+ *         project could not be loaded
+ */
+int build_run(const char *project_file, const char *const *names, int name_count, int max_parallel, bool force);
+
+#endif /* BUILD_H */
@@ -0,0 +1,71 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sha256.h"
+
+/**
+ * @brief Counters describing the compile cache
+ */
+typedef struct {
+    size_t entries;           // Number of cached compiles
+    size_t bytes;             // Bytes of cached code
+    size_t max_bytes;         // LRU size cap
+    uint64_t hits;            // Lookups served from the cache
+    uint64_t misses;          // Lookups that went to Ollama
+    uint64_t stores;          // Compiles added to the cache
+    uint64_t evictions;       // Compiles dropped to stay under the cap
+} cache_stats_t;
+
+/**
+ * @brief Compute the content address of a compile request
+ * @param model The Ollama model
+ * @param endpoint The Ollama endpoint URL
+ * @param target_language The target programming language
+ * @param prompt The full prompt text sent to the model
+ * @param options The sampling options, serialized
+ * @param key Receives the SHA-256 key
+ */
+void cache_make_key(const char *model, const char *endpoint, const char *target_language,
+                    const char *prompt, const char *options, uint8_t key[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief Look up a previously compiled result
+ * @param key The content address from cache_make_key
+ * @param length Receives the length of the cached code (may be NULL)
+ * @return The NUL-terminated code, to be released with free(), or NULL on a
+ *         miss or if the cache is unavailable
+ */
+char *cache_lookup(const uint8_t key[SHA256_DIGEST_SIZE], size_t *length);
+
+/**
+ * @brief Store a compiled result, evicting least recently used entries over the size cap
+ * @param key The content address from cache_make_key
+ * @param code The generated code
+ * @param length Length of the code in bytes
+ * @return true if the result was stored, false otherwise
+ */
+bool cache_store(const uint8_t key[SHA256_DIGEST_SIZE], const char *code, size_t length);
+
+/**
+ * @brief Read the cache counters
+ * @param stats Receives the counters
+ * @return true if the cache could be opened, false otherwise
+ */
+bool cache_get_stats(cache_stats_t *stats);
+
+/**
+ * @brief Remove every cached result and reset the counters
+ * @return true if the cache was cleared, false otherwise
+ */
+bool cache_clear(void);
+
+/**
+ * @brief Unmap the cache index
+ */
+void cache_close(void);
+
+#endif /* CACHE_H */
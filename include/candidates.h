@@ -0,0 +1,28 @@
+#ifndef CANDIDATES_H
+#define CANDIDATES_H
+
+#include <stddef.h>
+
+#include "english.h"
+
+/**
+ * @brief Sample several answers to one compile at once and keep the first that validates
+ *
+ * Every candidate is in flight at the same time through one CURL multi
+ * handle, each at its own temperature and seed. Each answer is checked by
+ * the language's validator as soon as it arrives; the first one that passes
+ * is returned and stored in the cache, and the slower candidates are
+ * cancelled. If no candidate passes, the first one that produced code is
+ * returned with a warning, as a single compile would have returned it.
+ *
+ * @param context The compile context
+ * @param english_text The English description of the code to generate
+ * @param target_language The target programming language
+ * @param count Number of candidates, at most ENGLISH_MAX_CANDIDATES
+ * @param output_length Receives the length of the generated code (may be NULL)
+ * @return The code, to be released with free(), or NULL if every candidate failed
+ */
+char *candidates_compile(english_context_t *context, const char *english_text, const char *target_language,
+                         int count, size_t *output_length);
+
+#endif /* CANDIDATES_H */
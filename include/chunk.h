@@ -0,0 +1,50 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Default token budget of one part of a chunked compile
+ */
+#define CHUNK_DEFAULT_TOKENS 2048
+
+/**
+ * @brief Smallest token budget a chunked compile accepts
+ */
+#define CHUNK_MIN_TOKENS 64
+
+/**
+ * @brief How the code of the parts of a chunked compile is put together
+ */
+typedef enum {
+    CHUNK_MERGE_JOIN,     // Join the parts in order, with their imports gathered at the top
+    CHUNK_MERGE_MODEL     // Ask the model to merge the parts, joining them if that fails
+} chunk_merge_t;
+
+/**
+ * @brief Compile a description too large for one prompt, part by part
+ *
+ * The description is cut into parts of at most budget_tokens, at markdown
+ * headings or blank lines where it can be, and between lines where a
+ * paragraph alone is too large. Every part is compiled concurrently, each
+ * prompt carrying an outline of all parts so the code of one can use the
+ * names of the others. Wall time therefore follows the largest part rather
+ * than the whole description. A description that fits the budget is
+ * compiled exactly as english_compile would.
+ *
+ * Parts are compiled with the default context and its settings.
+ *
+ * @param english_text The English description
+ * @param length Length of the description in bytes
+ * @param target_language The target programming language
+ * @param budget_tokens Most tokens of description per part
+ * @param merge How the code of the parts is put together
+ * @param max_parallel Maximum number of requests in flight
+ * @param output_length Pointer to store the length of the output
+ * @return The merged code (must be freed by the caller) or NULL if any part failed
+ */
+char *chunk_compile(const char *english_text, size_t length, const char *target_language, size_t budget_tokens,
+                    chunk_merge_t merge, int max_parallel, size_t *output_length);
+
+#endif /* CHUNK_H */
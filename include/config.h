@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 /**
  * @brief Initialize the configuration system
@@ -9,6 +10,12 @@
  */
 bool config_init(void);
 
+/**
+ * @brief Reload the configuration file if it changed since it was last read
+ * @return true if the configuration is current, false if reloading failed
+ */
+bool config_refresh(void);
+
 /**
  * @brief Set the API key for the AI service
  * @param key_value The API key to use
@@ -35,6 +42,130 @@ bool config_set_model(const char *model_value);
  */
 const char *config_get_model(void);
 
+/**
+ * @brief Set the Ollama endpoint URL and save it to the config file
+ * @param endpoint_value The URL of the Ollama API endpoint
+ * @return true if successful, false otherwise
+ */
+bool config_set_endpoint(const char *endpoint_value);
+
+/**
+ * @brief Get the Ollama endpoint URL saved in the config file
+ * @return The URL, or NULL if not set (the built-in default is used)
+ */
+const char *config_get_endpoint(void);
+
+/**
+ * @brief Set how long Ollama keeps the model loaded after a request and save it to the config file
+ * @param keep_alive_value A duration such as "30m", or a number of seconds ("-1" keeps it loaded)
+ * @return true if successful, false otherwise
+ */
+bool config_set_keep_alive(const char *keep_alive_value);
+
+/**
+ * @brief Get how long Ollama keeps the model loaded, as saved in the config file
+ * @return The duration, or NULL to leave it to the server (5 minutes by default)
+ */
+const char *config_get_keep_alive(void);
+
+/**
+ * @brief Get the configuration directory (~/.english)
+ * @return The directory path
+ */
+const char *config_get_dir(void);
+
+/**
+ * @brief Build the path of a directory under the configuration directory, creating it if needed
+ * @param name The subdirectory name (e.g., "cache")
+ * @param path Buffer to store the path
+ * @param path_size Size of the path buffer
+ * @return true if the directory exists or was created, false otherwise
+ */
+bool config_get_subdir(const char *name, char *path, size_t path_size);
+
+/**
+ * @brief Get the size cap of the compile cache
+ * @return The maximum number of bytes of cached code (cache_size_mb, default 64 MB)
+ */
+size_t config_get_cache_max_bytes(void);
+
+/**
+ * @brief Get the percentile of the time to first byte after which a request is hedged
+ * @return The percentile (hedge_percentile, default 95; 0 disables hedging)
+ */
+double config_get_hedge_percentile(void);
+
+/**
+ * @brief Get the Ollama model that embeds descriptions for the semantic cache
+ * @return The embedding model, or NULL if the semantic cache is not enabled
+ */
+const char *config_get_semantic_model(void);
+
+/**
+ * @brief Get the cosine similarity above which the semantic cache returns a stored compile
+ * @return The threshold, 0.95 unless configured
+ */
+double config_get_semantic_threshold(void);
+
+/**
+ * @brief What config_get_num_ctx and config_get_num_predict return when every request is sized for itself
+ */
+#define CONFIG_AUTO -1
+
+/**
+ * @brief What config_get_num_ctx returns for num_ctx=grow, where every request
+ *        is sized for itself but never asks for a smaller window than an earlier one
+ */
+#define CONFIG_GROW -2
+
+/**
+ * @brief Get the context window compiles ask Ollama for
+ * @return The window from num_ctx=N, 0 for num_ctx=off (the server's default),
+ *         CONFIG_GROW for num_ctx=grow, or CONFIG_AUTO unless configured
+ */
+long config_get_num_ctx(void);
+
+/**
+ * @brief Get the most tokens compiles let Ollama generate
+ * @return The limit from num_predict=N, 0 for num_predict=off (no limit),
+ *         or CONFIG_AUTO unless configured
+ */
+long config_get_num_predict(void);
+
+/**
+ * @brief Most routing rules the configuration file can hold
+ */
+#define CONFIG_MAX_ROUTES 32
+
+/**
+ * @brief Get the number of routing rules (route= lines) in the config file
+ * @return The number of rules
+ */
+size_t config_get_route_count(void);
+
+/**
+ * @brief Get a routing rule, as written after route=
+ * @param index The rule's position in the config file, from 0
+ * @return The rule, or NULL if there is no such rule
+ */
+const char *config_get_route(size_t index);
+
+/**
+ * @brief Most validators the configuration file can hold
+ */
+#define CONFIG_MAX_VALIDATORS 32
+
+/**
+ * @brief Get the configured validator of a language
+ *
+ * Each validator= line holds a language, then the command that checks code
+ * in it, e.g. "validator=python python3 -m pyflakes {}".
+ *
+ * @param language The target language, matched ignoring case
+ * @return The command, or NULL if the config file has none for the language
+ */
+const char *config_get_validator(const char *language);
+
 /**
  * @brief Clean up resources used by the configuration system
  */
@@ -0,0 +1,178 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <curl/curl.h>
+
+#include "arena.h"
+#include "balancer.h"
+#include "english.h"
+
+/**
+ * @brief Get the model a context compiles with
+ * @param context The compile context
+ * @return Its own model, or else the configured one
+ */
+const char *context_get_model(const english_context_t *context);
+
+/**
+ * @brief Get the endpoints a context sends to, as they enter cache keys
+ * @param context The compile context
+ * @return Its own endpoint list, or else the process-wide one
+ */
+const char *context_get_endpoint(const english_context_t *context);
+
+/**
+ * @brief Get the balancer spreading a context's requests over its endpoints
+ * @param context The compile context
+ * @return Its own balancer, or else the default one with the process-wide endpoints
+ */
+balancer_t *context_get_balancer(const english_context_t *context);
+
+/**
+ * @brief Check whether a context reports what it is doing on stderr
+ * @param context The compile context
+ * @return Its own setting, or else english_is_verbose
+ */
+bool context_is_verbose(const english_context_t *context);
+
+/**
+ * @brief Check whether a context serves and stores compiles in the cache
+ * @param context The compile context
+ * @return Its own setting, or else english_is_cache_enabled
+ */
+bool context_is_cache_enabled(const english_context_t *context);
+
+/**
+ * @brief Check whether a context's compiles continue the conversation of earlier ones
+ * @param context The compile context
+ * @return Its own setting, or else english_is_session
+ */
+bool context_is_session(const english_context_t *context);
+
+/**
+ * @brief Get which code a context's compiles return
+ * @param context The compile context
+ * @return Its own setting, or else english_get_extract_mode
+ */
+english_extract_t context_get_extract_mode(const english_context_t *context);
+
+/**
+ * @brief Get the deadline of a context's compiles
+ * @param context The compile context
+ * @return Milliseconds, or 0 for none; its own setting, or else english_get_timeout
+ */
+long context_get_timeout(const english_context_t *context);
+
+/**
+ * @brief Get how often a context's compiles are retried
+ * @param context The compile context
+ * @return Its own setting, or else english_get_max_retries
+ */
+int context_get_max_retries(const english_context_t *context);
+
+/**
+ * @brief Get the context window a context's requests ask for under num_ctx=grow
+ *
+ * The window only grows: once a request needed a larger one, later
+ * requests ask for it too, since Ollama reloads the model whenever the
+ * window changes.
+ *
+ * @param context The compile context
+ * @param window The window the request needs
+ * @return The window to ask for, at least window
+ */
+size_t context_fit_window(english_context_t *context, size_t window);
+
+/**
+ * @brief Take an easy handle from the context's pool, or create one
+ *
+ * The handle is attached to the context's share, so it reuses cached DNS
+ * entries and TLS sessions of earlier requests. Keep-alive connections live
+ * in the multi handle that runs the transfer; see context_acquire_multi.
+ *
+ * @param context The compile context
+ * @return The easy handle, or NULL on failure
+ */
+CURL *context_acquire_handle(english_context_t *context);
+
+/**
+ * @brief Return an easy handle to the context's pool
+ * @param context The compile context
+ * @param handle The handle, which must not be attached to a multi handle
+ */
+void context_release_handle(english_context_t *context, CURL *handle);
+
+/**
+ * @brief Take a multi handle from the context's pool, or create one
+ *
+ * A multi handle keeps the connections its transfers leave open, so a
+ * request run on a pooled one reuses the keep-alive connections of the
+ * requests run on it before. Only one thread may use it at a time.
+ *
+ * @param context The compile context
+ * @return The multi handle, or NULL on failure
+ */
+CURLM *context_acquire_multi(english_context_t *context);
+
+/**
+ * @brief Return a multi handle, and the connections it keeps, to the context's pool
+ * @param context The compile context
+ * @param multi The multi handle, which must have no easy handles attached
+ */
+void context_release_multi(english_context_t *context, CURLM *multi);
+
+/**
+ * @brief Take an arena from the context's pool, or create one
+ *
+ * A request allocates all of its working memory from one arena, so pooled
+ * arenas let later requests run without touching the heap.
+ *
+ * @param context The compile context
+ * @return The arena, or NULL if out of memory
+ */
+arena_t *context_acquire_arena(english_context_t *context);
+
+/**
+ * @brief Reset an arena and return it to the context's pool
+ * @param context The compile context
+ * @param arena The arena; nothing allocated from it may be used afterwards
+ */
+void context_release_arena(english_context_t *context, arena_t *arena);
+
+/**
+ * @brief Get the HTTP headers shared by every request of the context
+ * @param context The compile context
+ * @return The header list, owned by the context
+ */
+struct curl_slist *context_get_headers(english_context_t *context);
+
+/**
+ * @brief Remember the conversation state Ollama returned, for the next compile to continue
+ * @param context The compile context
+ * @param key What the state belongs to (model and target language)
+ * @param tokens The "context" array of the response, as JSON
+ * @param length Its length
+ */
+void context_set_session(english_context_t *context, const char *key, const char *tokens, size_t length);
+
+/**
+ * @brief Get the conversation state stored for a key
+ * @param context The compile context
+ * @param key What the state belongs to (model and target language)
+ * @param arena Where to copy it
+ * @return The JSON array, or NULL if the last compile had another key or there is none
+ */
+char *context_get_session(english_context_t *context, const char *key, arena_t *arena);
+
+/**
+ * @brief Get the process-wide context behind english_compile, creating it on first use
+ * @return The default context, or NULL on failure
+ */
+english_context_t *context_get_default(void);
+
+/**
+ * @brief Free the default context, if it was created
+ */
+void context_free_default(void);
+
+#endif /* CONTEXT_H */
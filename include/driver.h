@@ -0,0 +1,63 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <stdbool.h>
+
+#include "request.h"
+
+/**
+ * @brief Runs many requests at once through one CURL multi handle
+ *
+ * Callers start requests with driver_start while driver_has_room, and take
+ * them back one at a time from driver_next as they complete, each with the
+ * item it was started for. Transfers, hedges, retries and failovers are
+ * handled in between.
+ */
+typedef struct driver driver_t;
+
+/**
+ * @brief Create a driver with its multi handle
+ * @param max_parallel Requests to keep in flight at most; the multi handle
+ *        keeps one reusable connection for each
+ * @return The driver, or NULL if CURL could not be initialized
+ */
+driver_t *driver_new(int max_parallel);
+
+/**
+ * @brief Check whether another request may be started
+ * @param driver The driver
+ * @return true if fewer than max_parallel requests are in flight
+ */
+bool driver_has_room(const driver_t *driver);
+
+/**
+ * @brief Start a request's transfers
+ * @param driver The driver
+ * @param request The request, which must not be cached
+ * @param item What driver_next returns once the request completes; must not be NULL
+ * @return true if the request is in flight, false if it did not start and is
+ *         done already
+ */
+bool driver_start(driver_t *driver, english_request_t *request, void *item);
+
+/**
+ * @brief Run until one of the requests in flight completes
+ *
+ * The request is done and can be finished with request_finish. A signal
+ * interrupts the wait, so cancellation takes effect at once.
+ *
+ * @param driver The driver
+ * @return The item of the completed request, or NULL if none is in flight
+ */
+void *driver_next(driver_t *driver);
+
+/**
+ * @brief Release a driver and its multi handle
+ *
+ * Requests still in flight must be freed first.
+ *
+ * @param driver The driver, or NULL
+ */
+void driver_free(driver_t *driver);
+
+#endif /* DRIVER_H */
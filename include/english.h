@@ -6,6 +6,12 @@
 
 /**
  * @brief Initialize the English compiler
+ *
+ * CURL and the configuration are set up by the first call only, so every
+ * component of a program may call it; each call is paired with one call of
+ * english_cleanup, and the last of those tears everything down. Call it
+ * before starting threads that compile.
+ *
  * @return true if initialization was successful, false otherwise
  */
 bool english_init(void);
@@ -38,6 +44,11 @@ const char *english_config_get_model(void);
 
 /**
  * @brief Set verbose mode for detailed output
+ *
+ * This and the other english_set_* settings are process-wide defaults, for
+ * english_compile and every context without a setting of its own. Set them
+ * before starting threads that compile.
+ *
  * @param verbose true to enable verbose mode, false to disable
  */
 void english_set_verbose(bool verbose);
@@ -48,15 +59,108 @@ void english_set_verbose(bool verbose);
  */
 bool english_is_verbose(void);
 
+/**
+ * @brief Enable or disable the on-disk compile cache (enabled by default)
+ * @param enabled true to serve and store compiles in ~/.english/cache
+ */
+void english_set_cache_enabled(bool enabled);
+
+/**
+ * @brief Check if the on-disk compile cache is enabled
+ * @return true if the cache is enabled, false otherwise
+ */
+bool english_is_cache_enabled(void);
+
+/**
+ * @brief Which code a compile returns when the response has fenced blocks
+ */
+typedef enum {
+    ENGLISH_EXTRACT_FIRST,  // The first fenced block (default)
+    ENGLISH_EXTRACT_ALL,    // Every fenced block, separated by a blank line
+    ENGLISH_EXTRACT_NONE    // The whole response, fences included
+} english_extract_t;
+
+/**
+ * @brief Choose which code compiles return
+ * @param mode The extraction mode
+ */
+void english_set_extract_mode(english_extract_t mode);
+
+/**
+ * @brief Get the extraction mode set by english_set_extract_mode
+ * @return The extraction mode
+ */
+english_extract_t english_get_extract_mode(void);
+
+/**
+ * @brief Set how long a compile may take before it is abandoned
+ *
+ * The deadline is counted from the start of each compile and covers every
+ * attempt at it, including retries; connecting to a server is also given up
+ * after at most 10 seconds so another endpoint or a retry can be tried.
+ *
+ * @param timeout_ms Milliseconds, or 0 for no deadline (default)
+ */
+void english_set_timeout(long timeout_ms);
+
+/**
+ * @brief Get the deadline set by english_set_timeout
+ * @return Milliseconds, or 0 for no deadline
+ */
+long english_get_timeout(void);
+
+/**
+ * @brief Set how often a compile is retried after a transient failure
+ *
+ * Connection errors and overloaded servers (HTTP 429 or 5xx, e.g. while a
+ * model is loading) are retried with exponential backoff and jitter, as long
+ * as the deadline leaves time for it. A response that has started to reach
+ * the caller is never retried.
+ *
+ * @param retries Number of retries (default 2), or 0 to fail on the first error
+ */
+void english_set_max_retries(int retries);
+
+/**
+ * @brief Get the retry limit set by english_set_max_retries
+ * @return The number of retries
+ */
+int english_get_max_retries(void);
+
+/**
+ * @brief Abort every compile in progress and make new ones fail right away
+ *
+ * Safe to call from a signal handler, e.g. for SIGINT. Transfers in flight
+ * are dropped and the compiles return failure.
+ */
+void english_cancel(void);
+
+/**
+ * @brief Check whether english_cancel was called
+ * @return true if compiles are being cancelled, false otherwise
+ */
+bool english_is_cancelled(void);
+
+/**
+ * @brief Allow compiles again after english_cancel
+ */
+void english_reset_cancel(void);
+
 /**
  * @brief Set the Ollama endpoint URL
- * @param endpoint The URL of the Ollama API endpoint
+ *
+ * Several comma-separated URLs spread requests over servers running the same
+ * model: each request goes to the least busy one, is hedged to a second when
+ * it is slow to answer, and fails over when a server errors.
+ *
+ * @param endpoint The URL of the Ollama API endpoint, or a comma-separated list
  */
 void english_set_ollama_endpoint(const char *endpoint);
 
 /**
  * @brief Get the current Ollama endpoint URL
- * @return The URL of the Ollama API endpoint
+ * @return The URL of the Ollama API endpoint, or the comma-separated list; it
+ *         stays valid when the endpoint is set again
  */
 const char *english_get_ollama_endpoint(void);
 
@@ -64,12 +168,384 @@ const char *english_get_ollama_endpoint(void);
  * @brief Compile English text to the target programming language
  * @param english_text The English description of the code to generate
  * @param target_language The target programming language (e.g., "python", "javascript")
- * @param output Buffer to store the generated code
- * @param output_size Size of the output buffer
+ * @param output_length Receives the length of the generated code (may be NULL)
+ * @return The NUL-terminated code in an exactly-sized buffer that the caller
+ *         releases with free(), or NULL if compilation failed
+ */
+char *english_compile(const char *english_text, const char *target_language, size_t *output_length);
+
+/**
+ * @brief Callback receiving generated code as it is streamed from Ollama
+ * @param chunk The next piece of code (not NUL-terminated)
+ * @param length Length of the chunk in bytes
+ * @param userdata The pointer passed to english_compile_stream
+ * @return true to keep streaming, false to abort the compilation
+ */
+typedef bool (*english_stream_callback)(const char *chunk, size_t length, void *userdata);
+
+/**
+ * @brief Compile English text to the target language, streaming code as it is generated
+ *
+ * The opening markdown fence and any preamble before it are stripped on the fly,
+ * so the callback only ever sees code.
+ *
+ * @param english_text The English description of the code to generate
+ * @param target_language The target programming language (e.g., "python", "javascript")
+ * @param callback Function called with each piece of generated code
+ * @param userdata Pointer passed through to the callback
+ * @return true if compilation was successful, false otherwise
+ */
+bool english_compile_stream(const char *english_text, const char *target_language,
+                            english_stream_callback callback, void *userdata);
+
+/**
+ * @brief A reusable compile context
+ *
+ * A context owns a pool of CURL handles, whose multi handles keep their
+ * connections alive, a share of DNS results and TLS sessions, and prebuilt
+ * request headers, so consecutive compiles skip the TCP and TLS handshakes.
+ * english_compile and english_compile_stream use a process-wide default
+ * context.
+ *
+ * A context is also the handle of a library user: it can carry its own
+ * model, endpoints, verbosity, deadline, retries, cache and extraction
+ * settings (english_context_set_*), and whatever it does not set follows the
+ * process-wide settings. Compiles on separate contexts share nothing but the
+ * on-disk caches, which are locked, so they may run concurrently from any
+ * number of threads; so may compiles on one context, whose pools are locked.
+ * Settings are not locked: set them before the context is used.
+ */
+typedef struct english_context english_context_t;
+
+/**
+ * @brief Create a compile context
+ * @return The context, or NULL on failure
+ */
+english_context_t *english_context_new(void);
+
+/**
+ * @brief Set the model a context compiles with
+ * @param context The compile context
+ * @param model The model, or NULL for the configured one
+ * @return true if the model was set, false if out of memory
+ */
+bool english_context_set_model(english_context_t *context, const char *model);
+
+/**
+ * @brief Give a context endpoints of its own
+ *
+ * The context balances, hedges and fails over between its endpoints by
+ * itself, like english_set_ollama_endpoint does for the others.
+ *
+ * @param context The compile context
+ * @param endpoint One URL or a comma-separated list, or NULL for the process-wide endpoints
+ * @return true if the endpoints were set, false otherwise
+ */
+bool english_context_set_endpoint(english_context_t *context, const char *endpoint);
+
+/**
+ * @brief Set whether a context reports what it is doing on stderr
+ * @param context The compile context
+ * @param verbose true to enable verbose output, false to disable it
+ */
+void english_context_set_verbose(english_context_t *context, bool verbose);
+
+/**
+ * @brief Set whether a context serves and stores compiles in the on-disk cache
+ * @param context The compile context
+ * @param enabled true to use the cache, false to bypass it
+ */
+void english_context_set_cache_enabled(english_context_t *context, bool enabled);
+
+/**
+ * @brief Set whether a context's compiles continue the conversation of earlier ones
+ * @param context The compile context
+ * @param enabled true to continue conversations, false for independent compiles
+ */
+void english_context_set_session(english_context_t *context, bool enabled);
+
+/**
+ * @brief Choose which code a context's compiles return
+ * @param context The compile context
+ * @param mode The extraction mode
+ */
+void english_context_set_extract_mode(english_context_t *context, english_extract_t mode);
+
+/**
+ * @brief Set how long a context's compiles may take, as english_set_timeout does
+ * @param context The compile context
+ * @param timeout_ms Milliseconds, or 0 for no deadline
+ */
+void english_context_set_timeout(english_context_t *context, long timeout_ms);
+
+/**
+ * @brief Set how often a context's compiles are retried, as english_set_max_retries does
+ * @param context The compile context
+ * @param retries Number of retries, or 0 to fail on the first error
+ */
+void english_context_set_max_retries(english_context_t *context, int retries);
+
+/**
+ * @brief Compile English text to the target programming language using a context
+ * @param context The compile context
+ * @param english_text The English description of the code to generate
+ * @param target_language The target programming language (e.g., "python", "javascript")
+ * @param output_length Receives the length of the generated code (may be NULL)
+ * @return The code, to be released with free(), or NULL if compilation failed
+ */
+char *english_context_compile(english_context_t *context, const char *english_text, const char *target_language,
+                              size_t *output_length);
+
+/**
+ * @brief Compile English text using a context, streaming code as it is generated
+ * @param context The compile context
+ * @param english_text The English description of the code to generate
+ * @param target_language The target programming language (e.g., "python", "javascript")
+ * @param callback Function called with each piece of generated code
+ * @param userdata Pointer passed through to the callback
  * @return true if compilation was successful, false otherwise
  */
-bool english_compile(const char *english_text, const char *target_language, 
-                     char *output, size_t output_size);
+bool english_context_compile_stream(english_context_t *context, const char *english_text, const char *target_language,
+                                    english_stream_callback callback, void *userdata);
+
+/**
+ * @brief Most candidates english_compile_candidates samples at once
+ */
+#define ENGLISH_MAX_CANDIDATES 8
+
+/**
+ * @brief Compile English text by sampling several answers at once and keeping the first that parses
+ *
+ * The candidates are generated concurrently at rising temperatures, each
+ * with its own seed. Each one is checked by the target language's validator
+ * as soon as it arrives (a syntax-only run of the language's toolchain, or
+ * the validator= line of the config file), and the first that passes is
+ * returned while the others are cancelled. Ollama runs the candidates side
+ * by side only if it has parallel slots for them (OLLAMA_NUM_PARALLEL).
+ *
+ * @param context The compile context
+ * @param english_text The English description of the code to generate
+ * @param target_language The target programming language (e.g., "python", "javascript")
+ * @param candidates Number of candidates, from 1 to ENGLISH_MAX_CANDIDATES
+ * @param output_length Receives the length of the generated code (may be NULL)
+ * @return The code, to be released with free(), or NULL if compilation failed
+ */
+char *english_context_compile_candidates(english_context_t *context, const char *english_text,
+                                         const char *target_language, int candidates, size_t *output_length);
+
+/**
+ * @brief Compile English text by sampling several candidates, using the default context
+ * @param english_text The English description of the code to generate
+ * @param target_language The target programming language (e.g., "python", "javascript")
+ * @param candidates Number of candidates, from 1 to ENGLISH_MAX_CANDIDATES
+ * @param output_length Receives the length of the generated code (may be NULL)
+ * @return The code, to be released with free(), or NULL if compilation failed
+ */
+char *english_compile_candidates(const char *english_text, const char *target_language, int candidates,
+                                 size_t *output_length);
+
+/**
+ * @brief Free a compile context and close its connections
+ * @param context The context to free
+ */
+void english_context_free(english_context_t *context);
+
+/**
+ * @brief Continue the conversation of earlier compiles
+ *
+ * When enabled, each compile sends the "context" Ollama returned for the
+ * previous compile with the same model and target language in the same
+ * compile context, so follow-up descriptions can refer to earlier code and
+ * the server skips re-evaluating the shared history. Such compiles bypass
+ * the cache, since their result depends on what came before.
+ *
+ * @param enabled true to continue conversations, false for independent compiles (default)
+ */
+void english_set_session(bool enabled);
+
+/**
+ * @brief Check whether compiles continue the conversation of earlier ones
+ * @return true if enabled, false otherwise
+ */
+bool english_is_session(void);
+
+/**
+ * @brief Forget the conversation of a compile context, so the next compile starts fresh
+ * @param context The compile context
+ */
+void english_context_clear_session(english_context_t *context);
+
+/**
+ * @brief Events of a file descriptor, as english_async_t reports and receives them
+ */
+#define ENGLISH_ASYNC_READ 1
+#define ENGLISH_ASYNC_WRITE 2
+#define ENGLISH_ASYNC_ERROR 4
+
+/**
+ * @brief The compiles driven by one event loop
+ *
+ * Compiles started with english_async_compile never block: their transfers
+ * run on a CURL multi handle whose file descriptors and timeouts the loop
+ * watches, e.g. with epoll, kqueue or poll. Any number of compiles can be
+ * outstanding on one thread. An english_async_t belongs to the thread that
+ * drives it; loops on other threads need their own.
+ *
+ * The description is still looked up in the on-disk cache when a compile
+ * starts; with a semantic cache, that lookup waits for the embedding too.
+ */
+typedef struct english_async english_async_t;
+
+/**
+ * @brief One compile started with english_async_compile
+ */
+typedef struct english_async_job english_async_job_t;
+
+/**
+ * @brief Called when a file descriptor should be watched differently
+ * @param fd The file descriptor
+ * @param events ENGLISH_ASYNC_READ and/or ENGLISH_ASYNC_WRITE to watch for, or 0 to stop watching it
+ * @param userdata The pointer passed to english_async_new
+ */
+typedef void (*english_socket_callback)(int fd, int events, void *userdata);
+
+/**
+ * @brief Called when the loop's timer should be changed
+ * @param timeout_ms Call english_async_timeout after this many milliseconds (0 for as soon
+ * as possible), or -1 for no timer; replaces any earlier timer
+ * @param userdata The pointer passed to english_async_new
+ */
+typedef void (*english_timer_callback)(long timeout_ms, void *userdata);
+
+/**
+ * @brief Called once when a compile started with english_async_compile is over
+ * @param job The compile; it is freed when the callback returns
+ * @param code The code, to be released with free(), or NULL if compilation failed
+ * @param length Length of the code in bytes
+ * @param userdata The pointer passed to english_async_compile
+ */
+typedef void (*english_done_callback)(english_async_job_t *job, char *code, size_t length, void *userdata);
+
+/**
+ * @brief Create the compiles of an event loop
+ * @param context The compile context providing connections and settings
+ * @param on_socket Told which file descriptors to watch
+ * @param on_timer Told when to call english_async_timeout
+ * @param userdata Pointer passed through to both callbacks
+ * @return The set of compiles, or NULL on failure
+ */
+english_async_t *english_async_new(english_context_t *context, english_socket_callback on_socket,
+                                   english_timer_callback on_timer, void *userdata);
+
+/**
+ * @brief Start a compile without waiting for it
+ *
+ * The compile hedges, fails over, retries and escalates like a blocking one.
+ * Its callbacks only run inside english_async_socket_ready and
+ * english_async_timeout, never inside this function.
+ *
+ * @param async The event loop's compiles
+ * @param english_text The English description of the code to generate
+ * @param target_language The target programming language (e.g., "python", "javascript")
+ * @param on_chunk If not NULL, the code is streamed to it as it is generated
+ * @param on_done Called with the code once the compile is over (may be NULL)
+ * @param userdata Pointer passed through to both callbacks
+ * @return The compile, or NULL if it could not be started
+ */
+english_async_job_t *english_async_compile(english_async_t *async, const char *english_text,
+                                           const char *target_language, english_stream_callback on_chunk,
+                                           english_done_callback on_done, void *userdata);
+
+/**
+ * @brief Abandon a compile; its done callback is not called
+ *
+ * Not to be called from the compile's own stream callback, which stops the
+ * compile by returning false instead.
+ *
+ * @param job The compile
+ */
+void english_async_cancel(english_async_job_t *job);
+
+/**
+ * @brief Drive the compiles after a watched file descriptor became ready
+ * @param async The event loop's compiles
+ * @param fd The file descriptor
+ * @param events ENGLISH_ASYNC_READ, ENGLISH_ASYNC_WRITE and/or ENGLISH_ASYNC_ERROR
+ */
+void english_async_socket_ready(english_async_t *async, int fd, int events);
+
+/**
+ * @brief Drive the compiles once the timer set through the timer callback expired
+ *
+ * Sends hedged requests and retries that are due, and runs the done callbacks
+ * of finished compiles. english_cancel is noticed here too.
+ *
+ * @param async The event loop's compiles
+ */
+void english_async_timeout(english_async_t *async);
+
+/**
+ * @brief Count the compiles whose done callback has not run yet
+ * @param async The event loop's compiles
+ * @return The number of outstanding compiles
+ */
+size_t english_async_pending(const english_async_t *async);
+
+/**
+ * @brief Cancel every outstanding compile and free the event loop's compiles
+ *
+ * Not to be called from any of its callbacks.
+ *
+ * @param async The event loop's compiles
+ */
+void english_async_free(english_async_t *async);
+
+/**
+ * @brief Load the configured model on every endpoint ahead of the first compile
+ * @param keep_alive How long Ollama keeps the model loaded (e.g. "30m", or "-1" for
+ * ever), or NULL for the configured keep_alive
+ * @return true if every endpoint loaded the model, false otherwise
+ */
+bool english_warm(const char *keep_alive);
+
+/**
+ * @brief Where the time of one compile went
+ *
+ * Durations are in milliseconds. The network phases come from CURL and are
+ * zero for a compile served from the cache; the Ollama fields are what the
+ * server reported about its own work (durations in nanoseconds).
+ */
+typedef struct {
+    double config_ms;                 // Loading the configuration in english_init
+    double build_ms;                  // Building the prompt and request JSON
+    double embed_ms;                  // Embedding the description for the semantic cache
+    double dns_ms;                    // Resolving the endpoint host
+    double connect_ms;                // TCP connect
+    double tls_ms;                    // TLS handshake
+    double first_byte_ms;             // From sending the request to the first response byte
+    double transfer_ms;               // From the first to the last response byte
+    double parse_ms;                  // Parsing response JSON
+    double extract_ms;                // Extracting code from the response text
+    double total_ms;                  // From building the request to having the code
+    bool cached;                      // Served from the compile cache
+    unsigned long long eval_count;              // Tokens generated
+    unsigned long long eval_duration_ns;        // Time spent generating them
+    unsigned long long prompt_eval_count;       // Prompt tokens evaluated
+    unsigned long long prompt_eval_duration_ns; // Time spent evaluating the prompt
+    unsigned long long load_duration_ns;        // Time spent loading the model
+    unsigned long long arena_allocations;       // Allocations served by the request's arena
+    unsigned long long arena_bytes;             // Bytes they took
+    unsigned long long heap_allocations;        // Blocks the arena had to malloc for them
+    unsigned attempts;                // Transfers started, counting hedges, failovers and retries
+    unsigned escalations;             // Times a routed compile moved on to a larger model
+} english_stats_t;
+
+/**
+ * @brief Get the timing breakdown of the calling thread's most recent compile
+ * @param stats Receives the breakdown
+ * @return true if the thread has compiled anything, false otherwise
+ */
+bool english_get_last_stats(english_stats_t *stats);
 
 /**
  * @brief Clean up resources used by the English compiler
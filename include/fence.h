@@ -0,0 +1,57 @@
+#ifndef FENCE_H
+#define FENCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief A fenced code block in a model response
+ *
+ * All pointers point into the scanned text; nothing is copied and none of
+ * the spans is NUL-terminated.
+ */
+typedef struct {
+    const char *language;     // Language tag from the opening fence, may be empty
+    size_t language_length;
+    const char *info;         // Rest of the opening line after the tag (e.g. a file name)
+    size_t info_length;
+    const char *code;         // The code between the fences
+    size_t code_length;
+    bool closed;              // false if the text ended inside the block
+} fence_block_t;
+
+/**
+ * @brief Find the next fenced code block
+ *
+ * A block opens with a run of at least three backticks followed by an info
+ * string and a newline, and closes with a run at least as long that starts
+ * or ends a line. The text is scanned once, with memchr jumping between
+ * backticks.
+ *
+ * @param text The response text
+ * @param length Its length
+ * @param offset Where to start; advanced past the block that was found
+ * @param block Receives the block
+ * @return true if a block was found, false at the end of the text
+ */
+bool fence_next(const char *text, size_t length, size_t *offset, fence_block_t *block);
+
+/**
+ * @brief Find the code in a response: the first fenced block, else what follows
+ * a 'Code:' marker, else the whole text
+ * @param text The response text
+ * @param length Its length
+ * @param code_length Receives the length of the code
+ * @return The start of the code within text
+ */
+const char *fence_extract(const char *text, size_t length, size_t *code_length);
+
+/**
+ * @brief Get the usual file extension for a language tag
+ * @param language The tag, not necessarily NUL-terminated
+ * @param length Its length
+ * @return The extension without a dot ("txt" for unknown tags)
+ */
+const char *fence_file_extension(const char *language, size_t length);
+
+#endif /* FENCE_H */
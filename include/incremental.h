@@ -0,0 +1,32 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Suffix of the manifest kept next to the output of an incremental compile
+ */
+#define INCREMENTAL_MANIFEST_SUFFIX ".manifest"
+
+/**
+ * @brief Compile a description section by section, reusing unchanged sections
+ *
+ * The description is split at markdown headings, or at blank lines when it
+ * has no headings. Each section is hashed together with the model and
+ * target language. Sections whose hash appears in the manifest of the
+ * previous build reuse its stored code; the others are compiled
+ * concurrently. The fragments are joined in order into the output file,
+ * and the manifest is rewritten next to it.
+ *
+ * @param english_text The English description
+ * @param length Length of the description in bytes
+ * @param target_language The target programming language
+ * @param output_file Path of the output file
+ * @param max_parallel Maximum number of requests in flight
+ * @return true if every section compiled and the output was written, false otherwise
+ */
+bool incremental_compile(const char *english_text, size_t length, const char *target_language,
+                         const char *output_file, int max_parallel);
+
+#endif /* INCREMENTAL_H */
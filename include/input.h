@@ -0,0 +1,46 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief An English description read from a file or stdin
+ *
+ * input_open maps regular files into memory rather than copying them. The
+ * mapping is followed by at least one zero byte, so data is always
+ * NUL-terminated.
+ */
+typedef struct {
+    const char *data;  // The NUL-terminated text
+    size_t size;       // Length of the text in bytes
+    size_t mapped;     // Length of the mapping, or 0 if data is on the heap
+} input_t;
+
+/**
+ * @brief Open an input file, mapping it into memory when possible
+ * @param path The file to read, or NULL for stdin
+ * @param input Receives the text
+ * @return true on success, false if the input could not be read
+ */
+bool input_open(const char *path, input_t *input);
+
+/**
+ * @brief Read an input file into memory, never mapping it
+ *
+ * For files that may be rewritten or truncated while they are read, such as
+ * those being watched: the text is a copy, so nothing changes under it.
+ *
+ * @param path The file to read, or NULL for stdin
+ * @param input Receives the text
+ * @return true on success, false if the input could not be read
+ */
+bool input_read(const char *path, input_t *input);
+
+/**
+ * @brief Release the text of an input
+ * @param input The input to close
+ */
+void input_close(input_t *input);
+
+#endif /* INPUT_H */
@@ -0,0 +1,168 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Deepest nesting the decoder follows
+ */
+#define JSON_MAX_DEPTH 16
+
+/**
+ * @brief Longest member name the decoder keeps, including the NUL; longer names are cut short
+ */
+#define JSON_MAX_KEY 32
+
+/**
+ * @brief Decoded bytes of a string the decoder gathers before handing them over
+ */
+#define JSON_SCRATCH_SIZE 512
+
+/**
+ * @brief What a decoded value is
+ */
+typedef enum {
+    JSON_STRING,         // A piece of a string; long strings arrive in several pieces
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL,
+    JSON_BEGIN_OBJECT,
+    JSON_END_OBJECT,
+    JSON_BEGIN_ARRAY,
+    JSON_END_ARRAY
+} json_kind_t;
+
+/**
+ * @brief One value, or piece of a string, as the decoder reports it
+ */
+typedef struct {
+    json_kind_t kind;
+    int depth;             // 0 for the top-level object itself, 1 for its members, and so on
+    const char *key;       // Member name of the value, "" for an array element
+    const char *top_key;   // Name of the member of the top-level object the value is part of
+    const char *data;      // The piece of a string (decoded), or the text of a number
+    size_t length;
+    bool first;            // The first piece of a string
+    bool last;             // The last piece of a string
+} json_value_t;
+
+/**
+ * @brief Called for every value the decoder reads
+ * @param value The value; its strings only live until the callback returns
+ * @param userdata Pointer given to json_decoder_init
+ * @return false to stop decoding
+ */
+typedef bool (*json_value_callback)(const json_value_t *value, void *userdata);
+
+/**
+ * @brief Incremental decoder of a sequence of JSON objects, such as NDJSON
+ *
+ * Bytes are fed as they arrive, split anywhere. Values are reported through
+ * the callback as soon as they are complete, strings in pieces, without
+ * building a tree. Each top-level object is reported as a JSON_BEGIN_OBJECT
+ * and a JSON_END_OBJECT at depth 0, with everything in it in between.
+ * Nothing is allocated.
+ */
+typedef struct {
+    json_value_callback on_value;
+    void *userdata;
+    int state;
+    int depth;
+    uint32_t arrays;                      // Bit n is set when depth n is an array
+    char keys[JSON_MAX_DEPTH + 1][JSON_MAX_KEY];
+    size_t key_length;
+    const char *literal;                  // The literal being matched: "true", "false" or "null"
+    int literal_index;
+    char number[64];
+    size_t number_length;
+    char scratch[JSON_SCRATCH_SIZE];      // Decoded string bytes not yet handed over
+    size_t scratch_length;
+    bool string_started;                  // A piece of the current string was handed over
+    uint32_t code_point;                  // A \u escape being read
+    int hex_digits;
+    uint32_t high_surrogate;              // First half of a surrogate pair, 0 if none
+} json_decoder_t;
+
+/**
+ * @brief Prepare a decoder
+ * @param decoder The decoder
+ * @param on_value Called for every value
+ * @param userdata Pointer passed through to the callback
+ */
+void json_decoder_init(json_decoder_t *decoder, json_value_callback on_value, void *userdata);
+
+/**
+ * @brief Decode the next bytes of the input
+ * @param decoder The decoder
+ * @param data The bytes
+ * @param length Number of bytes
+ * @return false if the input is not JSON objects or the callback stopped the decoder
+ */
+bool json_decoder_feed(json_decoder_t *decoder, const char *data, size_t length);
+
+/**
+ * @brief Check that the input ended between two objects
+ * @param decoder The decoder
+ * @return true if every object was complete and nothing went wrong
+ */
+bool json_decoder_finish(const json_decoder_t *decoder);
+
+/**
+ * @brief Decode a complete text of JSON objects in one call
+ * @param data The text
+ * @param length Its length in bytes
+ * @param on_value Called for every value
+ * @param userdata Pointer passed through to the callback
+ * @return true if the whole text decoded
+ */
+bool json_decode(const char *data, size_t length, json_value_callback on_value, void *userdata);
+
+/**
+ * @brief Read a number the decoder reported as an integer
+ * @param value A JSON_NUMBER value
+ * @return The integer, truncated if it had a fraction
+ */
+int64_t json_get_int(const json_value_t *value);
+
+/**
+ * @brief Read a number the decoder reported
+ * @param value A JSON_NUMBER value
+ * @return The number
+ */
+double json_get_double(const json_value_t *value);
+
+/**
+ * @brief Check whether a value belongs to the member of that name
+ * @param value The value
+ * @param key The member name
+ * @return true if the value's member name is key
+ */
+bool json_is_key(const json_value_t *value, const char *key);
+
+/**
+ * @brief Called with the next bytes of encoded JSON
+ * @param data The bytes
+ * @param length Number of bytes
+ * @param target Pointer given to the encoder
+ * @return false to stop encoding
+ */
+typedef bool (*json_write_callback)(const char *data, size_t length, void *target);
+
+/**
+ * @brief Write a string as a JSON string literal, quotes included
+ *
+ * Runs of bytes that need no escaping are written in one piece, so the text
+ * goes straight to its destination without an intermediate copy.
+ *
+ * @param text The text
+ * @param length Its length in bytes
+ * @param write Receives the encoded bytes
+ * @param target Pointer passed through to write
+ * @return true if every write succeeded
+ */
+bool json_write_string(const char *text, size_t length, json_write_callback write, void *target);
+
+#endif /* JSON_H */
@@ -0,0 +1,10 @@
+#ifndef MONOTONIC_H
+#define MONOTONIC_H
+
+/**
+ * @brief Read the monotonic clock that requests and their callers are timed with
+ * @return Milliseconds since an arbitrary point; only differences are meaningful
+ */
+double monotonic_ms(void);
+
+#endif /* MONOTONIC_H */
@@ -0,0 +1,152 @@
+#ifndef REQUEST_H
+#define REQUEST_H
+
+#include <stdbool.h>
+#include <curl/curl.h>
+
+#include "english.h"
+
+/**
+ * @brief A single compile request to Ollama, from prompt to extracted code
+ *
+ * A request borrows CURL easy handles from its context, so callers can either
+ * run it with request_perform or start it on a multi handle to drive many at once.
+ */
+typedef struct english_request english_request_t;
+
+/**
+ * @brief Prepare a compile request
+ * @param context The context providing the CURL handle and shared connection state
+ * @param english_text The English description of the code to generate
+ * @param target_language The target programming language
+ * @param callback If not NULL, request a streaming response and pass code to this callback
+ * @param userdata Pointer passed through to the callback
+ * @return The request, or NULL on failure
+ */
+english_request_t *request_new(english_context_t *context, const char *english_text, const char *target_language,
+                               english_stream_callback callback, void *userdata);
+
+/**
+ * @brief Prepare one of several samples of the same compile
+ *
+ * Candidate 0 samples like an ordinary compile and may be answered from the
+ * cache; further candidates sample at higher temperatures, each with a seed
+ * of its own, and always go to Ollama. No candidate is stored in the cache
+ * unless the caller keeps it with request_keep.
+ *
+ * @param context The context providing the CURL handle and shared connection state
+ * @param english_text The English description of the code to generate
+ * @param target_language The target programming language
+ * @param candidate Which sample this is, from 0
+ * @return The request, or NULL on failure
+ */
+english_request_t *request_new_candidate(english_context_t *context, const char *english_text,
+                                         const char *target_language, int candidate);
+
+/**
+ * @brief Get the sampling temperature of a request
+ * @param request The request
+ * @return The temperature sent to Ollama
+ */
+double request_get_temperature(const english_request_t *request);
+
+/**
+ * @brief Check whether the request was answered from the cache and needs no transfer
+ * @param request The request
+ * @return true if the result is already available, false otherwise
+ */
+bool request_is_cached(const english_request_t *request);
+
+/**
+ * @brief Start the request's transfers on a multi handle
+ *
+ * The request picks an endpoint from the balancer and adds an easy handle for
+ * it to the multi handle. It may later add more: a hedged duplicate when the
+ * first endpoint is slow to answer, or a failover when an endpoint fails.
+ *
+ * @param request The request
+ * @param multi The multi handle to run the transfers on
+ * @param owner Stored as CURLOPT_PRIVATE of every easy handle the request adds
+ * @return true if a transfer was started, false otherwise
+ */
+bool request_start(english_request_t *request, CURLM *multi, void *owner);
+
+/**
+ * @brief Let a started request act on time passing: send a hedged request,
+ * start a retry whose backoff is over, or give up after english_cancel
+ * @param request The request
+ * @param timeout_ms Receives the milliseconds until it next needs polling, or -1
+ * @return true if the request is done and can be finished, false otherwise
+ */
+bool request_poll(english_request_t *request, long *timeout_ms);
+
+/**
+ * @brief Hand a completed easy handle back to the request that added it
+ * @param request The request
+ * @param handle The easy handle from a CURLMSG_DONE message; the request removes it
+ * from the multi handle
+ * @param result The result from the message
+ * @return true if the request is done and can be finished, false while transfers
+ * are still running for it or a retry is pending
+ */
+bool request_complete_transfer(english_request_t *request, CURL *handle, CURLcode result);
+
+/**
+ * @brief Run the request to completion on a private multi handle
+ * @param request The request
+ * @return true if the transfer succeeded (always for a cached request), false otherwise
+ */
+bool request_perform(english_request_t *request);
+
+/**
+ * @brief Process the response once the request is done
+ * @param request The request
+ * @return true if code was generated, false otherwise
+ */
+bool request_finish(english_request_t *request);
+
+/**
+ * @brief Store a finished candidate's code in the cache as the result of its compile
+ * @param request The candidate chosen by the caller; ordinary requests store
+ * themselves and are left alone
+ */
+void request_keep(english_request_t *request);
+
+/**
+ * @brief Get the generated code of a finished request
+ * @param request The request
+ * @return The code, or an empty string if none was generated
+ */
+const char *request_get_output(const english_request_t *request);
+
+/**
+ * @brief Get the length of the generated code of a finished request
+ * @param request The request
+ * @return The length of the code in bytes
+ */
+size_t request_get_output_length(const english_request_t *request);
+
+/**
+ * @brief Take ownership of the generated code of a finished request
+ * @param request The request, which no longer holds the code afterwards
+ * @param length Receives the length of the code (may be NULL)
+ * @return The NUL-terminated code, to be released with free(), or NULL if out of memory
+ */
+char *request_take_output(english_request_t *request, size_t *length);
+
+/**
+ * @brief Ask every endpoint of a context to load its model
+ * @param context The context providing the endpoints, the model and the CURL handles
+ * @param keep_alive How long the model stays loaded (e.g. "30m" or "-1"), or NULL
+ * for the server's default
+ * @return true if every endpoint loaded the model, false otherwise
+ */
+bool request_warm(english_context_t *context, const char *keep_alive);
+
+/**
+ * @brief Free a request and return its CURL handles to the context
+ * @param request The request; transfers still running are removed from their multi handle
+ */
+void request_free(english_request_t *request);
+
+#endif /* REQUEST_H */
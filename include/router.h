@@ -0,0 +1,73 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+/**
+ * @brief Most models one route can escalate through, the configured model included
+ */
+#define ROUTER_MAX_MODELS 8
+
+/**
+ * @brief The models chosen for a compile, smallest first
+ */
+typedef struct {
+    const char *models[ROUTER_MAX_MODELS];
+    size_t count;               // At least 1
+    int rule;                   // Index of the rule that matched, or -1 for the configured model
+    size_t estimated_tokens;    // The estimate the rule was matched against
+} router_route_t;
+
+/**
+ * @brief Read the routing hint at the start of a description
+ *
+ * A description may start with a line "@hint NAME", which routing rules can
+ * match with hint=NAME. The line is not part of the description.
+ *
+ * @param text The English description
+ * @param hint Receives the hint, or an empty string if there is none
+ * @param hint_size Size of the hint buffer
+ * @return The description after the hint line
+ */
+const char *router_read_hint(const char *text, char *hint, size_t hint_size);
+
+/**
+ * @brief Choose the models for a compile from the routing rules in the config file
+ *
+ * Each rule is a list of conditions (min_bytes, max_bytes, min_tokens,
+ * max_tokens, language and hint) followed by "->" and the models to try in
+ * turn. The first rule whose conditions all hold is used, and the compile's
+ * own model ends its chain unless already in it. Without a matching rule,
+ * that model is used alone.
+ *
+ * @param arena Where the model names are allocated
+ * @param text The description, whose tokens are estimated with tokens_estimate
+ * @param length Length of the description in bytes
+ * @param language The target language
+ * @param hint The description's hint, or an empty string
+ * @param model The model of the compile context
+ * @param route Receives the models
+ */
+void router_route(arena_t *arena, const char *text, size_t length, const char *language, const char *hint,
+                  const char *model, router_route_t *route);
+
+/**
+ * @brief Quick local check that generated code is not obviously broken
+ *
+ * Brackets must balance outside of string literals and comments. The check
+ * only catches truncated or garbled answers; it says nothing about whether
+ * the code works. Shell scripts and languages with regex literals
+ * (JavaScript, TypeScript, Ruby, Perl, awk) always pass, since the check
+ * misreads their valid code.
+ *
+ * @param code The extracted code
+ * @param length Length of the code in bytes
+ * @param language The target language, for the few places where it matters
+ * @return NULL if the code passes, or why it failed
+ */
+const char *router_check_code(const char *code, size_t length, const char *language);
+
+#endif /* ROUTER_H */
@@ -0,0 +1,94 @@
+#ifndef SEMCACHE_H
+#define SEMCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sha256.h"
+
+/**
+ * @brief How far below the threshold a match still counts as a near miss
+ */
+#define SEMCACHE_NEAR_MISS_MARGIN 0.05
+
+/**
+ * @brief How a semantic lookup ended, for the counters
+ */
+typedef enum {
+    SEMCACHE_HIT,        // A stored compile was similar enough and still cached
+    SEMCACHE_MISS,       // Nothing similar was stored
+    SEMCACHE_NEAR_MISS   // The best match fell just short of the threshold
+} semcache_outcome_t;
+
+/**
+ * @brief Counters describing the semantic cache
+ */
+typedef struct {
+    size_t entries;           // Stored descriptions
+    size_t dimensions;        // Length of their embeddings, 0 while empty
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t near_misses;
+    uint64_t stores;
+} semcache_stats_t;
+
+/**
+ * @brief Find the stored description most similar to an embedding
+ *
+ * Embeddings are compared by cosine similarity, only with those stored under
+ * the same scope (model, language and options). Small indexes are searched
+ * exhaustively; large ones first narrow the search down with locality
+ * sensitive hashes and only compare the embeddings that are likely close.
+ *
+ * @param scope What a match must have been stored under
+ * @param vector The embedding of the normalized description
+ * @param dimensions Length of the embedding
+ * @param key Receives the compile cache key of the best match
+ * @param similarity Receives the cosine similarity of the best match, or -1
+ * @return true if any description of the scope was compared, false otherwise
+ */
+bool semcache_lookup(const uint8_t scope[SHA256_DIGEST_SIZE], const float *vector, size_t dimensions,
+                     uint8_t key[SHA256_DIGEST_SIZE], double *similarity);
+
+/**
+ * @brief Remember the embedding of a compiled description
+ *
+ * The index holds a fixed number of embeddings and overwrites the oldest
+ * once full. An embedding of another length than those stored, e.g. after
+ * the embedding model changed, starts the index over.
+ *
+ * @param scope What the compile was made under
+ * @param vector The embedding of the normalized description
+ * @param dimensions Length of the embedding
+ * @param key The compile cache key holding the code
+ * @return true if the embedding was stored, false otherwise
+ */
+bool semcache_store(const uint8_t scope[SHA256_DIGEST_SIZE], const float *vector, size_t dimensions,
+                    const uint8_t key[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief Count the outcome of a lookup
+ * @param outcome How the lookup ended
+ */
+void semcache_record(semcache_outcome_t outcome);
+
+/**
+ * @brief Read the semantic cache counters
+ * @param stats Receives the counters
+ * @return true if the index could be opened, false otherwise
+ */
+bool semcache_get_stats(semcache_stats_t *stats);
+
+/**
+ * @brief Remove every stored embedding and reset the counters
+ * @return true if the index was cleared, false otherwise
+ */
+bool semcache_clear(void);
+
+/**
+ * @brief Unmap the index
+ */
+void semcache_close(void);
+
+#endif /* SEMCACHE_H */
@@ -0,0 +1,59 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Wire protocol between the CLI and the daemon
+ *
+ * Every message is a frame: a 4-byte big-endian length, then a 1-byte type,
+ * then length - 1 bytes of payload. A client sends one request frame and
+ * reads response frames until SERVER_FRAME_END or SERVER_FRAME_ERROR.
+ */
+#define SERVER_FRAME_COMPILE 'C'  // Request: "language\0english text"
+#define SERVER_FRAME_STREAM  'S'  // Request: as 'C', with code streamed in many data frames
+#define SERVER_FRAME_DATA    'D'  // Response: a piece of generated code
+#define SERVER_FRAME_ERROR   'E'  // Response: error message, ends the exchange
+#define SERVER_FRAME_END     'Z'  // Response: compilation finished successfully
+
+/**
+ * @brief Largest frame either side accepts
+ */
+#define SERVER_MAX_FRAME (16 * 1024 * 1024)
+
+/**
+ * @brief Build the default socket path (~/.english/english.sock)
+ * @param path Buffer to store the path
+ * @param path_size Size of the path buffer
+ * @return true if the path was built, false otherwise
+ */
+bool server_default_socket(char *path, size_t path_size);
+
+/**
+ * @brief Run the compile daemon until SIGINT or SIGTERM
+ *
+ * The daemon keeps configuration, the cache index and a CURL multi handle
+ * with its keep-alive connections resident, and serves any number of
+ * concurrent clients from a single event loop.
+ *
+ * @param socket_path Path of the Unix-domain socket to listen on
+ * @return 0 on a clean shutdown, 1 on failure
+ */
+int server_run(const char *socket_path);
+
+/**
+ * @brief Forward a compile to a running daemon
+ * @param socket_path Path of the daemon's socket
+ * @param english_text The English description of the code to generate
+ * @param target_language The target programming language
+ * @param stream true to write code as it is generated
+ * @param output_file File to write the generated code to, or NULL for stdout
+ * @param timeout_ms How long to wait for the whole answer, or 0 for no limit
+ * @return 0 on success, 1 if the daemon reported a failure, the wait timed out or
+ * english_cancel was called, -1 if no daemon is reachable
+ */
+int server_client_compile(const char *socket_path, const char *english_text, const char *target_language,
+                          bool stream, const char *output_file, long timeout_ms);
+
+#endif /* SERVER_H */
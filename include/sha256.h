@@ -0,0 +1,47 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+/**
+ * @brief Incremental SHA-256 state
+ */
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    size_t block_used;
+} sha256_ctx_t;
+
+/**
+ * @brief Start a new SHA-256 computation
+ * @param ctx The state to initialize
+ */
+void sha256_init(sha256_ctx_t *ctx);
+
+/**
+ * @brief Add bytes to a SHA-256 computation
+ * @param ctx The state to update
+ * @param data The bytes to hash
+ * @param length Number of bytes
+ */
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t length);
+
+/**
+ * @brief Finish a SHA-256 computation
+ * @param ctx The state to finalize
+ * @param digest Receives the 32-byte digest
+ */
+void sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief Format a digest as lowercase hexadecimal
+ * @param digest The 32-byte digest
+ * @param hex Buffer of at least 65 bytes receiving the NUL-terminated string
+ */
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char *hex);
+
+#endif /* SHA256_H */
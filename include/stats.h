@@ -0,0 +1,73 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "english.h"
+
+/**
+ * @brief Longest model and language names kept in the histogram store
+ */
+#define STATS_MAX_MODEL 64
+#define STATS_MAX_LANGUAGE 32
+
+/**
+ * @brief Latency summary of one model and target language
+ */
+typedef struct {
+    char model[STATS_MAX_MODEL];
+    char language[STATS_MAX_LANGUAGE];
+    uint64_t requests;          // Compiles sent to Ollama
+    uint64_t failures;          // Compiles that failed
+    double total_p50_ms;        // Whole-request latency percentiles
+    double total_p95_ms;
+    double total_p99_ms;
+    double first_byte_p50_ms;   // Time-to-first-byte percentiles
+    double first_byte_p95_ms;
+    double tokens_per_second;   // Generated tokens over Ollama's eval time
+} stats_summary_t;
+
+/**
+ * @brief Remember the breakdown of the calling thread's latest compile
+ * @param stats The breakdown
+ */
+void stats_set_last(const english_stats_t *stats);
+
+/**
+ * @brief Get the breakdown remembered by stats_set_last on this thread
+ * @param stats Receives the breakdown
+ * @return true if there was one, false otherwise
+ */
+bool stats_get_last(english_stats_t *stats);
+
+/**
+ * @brief Add a compile that went to Ollama to the histograms of its model and language
+ * @param model The model
+ * @param target_language The target language
+ * @param stats The breakdown of the compile
+ * @param success Whether the compile succeeded
+ */
+void stats_record(const char *model, const char *target_language, const english_stats_t *stats, bool success);
+
+/**
+ * @brief Summarize the histograms of every model and language seen so far
+ * @param summaries Receives an array to be released with free()
+ * @param count Receives the number of entries
+ * @return true if the store could be read, false otherwise
+ */
+bool stats_summarize(stats_summary_t **summaries, size_t *count);
+
+/**
+ * @brief Remove all recorded histograms
+ * @return true if the store was cleared, false otherwise
+ */
+bool stats_clear(void);
+
+/**
+ * @brief Unmap the histogram store
+ */
+void stats_close(void);
+
+#endif /* STATS_H */
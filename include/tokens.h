@@ -0,0 +1,48 @@
+#ifndef TOKENS_H
+#define TOKENS_H
+
+#include <stddef.h>
+
+/**
+ * @brief Smallest context window requested from Ollama, its own default
+ */
+#define TOKENS_MIN_WINDOW 2048
+
+/**
+ * @brief Largest context window requested from Ollama
+ */
+#define TOKENS_MAX_WINDOW 131072
+
+/**
+ * @brief Estimate how many tokens a text takes, from its words, numbers and symbols
+ *
+ * Made for sizing requests, so it leans towards counting too many: a prompt
+ * that does not fit its context window loses its beginning.
+ *
+ * @param text The text
+ * @param length Length of the text in bytes
+ * @return The estimated number of tokens
+ */
+size_t tokens_estimate(const char *text, size_t length);
+
+/**
+ * @brief Estimate the most tokens the code for a description may need
+ * @param language The target language; verbose languages get more room
+ * @param description_tokens Estimated tokens of the description
+ * @return The number of tokens to let the model generate
+ */
+size_t tokens_expected_output(const char *language, size_t description_tokens);
+
+/**
+ * @brief Round a number of tokens up to a context window size
+ *
+ * Windows are powers of two, so requests of similar size ask for the same
+ * window and Ollama does not reload the model for each of them.
+ *
+ * @param tokens The tokens the request needs, prompt and answer together
+ * @return The window, between TOKENS_MIN_WINDOW and TOKENS_MAX_WINDOW; a
+ *         request that needs more gets TOKENS_MAX_WINDOW
+ */
+size_t tokens_window(size_t tokens);
+
+#endif /* TOKENS_H */
@@ -0,0 +1,40 @@
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Get the command that checks the syntax of code in a language
+ *
+ * A validator= line of the config file wins over the built-in commands,
+ * which cover the languages whose toolchains have a syntax-only mode
+ * (python3, cc, c++, node --check, bash -n, ruby -c, php -l, gofmt -e
+ * and a few more). "{}" in the command stands for the file holding
+ * the code; without it the file is added at the end. A validator of "none"
+ * turns the check off.
+ *
+ * @param language The target language
+ * @return The command, or NULL if code in the language is only checked locally
+ */
+const char *validate_command(const char *language);
+
+/**
+ * @brief Check that generated code at least parses
+ *
+ * The language's validator is run on a temporary copy of the code. Brackets
+ * are only checked in-process when there is no validator, or it could not
+ * run: a validator that is not installed never rejects every candidate.
+ *
+ * @param code The extracted code
+ * @param length Length of the code in bytes
+ * @param language The target language
+ * @param verbose Whether to report what the validator did on stderr
+ * @param reason Receives why the code was rejected
+ * @param reason_size Size of the reason buffer
+ * @return true if the code passed, false otherwise
+ */
+bool validate_code(const char *code, size_t length, const char *language, bool verbose, char *reason,
+                   size_t reason_size);
+
+#endif /* VALIDATE_H */
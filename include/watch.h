@@ -0,0 +1,38 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+/**
+ * @brief Extension of the descriptions picked up when a directory is watched
+ */
+#define WATCH_EXTENSION ".eng"
+
+/**
+ * @brief Default quiet time after a change before the input is compiled, in milliseconds
+ */
+#define WATCH_DEFAULT_DEBOUNCE_MS 300
+
+/**
+ * @brief Recompile a description, or every description in a directory, whenever it changes
+ *
+ * Changes are picked up with inotify. A burst of saves is compiled once, when
+ * the input has been quiet for debounce_ms. A change to an input whose
+ * compile is still running cancels that compile at once, and its connection
+ * is closed so the server stops generating. An input whose contents are the
+ * same as at its last compile is not sent again. Outputs are replaced
+ * atomically, so a reader never sees a partial file.
+ *
+ * When input_path is a directory, each *.eng file in it is compiled to
+ * output_path/NAME.EXT, EXT being the usual extension of the language, and
+ * files added later are picked up as well.
+ *
+ * Runs until english_cancel is called, e.g. by Ctrl+C.
+ *
+ * @param input_path The description, or a directory of descriptions
+ * @param output_path The output file, or the output directory for a directory of descriptions
+ * @param target_language The target programming language
+ * @param debounce_ms Quiet time after a change before compiling
+ * @return 0 once stopped, or 1 if the input could not be watched
+ */
+int watch_run(const char *input_path, const char *output_path, const char *target_language, long debounce_ms);
+
+#endif /* WATCH_H */
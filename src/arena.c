@@ -0,0 +1,164 @@
+#include "../include/arena.h"
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Size of the first block; later blocks at least double the previous one
+#define ARENA_MIN_BLOCK (16 * 1024)
+
+// Most memory an idle arena keeps after a reset; a huge compile should not
+// pin its memory in a pooled arena forever
+#define ARENA_RETAIN_LIMIT (4 * 1024 * 1024)
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+// A block of memory; allocations are carved from the front
+typedef struct arena_block {
+    struct arena_block *next;  // Older, full blocks
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+} arena_block_t;
+
+struct arena {
+    arena_block_t *head;  // The block allocations come from
+    void *last;           // Latest allocation, which may grow in place
+    arena_usage_t usage;
+};
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static arena_block_t *new_block(arena_t *arena, size_t size) {
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    arena->usage.heap_allocations++;
+    arena->usage.capacity += size;
+    return block;
+}
+
+arena_t *arena_new(void) {
+    return calloc(1, sizeof(arena_t));
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size_t needed = align_up(size > 0 ? size : 1);
+    arena_block_t *head = arena->head;
+    
+    if (head == NULL || head->size - head->used < needed) {
+        // Grow geometrically, so a request needs O(log n) blocks at most
+        size_t block_size = head != NULL ? head->size * 2 : ARENA_MIN_BLOCK;
+        if (block_size < needed) {
+            block_size = needed;
+        }
+        
+        arena_block_t *block = new_block(arena, block_size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = head;
+        arena->head = head = block;
+    }
+    
+    void *ptr = head->data + head->used;
+    head->used += needed;
+    
+    arena->last = ptr;
+    arena->usage.allocations++;
+    arena->usage.bytes += size;
+    return ptr;
+}
+
+void *arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+    if (new_size <= old_size) {
+        return ptr;
+    }
+    
+    // The latest allocation can simply take more of its block
+    arena_block_t *head = arena->head;
+    if (ptr == arena->last) {
+        size_t needed = align_up(new_size);
+        size_t offset = (unsigned char *)ptr - head->data;
+        if (head->size - offset >= needed) {
+            head->used = offset + needed;
+            arena->usage.allocations++;
+            arena->usage.bytes += new_size - old_size;
+            return ptr;
+        }
+    }
+    
+    void *grown = arena_alloc(arena, new_size);
+    if (grown == NULL) {
+        return NULL;
+    }
+    memcpy(grown, ptr, old_size);
+    return grown;
+}
+
+char *arena_strdup(arena_t *arena, const char *text) {
+    size_t length = strlen(text);
+    char *copy = arena_alloc(arena, length + 1);
+    if (copy != NULL) {
+        memcpy(copy, text, length + 1);
+    }
+    return copy;
+}
+
+void arena_reset(arena_t *arena) {
+    arena_block_t *head = arena->head;
+    size_t capacity = arena->usage.capacity;
+    
+    if (head != NULL && (head->next != NULL || capacity > ARENA_RETAIN_LIMIT)) {
+        // Replace the chain with one block that fits everything it held
+        while (head != NULL) {
+            arena_block_t *next = head->next;
+            free(head);
+            head = next;
+        }
+        arena->head = NULL;
+        arena->usage.capacity = 0;
+        
+        size_t retained = capacity < ARENA_RETAIN_LIMIT ? capacity : ARENA_RETAIN_LIMIT;
+        arena->head = new_block(arena, retained);
+        head = arena->head;
+    }
+    
+    if (head != NULL) {
+        head->used = 0;
+    }
+    arena->last = NULL;
+    
+    size_t retained_capacity = head != NULL ? head->size : 0;
+    memset(&arena->usage, 0, sizeof(arena->usage));
+    arena->usage.capacity = retained_capacity;
+}
+
+void arena_get_usage(const arena_t *arena, arena_usage_t *usage) {
+    *usage = arena->usage;
+}
+
+void arena_free(arena_t *arena) {
+    if (arena == NULL) {
+        return;
+    }
+    
+    arena_block_t *block = arena->head;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
@@ -0,0 +1,328 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/english.h"
+#include "../include/monotonic.h"
+#include "../include/request.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+
+// A list of compiles, linked through the compiles themselves
+typedef struct {
+    english_async_job_t *first;
+    english_async_job_t *last;
+    size_t count;
+} job_list_t;
+
+// One compile in flight on an event loop
+struct english_async_job {
+    english_async_t *async;
+    english_request_t *request;
+    english_done_callback on_done;
+    void *userdata;
+    job_list_t *list;          // Running, or done and waiting for its callback
+    english_async_job_t *previous;
+    english_async_job_t *next;
+};
+
+// The compiles of one event loop, sharing one multi handle
+struct english_async {
+    english_context_t *context;
+    CURLM *multi;
+    english_socket_callback on_socket;
+    english_timer_callback on_timer;
+    void *userdata;
+    job_list_t running;
+    job_list_t done;           // Finished; their callbacks run at the next english_async_timeout
+    double curl_due_ms;        // When CURL wants its timeout handled, negative for never
+    double wake_ms;            // When a compile may next need to hedge or retry, negative for never
+    double reported_ms;        // The deadline the loop was last given, negative for none
+};
+
+// The earlier of two deadlines, where a negative one means never
+static double earliest(double a, double b) {
+    if (a < 0) {
+        return b;
+    }
+    return b < 0 || a < b ? a : b;
+}
+
+static void list_append(job_list_t *list, english_async_job_t *job) {
+    job->list = list;
+    job->previous = list->last;
+    job->next = NULL;
+    if (list->last != NULL) {
+        list->last->next = job;
+    } else {
+        list->first = job;
+    }
+    list->last = job;
+    list->count++;
+}
+
+static void list_remove(english_async_job_t *job) {
+    job_list_t *list = job->list;
+    if (job->previous != NULL) {
+        job->previous->next = job->next;
+    } else {
+        list->first = job->next;
+    }
+    if (job->next != NULL) {
+        job->next->previous = job->previous;
+    } else {
+        list->last = job->previous;
+    }
+    list->count--;
+    job->list = NULL;
+}
+
+// Give the loop the earliest deadline, if it changed; finished compiles are
+// due at once so their callbacks never run inside english_async_compile
+static void update_timer(english_async_t *async) {
+    double now = monotonic_ms();
+    double due = async->done.count > 0 ? now : earliest(async->curl_due_ms, async->wake_ms);
+    if (due == async->reported_ms) {
+        return;
+    }
+    
+    async->reported_ms = due;
+    long timeout = -1;
+    if (due >= 0) {
+        timeout = due > now ? (long)(due - now) + 1 : 0;
+    }
+    async->on_timer(timeout, async->userdata);
+}
+
+// CURL's socket callback: tell the loop which descriptors to watch
+static int socket_callback(CURL *easy, curl_socket_t socket, int what, void *userp, void *socketp) {
+    (void)easy;
+    (void)socketp;
+    english_async_t *async = (english_async_t *)userp;
+    int events = 0;
+    if (what == CURL_POLL_IN || what == CURL_POLL_INOUT) {
+        events |= ENGLISH_ASYNC_READ;
+    }
+    if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) {
+        events |= ENGLISH_ASYNC_WRITE;
+    }
+    async->on_socket((int)socket, events, async->userdata);
+    return 0;
+}
+
+// CURL's timer callback; the loop hears about it once the current call returns
+static int timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+    (void)multi;
+    english_async_t *async = (english_async_t *)userp;
+    async->curl_due_ms = timeout_ms >= 0 ? monotonic_ms() + timeout_ms : -1;
+    return 0;
+}
+
+// Move a compile that needs nothing more from the network to the done list
+static void mark_done(english_async_job_t *job) {
+    list_remove(job);
+    list_append(&job->async->done, job);
+}
+
+// Let a running compile hedge, retry or give up, and note when it next needs to
+static void poll_job(english_async_job_t *job) {
+    long next;
+    if (request_poll(job->request, &next)) {
+        mark_done(job);
+    } else if (next >= 0) {
+        job->async->wake_ms = earliest(job->async->wake_ms, monotonic_ms() + next);
+    }
+}
+
+// Hand finished transfers back to their compiles
+static void read_messages(english_async_t *async) {
+    CURLMsg *message;
+    int queued;
+    while ((message = curl_multi_info_read(async->multi, &queued)) != NULL) {
+        if (message->msg != CURLMSG_DONE) {
+            continue;
+        }
+        english_async_job_t *job = NULL;
+        curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char **)&job);
+        if (request_complete_transfer(job->request, message->easy_handle, message->data.result)) {
+            mark_done(job);
+        } else {
+            poll_job(job);
+        }
+    }
+}
+
+// Run the callbacks of finished compiles; a callback may start or cancel others
+static void finish_done(english_async_t *async) {
+    english_async_job_t *job;
+    while ((job = async->done.first) != NULL) {
+        list_remove(job);
+        
+        size_t length = 0;
+        char *code = NULL;
+        if (request_finish(job->request)) {
+            code = request_take_output(job->request, &length);
+        }
+        request_free(job->request);
+        job->request = NULL;
+        
+        if (job->on_done != NULL) {
+            job->on_done(job, code, length, job->userdata);
+        } else {
+            free(code);
+        }
+        free(job);
+    }
+}
+
+english_async_t *english_async_new(english_context_t *context, english_socket_callback on_socket,
+                                   english_timer_callback on_timer, void *userdata) {
+    if (context == NULL || on_socket == NULL || on_timer == NULL) {
+        return NULL;
+    }
+    
+    english_async_t *async = calloc(1, sizeof(english_async_t));
+    if (async == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    async->context = context;
+    async->on_socket = on_socket;
+    async->on_timer = on_timer;
+    async->userdata = userdata;
+    async->curl_due_ms = -1;
+    async->wake_ms = -1;
+    async->reported_ms = -1;
+    
+    async->multi = curl_multi_init();
+    if (async->multi == NULL) {
+        fprintf(stderr, "Error: Could not initialize CURL\n");
+        free(async);
+        return NULL;
+    }
+    curl_multi_setopt(async->multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(async->multi, CURLMOPT_SOCKETDATA, (void *)async);
+    curl_multi_setopt(async->multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+    curl_multi_setopt(async->multi, CURLMOPT_TIMERDATA, (void *)async);
+    return async;
+}
+
+english_async_job_t *english_async_compile(english_async_t *async, const char *english_text,
+                                           const char *target_language, english_stream_callback on_chunk,
+                                           english_done_callback on_done, void *userdata) {
+    if (async == NULL || english_text == NULL || target_language == NULL) {
+        return NULL;
+    }
+    
+    english_async_job_t *job = calloc(1, sizeof(english_async_job_t));
+    if (job == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    job->async = async;
+    job->on_done = on_done;
+    job->userdata = userdata;
+    job->request = request_new(async->context, english_text, target_language, on_chunk, userdata);
+    if (job->request == NULL) {
+        free(job);
+        return NULL;
+    }
+    
+    // A cached compile, or one that could not even start, finishes at the
+    // next timeout without touching the network
+    list_append(&async->running, job);
+    if (request_is_cached(job->request) || !request_start(job->request, async->multi, (void *)job)) {
+        mark_done(job);
+    } else {
+        poll_job(job);
+    }
+    
+    update_timer(async);
+    return job;
+}
+
+void english_async_cancel(english_async_job_t *job) {
+    if (job == NULL || job->list == NULL) {
+        return;
+    }
+    
+    // Its transfers are removed from the multi handle and their connections closed
+    english_async_t *async = job->async;
+    list_remove(job);
+    request_free(job->request);
+    free(job);
+    update_timer(async);
+}
+
+void english_async_socket_ready(english_async_t *async, int fd, int events) {
+    int mask = 0;
+    if (events & ENGLISH_ASYNC_READ) {
+        mask |= CURL_CSELECT_IN;
+    }
+    if (events & ENGLISH_ASYNC_WRITE) {
+        mask |= CURL_CSELECT_OUT;
+    }
+    if (events & ENGLISH_ASYNC_ERROR) {
+        mask |= CURL_CSELECT_ERR;
+    }
+    
+    int running;
+    curl_multi_socket_action(async->multi, (curl_socket_t)fd, mask, &running);
+    read_messages(async);
+    update_timer(async);
+}
+
+void english_async_timeout(english_async_t *async) {
+    double now = monotonic_ms();
+    
+    // CURL's own timeouts: connects, deadlines, and work it left for later
+    if (async->curl_due_ms >= 0 && now >= async->curl_due_ms) {
+        int running;
+        async->curl_due_ms = -1;
+        curl_multi_socket_action(async->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+        read_messages(async);
+    }
+    
+    // Hedges and retries; the earliest of them sets the next wake-up
+    if (async->wake_ms >= 0 && now >= async->wake_ms) {
+        async->wake_ms = -1;
+        english_async_job_t *job = async->running.first;
+        while (job != NULL) {
+            english_async_job_t *next = job->next;
+            poll_job(job);
+            job = next;
+        }
+        read_messages(async);
+    }
+    
+    finish_done(async);
+    update_timer(async);
+}
+
+size_t english_async_pending(const english_async_t *async) {
+    return async->running.count + async->done.count;
+}
+
+void english_async_free(english_async_t *async) {
+    if (async == NULL) {
+        return;
+    }
+    
+    // Outstanding compiles are cancelled without their callbacks
+    while (async->running.first != NULL) {
+        english_async_job_t *job = async->running.first;
+        list_remove(job);
+        request_free(job->request);
+        free(job);
+    }
+    while (async->done.first != NULL) {
+        english_async_job_t *job = async->done.first;
+        list_remove(job);
+        request_free(job->request);
+        free(job);
+    }
+    
+    curl_multi_cleanup(async->multi);
+    free(async);
+}
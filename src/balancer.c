@@ -0,0 +1,323 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/balancer.h"
+#include "../include/monotonic.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Endpoints a balancer remembers: those configured, plus retired ones that
+// transfers in flight may still hold
+#define MAX_SLOTS (BALANCER_MAX_ENDPOINTS * 2)
+
+// Times to first byte kept for the hedging percentile, and how many are
+// needed before hedging starts
+#define LATENCY_SAMPLES 256
+#define MIN_HEDGE_SAMPLES 20
+
+// An endpoint that fails sits out for 1s, doubling with each further failure
+#define COOLDOWN_BASE_MS 1000.0
+#define COOLDOWN_MAX_MS 30000.0
+
+// Weight of the newest latency in an endpoint's moving average
+#define LATENCY_EWMA_WEIGHT 0.2
+
+typedef struct {
+    char url[BALANCER_MAX_URL_LENGTH];
+    bool retired;             // No longer configured; kept until nothing holds it
+    int position;             // Where it appears in the configured list
+    int in_flight;
+    double latency_ms;        // Moving average of the time to first byte, 0 until measured
+    int failures;             // Consecutive failures
+    double down_until_ms;     // Out of rotation until then
+} endpoint_t;
+
+#define DEFAULT_HEDGE_PERCENTILE 95.0
+
+struct balancer {
+    pthread_mutex_t lock;
+    endpoint_t endpoints[MAX_SLOTS];   // Never moved, since transfers hold their index
+    size_t endpoint_count;             // Slots in use, retired ones included
+    size_t active_count;               // Configured endpoints
+    double samples[LATENCY_SAMPLES];  // Recent times to first byte across all endpoints
+    size_t sample_count;
+    size_t sample_next;
+    double hedge_percentile;
+};
+
+// The endpoints of english_set_ollama_endpoint, used by every context without its own
+static balancer_t default_balancer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .hedge_percentile = DEFAULT_HEDGE_PERCENTILE
+};
+
+balancer_t *balancer_new(void) {
+    balancer_t *balancer = calloc(1, sizeof(balancer_t));
+    if (balancer == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    pthread_mutex_init(&balancer->lock, NULL);
+    balancer->hedge_percentile = DEFAULT_HEDGE_PERCENTILE;
+    return balancer;
+}
+
+void balancer_free(balancer_t *balancer) {
+    if (balancer == NULL || balancer == &default_balancer) {
+        return;
+    }
+    pthread_mutex_destroy(&balancer->lock);
+    free(balancer);
+}
+
+balancer_t *balancer_get_default(void) {
+    return &default_balancer;
+}
+
+// The slot of url, or -1; call with the lock held
+static int find_endpoint(const balancer_t *balancer, const char *url) {
+    for (size_t i = 0; i < balancer->endpoint_count; i++) {
+        if (strcmp(balancer->endpoints[i].url, url) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Whether the configured endpoints are exactly urls, in order; call with the lock held
+static bool same_endpoints(const balancer_t *balancer, char urls[][BALANCER_MAX_URL_LENGTH], size_t count) {
+    if (balancer->active_count != count) {
+        return false;
+    }
+    for (size_t i = 0; i < balancer->endpoint_count; i++) {
+        const endpoint_t *endpoint = &balancer->endpoints[i];
+        if (!endpoint->retired && strcmp(endpoint->url, urls[endpoint->position]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A slot for a new endpoint: a fresh one, or a retired one nothing holds any
+// more; -1 if every slot is taken. Call with the lock held.
+static int free_slot(balancer_t *balancer) {
+    if (balancer->endpoint_count < MAX_SLOTS) {
+        return (int)balancer->endpoint_count++;
+    }
+    for (size_t i = 0; i < balancer->endpoint_count; i++) {
+        if (balancer->endpoints[i].retired && balancer->endpoints[i].in_flight == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+bool balancer_set_endpoints(balancer_t *balancer, const char *list) {
+    if (list == NULL) {
+        return false;
+    }
+    
+    char urls[BALANCER_MAX_ENDPOINTS][BALANCER_MAX_URL_LENGTH];
+    size_t count = 0;
+    const char *p = list;
+    while (*p != '\0' && count < BALANCER_MAX_ENDPOINTS) {
+        size_t length = strcspn(p, ",");
+        const char *start = p;
+        const char *end = p + length;
+        while (start < end && (*start == ' ' || *start == '\t')) {
+            start++;
+        }
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+        
+        if (end > start && (size_t)(end - start) < BALANCER_MAX_URL_LENGTH) {
+            memcpy(urls[count], start, end - start);
+            urls[count][end - start] = '\0';
+            count++;
+        }
+        
+        p += length;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    
+    if (count == 0) {
+        return false;
+    }
+    
+    pthread_mutex_lock(&balancer->lock);
+    if (same_endpoints(balancer, urls, count)) {
+        pthread_mutex_unlock(&balancer->lock);
+        return true;
+    }
+    
+    // Everything is retired, then what is listed comes back; an endpoint that
+    // stays keeps its slot and what was learned about it
+    for (size_t i = 0; i < balancer->endpoint_count; i++) {
+        balancer->endpoints[i].retired = true;
+    }
+    size_t active = 0;
+    for (size_t i = 0; i < count; i++) {
+        int slot = find_endpoint(balancer, urls[i]);
+        if (slot >= 0 && !balancer->endpoints[slot].retired) {
+            continue;
+        }
+        if (slot < 0) {
+            slot = free_slot(balancer);
+            if (slot < 0) {
+                fprintf(stderr, "Error: Too many endpoints still in use, leaving out %s\n", urls[i]);
+                continue;
+            }
+            memset(&balancer->endpoints[slot], 0, sizeof(endpoint_t));
+            memcpy(balancer->endpoints[slot].url, urls[i], sizeof(urls[i]));
+        }
+        balancer->endpoints[slot].retired = false;
+        balancer->endpoints[slot].position = (int)active++;
+    }
+    balancer->active_count = active;
+    pthread_mutex_unlock(&balancer->lock);
+    return active > 0;
+}
+
+size_t balancer_count(balancer_t *balancer) {
+    pthread_mutex_lock(&balancer->lock);
+    size_t count = balancer->active_count;
+    pthread_mutex_unlock(&balancer->lock);
+    return count;
+}
+
+size_t balancer_list(balancer_t *balancer, int *indexes) {
+    pthread_mutex_lock(&balancer->lock);
+    size_t count = balancer->active_count;
+    for (size_t i = 0; i < balancer->endpoint_count; i++) {
+        if (!balancer->endpoints[i].retired) {
+            indexes[balancer->endpoints[i].position] = (int)i;
+        }
+    }
+    pthread_mutex_unlock(&balancer->lock);
+    return count;
+}
+
+int balancer_acquire(balancer_t *balancer, int exclude) {
+    double now = monotonic_ms();
+    int best = -1;
+    int fallback = -1;
+    
+    endpoint_t *endpoints = balancer->endpoints;
+    pthread_mutex_lock(&balancer->lock);
+    for (size_t i = 0; i < balancer->endpoint_count; i++) {
+        endpoint_t *endpoint = &endpoints[i];
+        if ((int)i == exclude || endpoint->retired) {
+            continue;
+        }
+        
+        // Out of rotation: only remembered in case nothing else is available
+        if (endpoint->down_until_ms > now) {
+            if (fallback < 0 || endpoint->down_until_ms < endpoints[fallback].down_until_ms) {
+                fallback = (int)i;
+            }
+            continue;
+        }
+        
+        // Ties go to the endpoint listed first
+        if (best < 0 || endpoint->in_flight < endpoints[best].in_flight ||
+            (endpoint->in_flight == endpoints[best].in_flight &&
+             (endpoint->latency_ms < endpoints[best].latency_ms ||
+              (endpoint->latency_ms == endpoints[best].latency_ms && endpoint->position < endpoints[best].position)))) {
+            best = (int)i;
+        }
+    }
+    
+    if (best < 0) {
+        best = fallback;
+    }
+    if (best >= 0) {
+        endpoints[best].in_flight++;
+    }
+    pthread_mutex_unlock(&balancer->lock);
+    return best;
+}
+
+const char *balancer_url(balancer_t *balancer, int index, char *url) {
+    // A retired slot may be handed to a new endpoint once nothing holds it
+    pthread_mutex_lock(&balancer->lock);
+    if (index >= 0 && (size_t)index < balancer->endpoint_count) {
+        memcpy(url, balancer->endpoints[index].url, BALANCER_MAX_URL_LENGTH);
+    } else {
+        url[0] = '\0';
+    }
+    pthread_mutex_unlock(&balancer->lock);
+    return url;
+}
+
+void balancer_release(balancer_t *balancer, int index, balancer_outcome_t outcome, double first_byte_ms) {
+    pthread_mutex_lock(&balancer->lock);
+    if (index < 0 || (size_t)index >= balancer->endpoint_count) {
+        pthread_mutex_unlock(&balancer->lock);
+        return;
+    }
+    
+    endpoint_t *endpoint = &balancer->endpoints[index];
+    if (endpoint->in_flight > 0) {
+        endpoint->in_flight--;
+    }
+    
+    if (outcome == BALANCER_SUCCESS) {
+        endpoint->failures = 0;
+        endpoint->down_until_ms = 0;
+        endpoint->latency_ms = endpoint->latency_ms > 0 ?
+                               endpoint->latency_ms + LATENCY_EWMA_WEIGHT * (first_byte_ms - endpoint->latency_ms) :
+                               first_byte_ms;
+        
+        balancer->samples[balancer->sample_next] = first_byte_ms;
+        balancer->sample_next = (balancer->sample_next + 1) % LATENCY_SAMPLES;
+        if (balancer->sample_count < LATENCY_SAMPLES) {
+            balancer->sample_count++;
+        }
+    } else if (outcome == BALANCER_FAILURE) {
+        // Take the endpoint out of rotation, for longer after each failure in a row
+        double cooldown = COOLDOWN_BASE_MS;
+        for (int i = 0; i < endpoint->failures && cooldown < COOLDOWN_MAX_MS; i++) {
+            cooldown *= 2;
+        }
+        endpoint->failures++;
+        endpoint->down_until_ms = monotonic_ms() + (cooldown < COOLDOWN_MAX_MS ? cooldown : COOLDOWN_MAX_MS);
+    }
+    pthread_mutex_unlock(&balancer->lock);
+}
+
+void balancer_set_hedge_percentile(balancer_t *balancer, double percentile) {
+    pthread_mutex_lock(&balancer->lock);
+    balancer->hedge_percentile = percentile;
+    pthread_mutex_unlock(&balancer->lock);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double balancer_hedge_delay_ms(balancer_t *balancer) {
+    double sorted[LATENCY_SAMPLES];
+    size_t count;
+    double percentile;
+    
+    pthread_mutex_lock(&balancer->lock);
+    count = balancer->sample_count;
+    percentile = balancer->hedge_percentile;
+    if (balancer->active_count < 2 || percentile <= 0 || count < MIN_HEDGE_SAMPLES) {
+        pthread_mutex_unlock(&balancer->lock);
+        return -1;
+    }
+    memcpy(sorted, balancer->samples, count * sizeof(double));
+    pthread_mutex_unlock(&balancer->lock);
+    
+    qsort(sorted, count, sizeof(double), compare_doubles);
+    size_t rank = (size_t)(percentile / 100.0 * count);
+    return sorted[rank < count ? rank : count - 1];
+}
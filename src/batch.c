@@ -0,0 +1,434 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/batch.h"
+#include "../include/english.h"
+#include "../include/context.h"
+#include "../include/driver.h"
+#include "../include/fence.h"
+#include "../include/input.h"
+#include "../include/json.h"
+#include "../include/monotonic.h"
+#include "../include/request.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MAX_ERROR_LENGTH 256
+
+// One compile job from the job file
+typedef struct {
+    int line;                      // Line number in the job file, or 0 for a target of a fan-out
+    input_t input;                 // English description, mapped from a file or copied inline
+    const char *text;              // Description to compile: the job's input, or shared by a fan-out
+    char *language;                // Target language
+    char *output;                  // Output path
+    english_request_t *request;    // In-flight request, if any
+    double started_ms;             // Start time, in milliseconds
+    double seconds;                // Wall time of the request
+    bool done;
+    bool success;
+    bool report;                   // Print the job's status as soon as it finishes
+    char error[MAX_ERROR_LENGTH];  // Why the job failed
+} batch_job_t;
+
+// Read a whole file into a NUL-terminated heap buffer
+static char *read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    
+    size_t size = 0;
+    size_t capacity = 4096;
+    char *data = malloc(capacity);
+    while (data != NULL) {
+        size += fread(data + size, 1, capacity - size - 1, file);
+        if (size < capacity - 1) {
+            break;
+        }
+        capacity *= 2;
+        char *grown = realloc(data, capacity);
+        if (grown == NULL) {
+            free(data);
+            data = NULL;
+        } else {
+            data = grown;
+        }
+    }
+    
+    if (data != NULL) {
+        data[size] = '\0';
+    }
+    fclose(file);
+    return data;
+}
+
+// The string members a job object may have
+enum { JOB_LANGUAGE, JOB_OUTPUT, JOB_INPUT, JOB_TEXT, JOB_FIELDS };
+static const char *const job_keys[JOB_FIELDS] = { "language", "output", "input", "text" };
+
+// The string members of a job object as they are decoded, on the heap
+typedef struct {
+    char *values[JOB_FIELDS];  // NULL for a member the job does not have
+    size_t lengths[JOB_FIELDS];
+    int objects;
+} job_fields_t;
+
+// Keep the pieces of a job's string members
+static bool read_job_field(const json_value_t *value, void *userdata) {
+    job_fields_t *fields = (job_fields_t *)userdata;
+    if (value->kind == JSON_END_OBJECT && value->depth == 0) {
+        fields->objects++;
+    }
+    if (value->kind != JSON_STRING || value->depth != 1) {
+        return true;
+    }
+    
+    for (int i = 0; i < JOB_FIELDS; i++) {
+        if (!json_is_key(value, job_keys[i])) {
+            continue;
+        }
+        
+        // A repeated member replaces the earlier one
+        if (value->first) {
+            free(fields->values[i]);
+            fields->values[i] = NULL;
+            fields->lengths[i] = 0;
+        }
+        char *grown = realloc(fields->values[i], fields->lengths[i] + value->length + 1);
+        if (grown == NULL) {
+            return false;
+        }
+        memcpy(grown + fields->lengths[i], value->data, value->length);
+        fields->lengths[i] += value->length;
+        grown[fields->lengths[i]] = '\0';
+        fields->values[i] = grown;
+        break;
+    }
+    return true;
+}
+
+// Print a job's line of the summary
+static void print_job(const batch_job_t *job) {
+    char where[32] = "";
+    if (job->line > 0) {
+        snprintf(where, sizeof(where), "line %-4d ", job->line);
+    }
+    
+    if (job->success) {
+        printf("[ok]     %s%-12s %s (%.2fs)\n", where, job->language, job->output, job->seconds);
+    } else {
+        printf("[failed] %s%-12s %s: %s\n", where,
+               job->language != NULL ? job->language : "-",
+               job->output != NULL ? job->output : "-", job->error);
+    }
+}
+
+// Mark a job as finished with an error message
+static void fail_job(batch_job_t *job, const char *message) {
+    job->done = true;
+    job->success = false;
+    snprintf(job->error, sizeof(job->error), "%s", message);
+    if (job->report) {
+        print_job(job);
+        fflush(stdout);
+    }
+}
+
+// Fill in a job from one line of the job file
+static void parse_job(batch_job_t *job, const char *line) {
+    job_fields_t fields;
+    memset(&fields, 0, sizeof(fields));
+    if (!json_decode(line, strlen(line), read_job_field, &fields) || fields.objects != 1) {
+        fail_job(job, "invalid JSON");
+    } else if (fields.values[JOB_LANGUAGE] == NULL || fields.values[JOB_OUTPUT] == NULL) {
+        fail_job(job, "missing \"language\" or \"output\"");
+    } else if ((fields.values[JOB_INPUT] == NULL) == (fields.values[JOB_TEXT] == NULL)) {
+        fail_job(job, "exactly one of \"input\" or \"text\" is required");
+    } else {
+        // The job takes over the decoded strings
+        job->language = fields.values[JOB_LANGUAGE];
+        job->output = fields.values[JOB_OUTPUT];
+        fields.values[JOB_LANGUAGE] = NULL;
+        fields.values[JOB_OUTPUT] = NULL;
+        if (fields.values[JOB_INPUT] != NULL) {
+            if (!input_open(fields.values[JOB_INPUT], &job->input)) {
+                char message[MAX_ERROR_LENGTH];
+                snprintf(message, sizeof(message), "could not read input file %s", fields.values[JOB_INPUT]);
+                fail_job(job, message);
+            }
+        } else {
+            job->input.data = fields.values[JOB_TEXT];
+            job->input.size = fields.lengths[JOB_TEXT];
+            fields.values[JOB_TEXT] = NULL;
+        }
+        job->text = job->input.data;
+    }
+    
+    for (int i = 0; i < JOB_FIELDS; i++) {
+        free(fields.values[i]);
+    }
+}
+
+// Load every non-blank line of the job file
+static batch_job_t *load_jobs(const char *jobs_file, size_t *count) {
+    char *contents = read_file(jobs_file);
+    if (contents == NULL) {
+        fprintf(stderr, "Error: Could not read job file %s\n", jobs_file);
+        return NULL;
+    }
+    
+    size_t capacity = 16;
+    batch_job_t *jobs = calloc(capacity, sizeof(batch_job_t));
+    *count = 0;
+    
+    int line_number = 0;
+    char *line = contents;
+    while (jobs != NULL && line != NULL && *line != '\0') {
+        char *newline = strchr(line, '\n');
+        if (newline != NULL) {
+            *newline = '\0';
+        }
+        line_number++;
+        
+        // Skip blank lines
+        if (line[strspn(line, " \t\r")] != '\0') {
+            if (*count == capacity) {
+                capacity *= 2;
+                batch_job_t *grown = realloc(jobs, capacity * sizeof(batch_job_t));
+                if (grown == NULL) {
+                    break;
+                }
+                jobs = grown;
+                memset(jobs + *count, 0, (capacity - *count) * sizeof(batch_job_t));
+            }
+            
+            batch_job_t *job = &jobs[(*count)++];
+            job->line = line_number;
+            parse_job(job, line);
+        }
+        
+        line = newline != NULL ? newline + 1 : NULL;
+    }
+    
+    free(contents);
+    if (jobs == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+    }
+    return jobs;
+}
+
+// Write a finished job's code to its output file
+static void complete_job(batch_job_t *job) {
+    job->done = true;
+    job->seconds = (monotonic_ms() - job->started_ms) / 1000;
+    job->success = request_finish(job->request);
+    
+    if (!job->success) {
+        snprintf(job->error, sizeof(job->error), english_is_cancelled() ? "cancelled" : "compilation failed");
+    } else {
+        FILE *output_fp = fopen(job->output, "w");
+        if (output_fp == NULL) {
+            job->success = false;
+            snprintf(job->error, sizeof(job->error), "could not open output file %s", job->output);
+        } else {
+            fwrite(request_get_output(job->request), 1, request_get_output_length(job->request), output_fp);
+            fputc('\n', output_fp);
+            fclose(output_fp);
+        }
+    }
+    
+    request_free(job->request);
+    job->request = NULL;
+    
+    if (english_is_verbose() && job->line > 0) {
+        fprintf(stderr, "Verbose mode: Job on line %d %s after %.2fs\n",
+                job->line, job->success ? "succeeded" : "failed", job->seconds);
+    }
+    if (job->report) {
+        print_job(job);
+        fflush(stdout);
+    }
+}
+
+// Start a job; returns true if it is in flight
+static bool start_job(batch_job_t *job, driver_t *driver) {
+    job->started_ms = monotonic_ms();
+    job->request = request_new(context_get_default(), job->text, job->language, NULL, NULL);
+    if (job->request == NULL) {
+        fail_job(job, "could not create request");
+        return false;
+    }
+    
+    // Cached results complete without a transfer
+    if (request_is_cached(job->request)) {
+        complete_job(job);
+        return false;
+    }
+    
+    if (!driver_start(driver, job->request, job)) {
+        complete_job(job);
+        return false;
+    }
+    return true;
+}
+
+int batch_default_parallel(void) {
+    const char *env = getenv("OLLAMA_NUM_PARALLEL");
+    int parallel = env != NULL ? atoi(env) : 0;
+    return parallel > 0 ? parallel : BATCH_DEFAULT_PARALLEL;
+}
+
+// Run jobs through one multi handle with at most max_parallel requests in
+// flight; returns false if CURL could not be initialized
+static bool run_jobs(batch_job_t *jobs, size_t count, int max_parallel) {
+    driver_t *driver = driver_new(max_parallel);
+    if (driver == NULL) {
+        return false;
+    }
+    
+    size_t next = 0;
+    for (;;) {
+        // Top up to the concurrency limit; freed slots are refilled before
+        // waiting for more network activity
+        while (driver_has_room(driver) && next < count) {
+            batch_job_t *job = &jobs[next++];
+            if (!job->done) {
+                start_job(job, driver);
+            }
+        }
+        
+        batch_job_t *job = driver_next(driver);
+        if (job == NULL) {
+            break;
+        }
+        complete_job(job);
+    }
+    
+    driver_free(driver);
+    return true;
+}
+
+// Release what the jobs own
+static void free_jobs(batch_job_t *jobs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        input_close(&jobs[i].input);
+        free(jobs[i].language);
+        free(jobs[i].output);
+    }
+    free(jobs);
+}
+
+int batch_run(const char *jobs_file, int max_parallel) {
+    size_t count = 0;
+    batch_job_t *jobs = load_jobs(jobs_file, &count);
+    if (jobs == NULL) {
+        return -1;
+    }
+    
+    if (max_parallel < 1) {
+        max_parallel = 1;
+    }
+    
+    double started_ms = monotonic_ms();
+    if (!run_jobs(jobs, count, max_parallel)) {
+        free_jobs(jobs, count);
+        return -1;
+    }
+    
+    // Print the per-job summary
+    int failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!jobs[i].success) {
+            failed++;
+        }
+        print_job(&jobs[i]);
+    }
+    printf("%zu jobs, %zu succeeded, %d failed in %.2fs (up to %d in flight)\n",
+           count, count - failed, failed, (monotonic_ms() - started_ms) / 1000, max_parallel);
+    
+    free_jobs(jobs, count);
+    return failed;
+}
+
+int batch_fan_out(const char *text, const char *languages, const char *output_dir, const char *name) {
+    if (mkdir(output_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create directory %s\n", output_dir);
+        return -1;
+    }
+    
+    // One job per language of the comma-separated list, all sharing the text
+    size_t capacity = 1;
+    for (const char *p = languages; *p != '\0'; p++) {
+        capacity += *p == ',';
+    }
+    batch_job_t *jobs = calloc(capacity, sizeof(batch_job_t));
+    if (jobs == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+    
+    size_t count = 0;
+    const char *p = languages;
+    while (*p != '\0') {
+        size_t length = strcspn(p, ",");
+        const char *start = p;
+        const char *end = p + length;
+        while (start < end && (*start == ' ' || *start == '\t')) {
+            start++;
+        }
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+        
+        if (end > start) {
+            batch_job_t *job = &jobs[count++];
+            job->text = text;
+            job->report = true;
+            job->language = strndup(start, end - start);
+            
+            const char *extension = fence_file_extension(start, end - start);
+            size_t path_length = strlen(output_dir) + strlen(name) + strlen(extension) + 3;
+            job->output = malloc(path_length);
+            if (job->language == NULL || job->output == NULL) {
+                fail_job(job, "out of memory");
+            } else {
+                snprintf(job->output, path_length, "%s/%s.%s", output_dir, name, extension);
+                for (size_t i = 0; i + 1 < count; i++) {
+                    // A target that ran out of memory has no output to clash with
+                    if (jobs[i].output != NULL && strcmp(jobs[i].output, job->output) == 0) {
+                        fail_job(job, "another target writes the same file");
+                        break;
+                    }
+                }
+            }
+        }
+        
+        p += length;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    
+    // Every target is in flight at once, so the wall time is that of the slowest
+    double started_ms = monotonic_ms();
+    if (!run_jobs(jobs, count, (int)count)) {
+        free_jobs(jobs, count);
+        return -1;
+    }
+    
+    int failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!jobs[i].success) {
+            failed++;
+        }
+    }
+    printf("%zu targets, %zu succeeded, %d failed in %.2fs\n",
+           count, count - failed, failed, (monotonic_ms() - started_ms) / 1000);
+    
+    free_jobs(jobs, count);
+    return failed;
+}
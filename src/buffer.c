@@ -0,0 +1,28 @@
+#include "../include/buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool buffer_append(buffer_t *buffer, const void *data, size_t length) {
+    if (buffer->size + length + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+        while (capacity < buffer->size + length + 1) {
+            capacity *= 2;
+        }
+        char *grown = realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            return false;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+    buffer->data[buffer->size] = '\0';
+    return true;
+}
+
+bool buffer_append_string(buffer_t *buffer, const char *text) {
+    return buffer_append(buffer, text, strlen(text));
+}
@@ -0,0 +1,966 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/build.h"
+#include "../include/english.h"
+#include "../include/buffer.h"
+#include "../include/config.h"
+#include "../include/context.h"
+#include "../include/driver.h"
+#include "../include/input.h"
+#include "../include/json.h"
+#include "../include/monotonic.h"
+#include "../include/request.h"
+#include "../include/router.h"
+#include "../include/sha256.h"
+#include "../include/tokens.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_PATH_LENGTH 1024
+#define MAX_ERROR_LENGTH 256
+#define MAX_HINT_LENGTH 64
+#define HASH_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+
+// Where a target is in the build
+typedef enum {
+    TARGET_PENDING,                // Waiting for its dependencies, or for a free slot
+    TARGET_RUNNING,
+    TARGET_BUILT,
+    TARGET_UP_TO_DATE,
+    TARGET_FAILED,
+    TARGET_SKIPPED                 // Not built, since a dependency was not
+} target_status_t;
+
+// One target of the project
+typedef struct {
+    char *name;
+    char *input;                   // Path of the description
+    char *language;
+    char *output;                  // Path of the generated code
+    char *output_name;             // The same path as the project file gives it, for prompts
+    char **depends;                // Names of its dependencies, as the project file gives them
+    size_t depend_count;
+    size_t *dependencies;          // Indices of its dependencies, without repeats
+    size_t dependency_count;
+    size_t *dependents;            // Indices of the targets that depend on it
+    size_t dependent_count;
+    size_t waiting;                // Dependencies not done yet
+    size_t priority;               // Estimated tokens to generate on the longest chain starting at it
+    bool wanted;                   // Part of this build
+    target_status_t status;
+    char hash[HASH_HEX_SIZE];      // Of everything its compile depends on
+    char output_hash[HASH_HEX_SIZE];  // Of its output, once built or up to date
+    english_request_t *request;    // The compile in flight, if any
+    double started_ms;
+    double seconds;
+    bool cached;                   // Its code came from the compile cache
+    char error[MAX_ERROR_LENGTH];  // Why it failed or was skipped
+} build_target_t;
+
+// What the state file remembers of a target's last build
+typedef struct {
+    char *name;
+    char hash[HASH_HEX_SIZE];
+    char output_hash[HASH_HEX_SIZE];
+} state_entry_t;
+
+// A project being built
+typedef struct {
+    build_target_t *targets;       // Not moved once the build runs, since they are CURLOPT_PRIVATE of their transfers
+    size_t count;
+    state_entry_t *entries;
+    size_t entry_count;
+    bool force;
+} build_t;
+
+// Append a piece of a decoded string to a heap string; the first piece replaces what was there
+static bool append_piece(char **value, size_t *length, const json_value_t *piece) {
+    if (piece->first) {
+        free(*value);
+        *value = NULL;
+        *length = 0;
+    }
+    char *grown = realloc(*value, *length + piece->length + 1);
+    if (grown == NULL) {
+        return false;
+    }
+    memcpy(grown + *length, piece->data, piece->length);
+    *length += piece->length;
+    grown[*length] = '\0';
+    *value = grown;
+    return true;
+}
+
+// The string members a target object may have
+enum { FIELD_NAME, FIELD_INPUT, FIELD_LANGUAGE, FIELD_OUTPUT, FIELDS };
+static const char *const field_keys[FIELDS] = { "name", "input", "language", "output" };
+
+// The project file as it is decoded
+typedef struct {
+    build_target_t *targets;
+    size_t count;
+    size_t capacity;
+    char *language;                // Default language of the targets
+    size_t language_length;
+    char *fields[FIELDS];          // String members of the target being read, NULL for those it lacks
+    size_t lengths[FIELDS];
+    char **depends;                // Its dependencies
+    size_t depend_count;
+    size_t depend_length;
+    bool in_depends;
+} project_reader_t;
+
+// Release what a target owns
+static void free_target(build_target_t *target) {
+    free(target->name);
+    free(target->input);
+    free(target->language);
+    free(target->output);
+    free(target->output_name);
+    for (size_t i = 0; i < target->depend_count; i++) {
+        free(target->depends[i]);
+    }
+    free(target->depends);
+    free(target->dependencies);
+    free(target->dependents);
+    request_free(target->request);
+}
+
+// Keep the target object just read
+static bool add_target(project_reader_t *reader) {
+    if (reader->count == reader->capacity) {
+        size_t capacity = reader->capacity > 0 ? reader->capacity * 2 : 16;
+        build_target_t *targets = realloc(reader->targets, capacity * sizeof(build_target_t));
+        if (targets == NULL) {
+            return false;
+        }
+        reader->targets = targets;
+        reader->capacity = capacity;
+    }
+    
+    // The target takes over the decoded strings
+    build_target_t *target = &reader->targets[reader->count++];
+    memset(target, 0, sizeof(build_target_t));
+    target->name = reader->fields[FIELD_NAME];
+    target->input = reader->fields[FIELD_INPUT];
+    target->language = reader->fields[FIELD_LANGUAGE];
+    target->output = reader->fields[FIELD_OUTPUT];
+    target->depends = reader->depends;
+    target->depend_count = reader->depend_count;
+    memset(reader->fields, 0, sizeof(reader->fields));
+    reader->depends = NULL;
+    reader->depend_count = 0;
+    return true;
+}
+
+// Collect the targets of the project file as they are decoded
+static bool read_project(const json_value_t *value, void *userdata) {
+    project_reader_t *reader = (project_reader_t *)userdata;
+    bool in_targets = strcmp(value->top_key, "targets") == 0;
+    
+    if (value->depth == 1 && value->kind == JSON_STRING && json_is_key(value, "language")) {
+        return append_piece(&reader->language, &reader->language_length, value);
+    }
+    if (!in_targets) {
+        return true;
+    }
+    
+    if (value->depth == 2 && value->kind == JSON_END_OBJECT) {
+        return add_target(reader);
+    }
+    if (value->depth == 3 && value->kind == JSON_STRING) {
+        for (int i = 0; i < FIELDS; i++) {
+            if (json_is_key(value, field_keys[i])) {
+                return append_piece(&reader->fields[i], &reader->lengths[i], value);
+            }
+        }
+    } else if (value->depth == 3 && (value->kind == JSON_BEGIN_ARRAY || value->kind == JSON_END_ARRAY)) {
+        reader->in_depends = value->kind == JSON_BEGIN_ARRAY && json_is_key(value, "depends");
+    } else if (value->depth == 4 && value->kind == JSON_STRING && reader->in_depends) {
+        if (value->first) {
+            char **depends = realloc(reader->depends, (reader->depend_count + 1) * sizeof(char *));
+            if (depends == NULL) {
+                return false;
+            }
+            reader->depends = depends;
+            reader->depends[reader->depend_count++] = NULL;
+        }
+        return append_piece(&reader->depends[reader->depend_count - 1], &reader->depend_length, value);
+    }
+    return true;
+}
+
+// Resolve a path of the project file against the directory the file is in
+static char *resolve_path(const char *project_file, const char *path) {
+    const char *slash = strrchr(project_file, '/');
+    if (path[0] == '/' || slash == NULL) {
+        return strdup(path);
+    }
+    
+    size_t directory_length = slash - project_file;
+    size_t length = directory_length + strlen(path) + 2;
+    char *resolved = malloc(length);
+    if (resolved != NULL) {
+        snprintf(resolved, length, "%.*s/%s", (int)directory_length, project_file, path);
+    }
+    return resolved;
+}
+
+static build_target_t *find_target(const build_t *build, const char *name) {
+    for (size_t i = 0; i < build->count; i++) {
+        if (strcmp(build->targets[i].name, name) == 0) {
+            return &build->targets[i];
+        }
+    }
+    return NULL;
+}
+
+// Fill in what a target leaves to defaults, and check it is complete
+static bool complete_definition(build_t *build, size_t index, const char *project_file, const char *language) {
+    build_target_t *target = &build->targets[index];
+    if (target->input == NULL || target->output == NULL) {
+        fprintf(stderr, "Error: Target %zu of %s needs \"input\" and \"output\"\n", index + 1, project_file);
+        return false;
+    }
+    if (target->language == NULL && language == NULL) {
+        fprintf(stderr, "Error: Target %zu of %s has no \"language\", and the project sets none\n",
+                index + 1, project_file);
+        return false;
+    }
+    
+    if (target->name == NULL) {
+        target->name = strdup(target->input);
+    }
+    if (target->language == NULL) {
+        target->language = strdup(language);
+    }
+    char *input = resolve_path(project_file, target->input);
+    free(target->input);
+    target->input = input;
+    target->output_name = target->output;
+    target->output = resolve_path(project_file, target->output_name);
+    if (target->name == NULL || target->language == NULL || target->input == NULL || target->output == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+    
+    for (size_t i = 0; i < index; i++) {
+        if (strcmp(build->targets[i].name, target->name) == 0) {
+            fprintf(stderr, "Error: Two targets of %s are named %s\n", project_file, target->name);
+            return false;
+        }
+        if (strcmp(build->targets[i].output, target->output) == 0) {
+            fprintf(stderr, "Error: Targets %s and %s both write %s\n",
+                    build->targets[i].name, target->name, target->output);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Turn the dependencies' names into indices, and record each target's dependents
+static bool link_targets(build_t *build) {
+    for (size_t i = 0; i < build->count; i++) {
+        build_target_t *target = &build->targets[i];
+        target->dependencies = malloc((target->depend_count + 1) * sizeof(size_t));
+        if (target->dependencies == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return false;
+        }
+        
+        for (size_t j = 0; j < target->depend_count; j++) {
+            build_target_t *dependency = find_target(build, target->depends[j]);
+            if (dependency == NULL) {
+                fprintf(stderr, "Error: Target %s depends on unknown target %s\n", target->name, target->depends[j]);
+                return false;
+            }
+            
+            size_t index = dependency - build->targets;
+            bool repeated = false;
+            for (size_t k = 0; k < target->dependency_count; k++) {
+                repeated = repeated || target->dependencies[k] == index;
+            }
+            if (repeated) {
+                continue;
+            }
+            
+            size_t *dependents = realloc(dependency->dependents, (dependency->dependent_count + 1) * sizeof(size_t));
+            if (dependents == NULL) {
+                fprintf(stderr, "Error: Out of memory\n");
+                return false;
+            }
+            dependency->dependents = dependents;
+            dependency->dependents[dependency->dependent_count++] = i;
+            target->dependencies[target->dependency_count++] = index;
+        }
+    }
+    return true;
+}
+
+// Order the targets so that each comes after its dependencies, and give each
+// the work on the longest chain from it to a target nothing depends on;
+// fails on a dependency cycle
+static bool order_targets(build_t *build) {
+    size_t *order = malloc((build->count + 1) * sizeof(size_t));
+    size_t *remaining = malloc((build->count + 1) * sizeof(size_t));
+    if (order == NULL || remaining == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        free(order);
+        free(remaining);
+        return false;
+    }
+    
+    // Kahn's algorithm: a target is placed once all of its dependencies are
+    size_t placed = 0;
+    for (size_t i = 0; i < build->count; i++) {
+        remaining[i] = build->targets[i].dependency_count;
+        if (remaining[i] == 0) {
+            order[placed++] = i;
+        }
+    }
+    for (size_t next = 0; next < placed; next++) {
+        const build_target_t *target = &build->targets[order[next]];
+        for (size_t j = 0; j < target->dependent_count; j++) {
+            if (--remaining[target->dependents[j]] == 0) {
+                order[placed++] = target->dependents[j];
+            }
+        }
+    }
+    
+    if (placed < build->count) {
+        fprintf(stderr, "Error: Dependency cycle among targets");
+        const char *separator = " ";
+        for (size_t i = 0; i < build->count; i++) {
+            if (remaining[i] > 0) {
+                fprintf(stderr, "%s%s", separator, build->targets[i].name);
+                separator = ", ";
+            }
+        }
+        fprintf(stderr, "\n");
+        free(order);
+        free(remaining);
+        return false;
+    }
+    
+    // Dependents come later in the order, so their chains are known first
+    for (size_t i = build->count; i-- > 0;) {
+        build_target_t *target = &build->targets[order[i]];
+        struct stat st;
+        input_t input;
+        size_t description_tokens = 0;
+        if (stat(target->input, &st) == 0 && input_open(target->input, &input)) {
+            description_tokens = tokens_estimate(input.data, input.size);
+            input_close(&input);
+        }
+        size_t longest = 0;
+        for (size_t j = 0; j < target->dependent_count; j++) {
+            size_t priority = build->targets[target->dependents[j]].priority;
+            longest = priority > longest ? priority : longest;
+        }
+        target->priority = tokens_expected_output(target->language, description_tokens) + longest;
+    }
+    
+    free(order);
+    free(remaining);
+    return true;
+}
+
+// Include a target in this build, with everything it depends on
+static void want_target(build_t *build, build_target_t *target) {
+    if (target->wanted) {
+        return;
+    }
+    target->wanted = true;
+    for (size_t i = 0; i < target->dependency_count; i++) {
+        want_target(build, &build->targets[target->dependencies[i]]);
+    }
+}
+
+// Read the project file and check that its targets form a DAG
+static bool load_project(build_t *build, const char *project_file) {
+    input_t input;
+    if (!input_open(project_file, &input)) {
+        fprintf(stderr, "Error: Could not read project file %s\n", project_file);
+        return false;
+    }
+    
+    project_reader_t reader;
+    memset(&reader, 0, sizeof(reader));
+    bool decoded = json_decode(input.data, input.size, read_project, &reader);
+    input_close(&input);
+    
+    build->targets = reader.targets;
+    build->count = reader.count;
+    for (int i = 0; i < FIELDS; i++) {
+        free(reader.fields[i]);
+    }
+    for (size_t i = 0; i < reader.depend_count; i++) {
+        free(reader.depends[i]);
+    }
+    free(reader.depends);
+    
+    bool loaded = decoded;
+    if (!decoded) {
+        fprintf(stderr, "Error: Invalid project file %s\n", project_file);
+    } else if (build->count == 0) {
+        fprintf(stderr, "Error: Project file %s has no targets\n", project_file);
+        loaded = false;
+    }
+    for (size_t i = 0; loaded && i < build->count; i++) {
+        loaded = complete_definition(build, i, project_file, reader.language);
+    }
+    free(reader.language);
+    
+    return loaded && link_targets(build) && order_targets(build);
+}
+
+// Hash a file's contents; fails quietly if there is no such file
+static bool hash_file(const char *path, char hash[HASH_HEX_SIZE]) {
+    struct stat st;
+    input_t input;
+    if (stat(path, &st) != 0 || !input_open(path, &input)) {
+        return false;
+    }
+    
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, input.data, input.size);
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, hash);
+    input_close(&input);
+    return true;
+}
+
+// Hash everything a target's compile depends on: its prompt, and the model,
+// endpoints, routing rules and settings it is compiled with
+static void hash_target(build_target_t *target, const char *prompt, size_t length) {
+    english_context_t *context = context_get_default();
+    char settings[64];
+    snprintf(settings, sizeof(settings), "%d %ld %ld", (int)context_get_extract_mode(context),
+             config_get_num_ctx(), config_get_num_predict());
+    const char *fields[] = { context_get_model(context), context_get_endpoint(context), target->language, settings };
+    
+    // Fields are NUL-separated so that shifting bytes between them changes the hash
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        const char *field = fields[i] != NULL ? fields[i] : "";
+        sha256_update(&ctx, field, strlen(field) + 1);
+    }
+    for (size_t i = 0; i < config_get_route_count(); i++) {
+        const char *route = config_get_route(i);
+        sha256_update(&ctx, route, strlen(route) + 1);
+    }
+    sha256_update(&ctx, prompt, length);
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, target->hash);
+}
+
+// The description of a target, after the code of its dependencies; a hint
+// line stays first so routing still sees it. Sets the target's error on failure.
+static char *build_prompt(const build_t *build, build_target_t *target, const input_t *input, size_t *length) {
+    buffer_t prompt = { NULL, 0, 0 };
+    if (target->dependency_count == 0) {
+        // Compiled as is, so it shares cached compiles with 'english compile'
+        if (!buffer_append(&prompt, input->data, input->size)) {
+            snprintf(target->error, sizeof(target->error), "out of memory");
+            return NULL;
+        }
+        *length = prompt.size;
+        return prompt.data;
+    }
+    
+    char hint[MAX_HINT_LENGTH];
+    const char *text = router_read_hint(input->data, hint, sizeof(hint));
+    bool built = (hint[0] == '\0' ||
+                  (buffer_append_string(&prompt, "@hint ") && buffer_append_string(&prompt, hint) &&
+                   buffer_append_string(&prompt, "\n"))) &&
+                 buffer_append_string(&prompt, "The code below was already generated from other descriptions of "
+                                      "this program. Use the names it defines, but do not repeat its code.\n\n");
+    
+    for (size_t i = 0; built && i < target->dependency_count; i++) {
+        const build_target_t *dependency = &build->targets[target->dependencies[i]];
+        input_t code;
+        if (!input_open(dependency->output, &code)) {
+            snprintf(target->error, sizeof(target->error), "could not read %s, the output of %s",
+                     dependency->output, dependency->name);
+            free(prompt.data);
+            return NULL;
+        }
+        built = buffer_append_string(&prompt, "File ") && buffer_append_string(&prompt, dependency->output_name) &&
+                buffer_append_string(&prompt, ":\n```") && buffer_append_string(&prompt, dependency->language) &&
+                buffer_append_string(&prompt, "\n") && buffer_append(&prompt, code.data, code.size) &&
+                (code.size == 0 || code.data[code.size - 1] == '\n' || buffer_append_string(&prompt, "\n")) &&
+                buffer_append_string(&prompt, "```\n\n");
+        input_close(&code);
+    }
+    
+    built = built && buffer_append_string(&prompt, "Write the code described below.\n\n") &&
+            buffer_append_string(&prompt, text);
+    if (!built) {
+        snprintf(target->error, sizeof(target->error), "out of memory");
+        free(prompt.data);
+        return NULL;
+    }
+    *length = prompt.size;
+    return prompt.data;
+}
+
+static state_entry_t *find_entry(const build_t *build, const char *name) {
+    for (size_t i = 0; i < build->entry_count; i++) {
+        if (strcmp(build->entries[i].name, name) == 0) {
+            return &build->entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Check whether a target's last build is still current, keeping the hash of its output
+static bool is_up_to_date(const build_t *build, build_target_t *target) {
+    const state_entry_t *entry = find_entry(build, target->name);
+    const char *reason = NULL;
+    char output_hash[HASH_HEX_SIZE];
+    if (build->force) {
+        reason = "every target is rebuilt";
+    } else if (entry == NULL) {
+        reason = "it was never built";
+    } else if (strcmp(entry->hash, target->hash) != 0) {
+        reason = "its description, dependencies or settings changed";
+    } else if (!hash_file(target->output, output_hash)) {
+        reason = "its output is missing";
+    } else if (strcmp(entry->output_hash, output_hash) != 0) {
+        reason = "its output was changed";
+    }
+    
+    if (reason != NULL) {
+        if (english_is_verbose()) {
+            fprintf(stderr, "Verbose mode: Building %s, since %s\n", target->name, reason);
+        }
+        return false;
+    }
+    memcpy(target->output_hash, output_hash, HASH_HEX_SIZE);
+    return true;
+}
+
+// Remember a target's build for the state file
+static bool record_build(build_t *build, const build_target_t *target) {
+    state_entry_t *entry = find_entry(build, target->name);
+    if (entry == NULL) {
+        state_entry_t *entries = realloc(build->entries, (build->entry_count + 1) * sizeof(state_entry_t));
+        if (entries == NULL) {
+            return false;
+        }
+        build->entries = entries;
+        entry = &build->entries[build->entry_count];
+        entry->name = strdup(target->name);
+        if (entry->name == NULL) {
+            return false;
+        }
+        build->entry_count++;
+    }
+    memcpy(entry->hash, target->hash, HASH_HEX_SIZE);
+    memcpy(entry->output_hash, target->output_hash, HASH_HEX_SIZE);
+    return true;
+}
+
+// Entries of the state file as they are decoded
+typedef struct {
+    build_t *build;
+    char *name;
+    size_t name_length;
+    char *hashes[2];               // "hash" and "output"
+    size_t hash_lengths[2];
+} state_reader_t;
+
+// Collect the entries of the state file as they are decoded
+static bool read_state(const json_value_t *value, void *userdata) {
+    state_reader_t *reader = (state_reader_t *)userdata;
+    if (strcmp(value->top_key, "targets") != 0) {
+        return true;
+    }
+    
+    if (value->depth == 3 && value->kind == JSON_STRING) {
+        if (json_is_key(value, "name")) {
+            return append_piece(&reader->name, &reader->name_length, value);
+        } else if (json_is_key(value, "hash")) {
+            return append_piece(&reader->hashes[0], &reader->hash_lengths[0], value);
+        } else if (json_is_key(value, "output")) {
+            return append_piece(&reader->hashes[1], &reader->hash_lengths[1], value);
+        }
+    } else if (value->depth == 2 && value->kind == JSON_END_OBJECT) {
+        // Keep an entry only once it has a name and both hashes
+        bool complete = reader->name != NULL && reader->hashes[0] != NULL && reader->hashes[1] != NULL &&
+                        reader->hash_lengths[0] == HASH_HEX_SIZE - 1 && reader->hash_lengths[1] == HASH_HEX_SIZE - 1;
+        if (complete) {
+            build_t *build = reader->build;
+            state_entry_t *entries = realloc(build->entries, (build->entry_count + 1) * sizeof(state_entry_t));
+            if (entries == NULL) {
+                return false;
+            }
+            build->entries = entries;
+            state_entry_t *entry = &build->entries[build->entry_count++];
+            entry->name = reader->name;
+            memcpy(entry->hash, reader->hashes[0], HASH_HEX_SIZE);
+            memcpy(entry->output_hash, reader->hashes[1], HASH_HEX_SIZE);
+            reader->name = NULL;
+        }
+        build_t *build = reader->build;
+        free(reader->name);
+        free(reader->hashes[0]);
+        free(reader->hashes[1]);
+        memset(reader, 0, sizeof(state_reader_t));
+        reader->build = build;
+    }
+    return true;
+}
+
+// Read what the previous builds recorded; a missing state file means nothing was built
+static void load_state(build_t *build, const char *path) {
+    struct stat st;
+    input_t input;
+    if (stat(path, &st) != 0 || !input_open(path, &input)) {
+        return;
+    }
+    
+    state_reader_t reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.build = build;
+    if (!json_decode(input.data, input.size, read_state, &reader)) {
+        fprintf(stderr, "Warning: Ignoring unreadable build state %s\n", path);
+        for (size_t i = 0; i < build->entry_count; i++) {
+            free(build->entries[i].name);
+        }
+        build->entry_count = 0;
+    }
+    free(reader.name);
+    free(reader.hashes[0]);
+    free(reader.hashes[1]);
+    input_close(&input);
+}
+
+// Write a string to a file, as a json_write_callback
+static bool write_file(const char *data, size_t length, void *target) {
+    return fwrite(data, 1, length, (FILE *)target) == length;
+}
+
+// Replace the state file with what the builds so far recorded of the project's targets
+static bool save_state(const build_t *build, const char *path) {
+    char temp_path[MAX_PATH_LENGTH + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp.%ld", path, (long)getpid());
+    
+    FILE *file = fopen(temp_path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    
+    bool success = fputs("{\n  \"targets\": [", file) != EOF;
+    const char *separator = "";
+    for (size_t i = 0; success && i < build->entry_count; i++) {
+        // Targets removed from the project are forgotten
+        const state_entry_t *entry = &build->entries[i];
+        if (find_target(build, entry->name) == NULL) {
+            continue;
+        }
+        success = fprintf(file, "%s\n    {\n      \"name\": ", separator) >= 0 &&
+                  json_write_string(entry->name, strlen(entry->name), write_file, file) &&
+                  fprintf(file, ",\n      \"hash\": \"%s\",\n      \"output\": \"%s\"\n    }",
+                          entry->hash, entry->output_hash) >= 0;
+        separator = ",";
+    }
+    success = success && fputs("\n  ]\n}\n", file) != EOF;
+    success = fclose(file) == 0 && success;
+    if (!success || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
+
+// Create the directories an output goes in
+static void make_parent_directories(const char *path) {
+    char directory[MAX_PATH_LENGTH];
+    snprintf(directory, sizeof(directory), "%s", path);
+    for (char *slash = strchr(directory + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(directory, 0755);
+        *slash = '/';
+    }
+}
+
+// Replace an output atomically, keeping the hash of what was written
+static bool write_output(const char *path, const char *code, size_t length, char hash[HASH_HEX_SIZE]) {
+    char temp_path[MAX_PATH_LENGTH + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp.%ld", path, (long)getpid());
+    make_parent_directories(path);
+    
+    FILE *file = fopen(temp_path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    bool written = fwrite(code, 1, length, file) == length && fputc('\n', file) != EOF;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return false;
+    }
+    
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, code, length);
+    sha256_update(&ctx, "\n", 1);
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, hash);
+    return true;
+}
+
+// Print a target's line of the report
+static void print_target(const build_target_t *target) {
+    switch (target->status) {
+        case TARGET_BUILT:
+            printf("[ok]         %s -> %s (%.2fs%s)\n", target->name, target->output, target->seconds,
+                   target->cached ? ", cached" : "");
+            break;
+        case TARGET_UP_TO_DATE:
+            printf("[up to date] %s\n", target->name);
+            break;
+        case TARGET_FAILED:
+            printf("[failed]     %s: %s\n", target->name, target->error);
+            break;
+        case TARGET_SKIPPED:
+            printf("[skipped]    %s: %s\n", target->name, target->error);
+            break;
+        default:
+            break;
+    }
+    fflush(stdout);
+}
+
+// Skip every target waiting on one that was not built
+static void skip_dependents(build_t *build, const build_target_t *target, const char *failed) {
+    for (size_t i = 0; i < target->dependent_count; i++) {
+        build_target_t *dependent = &build->targets[target->dependents[i]];
+        if (!dependent->wanted || dependent->status != TARGET_PENDING) {
+            continue;
+        }
+        dependent->status = TARGET_SKIPPED;
+        if (english_is_cancelled()) {
+            snprintf(dependent->error, sizeof(dependent->error), "cancelled");
+        } else {
+            snprintf(dependent->error, sizeof(dependent->error), "dependency %s failed", failed);
+        }
+        print_target(dependent);
+        skip_dependents(build, dependent, failed);
+    }
+}
+
+// Report a target that is done, and release or skip its dependents
+static void finish_target(build_t *build, build_target_t *target, target_status_t status) {
+    target->status = status;
+    print_target(target);
+    
+    if (status == TARGET_BUILT || status == TARGET_UP_TO_DATE) {
+        for (size_t i = 0; i < target->dependent_count; i++) {
+            build->targets[target->dependents[i]].waiting--;
+        }
+    } else {
+        skip_dependents(build, target, target->name);
+    }
+}
+
+// Write a finished target's code and record its build
+static void complete_target(build_t *build, build_target_t *target) {
+    target->seconds = (monotonic_ms() - target->started_ms) / 1000;
+    target->cached = request_is_cached(target->request);
+    bool success = request_finish(target->request);
+    target_status_t status = TARGET_BUILT;
+    
+    if (!success) {
+        status = TARGET_FAILED;
+        snprintf(target->error, sizeof(target->error), english_is_cancelled() ? "cancelled" : "compilation failed");
+    } else if (!write_output(target->output, request_get_output(target->request),
+                             request_get_output_length(target->request), target->output_hash)) {
+        status = TARGET_FAILED;
+        snprintf(target->error, sizeof(target->error), "could not write %s", target->output);
+    } else if (!record_build(build, target)) {
+        fprintf(stderr, "Error: Out of memory\n");
+    }
+    
+    request_free(target->request);
+    target->request = NULL;
+    finish_target(build, target, status);
+}
+
+// Start a target whose dependencies are done; returns true if it is in flight
+static bool start_target(build_t *build, build_target_t *target, driver_t *driver) {
+    target->status = TARGET_RUNNING;
+    target->started_ms = monotonic_ms();
+    
+    input_t input;
+    if (!input_open(target->input, &input)) {
+        snprintf(target->error, sizeof(target->error), "could not read input file %s", target->input);
+        finish_target(build, target, TARGET_FAILED);
+        return false;
+    }
+    size_t length = 0;
+    char *prompt = build_prompt(build, target, &input, &length);
+    input_close(&input);
+    if (prompt == NULL) {
+        finish_target(build, target, TARGET_FAILED);
+        return false;
+    }
+    
+    hash_target(target, prompt, length);
+    if (is_up_to_date(build, target)) {
+        free(prompt);
+        finish_target(build, target, TARGET_UP_TO_DATE);
+        return false;
+    }
+    
+    // The request copies what it needs of the prompt
+    target->request = request_new(context_get_default(), prompt, target->language, NULL, NULL);
+    free(prompt);
+    if (target->request == NULL) {
+        snprintf(target->error, sizeof(target->error), "could not create request");
+        finish_target(build, target, TARGET_FAILED);
+        return false;
+    }
+    
+    // Cached results complete without a transfer
+    if (request_is_cached(target->request) || !driver_start(driver, target->request, target)) {
+        complete_target(build, target);
+        return false;
+    }
+    return true;
+}
+
+// The ready target with the most work on the chain ahead of it, or NULL if none is ready
+static build_target_t *next_ready(const build_t *build) {
+    build_target_t *best = NULL;
+    for (size_t i = 0; i < build->count; i++) {
+        build_target_t *target = &build->targets[i];
+        if (target->wanted && target->status == TARGET_PENDING && target->waiting == 0 &&
+            (best == NULL || target->priority > best->priority)) {
+            best = target;
+        }
+    }
+    return best;
+}
+
+// Build the wanted targets through one multi handle with at most
+// max_parallel requests in flight; returns false if CURL could not be initialized
+static bool run_targets(build_t *build, int max_parallel) {
+    driver_t *driver = driver_new(max_parallel);
+    if (driver == NULL) {
+        return false;
+    }
+    
+    for (size_t i = 0; i < build->count; i++) {
+        build->targets[i].waiting = build->targets[i].dependency_count;
+    }
+    
+    for (;;) {
+        // Top up to the concurrency limit, longest chains first; a target
+        // that finishes at once may make others ready. Freed slots are
+        // refilled before waiting for more network activity.
+        build_target_t *target;
+        while (driver_has_room(driver) && !english_is_cancelled() && (target = next_ready(build)) != NULL) {
+            if (english_is_verbose()) {
+                fprintf(stderr, "Verbose mode: Starting %s, ~%zu tokens to generate on its longest chain\n",
+                        target->name, target->priority);
+            }
+            start_target(build, target, driver);
+        }
+        
+        build_target_t *done = driver_next(driver);
+        if (done == NULL) {
+            break;
+        }
+        complete_target(build, done);
+    }
+    
+    driver_free(driver);
+    return true;
+}
+
+// Release what the build owns
+static void free_build(build_t *build) {
+    for (size_t i = 0; i < build->count; i++) {
+        free_target(&build->targets[i]);
+    }
+    free(build->targets);
+    for (size_t i = 0; i < build->entry_count; i++) {
+        free(build->entries[i].name);
+    }
+    free(build->entries);
+}
+
+int build_run(const char *project_file, const char *const *names, int name_count, int max_parallel, bool force) {
+    build_t build;
+    memset(&build, 0, sizeof(build));
+    build.force = force;
+    if (!load_project(&build, project_file)) {
+        free_build(&build);
+        return -1;
+    }
+    
+    for (int i = 0; i < name_count; i++) {
+        build_target_t *target = find_target(&build, names[i]);
+        if (target == NULL) {
+            fprintf(stderr, "Error: No target named %s in %s\n", names[i], project_file);
+            free_build(&build);
+            return -1;
+        }
+        want_target(&build, target);
+    }
+    for (size_t i = 0; name_count == 0 && i < build.count; i++) {
+        build.targets[i].wanted = true;
+    }
+    
+    char state_path[MAX_PATH_LENGTH];
+    snprintf(state_path, sizeof(state_path), "%s%s", project_file, BUILD_STATE_SUFFIX);
+    load_state(&build, state_path);
+    
+    if (max_parallel < 1) {
+        max_parallel = 1;
+    }
+    
+    double started_ms = monotonic_ms();
+    if (!run_targets(&build, max_parallel)) {
+        free_build(&build);
+        return -1;
+    }
+    
+    // Whatever was built is remembered, even when the build stopped early
+    if (!save_state(&build, state_path)) {
+        fprintf(stderr, "Warning: Could not write build state %s\n", state_path);
+    }
+    
+    size_t counts[TARGET_SKIPPED + 1] = { 0 };
+    size_t wanted = 0;
+    for (size_t i = 0; i < build.count; i++) {
+        build_target_t *target = &build.targets[i];
+        if (!target->wanted) {
+            continue;
+        }
+        if (target->status == TARGET_PENDING) {
+            target->status = TARGET_SKIPPED;
+            snprintf(target->error, sizeof(target->error), "cancelled");
+            print_target(target);
+        }
+        counts[target->status]++;
+        wanted++;
+    }
+    printf("%zu targets, %zu built, %zu up to date, %zu failed, %zu skipped in %.2fs (up to %d in flight)\n",
+           wanted, counts[TARGET_BUILT], counts[TARGET_UP_TO_DATE], counts[TARGET_FAILED],
+           counts[TARGET_SKIPPED], (monotonic_ms() - started_ms) / 1000, max_parallel);
+    
+    free_build(&build);
+    return (int)(counts[TARGET_FAILED] + counts[TARGET_SKIPPED]);
+}
@@ -0,0 +1,438 @@
+#define _DEFAULT_SOURCE
+
+#include "../include/cache.h"
+#include "../include/config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_DIR_NAME "cache"
+#define CACHE_INDEX_NAME "index"
+#define CACHE_MAGIC "ENGCACH1"
+#define CACHE_CAPACITY 8192
+#define MAX_PATH_LENGTH 1024
+
+// Slot states in the index hash table
+#define SLOT_EMPTY 0
+#define SLOT_USED 1
+#define SLOT_DELETED 2
+
+// Header at the start of the memory-mapped index
+typedef struct {
+    char magic[8];
+    uint32_t capacity;
+    uint32_t reserved;
+    uint64_t clock;           // Logical time used for LRU ordering
+    uint64_t entries;
+    uint64_t tombstones;
+    uint64_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+} cache_header_t;
+
+// One slot of the open-addressing hash table that follows the header
+typedef struct {
+    uint8_t key[SHA256_DIGEST_SIZE];
+    uint64_t size;
+    uint64_t last_used;
+    uint32_t state;
+    uint32_t reserved;
+} cache_entry_t;
+
+#define CACHE_INDEX_SIZE (sizeof(cache_header_t) + CACHE_CAPACITY * sizeof(cache_entry_t))
+
+// flock only separates processes, so threads of one process also take turns
+// on a mutex; it covers opening the index too
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char cache_dir[MAX_PATH_LENGTH];
+static int index_fd = -1;
+static cache_header_t *header = NULL;
+static cache_entry_t *slots = NULL;
+
+// Build the path of the object file holding the code for a key
+static void object_path(const uint8_t key[SHA256_DIGEST_SIZE], char *path, size_t path_size) {
+    char hex[SHA256_DIGEST_SIZE * 2 + 1];
+    sha256_to_hex(key, hex);
+    snprintf(path, path_size, "%s/%s", cache_dir, hex);
+}
+
+// Reset the index to an empty table
+static void reset_index(void) {
+    memset(header, 0, CACHE_INDEX_SIZE);
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    header->capacity = CACHE_CAPACITY;
+}
+
+// Map the index file, creating it on first use; the index stays mapped for the
+// process. The thread lock must be held.
+static bool open_index(void) {
+    if (header != NULL) {
+        return true;
+    }
+    
+    if (!config_get_subdir(CACHE_DIR_NAME, cache_dir, sizeof(cache_dir))) {
+        return false;
+    }
+    
+    char index_path[MAX_PATH_LENGTH + 16];
+    snprintf(index_path, sizeof(index_path), "%s/%s", cache_dir, CACHE_INDEX_NAME);
+    
+    int fd = open(index_path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open cache index %s\n", index_path);
+        return false;
+    }
+    
+    // Size the file under the lock so concurrent first users agree on the layout
+    flock(fd, LOCK_EX);
+    
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || (size_t)st.st_size != CACHE_INDEX_SIZE;
+    if (fresh && ftruncate(fd, CACHE_INDEX_SIZE) != 0) {
+        fprintf(stderr, "Error: Could not size cache index %s\n", index_path);
+        flock(fd, LOCK_UN);
+        close(fd);
+        return false;
+    }
+    
+    void *map = mmap(NULL, CACHE_INDEX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Could not map cache index %s\n", index_path);
+        flock(fd, LOCK_UN);
+        close(fd);
+        return false;
+    }
+    
+    header = (cache_header_t *)map;
+    slots = (cache_entry_t *)(header + 1);
+    
+    // A new, truncated or foreign index starts out empty
+    if (fresh || memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->capacity != CACHE_CAPACITY) {
+        reset_index();
+    }
+    
+    flock(fd, LOCK_UN);
+    index_fd = fd;
+    return true;
+}
+
+// Take the thread lock and open the index, then the file lock; false if the
+// index is unavailable, in which case no lock is held
+static bool lock_index(int operation) {
+    pthread_mutex_lock(&cache_lock);
+    if (!open_index()) {
+        pthread_mutex_unlock(&cache_lock);
+        return false;
+    }
+    flock(index_fd, operation);
+    return true;
+}
+
+static void unlock_index(void) {
+    flock(index_fd, LOCK_UN);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Open the index without keeping a lock, for work that comes before taking one
+static bool prepare_index(void) {
+    pthread_mutex_lock(&cache_lock);
+    bool ready = open_index();
+    pthread_mutex_unlock(&cache_lock);
+    return ready;
+}
+
+// Find the slot holding a key, or NULL; the index lock must be held
+static cache_entry_t *find_slot(const uint8_t key[SHA256_DIGEST_SIZE]) {
+    uint32_t start;
+    memcpy(&start, key, sizeof(start));
+    
+    for (uint32_t i = 0; i < CACHE_CAPACITY; i++) {
+        cache_entry_t *slot = &slots[(start + i) % CACHE_CAPACITY];
+        if (slot->state == SLOT_EMPTY) {
+            return NULL;
+        }
+        if (slot->state == SLOT_USED && memcmp(slot->key, key, SHA256_DIGEST_SIZE) == 0) {
+            return slot;
+        }
+    }
+    
+    return NULL;
+}
+
+// Find a free slot for a new key; the index lock must be held
+static cache_entry_t *free_slot(const uint8_t key[SHA256_DIGEST_SIZE]) {
+    uint32_t start;
+    memcpy(&start, key, sizeof(start));
+    
+    for (uint32_t i = 0; i < CACHE_CAPACITY; i++) {
+        cache_entry_t *slot = &slots[(start + i) % CACHE_CAPACITY];
+        if (slot->state != SLOT_USED) {
+            return slot;
+        }
+    }
+    
+    return NULL;
+}
+
+// Drop one entry and its object file; the index lock must be held
+static void remove_slot(cache_entry_t *slot) {
+    char path[MAX_PATH_LENGTH];
+    object_path(slot->key, path, sizeof(path));
+    unlink(path);
+    
+    header->bytes -= slot->size;
+    header->entries--;
+    header->tombstones++;
+    slot->state = SLOT_DELETED;
+}
+
+// Evict the least recently used entry; the index lock must be held
+static bool evict_one(void) {
+    cache_entry_t *oldest = NULL;
+    
+    for (uint32_t i = 0; i < CACHE_CAPACITY; i++) {
+        if (slots[i].state == SLOT_USED && (oldest == NULL || slots[i].last_used < oldest->last_used)) {
+            oldest = &slots[i];
+        }
+    }
+    
+    if (oldest == NULL) {
+        return false;
+    }
+    
+    remove_slot(oldest);
+    header->evictions++;
+    return true;
+}
+
+// Rebuild the table without tombstones so probe sequences stay short
+static void compact_index(void) {
+    cache_entry_t *live = malloc(header->entries * sizeof(cache_entry_t));
+    if (live == NULL) {
+        return;
+    }
+    
+    size_t count = 0;
+    for (uint32_t i = 0; i < CACHE_CAPACITY; i++) {
+        if (slots[i].state == SLOT_USED) {
+            live[count++] = slots[i];
+        }
+    }
+    
+    memset(slots, 0, CACHE_CAPACITY * sizeof(cache_entry_t));
+    header->tombstones = 0;
+    for (size_t i = 0; i < count; i++) {
+        *free_slot(live[i].key) = live[i];
+    }
+    
+    free(live);
+}
+
+void cache_make_key(const char *model, const char *endpoint, const char *target_language,
+                    const char *prompt, const char *options, uint8_t key[SHA256_DIGEST_SIZE]) {
+    const char *fields[] = { model, endpoint, target_language, prompt, options };
+    sha256_ctx_t ctx;
+    
+    // Fields are NUL-separated so that shifting bytes between them changes the key
+    sha256_init(&ctx);
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        const char *field = fields[i] != NULL ? fields[i] : "";
+        sha256_update(&ctx, field, strlen(field) + 1);
+    }
+    sha256_final(&ctx, key);
+}
+
+char *cache_lookup(const uint8_t key[SHA256_DIGEST_SIZE], size_t *length) {
+    if (!lock_index(LOCK_EX)) {
+        return NULL;
+    }
+    cache_entry_t *slot = find_slot(key);
+    if (slot == NULL) {
+        header->misses++;
+        unlock_index();
+        return NULL;
+    }
+    slot->last_used = ++header->clock;
+    unlock_index();
+    
+    // Object files are replaced atomically, so no lock is needed to read one
+    char path[MAX_PATH_LENGTH];
+    object_path(key, path, sizeof(path));
+    
+    char *code = NULL;
+    size_t size = 0;
+    FILE *file = fopen(path, "rb");
+    if (file != NULL) {
+        struct stat st;
+        if (fstat(fileno(file), &st) == 0) {
+            size = (size_t)st.st_size;
+            code = malloc(size + 1);
+        }
+        if (code != NULL && fread(code, 1, size, file) == size) {
+            code[size] = '\0';
+        } else {
+            free(code);
+            code = NULL;
+        }
+        fclose(file);
+    }
+    
+    if (lock_index(LOCK_EX)) {
+        if (code == NULL) {
+            // Evicted or deleted behind our back; forget the entry
+            slot = find_slot(key);
+            if (slot != NULL && file == NULL) {
+                remove_slot(slot);
+            }
+            header->misses++;
+        } else {
+            header->hits++;
+        }
+        unlock_index();
+    }
+    
+    if (code != NULL && length != NULL) {
+        *length = size;
+    }
+    return code;
+}
+
+bool cache_store(const uint8_t key[SHA256_DIGEST_SIZE], const char *code, size_t length) {
+    if (code == NULL || !prepare_index()) {
+        return false;
+    }
+    
+    size_t max_bytes = config_get_cache_max_bytes();
+    if (length > max_bytes) {
+        return false;
+    }
+    
+    // Write the object under a private name, then publish it with an atomic
+    // rename; the buffer's address tells concurrent writers of one process apart
+    char path[MAX_PATH_LENGTH];
+    char temp_path[MAX_PATH_LENGTH + 32];
+    object_path(key, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp.%ld.%p", path, (long)getpid(), (const void *)code);
+    
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    bool written = fwrite(code, 1, length, file) == length;
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        unlink(temp_path);
+        return false;
+    }
+    
+    if (!lock_index(LOCK_EX)) {
+        unlink(temp_path);
+        return false;
+    }
+    
+    // Replace any previous entry for the same key
+    cache_entry_t *slot = find_slot(key);
+    if (slot != NULL) {
+        header->bytes -= slot->size;
+        header->entries--;
+        slot->state = SLOT_DELETED;
+        header->tombstones++;
+    }
+    
+    // Stay under the size cap and keep the table at most three quarters full
+    while (header->entries > 0 &&
+           (header->bytes + length > max_bytes || header->entries + 1 > CACHE_CAPACITY * 3 / 4)) {
+        evict_one();
+    }
+    if (header->entries + header->tombstones + 1 > CACHE_CAPACITY * 7 / 8) {
+        compact_index();
+    }
+    
+    bool success = rename(temp_path, path) == 0;
+    if (success) {
+        slot = free_slot(key);
+        if (slot->state == SLOT_DELETED) {
+            header->tombstones--;
+        }
+        memcpy(slot->key, key, SHA256_DIGEST_SIZE);
+        slot->size = length;
+        slot->last_used = ++header->clock;
+        slot->state = SLOT_USED;
+        header->entries++;
+        header->bytes += length;
+        header->stores++;
+    } else {
+        unlink(temp_path);
+    }
+    
+    unlock_index();
+    return success;
+}
+
+bool cache_get_stats(cache_stats_t *stats) {
+    if (stats == NULL || !lock_index(LOCK_SH)) {
+        return false;
+    }
+    
+    stats->entries = header->entries;
+    stats->bytes = header->bytes;
+    stats->hits = header->hits;
+    stats->misses = header->misses;
+    stats->stores = header->stores;
+    stats->evictions = header->evictions;
+    unlock_index();
+    
+    stats->max_bytes = config_get_cache_max_bytes();
+    return true;
+}
+
+bool cache_clear(void) {
+    if (!lock_index(LOCK_EX)) {
+        return false;
+    }
+    
+    // Remove every object, including temporaries left by interrupted writers
+    DIR *dir = opendir(cache_dir);
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.' || strcmp(entry->d_name, CACHE_INDEX_NAME) == 0) {
+                continue;
+            }
+            char path[MAX_PATH_LENGTH + 256];
+            snprintf(path, sizeof(path), "%s/%s", cache_dir, entry->d_name);
+            unlink(path);
+        }
+        closedir(dir);
+    }
+    
+    reset_index();
+    unlock_index();
+    return true;
+}
+
+void cache_close(void) {
+    pthread_mutex_lock(&cache_lock);
+    if (header != NULL) {
+        munmap(header, CACHE_INDEX_SIZE);
+        header = NULL;
+        slots = NULL;
+    }
+    if (index_fd >= 0) {
+        close(index_fd);
+        index_fd = -1;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,176 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/candidates.h"
+#include "../include/context.h"
+#include "../include/driver.h"
+#include "../include/monotonic.h"
+#include "../include/request.h"
+#include "../include/validate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_REASON_LENGTH 256
+
+// Candidates one race can hold: the samples, plus a fresh one replacing a
+// cached answer that failed validation
+#define MAX_SLOTS (ENGLISH_MAX_CANDIDATES + 1)
+
+// One sampled answer to the compile
+typedef struct {
+    english_request_t *request;    // NULL once the candidate is rejected
+    int index;                     // Which sample it is, for its temperature and seed
+    bool running;                  // Its request is in flight
+} candidate_t;
+
+// Every candidate of one compile, racing to a valid answer
+typedef struct {
+    const char *language;
+    bool verbose;                  // The context's verbosity
+    candidate_t candidates[MAX_SLOTS];
+    int count;
+    int running;
+    candidate_t *winner;           // The first candidate that validated
+    candidate_t *fallback;         // The first that produced code, in case none validates
+    char reason[MAX_REASON_LENGTH];  // Why the fallback was rejected
+    double started_ms;
+} race_t;
+
+// Drop a candidate that failed or lost
+static void drop_candidate(candidate_t *candidate) {
+    request_free(candidate->request);
+    candidate->request = NULL;
+}
+
+// Validate a finished candidate's code; the first to pass wins the race
+static void judge_candidate(race_t *race, candidate_t *candidate) {
+    if (candidate->running) {
+        candidate->running = false;
+        race->running--;
+    }
+    
+    if (!request_finish(candidate->request)) {
+        drop_candidate(candidate);
+        return;
+    }
+    
+    char reason[MAX_REASON_LENGTH];
+    double elapsed = monotonic_ms() - race->started_ms;
+    if (validate_code(request_get_output(candidate->request), request_get_output_length(candidate->request),
+                      race->language, race->verbose, reason, sizeof(reason))) {
+        race->winner = candidate;
+        if (race->verbose) {
+            fprintf(stderr, "Verbose mode: Candidate %d (temperature %.1f%s) passed validation after %.0f ms\n",
+                    candidate->index + 1, request_get_temperature(candidate->request),
+                    request_is_cached(candidate->request) ? ", cached" : "", elapsed);
+        }
+        return;
+    }
+    
+    if (race->verbose) {
+        fprintf(stderr, "Verbose mode: Candidate %d (temperature %.1f%s) rejected after %.0f ms: %s\n",
+                candidate->index + 1, request_get_temperature(candidate->request),
+                request_is_cached(candidate->request) ? ", cached" : "", elapsed, reason);
+    }
+    if (race->fallback == NULL) {
+        race->fallback = candidate;
+        snprintf(race->reason, sizeof(race->reason), "%s", reason);
+    } else {
+        drop_candidate(candidate);
+    }
+}
+
+// Prepare the next candidate; false if it could not even be built
+static bool add_candidate(race_t *race, english_context_t *context, const char *english_text, int index) {
+    candidate_t *candidate = &race->candidates[race->count];
+    candidate->index = index;
+    candidate->running = false;
+    candidate->request = request_new_candidate(context, english_text, race->language, index);
+    if (candidate->request == NULL) {
+        return false;
+    }
+    race->count++;
+    return true;
+}
+
+// Put a candidate's request in flight
+static void start_candidate(race_t *race, candidate_t *candidate, driver_t *driver) {
+    if (driver_start(driver, candidate->request, candidate)) {
+        candidate->running = true;
+        race->running++;
+    } else {
+        judge_candidate(race, candidate);
+    }
+}
+
+char *candidates_compile(english_context_t *context, const char *english_text, const char *target_language,
+                         int count, size_t *output_length) {
+    if (count > ENGLISH_MAX_CANDIDATES) {
+        count = ENGLISH_MAX_CANDIDATES;
+    }
+    
+    race_t race;
+    memset(&race, 0, sizeof(race));
+    race.language = target_language;
+    race.verbose = context_is_verbose(context);
+    race.started_ms = monotonic_ms();
+    
+    // The first candidate samples like a plain compile, so the cache may
+    // already hold a valid answer and nothing needs to be sent
+    if (!add_candidate(&race, context, english_text, 0)) {
+        return NULL;
+    }
+    int fresh = count - 1;
+    if (request_is_cached(race.candidates[0].request)) {
+        judge_candidate(&race, &race.candidates[0]);
+        fresh = count;
+    }
+    
+    driver_t *driver = race.winner == NULL ? driver_new(MAX_SLOTS) : NULL;
+    if (driver != NULL) {
+        // Every candidate is in flight at once
+        for (int i = 1; i <= fresh; i++) {
+            add_candidate(&race, context, english_text, i);
+        }
+        for (int i = 0; i < race.count; i++) {
+            if (race.candidates[i].request != NULL && !request_is_cached(race.candidates[i].request)) {
+                start_candidate(&race, &race.candidates[i], driver);
+            }
+        }
+        if (race.verbose) {
+            fprintf(stderr, "Verbose mode: Racing %d candidates\n", race.running);
+        }
+    }
+    
+    // Each answer is validated as soon as it is complete
+    candidate_t *candidate;
+    while (race.winner == NULL && driver != NULL && (candidate = driver_next(driver)) != NULL) {
+        judge_candidate(&race, candidate);
+    }
+    
+    // Only a validated answer is worth storing in the cache
+    candidate_t *kept = race.winner != NULL ? race.winner : race.fallback;
+    char *output = NULL;
+    if (english_is_cancelled()) {
+        kept = NULL;
+    } else if (race.winner != NULL) {
+        request_keep(race.winner->request);
+    } else if (kept != NULL) {
+        fprintf(stderr, "Warning: No candidate passed validation, using candidate %d (%s)\n", kept->index + 1,
+                race.reason);
+    }
+    if (kept != NULL) {
+        output = request_take_output(kept->request, output_length);
+    }
+    
+    // The slower candidates are cancelled with their transfers
+    if (race.verbose && race.winner != NULL && race.running > 0) {
+        fprintf(stderr, "Verbose mode: Cancelling %d slower candidates\n", race.running);
+    }
+    for (int i = 0; i < race.count; i++) {
+        request_free(race.candidates[i].request);
+    }
+    driver_free(driver);
+    return output;
+}
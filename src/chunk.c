@@ -0,0 +1,476 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/chunk.h"
+#include "../include/english.h"
+#include "../include/buffer.h"
+#include "../include/context.h"
+#include "../include/driver.h"
+#include "../include/monotonic.h"
+#include "../include/request.h"
+#include "../include/router.h"
+#include "../include/tokens.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_HINT_LENGTH 64
+
+// Longest title of a part in the outline
+#define MAX_TITLE_LENGTH 100
+
+// Shortest a title is cut to when the outline would take too much of the budget
+#define MIN_TITLE_LENGTH 24
+
+// Share of the budget the outline may take
+#define OUTLINE_BUDGET_DIVISOR 4
+
+// Parts are joined with a blank line between them
+#define PART_SEPARATOR "\n\n"
+
+// Lines that may open a part's code and are only needed once, at the top of the program
+static const char *const preamble_prefixes[] = {
+    "#include", "import ", "from ", "using ", "use ", "require ", "package ",
+};
+
+// One part of the description and the code generated for it
+typedef struct {
+    const char *text;              // Start of the part in the description
+    size_t length;
+    const char *title;             // Its first heading, or else its first line
+    size_t title_length;
+    char *prompt;                  // The part with the outline, while it compiles
+    english_request_t *request;
+    char *code;                    // Generated code, once known
+    size_t code_length;
+} part_t;
+
+// Check whether a line holds nothing but whitespace
+static bool is_blank(const char *line, const char *end) {
+    for (const char *p = line; p < end; p++) {
+        if (*p != ' ' && *p != '\t' && *p != '\r') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Append a part spanning start to end, titled by its first heading or line
+static bool add_part(part_t **parts, size_t *count, size_t *capacity, const char *start, const char *end) {
+    if (*count == *capacity) {
+        *capacity = *capacity > 0 ? *capacity * 2 : 16;
+        part_t *grown = realloc(*parts, *capacity * sizeof(part_t));
+        if (grown == NULL) {
+            return false;
+        }
+        *parts = grown;
+    }
+    
+    part_t *part = &(*parts)[(*count)++];
+    memset(part, 0, sizeof(part_t));
+    part->text = start;
+    part->length = end - start;
+    
+    const char *title = NULL;
+    for (const char *line = start; line < end && title == NULL; ) {
+        const char *newline = memchr(line, '\n', end - line);
+        if (*line == '#') {
+            title = line;
+        }
+        line = newline != NULL ? newline + 1 : end;
+    }
+    title = title != NULL ? title : start;
+    while (title < end && (*title == '#' || *title == ' ' || *title == '\t')) {
+        title++;
+    }
+    part->title = title;
+    part->title_length = strcspn(title, "\n");
+    if (part->title_length > (size_t)(end - title)) {
+        part->title_length = end - title;
+    }
+    while (part->title_length > 0 && (title[part->title_length - 1] == '\r' || title[part->title_length - 1] == ' ')) {
+        part->title_length--;
+    }
+    return true;
+}
+
+// Cut the description into parts of at most budget tokens. Parts end before
+// a heading or a paragraph; a heading starts a new part once the current one
+// is half full, and a paragraph too large for the budget is cut between lines.
+static part_t *split_parts(const char *text, const char *end, size_t budget, size_t *count) {
+    part_t *parts = NULL;
+    size_t capacity = 0;
+    *count = 0;
+    
+    const char *start = NULL;          // First line of the current part
+    const char *last_end = NULL;       // End of its last non-blank line
+    const char *paragraph = NULL;      // Start of its last paragraph
+    const char *before_paragraph = NULL;  // End of the text before that paragraph
+    bool after_blank = false;
+    for (const char *line = text; line < end; ) {
+        const char *newline = memchr(line, '\n', end - line);
+        const char *line_end = newline != NULL ? newline : end;
+        const char *next = newline != NULL ? newline + 1 : end;
+        if (is_blank(line, line_end)) {
+            after_blank = true;
+            line = next;
+            continue;
+        }
+        
+        bool heading = *line == '#';
+        bool boundary = start == NULL || after_blank || heading;
+        if (start != NULL) {
+            size_t current = tokens_estimate(start, last_end - start);
+            size_t with_line = tokens_estimate(start, line_end - start);
+            if (boundary && (with_line > budget || (heading && current >= budget / 2))) {
+                if (!add_part(&parts, count, &capacity, start, last_end)) {
+                    free(parts);
+                    return NULL;
+                }
+                start = NULL;
+            } else if (with_line > budget) {
+                // Close the part before its last paragraph, and if that
+                // paragraph is still too large, cut it before this line
+                if (paragraph > start) {
+                    if (!add_part(&parts, count, &capacity, start, before_paragraph)) {
+                        free(parts);
+                        return NULL;
+                    }
+                    start = paragraph;
+                }
+                if (tokens_estimate(start, line_end - start) > budget) {
+                    if (!add_part(&parts, count, &capacity, start, last_end)) {
+                        free(parts);
+                        return NULL;
+                    }
+                    start = NULL;
+                }
+            }
+        }
+        
+        if (start == NULL) {
+            start = line;
+        }
+        if (boundary) {
+            paragraph = line;
+            before_paragraph = last_end;
+        }
+        last_end = line_end;
+        after_blank = false;
+        line = next;
+    }
+    
+    if (start != NULL && !add_part(&parts, count, &capacity, start, last_end)) {
+        free(parts);
+        return NULL;
+    }
+    
+    // An empty description still needs an array to hand back
+    if (parts == NULL) {
+        parts = calloc(1, sizeof(part_t));
+    }
+    return parts;
+}
+
+// Estimated tokens of an outline whose titles are cut to title_limit bytes
+static size_t outline_tokens(const part_t *parts, size_t count, size_t title_limit) {
+    size_t tokens = 0;
+    for (size_t i = 0; i < count; i++) {
+        // Each entry also takes its number, a cut title's "..." and a newline
+        size_t length = parts[i].title_length < title_limit ? parts[i].title_length : title_limit;
+        tokens += tokens_estimate(parts[i].title, length) + 3;
+    }
+    return tokens;
+}
+
+// Number the parts by their titles, cut short enough to leave the budget to the parts themselves
+static bool build_outline(buffer_t *outline, const part_t *parts, size_t count, size_t budget) {
+    size_t title_limit = MAX_TITLE_LENGTH;
+    while (title_limit > MIN_TITLE_LENGTH && outline_tokens(parts, count, title_limit) > budget / OUTLINE_BUDGET_DIVISOR) {
+        title_limit--;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        char number[32];
+        snprintf(number, sizeof(number), "%zu. ", i + 1);
+        size_t length = parts[i].title_length < title_limit ? parts[i].title_length : title_limit;
+        if (!buffer_append_string(outline, number) || !buffer_append(outline, parts[i].title, length) ||
+            (length < parts[i].title_length && !buffer_append_string(outline, "...")) ||
+            !buffer_append_string(outline, "\n")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The prompt of one part: the outline of the whole program, then the part
+static char *build_part_prompt(const part_t *part, size_t index, size_t count, const char *hint,
+                               const buffer_t *outline) {
+    buffer_t prompt = { NULL, 0, 0 };
+    char heading[160];
+    snprintf(heading, sizeof(heading), "This is part %zu of %zu of one program, whose parts are:\n", index + 1, count);
+    char instructions[256];
+    snprintf(instructions, sizeof(instructions),
+             "\nWrite only the code of part %zu, described below. The other parts are written separately: "
+             "use the names they define, but do not repeat their code.\n\n", index + 1);
+    
+    bool built = (hint[0] == '\0' ||
+                  (buffer_append_string(&prompt, "@hint ") && buffer_append_string(&prompt, hint) &&
+                   buffer_append_string(&prompt, "\n"))) &&
+                 buffer_append_string(&prompt, heading) &&
+                 buffer_append(&prompt, outline->data, outline->size) &&
+                 buffer_append_string(&prompt, instructions) &&
+                 buffer_append(&prompt, part->text, part->length);
+    if (!built) {
+        free(prompt.data);
+        return NULL;
+    }
+    return prompt.data;
+}
+
+// Store a finished part's code, releasing its request
+static void complete_part(part_t *part) {
+    if (request_finish(part->request)) {
+        part->code = request_take_output(part->request, &part->code_length);
+    }
+    
+    request_free(part->request);
+    part->request = NULL;
+    free(part->prompt);
+    part->prompt = NULL;
+}
+
+// Start compiling a part; returns true if it is in flight
+static bool start_part(part_t *part, const char *target_language, driver_t *driver) {
+    part->request = request_new(context_get_default(), part->prompt, target_language, NULL, NULL);
+    if (part->request == NULL) {
+        free(part->prompt);
+        part->prompt = NULL;
+        return false;
+    }
+    
+    if (request_is_cached(part->request) || !driver_start(driver, part->request, part)) {
+        complete_part(part);
+        return false;
+    }
+    return true;
+}
+
+// Compile every part, with at most max_parallel in flight
+static bool compile_parts(part_t *parts, size_t count, const char *target_language, int max_parallel) {
+    driver_t *driver = driver_new(max_parallel);
+    if (driver == NULL) {
+        return false;
+    }
+    
+    size_t next = 0;
+    for (;;) {
+        while (driver_has_room(driver) && next < count) {
+            start_part(&parts[next++], target_language, driver);
+        }
+        
+        part_t *part = driver_next(driver);
+        if (part == NULL) {
+            break;
+        }
+        complete_part(part);
+    }
+    
+    driver_free(driver);
+    
+    for (size_t i = 0; i < count; i++) {
+        if (parts[i].code == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether a line of code is an import that belongs at the top of the program;
+// one opening a block, like Go's "import (", stays where it is
+static bool is_preamble_line(const char *line, size_t length) {
+    if (length == 0 || line[length - 1] == '(' || line[length - 1] == '{' || line[length - 1] == '\\') {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(preamble_prefixes) / sizeof(preamble_prefixes[0]); i++) {
+        size_t prefix_length = strlen(preamble_prefixes[i]);
+        if (length >= prefix_length && memcmp(line, preamble_prefixes[i], prefix_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether the gathered imports already hold a line
+static bool preamble_contains(const buffer_t *preamble, const char *line, size_t length) {
+    for (const char *p = preamble->data; p != NULL && p < preamble->data + preamble->size; ) {
+        size_t line_length = strcspn(p, "\n");
+        if (line_length == length && memcmp(p, line, length) == 0) {
+            return true;
+        }
+        p += line_length + 1;
+    }
+    return false;
+}
+
+// Join the parts' code in order. The imports each part opens with are
+// gathered, once each, at the top of the program.
+static char *join_parts(const part_t *parts, size_t count, size_t *output_length) {
+    buffer_t preamble = { NULL, 0, 0 };
+    buffer_t body = { NULL, 0, 0 };
+    bool success = true;
+    
+    for (size_t i = 0; i < count && success; i++) {
+        const char *code = parts[i].code;
+        const char *end = code + parts[i].code_length;
+        
+        // The part's leading imports and blank lines
+        while (code < end && success) {
+            const char *newline = memchr(code, '\n', end - code);
+            const char *line_end = newline != NULL ? newline : end;
+            size_t length = line_end - code;
+            while (length > 0 && (code[length - 1] == '\r' || code[length - 1] == ' ' || code[length - 1] == '\t')) {
+                length--;
+            }
+            if (length > 0 && !is_preamble_line(code, length)) {
+                break;
+            }
+            if (length > 0 && !preamble_contains(&preamble, code, length)) {
+                success = buffer_append(&preamble, code, length) && buffer_append_string(&preamble, "\n");
+            }
+            code = newline != NULL ? newline + 1 : end;
+        }
+        
+        // Trailing newlines would widen the gap between parts
+        while (end > code && (end[-1] == '\n' || end[-1] == '\r')) {
+            end--;
+        }
+        if (end > code) {
+            success = success && (body.size == 0 || buffer_append_string(&body, PART_SEPARATOR)) &&
+                      buffer_append(&body, code, end - code);
+        }
+    }
+    
+    buffer_t output = { NULL, 0, 0 };
+    success = success && buffer_append_string(&output, "") &&
+              (preamble.size == 0 || buffer_append(&output, preamble.data, preamble.size)) &&
+              (preamble.size == 0 || body.size == 0 || buffer_append_string(&output, "\n")) &&
+              (body.size == 0 || buffer_append(&output, body.data, body.size));
+    free(preamble.data);
+    free(body.data);
+    if (!success) {
+        fprintf(stderr, "Error: Out of memory\n");
+        free(output.data);
+        return NULL;
+    }
+    
+    *output_length = output.size;
+    return output.data;
+}
+
+// Ask the model to merge the parts' code into one program
+static char *merge_with_model(const part_t *parts, size_t count, const char *target_language, const char *hint,
+                              size_t *output_length) {
+    buffer_t prompt = { NULL, 0, 0 };
+    bool built = (hint[0] == '\0' ||
+                  (buffer_append_string(&prompt, "@hint ") && buffer_append_string(&prompt, hint) &&
+                   buffer_append_string(&prompt, "\n"))) &&
+                 buffer_append_string(&prompt, "The parts below were written separately as parts of one program. "
+                                      "Merge them into one coherent program: put the imports together at the top, "
+                                      "remove duplicated definitions and declarations, and keep everything else "
+                                      "unchanged.");
+    for (size_t i = 0; i < count && built; i++) {
+        char heading[64];
+        snprintf(heading, sizeof(heading), "\n\nPart %zu:\n", i + 1);
+        built = buffer_append_string(&prompt, heading) && buffer_append(&prompt, parts[i].code, parts[i].code_length);
+    }
+    if (!built) {
+        free(prompt.data);
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    
+    char *output = english_compile(prompt.data, target_language, output_length);
+    free(prompt.data);
+    return output;
+}
+
+char *chunk_compile(const char *english_text, size_t length, const char *target_language, size_t budget_tokens,
+                    chunk_merge_t merge, int max_parallel, size_t *output_length) {
+    bool verbose = english_is_verbose();
+    if (budget_tokens < CHUNK_MIN_TOKENS) {
+        budget_tokens = CHUNK_MIN_TOKENS;
+    }
+    
+    // The routing hint applies to the whole description, so every part carries it
+    char hint[MAX_HINT_LENGTH];
+    const char *text = router_read_hint(english_text, hint, sizeof(hint));
+    const char *end = english_text + length;
+    
+    size_t count;
+    part_t *parts = split_parts(text, end, budget_tokens, &count);
+    if (parts == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    if (count <= 1) {
+        // Nothing to cut, so it is an ordinary compile, cached as one
+        free(parts);
+        if (verbose) {
+            fprintf(stderr, "Verbose mode: Description fits in one part of %zu tokens\n", budget_tokens);
+        }
+        return english_compile(english_text, target_language, output_length);
+    }
+    
+    buffer_t outline = { NULL, 0, 0 };
+    bool prepared = build_outline(&outline, parts, count, budget_tokens);
+    size_t largest = 0;
+    for (size_t i = 0; i < count && prepared; i++) {
+        parts[i].prompt = build_part_prompt(&parts[i], i, count, hint, &outline);
+        prepared = parts[i].prompt != NULL;
+        size_t tokens = tokens_estimate(parts[i].text, parts[i].length);
+        largest = tokens > largest ? tokens : largest;
+        if (verbose) {
+            fprintf(stderr, "Verbose mode: Part %zu (~%zu tokens): %.*s\n", i + 1, tokens,
+                    (int)parts[i].title_length, parts[i].title);
+        }
+    }
+    free(outline.data);
+    
+    double started = monotonic_ms();
+    bool success = false;
+    if (!prepared) {
+        fprintf(stderr, "Error: Out of memory\n");
+        for (size_t i = 0; i < count; i++) {
+            free(parts[i].prompt);
+        }
+    } else {
+        if (verbose) {
+            fprintf(stderr, "Verbose mode: Compiling %zu parts, the largest ~%zu tokens\n", count,
+                    largest);
+        }
+        success = compile_parts(parts, count, target_language, max_parallel > 0 ? max_parallel : 1);
+    }
+    
+    char *output = NULL;
+    if (success) {
+        if (verbose) {
+            fprintf(stderr, "Verbose mode: Parts compiled in %.0f ms\n", monotonic_ms() - started);
+        }
+        if (merge == CHUNK_MERGE_MODEL) {
+            output = merge_with_model(parts, count, target_language, hint, output_length);
+            if (output == NULL && !english_is_cancelled()) {
+                fprintf(stderr, "Warning: The model could not merge the parts, joining them instead\n");
+            }
+        }
+        if (output == NULL && !english_is_cancelled()) {
+            output = join_parts(parts, count, output_length);
+        }
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        free(parts[i].code);
+    }
+    free(parts);
+    return output;
+}
@@ -1,8 +1,10 @@
 #include "../include/config.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -12,14 +14,31 @@
 #define MAX_PATH_LENGTH 1024
 #define MAX_KEY_LENGTH 1024
 #define MAX_MODEL_LENGTH 256
+#define MAX_KEEP_ALIVE_LENGTH 64
 #define DEFAULT_MODEL "llama3"
+#define DEFAULT_CACHE_SIZE_MB 64
+#define DEFAULT_HEDGE_PERCENTILE 95.0
+#define DEFAULT_SEMANTIC_THRESHOLD 0.95
 
 static char config_dir[MAX_PATH_LENGTH];
 static char config_file[MAX_PATH_LENGTH];
 static char api_key[MAX_KEY_LENGTH];
 static char model[MAX_MODEL_LENGTH];
+static char endpoint[MAX_KEY_LENGTH];
+static char keep_alive[MAX_KEEP_ALIVE_LENGTH];
+static unsigned long cache_size_mb;
+static double hedge_percentile;   // Negative when not configured
+static char semantic_model[MAX_MODEL_LENGTH];
+static double semantic_threshold; // 0 when not configured
+static long num_ctx;              // CONFIG_AUTO when not configured
+static long num_predict;          // CONFIG_AUTO when not configured
+static char routes[CONFIG_MAX_ROUTES][MAX_KEY_LENGTH];
+static size_t route_count;
+static char validators[CONFIG_MAX_VALIDATORS][MAX_KEY_LENGTH];
+static size_t validator_count;
+static time_t config_mtime;
 
-static bool ensure_config_dir(void);
+static bool ensure_dir(const char *path);
 static bool load_config(void);
 static bool save_config(void);
 
@@ -38,7 +57,7 @@ bool config_init(void) {
     snprintf(config_file, sizeof(config_file), "%s/%s", config_dir, CONFIG_FILE_NAME);
     
     // Ensure the config directory exists
-    if (!ensure_config_dir()) {
+    if (!ensure_dir(config_dir)) {
         return false;
     }
     
@@ -80,39 +99,168 @@ const char *config_get_model(void) {
     return model[0] != '\0' ? model : DEFAULT_MODEL;
 }
 
+bool config_set_endpoint(const char *endpoint_value) {
+    if (endpoint_value == NULL) {
+        return false;
+    }
+    
+    strncpy(endpoint, endpoint_value, sizeof(endpoint) - 1);
+    endpoint[sizeof(endpoint) - 1] = '\0';
+    
+    return save_config();
+}
+
+const char *config_get_endpoint(void) {
+    return endpoint[0] != '\0' ? endpoint : NULL;
+}
+
+bool config_set_keep_alive(const char *keep_alive_value) {
+    if (keep_alive_value == NULL) {
+        return false;
+    }
+    
+    strncpy(keep_alive, keep_alive_value, sizeof(keep_alive) - 1);
+    keep_alive[sizeof(keep_alive) - 1] = '\0';
+    
+    return save_config();
+}
+
+const char *config_get_keep_alive(void) {
+    return keep_alive[0] != '\0' ? keep_alive : NULL;
+}
+
+bool config_refresh(void) {
+    struct stat st;
+    time_t mtime = stat(config_file, &st) == 0 ? st.st_mtime : 0;
+    
+    if (mtime == config_mtime) {
+        return true;
+    }
+    return load_config();
+}
+
+const char *config_get_dir(void) {
+    return config_dir;
+}
+
+bool config_get_subdir(const char *name, char *path, size_t path_size) {
+    if (name == NULL || path == NULL || path_size == 0) {
+        return false;
+    }
+    
+    int written = snprintf(path, path_size, "%s/%s", config_dir, name);
+    if (written < 0 || (size_t)written >= path_size) {
+        fprintf(stderr, "Error: Path for %s is too long\n", name);
+        return false;
+    }
+    
+    return ensure_dir(path);
+}
+
+size_t config_get_cache_max_bytes(void) {
+    unsigned long size_mb = cache_size_mb != 0 ? cache_size_mb : DEFAULT_CACHE_SIZE_MB;
+    return (size_t)size_mb * 1024 * 1024;
+}
+
+double config_get_hedge_percentile(void) {
+    return hedge_percentile >= 0 ? hedge_percentile : DEFAULT_HEDGE_PERCENTILE;
+}
+
+const char *config_get_semantic_model(void) {
+    return semantic_model[0] != '\0' ? semantic_model : NULL;
+}
+
+double config_get_semantic_threshold(void) {
+    return semantic_threshold > 0 ? semantic_threshold : DEFAULT_SEMANTIC_THRESHOLD;
+}
+
+long config_get_num_ctx(void) {
+    return num_ctx;
+}
+
+long config_get_num_predict(void) {
+    return num_predict;
+}
+
+size_t config_get_route_count(void) {
+    return route_count;
+}
+
+const char *config_get_route(size_t index) {
+    return index < route_count ? routes[index] : NULL;
+}
+
+const char *config_get_validator(const char *language) {
+    size_t length = strlen(language);
+    for (size_t i = 0; i < validator_count; i++) {
+        const char *command = validators[i] + length;
+        if (strncasecmp(validators[i], language, length) == 0 && (*command == ' ' || *command == '\t')) {
+            while (*command == ' ' || *command == '\t') {
+                command++;
+            }
+            return command;
+        }
+    }
+    return NULL;
+}
+
 void config_cleanup(void) {
     // Nothing to clean up for now
 }
 
-static bool ensure_config_dir(void) {
+static bool ensure_dir(const char *path) {
     struct stat st;
     
     // Check if the directory exists
-    if (stat(config_dir, &st) == 0) {
+    if (stat(path, &st) == 0) {
         // Check if it's a directory
         if (S_ISDIR(st.st_mode)) {
             return true;
         }
         
-        fprintf(stderr, "Error: %s exists but is not a directory\n", config_dir);
+        fprintf(stderr, "Error: %s exists but is not a directory\n", path);
         return false;
     }
     
-    // Create the directory
-    if (mkdir(config_dir, 0700) != 0) {
-        fprintf(stderr, "Error: Could not create directory %s\n", config_dir);
+    // Create the directory (another process may have just done so)
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create directory %s\n", path);
         return false;
     }
     
     return true;
 }
 
+// A token count, "off" (or 0) for the server's own default, or "auto"
+static long parse_token_limit(const char *value) {
+    if (strcasecmp(value, "off") == 0) {
+        return 0;
+    }
+    char *end;
+    long tokens = strtol(value, &end, 10);
+    return end != value && *end == '\0' && tokens >= 0 ? tokens : CONFIG_AUTO;
+}
+
 static bool load_config(void) {
+    // Remember which version of the file was loaded, for config_refresh
+    struct stat st;
+    config_mtime = stat(config_file, &st) == 0 ? st.st_mtime : 0;
+    
     FILE *file = fopen(config_file, "r");
     if (file == NULL) {
         // It's okay if the file doesn't exist yet
         api_key[0] = '\0';
         model[0] = '\0';  // Default model will be used
+        endpoint[0] = '\0';
+        keep_alive[0] = '\0';
+        cache_size_mb = 0;
+        hedge_percentile = -1;
+        semantic_model[0] = '\0';
+        semantic_threshold = 0;
+        num_ctx = CONFIG_AUTO;
+        num_predict = CONFIG_AUTO;
+        route_count = 0;
+        validator_count = 0;
         return true;
     }
     
@@ -123,6 +271,16 @@ static bool load_config(void) {
     // Initialize with empty values
     api_key[0] = '\0';
     model[0] = '\0';
+    endpoint[0] = '\0';
+    keep_alive[0] = '\0';
+    cache_size_mb = 0;
+    hedge_percentile = -1;
+    semantic_model[0] = '\0';
+    semantic_threshold = 0;
+    num_ctx = CONFIG_AUTO;
+    num_predict = CONFIG_AUTO;
+    route_count = 0;
+    validator_count = 0;
     
     // Read each line of the config file
     while (fgets(line, sizeof(line), file) != NULL) {
@@ -146,6 +304,34 @@ static bool load_config(void) {
             } else if (strcmp(key, "model") == 0) {
                 strncpy(model, value, sizeof(model) - 1);
                 model[sizeof(model) - 1] = '\0';
+            } else if (strcmp(key, "endpoint") == 0) {
+                strncpy(endpoint, value, sizeof(endpoint) - 1);
+                endpoint[sizeof(endpoint) - 1] = '\0';
+            } else if (strcmp(key, "keep_alive") == 0) {
+                strncpy(keep_alive, value, sizeof(keep_alive) - 1);
+                keep_alive[sizeof(keep_alive) - 1] = '\0';
+            } else if (strcmp(key, "cache_size_mb") == 0) {
+                cache_size_mb = strtoul(value, NULL, 10);
+            } else if (strcmp(key, "hedge_percentile") == 0) {
+                hedge_percentile = strtod(value, NULL);
+            } else if (strcmp(key, "semantic_model") == 0) {
+                strncpy(semantic_model, value, sizeof(semantic_model) - 1);
+                semantic_model[sizeof(semantic_model) - 1] = '\0';
+            } else if (strcmp(key, "semantic_threshold") == 0) {
+                semantic_threshold = strtod(value, NULL);
+            } else if (strcmp(key, "num_ctx") == 0) {
+                num_ctx = strcasecmp(value, "grow") == 0 ? CONFIG_GROW : parse_token_limit(value);
+            } else if (strcmp(key, "num_predict") == 0) {
+                num_predict = parse_token_limit(value);
+            } else if (strcmp(key, "route") == 0 && route_count < CONFIG_MAX_ROUTES) {
+                // Routing rules are kept in the order they appear
+                strncpy(routes[route_count], value, sizeof(routes[route_count]) - 1);
+                routes[route_count][sizeof(routes[route_count]) - 1] = '\0';
+                route_count++;
+            } else if (strcmp(key, "validator") == 0 && validator_count < CONFIG_MAX_VALIDATORS) {
+                strncpy(validators[validator_count], value, sizeof(validators[validator_count]) - 1);
+                validators[validator_count][sizeof(validators[validator_count]) - 1] = '\0';
+                validator_count++;
             }
         }
     }
@@ -169,6 +355,54 @@ static bool save_config(void) {
         fprintf(file, "model=%s\n", model);
     }
     
+    // Only write the endpoint if it was changed from the default
+    if (endpoint[0] != '\0') {
+        fprintf(file, "endpoint=%s\n", endpoint);
+    }
+    
+    // Only write how long models stay loaded if it was configured
+    if (keep_alive[0] != '\0') {
+        fprintf(file, "keep_alive=%s\n", keep_alive);
+    }
+    
+    // Only write the cache size if it was configured
+    if (cache_size_mb != 0) {
+        fprintf(file, "cache_size_mb=%lu\n", cache_size_mb);
+    }
+    
+    // Only write the hedging percentile if it was configured
+    if (hedge_percentile >= 0) {
+        fprintf(file, "hedge_percentile=%g\n", hedge_percentile);
+    }
+    
+    // Only write the semantic cache settings if they were configured
+    if (semantic_model[0] != '\0') {
+        fprintf(file, "semantic_model=%s\n", semantic_model);
+    }
+    if (semantic_threshold > 0) {
+        fprintf(file, "semantic_threshold=%g\n", semantic_threshold);
+    }
+    
+    // Only write the request sizes if they were configured
+    if (num_ctx == CONFIG_GROW) {
+        fprintf(file, "num_ctx=grow\n");
+    } else if (num_ctx != CONFIG_AUTO) {
+        fprintf(file, num_ctx > 0 ? "num_ctx=%ld\n" : "num_ctx=off\n", num_ctx);
+    }
+    if (num_predict != CONFIG_AUTO) {
+        fprintf(file, num_predict > 0 ? "num_predict=%ld\n" : "num_predict=off\n", num_predict);
+    }
+    
+    // Routing rules, in order
+    for (size_t i = 0; i < route_count; i++) {
+        fprintf(file, "route=%s\n", routes[i]);
+    }
+    
+    // Validators of --candidates, one per language
+    for (size_t i = 0; i < validator_count; i++) {
+        fprintf(file, "validator=%s\n", validators[i]);
+    }
+    
     fclose(file);
     return true;
 }
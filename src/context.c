@@ -0,0 +1,422 @@
+#include "../include/context.h"
+#include "../include/balancer.h"
+#include "../include/config.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Idle easy handles and arenas kept per context
+#define CONTEXT_POOL_SIZE 16
+
+// A setting the context leaves to the process-wide one
+#define UNSET -1
+
+// A compile context: pooled easy handles plus the state they share
+struct english_context {
+    CURLSH *share;
+    pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+    struct curl_slist *headers;
+    pthread_mutex_t pool_lock;
+    CURL *idle[CONTEXT_POOL_SIZE];
+    size_t idle_count;
+    CURLM *idle_multis[CONTEXT_POOL_SIZE];  // Each holds the connections its transfers left open
+    size_t idle_multi_count;
+    arena_t *idle_arenas[CONTEXT_POOL_SIZE];
+    size_t idle_arena_count;
+    pthread_mutex_t session_lock;
+    char *session_key;         // Model and language the conversation state belongs to
+    char *session_tokens;      // Ollama's "context" array from the last compile, as JSON
+    size_t session_length;
+    char *model;               // NULL for the configured model
+    char *endpoint;            // NULL for the endpoints of english_set_ollama_endpoint
+    balancer_t *balancer;      // Spreads requests over endpoint, when it is set
+    int verbose;               // The settings below are UNSET unless the context has its own
+    int cache_enabled;
+    int session;
+    int extract_mode;
+    long timeout_ms;
+    int max_retries;
+    size_t window;             // Largest context window asked for so far
+};
+
+static english_context_t *default_context = NULL;
+static pthread_mutex_t default_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Share lock callbacks, so handles may be used from several threads
+static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    english_context_t *context = (english_context_t *)userptr;
+    pthread_mutex_lock(&context->share_locks[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    english_context_t *context = (english_context_t *)userptr;
+    pthread_mutex_unlock(&context->share_locks[data]);
+}
+
+english_context_t *english_context_new(void) {
+    english_context_t *context = calloc(1, sizeof(english_context_t));
+    if (context == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&context->share_locks[i], NULL);
+    }
+    pthread_mutex_init(&context->pool_lock, NULL);
+    pthread_mutex_init(&context->session_lock, NULL);
+    context->verbose = UNSET;
+    context->cache_enabled = UNSET;
+    context->session = UNSET;
+    context->extract_mode = UNSET;
+    context->timeout_ms = UNSET;
+    context->max_retries = UNSET;
+    
+    // Share DNS results and TLS sessions between handles. Live connections
+    // stay in the connection cache of the multi handle that ran them, which
+    // the pool hands out again: libcurl does not support sharing a connection
+    // cache between threads.
+    context->share = curl_share_init();
+    if (context->share == NULL) {
+        fprintf(stderr, "Error: Could not initialize CURL\n");
+        english_context_free(context);
+        return NULL;
+    }
+    curl_share_setopt(context->share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(context->share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(context->share, CURLSHOPT_USERDATA, (void *)context);
+    curl_share_setopt(context->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(context->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    
+    // Every request carries the same headers, so build them once
+    context->headers = curl_slist_append(NULL, "Content-Type: application/json");
+    
+    return context;
+}
+
+void english_context_free(english_context_t *context) {
+    if (context == NULL) {
+        return;
+    }
+    
+    // Handles must go before the share they are attached to; the multi
+    // handles close the connections they keep
+    for (size_t i = 0; i < context->idle_multi_count; i++) {
+        curl_multi_cleanup(context->idle_multis[i]);
+    }
+    for (size_t i = 0; i < context->idle_count; i++) {
+        curl_easy_cleanup(context->idle[i]);
+    }
+    for (size_t i = 0; i < context->idle_arena_count; i++) {
+        arena_free(context->idle_arenas[i]);
+    }
+    if (context->share != NULL) {
+        curl_share_cleanup(context->share);
+    }
+    curl_slist_free_all(context->headers);
+    free(context->session_key);
+    free(context->session_tokens);
+    free(context->model);
+    free(context->endpoint);
+    balancer_free(context->balancer);
+    
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&context->share_locks[i]);
+    }
+    pthread_mutex_destroy(&context->pool_lock);
+    pthread_mutex_destroy(&context->session_lock);
+    free(context);
+}
+
+// Replace a string setting with a copy of value, or clear it for NULL
+static bool set_string(char **setting, const char *value) {
+    char *copy = NULL;
+    if (value != NULL) {
+        copy = malloc(strlen(value) + 1);
+        if (copy == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return false;
+        }
+        memcpy(copy, value, strlen(value) + 1);
+    }
+    free(*setting);
+    *setting = copy;
+    return true;
+}
+
+bool english_context_set_model(english_context_t *context, const char *model) {
+    return set_string(&context->model, model);
+}
+
+bool english_context_set_endpoint(english_context_t *context, const char *endpoint) {
+    if (endpoint == NULL) {
+        balancer_free(context->balancer);
+        context->balancer = NULL;
+        return set_string(&context->endpoint, NULL);
+    }
+    
+    // The context learns about its endpoints on its own, hedging like the default
+    if (context->balancer == NULL) {
+        context->balancer = balancer_new();
+        if (context->balancer == NULL) {
+            return false;
+        }
+        balancer_set_hedge_percentile(context->balancer, config_get_hedge_percentile());
+    }
+    if (!balancer_set_endpoints(context->balancer, endpoint)) {
+        fprintf(stderr, "Error: No endpoint in '%s'\n", endpoint);
+        return false;
+    }
+    return set_string(&context->endpoint, endpoint);
+}
+
+void english_context_set_verbose(english_context_t *context, bool verbose) {
+    context->verbose = verbose;
+}
+
+void english_context_set_cache_enabled(english_context_t *context, bool enabled) {
+    context->cache_enabled = enabled;
+}
+
+void english_context_set_session(english_context_t *context, bool enabled) {
+    context->session = enabled;
+}
+
+void english_context_set_extract_mode(english_context_t *context, english_extract_t mode) {
+    context->extract_mode = (int)mode;
+}
+
+void english_context_set_timeout(english_context_t *context, long timeout_ms) {
+    context->timeout_ms = timeout_ms > 0 ? timeout_ms : 0;
+}
+
+void english_context_set_max_retries(english_context_t *context, int retries) {
+    context->max_retries = retries > 0 ? retries : 0;
+}
+
+const char *context_get_model(const english_context_t *context) {
+    return context->model != NULL ? context->model : config_get_model();
+}
+
+const char *context_get_endpoint(const english_context_t *context) {
+    return context->endpoint != NULL ? context->endpoint : english_get_ollama_endpoint();
+}
+
+balancer_t *context_get_balancer(const english_context_t *context) {
+    if (context->balancer != NULL) {
+        return context->balancer;
+    }
+    
+    // The default endpoint, unless one was set
+    balancer_t *balancer = balancer_get_default();
+    if (balancer_count(balancer) == 0) {
+        balancer_set_endpoints(balancer, english_get_ollama_endpoint());
+    }
+    return balancer;
+}
+
+bool context_is_verbose(const english_context_t *context) {
+    return context->verbose != UNSET ? context->verbose != 0 : english_is_verbose();
+}
+
+bool context_is_cache_enabled(const english_context_t *context) {
+    return context->cache_enabled != UNSET ? context->cache_enabled != 0 : english_is_cache_enabled();
+}
+
+bool context_is_session(const english_context_t *context) {
+    return context->session != UNSET ? context->session != 0 : english_is_session();
+}
+
+english_extract_t context_get_extract_mode(const english_context_t *context) {
+    return context->extract_mode != UNSET ? (english_extract_t)context->extract_mode : english_get_extract_mode();
+}
+
+long context_get_timeout(const english_context_t *context) {
+    return context->timeout_ms != UNSET ? context->timeout_ms : english_get_timeout();
+}
+
+int context_get_max_retries(const english_context_t *context) {
+    return context->max_retries != UNSET ? context->max_retries : english_get_max_retries();
+}
+
+size_t context_fit_window(english_context_t *context, size_t window) {
+    pthread_mutex_lock(&context->pool_lock);
+    if (window > context->window) {
+        context->window = window;
+    }
+    window = context->window;
+    pthread_mutex_unlock(&context->pool_lock);
+    return window;
+}
+
+CURL *context_acquire_handle(english_context_t *context) {
+    CURL *handle = NULL;
+    
+    pthread_mutex_lock(&context->pool_lock);
+    if (context->idle_count > 0) {
+        handle = context->idle[--context->idle_count];
+    }
+    pthread_mutex_unlock(&context->pool_lock);
+    
+    if (handle == NULL) {
+        handle = curl_easy_init();
+        if (handle == NULL) {
+            fprintf(stderr, "Error: Could not initialize CURL\n");
+            return NULL;
+        }
+    }
+    
+    curl_easy_setopt(handle, CURLOPT_SHARE, context->share);
+    return handle;
+}
+
+void context_release_handle(english_context_t *context, CURL *handle) {
+    // Clear per-request options; DNS results and TLS sessions live on in the
+    // share, and connections in the multi handle that ran the transfer
+    curl_easy_reset(handle);
+    
+    pthread_mutex_lock(&context->pool_lock);
+    if (context->idle_count < CONTEXT_POOL_SIZE) {
+        context->idle[context->idle_count++] = handle;
+        handle = NULL;
+    }
+    pthread_mutex_unlock(&context->pool_lock);
+    
+    if (handle != NULL) {
+        curl_easy_cleanup(handle);
+    }
+}
+
+CURLM *context_acquire_multi(english_context_t *context) {
+    CURLM *multi = NULL;
+    
+    pthread_mutex_lock(&context->pool_lock);
+    if (context->idle_multi_count > 0) {
+        multi = context->idle_multis[--context->idle_multi_count];
+    }
+    pthread_mutex_unlock(&context->pool_lock);
+    
+    if (multi == NULL) {
+        multi = curl_multi_init();
+        if (multi == NULL) {
+            fprintf(stderr, "Error: Could not initialize CURL\n");
+        }
+    }
+    return multi;
+}
+
+void context_release_multi(english_context_t *context, CURLM *multi) {
+    pthread_mutex_lock(&context->pool_lock);
+    if (context->idle_multi_count < CONTEXT_POOL_SIZE) {
+        context->idle_multis[context->idle_multi_count++] = multi;
+        multi = NULL;
+    }
+    pthread_mutex_unlock(&context->pool_lock);
+    
+    if (multi != NULL) {
+        curl_multi_cleanup(multi);
+    }
+}
+
+arena_t *context_acquire_arena(english_context_t *context) {
+    arena_t *arena = NULL;
+    
+    pthread_mutex_lock(&context->pool_lock);
+    if (context->idle_arena_count > 0) {
+        arena = context->idle_arenas[--context->idle_arena_count];
+    }
+    pthread_mutex_unlock(&context->pool_lock);
+    
+    if (arena == NULL) {
+        arena = arena_new();
+        if (arena == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+        }
+    }
+    return arena;
+}
+
+void context_release_arena(english_context_t *context, arena_t *arena) {
+    // Everything the request allocated goes at once; the memory stays for the next one
+    arena_reset(arena);
+    
+    pthread_mutex_lock(&context->pool_lock);
+    if (context->idle_arena_count < CONTEXT_POOL_SIZE) {
+        context->idle_arenas[context->idle_arena_count++] = arena;
+        arena = NULL;
+    }
+    pthread_mutex_unlock(&context->pool_lock);
+    
+    arena_free(arena);
+}
+
+struct curl_slist *context_get_headers(english_context_t *context) {
+    return context->headers;
+}
+
+void context_set_session(english_context_t *context, const char *key, const char *tokens, size_t length) {
+    size_t key_length = strlen(key);
+    char *key_copy = malloc(key_length + 1);
+    char *tokens_copy = malloc(length + 1);
+    if (key_copy == NULL || tokens_copy == NULL) {
+        free(key_copy);
+        free(tokens_copy);
+        return;
+    }
+    memcpy(key_copy, key, key_length + 1);
+    memcpy(tokens_copy, tokens, length);
+    tokens_copy[length] = '\0';
+    
+    // Only the latest compile is continued; it already carries the ones before it
+    pthread_mutex_lock(&context->session_lock);
+    free(context->session_key);
+    free(context->session_tokens);
+    context->session_key = key_copy;
+    context->session_tokens = tokens_copy;
+    context->session_length = length;
+    pthread_mutex_unlock(&context->session_lock);
+}
+
+char *context_get_session(english_context_t *context, const char *key, arena_t *arena) {
+    char *tokens = NULL;
+    
+    pthread_mutex_lock(&context->session_lock);
+    if (context->session_key != NULL && strcmp(context->session_key, key) == 0) {
+        tokens = arena_alloc(arena, context->session_length + 1);
+        if (tokens != NULL) {
+            memcpy(tokens, context->session_tokens, context->session_length + 1);
+        }
+    }
+    pthread_mutex_unlock(&context->session_lock);
+    return tokens;
+}
+
+void english_context_clear_session(english_context_t *context) {
+    pthread_mutex_lock(&context->session_lock);
+    free(context->session_key);
+    free(context->session_tokens);
+    context->session_key = NULL;
+    context->session_tokens = NULL;
+    context->session_length = 0;
+    pthread_mutex_unlock(&context->session_lock);
+}
+
+english_context_t *context_get_default(void) {
+    pthread_mutex_lock(&default_lock);
+    if (default_context == NULL) {
+        default_context = english_context_new();
+    }
+    english_context_t *context = default_context;
+    pthread_mutex_unlock(&default_lock);
+    return context;
+}
+
+void context_free_default(void) {
+    english_context_free(default_context);
+    default_context = NULL;
+}
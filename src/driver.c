@@ -0,0 +1,148 @@
+#include "../include/driver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Longest wait for network activity before the requests are polled again
+#define MAX_WAIT_MS 1000
+
+// A request in flight and what it was started for
+typedef struct {
+    english_request_t *request;
+    void *item;
+    bool done;                     // Completed, waiting to be handed back
+} slot_t;
+
+struct driver {
+    CURLM *multi;
+    int max_parallel;
+    slot_t *slots;                 // The requests in flight, in no particular order
+    int count;
+    int capacity;
+};
+
+driver_t *driver_new(int max_parallel) {
+    driver_t *driver = calloc(1, sizeof(driver_t));
+    if (driver == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    
+    driver->multi = curl_multi_init();
+    if (driver->multi == NULL) {
+        fprintf(stderr, "Error: Could not initialize CURL\n");
+        free(driver);
+        return NULL;
+    }
+    
+    // Keep one reusable connection per in-flight request
+    driver->max_parallel = max_parallel > 0 ? max_parallel : 1;
+    curl_multi_setopt(driver->multi, CURLMOPT_MAXCONNECTS, (long)driver->max_parallel);
+    return driver;
+}
+
+bool driver_has_room(const driver_t *driver) {
+    return driver->count < driver->max_parallel;
+}
+
+bool driver_start(driver_t *driver, english_request_t *request, void *item) {
+    if (driver->count == driver->capacity) {
+        int capacity = driver->capacity > 0 ? driver->capacity * 2 : driver->max_parallel;
+        slot_t *grown = realloc(driver->slots, (size_t)capacity * sizeof(slot_t));
+        if (grown == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return false;
+        }
+        driver->slots = grown;
+        driver->capacity = capacity;
+    }
+    
+    if (!request_start(request, driver->multi, item)) {
+        return false;
+    }
+    driver->slots[driver->count++] = (slot_t){ request, item, false };
+    return true;
+}
+
+// The slot of the request that was started for item
+static slot_t *find_slot(driver_t *driver, const void *item) {
+    for (int i = 0; i < driver->count; i++) {
+        if (driver->slots[i].item == item) {
+            return &driver->slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Hand back the first completed request, freeing its slot; NULL if none completed
+static void *take_done(driver_t *driver) {
+    for (int i = 0; i < driver->count; i++) {
+        if (driver->slots[i].done) {
+            void *item = driver->slots[i].item;
+            driver->slots[i] = driver->slots[--driver->count];
+            return item;
+        }
+    }
+    return NULL;
+}
+
+void *driver_next(driver_t *driver) {
+    for (;;) {
+        // Requests that completed together are handed back before waiting again
+        void *item = take_done(driver);
+        if (item != NULL || driver->count == 0) {
+            return item;
+        }
+        
+        int running = 0;
+        curl_multi_perform(driver->multi, &running);
+        
+        // Collect finished transfers
+        bool completed = false;
+        CURLMsg *message;
+        int queued;
+        while ((message = curl_multi_info_read(driver->multi, &queued)) != NULL) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
+            
+            void *owner = NULL;
+            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char **)&owner);
+            slot_t *slot = find_slot(driver, owner);
+            if (slot != NULL && !slot->done &&
+                request_complete_transfer(slot->request, message->easy_handle, message->data.result)) {
+                slot->done = true;
+                completed = true;
+            }
+        }
+        
+        // Give running requests a chance to hedge, retry or give up
+        long shortest = MAX_WAIT_MS;
+        for (int i = 0; i < driver->count; i++) {
+            slot_t *slot = &driver->slots[i];
+            long next;
+            if (slot->done) {
+                continue;
+            }
+            if (request_poll(slot->request, &next)) {
+                slot->done = true;
+                completed = true;
+            } else if (next >= 0 && next < shortest) {
+                shortest = next;
+            }
+        }
+        
+        if (!completed) {
+            curl_multi_poll(driver->multi, NULL, 0, (int)shortest, NULL);
+        }
+    }
+}
+
+void driver_free(driver_t *driver) {
+    if (driver == NULL) {
+        return;
+    }
+    curl_multi_cleanup(driver->multi);
+    free(driver->slots);
+    free(driver);
+}
@@ -1,49 +1,84 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "../include/english.h"
+#include "../include/candidates.h"
 #include "../include/config.h"
+#include "../include/cache.h"
+#include "../include/semcache.h"
+#include "../include/context.h"
+#include "../include/request.h"
+#include "../include/stats.h"
+#include "../include/balancer.h"
 
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <curl/curl.h>
-#include <json-c/json.h>
-
-// Structure to store response data from API calls
-typedef struct {
-    char *data;
-    size_t size;
-} response_data_t;
 
 // Global verbose flag
 static bool verbose_mode = false;
 
-// Default Ollama endpoint
-static char ollama_endpoint[1024] = "http://localhost:11434/api/generate";
+// Whether compiles are served from and stored in the on-disk cache
+static bool cache_enabled = true;
 
-// Callback function for CURL to handle response data
-static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
-    size_t real_size = size * nmemb;
-    response_data_t *resp = (response_data_t *)userp;
-    
-    char *ptr = realloc(resp->data, resp->size + real_size + 1);
-    if (ptr == NULL) {
-        fprintf(stderr, "Error: Out of memory\n");
-        return 0;
-    }
-    
-    resp->data = ptr;
-    memcpy(&(resp->data[resp->size]), contents, real_size);
-    resp->size += real_size;
-    resp->data[resp->size] = '\0';
-    
-    return real_size;
-}
+// Which code compiles return
+static english_extract_t extract_mode = ENGLISH_EXTRACT_FIRST;
+
+// Deadline of each compile in milliseconds (0 for none) and how often it is retried
+static long timeout_ms = 0;
+static int max_retries = 2;
+
+// Whether compiles continue the conversation of the previous one
+static bool session_enabled = false;
+
+// Set from signal handlers, so it can only be an atomic flag
+static volatile sig_atomic_t cancel_requested = 0;
+
+// Ollama endpoint, or a comma-separated list of endpoints to balance over.
+// Each setting is a copy that is never changed or freed, so callers of
+// english_get_ollama_endpoint can keep using it after it is replaced.
+static const char *ollama_endpoint = "http://localhost:11434/api/generate";
+static pthread_mutex_t endpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Time english_init spent loading the configuration
+static double config_load_ms = 0;
+
+// Calls of english_init not yet paired with english_cleanup; only the first
+// and the last touch process-wide state
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static int init_count = 0;
 
 bool english_init(void) {
+    pthread_mutex_lock(&init_lock);
+    if (init_count > 0) {
+        init_count++;
+        pthread_mutex_unlock(&init_lock);
+        return true;
+    }
+    
     // Initialize CURL
     curl_global_init(CURL_GLOBAL_DEFAULT);
     
     // Initialize configuration
-    return config_init();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!config_init()) {
+        curl_global_cleanup();
+        pthread_mutex_unlock(&init_lock);
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    config_load_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    
+    // A saved endpoint replaces the default
+    english_set_ollama_endpoint(config_get_endpoint());
+    balancer_set_hedge_percentile(balancer_get_default(), config_get_hedge_percentile());
+    init_count = 1;
+    pthread_mutex_unlock(&init_lock);
+    return true;
 }
 
 bool english_config_set_key(const char *key_value) {
@@ -70,214 +105,215 @@ bool english_is_verbose(void) {
     return verbose_mode;
 }
 
-void english_set_ollama_endpoint(const char *endpoint) {
-    if (endpoint != NULL) {
-        strncpy(ollama_endpoint, endpoint, sizeof(ollama_endpoint) - 1);
-        ollama_endpoint[sizeof(ollama_endpoint) - 1] = '\0';
-    }
+void english_set_cache_enabled(bool enabled) {
+    cache_enabled = enabled;
 }
 
-const char *english_get_ollama_endpoint(void) {
-    return ollama_endpoint;
+bool english_is_cache_enabled(void) {
+    return cache_enabled;
+}
+
+void english_set_extract_mode(english_extract_t mode) {
+    extract_mode = mode;
 }
 
-bool english_compile(const char *english_text, const char *target_language, 
-                     char *output, size_t output_size) {
-    if (english_text == NULL || target_language == NULL || output == NULL || output_size == 0) {
+english_extract_t english_get_extract_mode(void) {
+    return extract_mode;
+}
+
+void english_set_timeout(long timeout) {
+    timeout_ms = timeout > 0 ? timeout : 0;
+}
+
+long english_get_timeout(void) {
+    return timeout_ms;
+}
+
+void english_set_max_retries(int retries) {
+    max_retries = retries > 0 ? retries : 0;
+}
+
+int english_get_max_retries(void) {
+    return max_retries;
+}
+
+void english_cancel(void) {
+    cancel_requested = 1;
+}
+
+bool english_is_cancelled(void) {
+    return cancel_requested != 0;
+}
+
+void english_reset_cancel(void) {
+    cancel_requested = 0;
+}
+
+void english_set_session(bool enabled) {
+    session_enabled = enabled;
+}
+
+bool english_is_session(void) {
+    return session_enabled;
+}
+
+bool english_warm(const char *keep_alive) {
+    english_context_t *context = context_get_default();
+    if (context == NULL) {
         return false;
     }
     
-    // Get the model name (no API key needed for Ollama)
-    const char *model_name = config_get_model();
-    
-    if (verbose_mode) {
-        fprintf(stderr, "Verbose mode: Using Ollama model: %s\n", model_name);
-        fprintf(stderr, "Verbose mode: Using Ollama endpoint: %s\n", ollama_endpoint);
+    return request_warm(context, keep_alive != NULL ? keep_alive : config_get_keep_alive());
+}
+
+void english_set_ollama_endpoint(const char *endpoint) {
+    if (endpoint == NULL) {
+        return;
     }
     
-    // Initialize CURL
-    CURL *curl = curl_easy_init();
-    if (curl == NULL) {
-        fprintf(stderr, "Error: Could not initialize CURL\n");
-        return false;
+    // The daemon sets the configured endpoint before every request, which
+    // mostly changes nothing
+    pthread_mutex_lock(&endpoint_lock);
+    if (strcmp(endpoint, ollama_endpoint) != 0) {
+        char *copy = strdup(endpoint);
+        if (copy == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+        } else {
+            ollama_endpoint = copy;
+            balancer_set_endpoints(balancer_get_default(), copy);
+        }
+    }
+    pthread_mutex_unlock(&endpoint_lock);
+}
+
+const char *english_get_ollama_endpoint(void) {
+    pthread_mutex_lock(&endpoint_lock);
+    const char *endpoint = ollama_endpoint;
+    pthread_mutex_unlock(&endpoint_lock);
+    return endpoint;
+}
+
+char *english_compile(const char *english_text, const char *target_language, size_t *output_length) {
+    english_context_t *context = context_get_default();
+    if (context == NULL) {
+        return NULL;
     }
     
-    // Set up the request
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    
-    // Create the request payload for Ollama
-    json_object *request = json_object_new_object();
-    
-    // Add model
-    json_object *model = json_object_new_string(model_name);
-    json_object_object_add(request, "model", model);
-    
-    // Create the prompt with system and user message combined
-    char prompt[8192];
-    snprintf(prompt, sizeof(prompt), 
-             "You are a compiler that translates English to %s code. IMPORTANT: Generate ONLY code with NO explanations, comments, or any other text.\n\n"
-             "Your response must ONLY contain valid %s code and nothing else. Do not include any explanations before or after the code.\n\n"
-             "Translate the following English description into %s code:\n\n%s\n\nCode:", 
-             target_language, target_language, target_language, english_text);
-    
-    json_object *prompt_obj = json_object_new_string(prompt);
-    json_object_object_add(request, "prompt", prompt_obj);
-    
-    // Add temperature parameter
-    json_object *temperature = json_object_new_double(0.1);
-    json_object_object_add(request, "temperature", temperature);
+    return english_context_compile(context, english_text, target_language, output_length);
+}
+
+char *english_context_compile(english_context_t *context, const char *english_text, const char *target_language,
+                              size_t *output_length) {
+    if (context == NULL || english_text == NULL || target_language == NULL) {
+        return NULL;
+    }
     
-    // Add stream parameter (false for non-streaming response)
-    json_object *stream = json_object_new_boolean(0);
-    json_object_object_add(request, "stream", stream);
+    english_request_t *request = request_new(context, english_text, target_language, NULL, NULL);
+    if (request == NULL) {
+        return NULL;
+    }
     
-    // Convert the request to a string
-    const char *request_str = json_object_to_json_string(request);
+    // Perform the request
+    if (!request_is_cached(request) && context_is_verbose(context)) {
+        fprintf(stderr, "Verbose mode: Sending request to Ollama API...\n");
+    }
+    request_perform(request);
     
-    if (verbose_mode) {
-        fprintf(stderr, "Verbose mode: Request payload: %s\n", request_str);
+    // Hand the code over without copying it
+    char *output = NULL;
+    if (request_finish(request)) {
+        output = request_take_output(request, output_length);
     }
     
-    // Set up CURL options for Ollama
-    curl_easy_setopt(curl, CURLOPT_URL, ollama_endpoint);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request_str);
+    request_free(request);
+    return output;
+}
+
+char *english_compile_candidates(const char *english_text, const char *target_language, int candidates,
+                                 size_t *output_length) {
+    english_context_t *context = context_get_default();
+    if (context == NULL) {
+        return NULL;
+    }
     
-    // Set up the response data
-    response_data_t response_data;
-    response_data.data = malloc(1);
-    response_data.size = 0;
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response_data);
+    return english_context_compile_candidates(context, english_text, target_language, candidates, output_length);
+}
+
+char *english_context_compile_candidates(english_context_t *context, const char *english_text,
+                                         const char *target_language, int candidates, size_t *output_length) {
+    if (context == NULL || english_text == NULL || target_language == NULL) {
+        return NULL;
+    }
     
-    // Perform the request
-    if (verbose_mode) {
-        fprintf(stderr, "Verbose mode: Sending request to Ollama API...\n");
+    // A session continues from one answer, so it cannot sample several
+    if (candidates <= 1 || context_is_session(context)) {
+        return english_context_compile(context, english_text, target_language, output_length);
+    }
+    return candidates_compile(context, english_text, target_language, candidates, output_length);
+}
+
+bool english_compile_stream(const char *english_text, const char *target_language,
+                            english_stream_callback callback, void *userdata) {
+    english_context_t *context = context_get_default();
+    if (context == NULL) {
+        return false;
     }
     
-    CURLcode res = curl_easy_perform(curl);
-    bool success = false;
+    return english_context_compile_stream(context, english_text, target_language, callback, userdata);
+}
+
+bool english_context_compile_stream(english_context_t *context, const char *english_text, const char *target_language,
+                                    english_stream_callback callback, void *userdata) {
+    if (context == NULL || english_text == NULL || target_language == NULL || callback == NULL) {
+        return false;
+    }
     
-    if (res != CURLE_OK) {
-        fprintf(stderr, "Error: CURL request failed: %s\n", curl_easy_strerror(res));
-    } else {
-        if (verbose_mode) {
-            fprintf(stderr, "Verbose mode: Received response from Ollama API\n");
-        }
-        if (verbose_mode) {
-            fprintf(stderr, "Verbose mode: Raw response: %s\n", response_data.data);
-        }
-        
-        // Parse the response from Ollama
-        json_object *response = json_tokener_parse(response_data.data);
-        if (response == NULL) {
-            fprintf(stderr, "Error: Could not parse JSON response\n");
-        } else {
-            // Get the response content directly (Ollama format is different from OpenAI)
-            json_object *response_content;
-            if (json_object_object_get_ex(response, "response", &response_content)) {
-                // Copy the content to the output buffer
-                const char *content_str = json_object_get_string(response_content);
-                
-                // Extract code from markdown code blocks or after 'Code:' marker
-                char *code_start = NULL;
-                char *code_end = NULL;
-                
-                // Check for markdown code block format: ```language
-                // followed by code and then closing ```
-                char *markdown_start = strstr(content_str, "```");
-                if (markdown_start) {
-                    // Find the end of the language specifier line
-                    char *newline = strchr(markdown_start + 3, '\n');
-                    if (newline) {
-                        // Start of actual code is after the newline
-                        code_start = newline + 1;
-                        
-                        // Find the closing code block marker
-                        code_end = strstr(code_start, "```");
-                        if (code_end) {
-                            // Create a temporary buffer to hold just the code
-                            size_t code_length = code_end - code_start;
-                            char *temp_code = malloc(code_length + 1);
-                            if (temp_code) {
-                                // Copy just the code part
-                                strncpy(temp_code, code_start, code_length);
-                                temp_code[code_length] = '\0';
-                                
-                                // Copy to output
-                                strncpy(output, temp_code, output_size - 1);
-                                free(temp_code);
-                            } else {
-                                // Memory allocation failed, fall back to using the whole content
-                                strncpy(output, content_str, output_size - 1);
-                            }
-                        } else {
-                            // No closing marker, use from code_start to the end
-                            strncpy(output, code_start, output_size - 1);
-                        }
-                    } else {
-                        // No newline after code block marker, fall back to whole content
-                        strncpy(output, content_str, output_size - 1);
-                    }
-                } else {
-                    // No markdown code block, check for 'Code:' marker
-                    code_start = strstr(content_str, "Code:");
-                    if (code_start) {
-                        // Move past the 'Code:' prefix
-                        code_start += 5;  // Length of 'Code:'
-                        // Skip any leading whitespace
-                        while (*code_start && (*code_start == ' ' || *code_start == '\n' || *code_start == '\t' || *code_start == '\r')) {
-                            code_start++;
-                        }
-                        strncpy(output, code_start, output_size - 1);
-                    } else {
-                        // No code markers found, use the whole response
-                        strncpy(output, content_str, output_size - 1);
-                    }
-                }
-                
-                output[output_size - 1] = '\0';
-                success = true;
-                
-                if (verbose_mode) {
-                    fprintf(stderr, "Verbose mode: Successfully parsed response\n");
-                }
-            } else {
-                // Check for error message
-                json_object *error;
-                if (json_object_object_get_ex(response, "error", &error)) {
-                    const char *error_str = json_object_get_string(error);
-                    fprintf(stderr, "Error from Ollama: %s\n", error_str);
-                    
-                    // Provide more helpful error message for common errors
-                    if (strstr(error_str, "model not found") != NULL) {
-                        fprintf(stderr, "The model '%s' is not available in your Ollama installation.\n", model_name);
-                        fprintf(stderr, "Try setting a different model with 'english set model MODEL_NAME'\n");
-                        fprintf(stderr, "Common Ollama models include: llama3, codellama, mistral, gemma\n");
-                    }
-                } else {
-                    fprintf(stderr, "Error: Unexpected response format from Ollama\n");
-                }
-            }
-            
-            json_object_put(response);
-        }
+    english_request_t *request = request_new(context, english_text, target_language, callback, userdata);
+    if (request == NULL) {
+        return false;
     }
     
-    // Clean up
-    free(response_data.data);
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    json_object_put(request);
+    if (!request_is_cached(request) && context_is_verbose(context)) {
+        fprintf(stderr, "Verbose mode: Sending streaming request to Ollama API...\n");
+    }
+    request_perform(request);
     
+    bool success = request_finish(request);
+    request_free(request);
     return success;
 }
 
+bool english_get_last_stats(english_stats_t *stats) {
+    if (stats == NULL || !stats_get_last(stats)) {
+        return false;
+    }
+    
+    // The configuration is loaded once per process, not per compile
+    stats->config_ms = config_load_ms;
+    return true;
+}
+
 void english_cleanup(void) {
+    pthread_mutex_lock(&init_lock);
+    if (init_count == 0 || --init_count > 0) {
+        pthread_mutex_unlock(&init_lock);
+        return;
+    }
+    
+    // Release pooled handles and connections of english_compile
+    context_free_default();
+    
+    // Release the cache indexes
+    cache_close();
+    semcache_close();
+    
+    // Unmap the latency histograms
+    stats_close();
+    
     // Clean up configuration
     config_cleanup();
     
     // Clean up CURL
     curl_global_cleanup();
+    pthread_mutex_unlock(&init_lock);
 }
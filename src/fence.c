@@ -0,0 +1,174 @@
+#define _DEFAULT_SOURCE
+
+#include "../include/fence.h"
+
+#include <string.h>
+#include <strings.h>
+
+// Shortest run of backticks that makes a fence
+#define FENCE_MIN_RUN 3
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Find the next run of at least min_run backticks; memchr skips the text in between
+static const char *find_run(const char *p, const char *end, size_t min_run, size_t *run) {
+    while (p < end) {
+        const char *tick = memchr(p, '`', end - p);
+        if (tick == NULL) {
+            return NULL;
+        }
+        
+        const char *after = tick + 1;
+        while (after < end && *after == '`') {
+            after++;
+        }
+        if ((size_t)(after - tick) >= min_run) {
+            *run = after - tick;
+            return tick;
+        }
+        p = after;
+    }
+    return NULL;
+}
+
+// Whether only blanks separate a position from the start of its line
+static bool starts_line(const char *start, const char *p) {
+    while (p > start && is_blank(p[-1])) {
+        p--;
+    }
+    return p == start || p[-1] == '\n';
+}
+
+// Whether only blanks separate a position from the end of its line
+static bool ends_line(const char *p, const char *end) {
+    while (p < end && is_blank(*p)) {
+        p++;
+    }
+    return p == end || *p == '\n';
+}
+
+bool fence_next(const char *text, size_t length, size_t *offset, fence_block_t *block) {
+    const char *end = text + length;
+    const char *p = text + *offset;
+    size_t run;
+    
+    while ((p = find_run(p, end, FENCE_MIN_RUN, &run)) != NULL) {
+        const char *info = p + run;
+        const char *newline = memchr(info, '\n', end - info);
+        if (newline == NULL) {
+            // An opening fence needs a line of code after it
+            break;
+        }
+        
+        // Backticks in the info string make this line inline code, not a fence
+        if (memchr(info, '`', newline - info) != NULL) {
+            p = newline;
+            continue;
+        }
+        
+        // The first word of the info string is the language, the rest is kept as is
+        while (info < newline && is_blank(*info)) {
+            info++;
+        }
+        const char *info_end = newline;
+        while (info_end > info && is_blank(info_end[-1])) {
+            info_end--;
+        }
+        const char *tag_end = info;
+        while (tag_end < info_end && !is_blank(*tag_end)) {
+            tag_end++;
+        }
+        block->language = info;
+        block->language_length = tag_end - info;
+        while (tag_end < info_end && is_blank(*tag_end)) {
+            tag_end++;
+        }
+        block->info = tag_end;
+        block->info_length = info_end - tag_end;
+        
+        // The block closes at a run at least as long as the opening one that
+        // starts or ends a line
+        const char *code = newline + 1;
+        const char *search = code;
+        const char *close;
+        size_t close_run;
+        while ((close = find_run(search, end, run, &close_run)) != NULL) {
+            if (starts_line(code, close) || ends_line(close + close_run, end)) {
+                break;
+            }
+            search = close + close_run;
+        }
+        
+        const char *code_end = close != NULL ? close : end;
+        if (close != NULL && starts_line(code, close)) {
+            // Drop the indentation of the closing fence
+            while (code_end > code && is_blank(code_end[-1])) {
+                code_end--;
+            }
+        }
+        
+        block->code = code;
+        block->code_length = code_end - code;
+        block->closed = close != NULL;
+        *offset = (close != NULL ? close + close_run : end) - text;
+        return true;
+    }
+    
+    *offset = length;
+    return false;
+}
+
+const char *fence_extract(const char *text, size_t length, size_t *code_length) {
+    size_t offset = 0;
+    fence_block_t block;
+    if (fence_next(text, length, &offset, &block)) {
+        *code_length = block.code_length;
+        return block.code;
+    }
+    
+    // No fenced block, check for a 'Code:' marker
+    const char *end = text + length;
+    for (const char *p = text; (p = memchr(p, 'C', end - p)) != NULL; p++) {
+        if ((size_t)(end - p) >= 5 && memcmp(p, "Code:", 5) == 0) {
+            // Skip any leading whitespace
+            const char *code = p + 5;
+            while (code < end && (is_blank(*code) || *code == '\n')) {
+                code++;
+            }
+            *code_length = end - code;
+            return code;
+        }
+    }
+    
+    // No code markers found, use the whole response
+    *code_length = length;
+    return text;
+}
+
+const char *fence_file_extension(const char *language, size_t length) {
+    static const char *const extensions[][2] = {
+        { "python", "py" }, { "py", "py" },
+        { "javascript", "js" }, { "js", "js" },
+        { "typescript", "ts" }, { "ts", "ts" },
+        { "c", "c" }, { "h", "h" },
+        { "cpp", "cpp" }, { "c++", "cpp" }, { "cxx", "cpp" },
+        { "csharp", "cs" }, { "c#", "cs" }, { "cs", "cs" },
+        { "java", "java" }, { "kotlin", "kt" }, { "swift", "swift" },
+        { "go", "go" }, { "golang", "go" }, { "rust", "rs" }, { "rs", "rs" },
+        { "ruby", "rb" }, { "rb", "rb" }, { "php", "php" }, { "perl", "pl" },
+        { "bash", "sh" }, { "sh", "sh" }, { "shell", "sh" }, { "zsh", "sh" },
+        { "html", "html" }, { "css", "css" }, { "json", "json" },
+        { "yaml", "yaml" }, { "yml", "yaml" }, { "toml", "toml" }, { "xml", "xml" },
+        { "sql", "sql" }, { "lua", "lua" }, { "haskell", "hs" }, { "scala", "scala" },
+        { "makefile", "mk" }, { "make", "mk" }, { "dockerfile", "dockerfile" },
+    };
+    
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (strlen(extensions[i][0]) == length && strncasecmp(extensions[i][0], language, length) == 0) {
+            return extensions[i][1];
+        }
+    }
+    return "txt";
+}
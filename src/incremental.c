@@ -0,0 +1,460 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/incremental.h"
+#include "../include/english.h"
+#include "../include/config.h"
+#include "../include/context.h"
+#include "../include/driver.h"
+#include "../include/json.h"
+#include "../include/request.h"
+#include "../include/sha256.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HASH_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+#define MAX_PATH_LENGTH 1024
+
+// Bytes of the manifest read at a time
+#define MANIFEST_READ_SIZE 65536
+
+// Fragments are joined with a blank line between them
+#define FRAGMENT_SEPARATOR "\n\n"
+
+// One section of the description and the code generated for it
+typedef struct {
+    const char *text;              // Start of the section in the description
+    size_t length;
+    char hash[HASH_HEX_SIZE];
+    char *code;                    // Generated fragment, once known
+    size_t code_length;
+    char *prompt_text;             // NUL-terminated copy of the section while it compiles
+    english_request_t *request;
+    bool reused;
+} section_t;
+
+// A section remembered from the previous build
+typedef struct {
+    char hash[HASH_HEX_SIZE];
+    char *code;
+    size_t code_length;
+} manifest_entry_t;
+
+// The sections of a manifest as they are decoded
+typedef struct {
+    manifest_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    manifest_entry_t current;      // The section being read
+    size_t hash_length;            // Bytes of its hash, which must fill the hash exactly
+    bool has_code;
+    bool has_sections;
+} manifest_reader_t;
+
+// Check whether a line holds nothing but whitespace
+static bool is_blank(const char *line, const char *end) {
+    for (const char *p = line; p < end; p++) {
+        if (*p != ' ' && *p != '\t' && *p != '\r') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Append a section, trimmed to its first and last non-blank lines
+static bool add_section(section_t **sections, size_t *count, size_t *capacity, const char *start, const char *end) {
+    if (*count == *capacity) {
+        *capacity = *capacity > 0 ? *capacity * 2 : 16;
+        section_t *grown = realloc(*sections, *capacity * sizeof(section_t));
+        if (grown == NULL) {
+            return false;
+        }
+        *sections = grown;
+    }
+    
+    section_t *section = &(*sections)[(*count)++];
+    memset(section, 0, sizeof(section_t));
+    section->text = start;
+    section->length = end - start;
+    return true;
+}
+
+// Split the description at headings, or at blank lines when there are none
+static section_t *split_sections(const char *text, size_t length, size_t *count) {
+    const char *end = text + length;
+    
+    bool headings = false;
+    for (const char *line = text; line < end && !headings; ) {
+        headings = *line == '#';
+        const char *newline = memchr(line, '\n', end - line);
+        line = newline != NULL ? newline + 1 : end;
+    }
+    
+    section_t *sections = NULL;
+    size_t capacity = 0;
+    *count = 0;
+    
+    const char *start = NULL;      // First non-blank line of the current section
+    const char *last_end = NULL;   // End of its last non-blank line
+    for (const char *line = text; line < end; ) {
+        const char *newline = memchr(line, '\n', end - line);
+        const char *line_end = newline != NULL ? newline : end;
+        bool blank = is_blank(line, line_end);
+        
+        bool boundary = headings ? *line == '#' : blank;
+        if (boundary && start != NULL) {
+            if (!add_section(&sections, count, &capacity, start, last_end)) {
+                free(sections);
+                return NULL;
+            }
+            start = NULL;
+        }
+        if (!blank) {
+            if (start == NULL) {
+                start = line;
+            }
+            last_end = line_end;
+        }
+        
+        line = newline != NULL ? newline + 1 : end;
+    }
+    
+    if (start != NULL && !add_section(&sections, count, &capacity, start, last_end)) {
+        free(sections);
+        return NULL;
+    }
+    
+    // An empty description still needs an array to hand back
+    if (sections == NULL) {
+        sections = calloc(1, sizeof(section_t));
+    }
+    return sections;
+}
+
+// Hash a section together with everything else that shapes its code
+static void hash_section(section_t *section, const char *model, const char *target_language) {
+    sha256_ctx_t ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    
+    sha256_init(&ctx);
+    sha256_update(&ctx, model, strlen(model) + 1);
+    sha256_update(&ctx, target_language, strlen(target_language) + 1);
+    sha256_update(&ctx, section->text, section->length);
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, section->hash);
+}
+
+// Keep a section of the manifest once it has both a hash and code
+static bool add_entry(manifest_reader_t *reader) {
+    if (reader->hash_length != HASH_HEX_SIZE - 1 || !reader->has_code) {
+        free(reader->current.code);
+        reader->current.code = NULL;
+        return true;
+    }
+    
+    if (reader->count == reader->capacity) {
+        size_t capacity = reader->capacity > 0 ? reader->capacity * 2 : 16;
+        manifest_entry_t *grown = realloc(reader->entries, capacity * sizeof(manifest_entry_t));
+        if (grown == NULL) {
+            return false;
+        }
+        reader->entries = grown;
+        reader->capacity = capacity;
+    }
+    reader->current.hash[HASH_HEX_SIZE - 1] = '\0';
+    reader->entries[reader->count++] = reader->current;
+    reader->current.code = NULL;
+    return true;
+}
+
+// Collect the hash and code of each section of the manifest as they are decoded
+static bool read_manifest(const json_value_t *value, void *userdata) {
+    manifest_reader_t *reader = (manifest_reader_t *)userdata;
+    if (strcmp(value->top_key, "sections") != 0) {
+        return true;
+    }
+    
+    if (value->depth == 1) {
+        reader->has_sections = reader->has_sections || value->kind == JSON_BEGIN_ARRAY;
+    } else if (value->depth == 2 && value->kind == JSON_BEGIN_OBJECT) {
+        memset(&reader->current, 0, sizeof(reader->current));
+        reader->hash_length = 0;
+        reader->has_code = false;
+    } else if (value->depth == 2 && value->kind == JSON_END_OBJECT) {
+        return add_entry(reader);
+    } else if (value->depth == 3 && value->kind == JSON_STRING && json_is_key(value, "hash")) {
+        size_t room = HASH_HEX_SIZE - 1 > reader->hash_length ? HASH_HEX_SIZE - 1 - reader->hash_length : 0;
+        memcpy(reader->current.hash + reader->hash_length, value->data, value->length < room ? value->length : room);
+        reader->hash_length += value->length;
+    } else if (value->depth == 3 && value->kind == JSON_STRING && json_is_key(value, "code")) {
+        manifest_entry_t *entry = &reader->current;
+        if (value->first) {
+            entry->code_length = 0;
+        }
+        char *grown = realloc(entry->code, entry->code_length + value->length + 1);
+        if (grown == NULL) {
+            return false;
+        }
+        memcpy(grown + entry->code_length, value->data, value->length);
+        entry->code_length += value->length;
+        grown[entry->code_length] = '\0';
+        entry->code = grown;
+        reader->has_code = true;
+    }
+    return true;
+}
+
+// Release the sections of a manifest
+static void free_manifest(manifest_entry_t *entries, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(entries[i].code);
+    }
+    free(entries);
+}
+
+// Load the manifest of the previous build; a missing or unreadable manifest
+// is empty. It is decoded as it is read, without holding the whole file.
+static void load_manifest(const char *path, manifest_entry_t **entries, size_t *count) {
+    *entries = NULL;
+    *count = 0;
+    
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return;
+    }
+    
+    manifest_reader_t reader;
+    memset(&reader, 0, sizeof(reader));
+    json_decoder_t decoder;
+    json_decoder_init(&decoder, read_manifest, &reader);
+    
+    char buffer[MANIFEST_READ_SIZE];
+    bool success = true;
+    size_t size;
+    while (success && (size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        success = json_decoder_feed(&decoder, buffer, size);
+    }
+    success = success && !ferror(file) && json_decoder_finish(&decoder) && reader.has_sections;
+    fclose(file);
+    
+    if (!success) {
+        // The code of a section cut short belongs to no entry yet
+        free(reader.current.code);
+        fprintf(stderr, "Warning: Ignoring unreadable manifest %s\n", path);
+        free_manifest(reader.entries, reader.count);
+        return;
+    }
+    
+    *entries = reader.entries;
+    *count = reader.count;
+}
+
+// Hand encoded JSON to a file
+static bool write_file(const char *data, size_t length, void *target) {
+    return fwrite(data, 1, length, (FILE *)target) == length;
+}
+
+// Write the manifest for the sections that have code; it is replaced atomically
+static bool save_manifest(const char *path, const section_t *sections, size_t count) {
+    char temp_path[MAX_PATH_LENGTH + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp.%ld", path, (long)getpid());
+    
+    bool success = false;
+    FILE *file = fopen(temp_path, "w");
+    if (file != NULL) {
+        // The code is escaped straight into the file
+        success = fputs("{\n  \"sections\": [", file) >= 0;
+        const char *separator = "\n";
+        for (size_t i = 0; success && i < count; i++) {
+            if (sections[i].code == NULL) {
+                continue;
+            }
+            success = fprintf(file, "%s    {\n      \"hash\": \"%s\",\n      \"code\": ", separator,
+                              sections[i].hash) >= 0 &&
+                      json_write_string(sections[i].code, sections[i].code_length, write_file, file) &&
+                      fputs("\n    }", file) >= 0;
+            separator = ",\n";
+        }
+        success = success && fputs("\n  ]\n}\n", file) >= 0;
+        success = fclose(file) == 0 && success;
+        success = success && rename(temp_path, path) == 0;
+        if (!success) {
+            unlink(temp_path);
+        }
+    }
+    
+    if (!success) {
+        fprintf(stderr, "Error: Could not write manifest %s\n", path);
+    }
+    return success;
+}
+
+// Store a finished section's code, releasing its request
+static void complete_section(section_t *section) {
+    if (request_finish(section->request)) {
+        section->code = request_take_output(section->request, &section->code_length);
+    }
+    
+    request_free(section->request);
+    section->request = NULL;
+    free(section->prompt_text);
+    section->prompt_text = NULL;
+}
+
+// Start compiling a section; returns true if it is in flight
+static bool start_section(section_t *section, const char *target_language, driver_t *driver) {
+    section->prompt_text = strndup(section->text, section->length);
+    if (section->prompt_text == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+    
+    section->request = request_new(context_get_default(), section->prompt_text, target_language, NULL, NULL);
+    if (section->request == NULL) {
+        free(section->prompt_text);
+        section->prompt_text = NULL;
+        return false;
+    }
+    
+    if (request_is_cached(section->request)) {
+        complete_section(section);
+        return false;
+    }
+    
+    if (!driver_start(driver, section->request, section)) {
+        complete_section(section);
+        return false;
+    }
+    return true;
+}
+
+// Compile every section that was not reused, with at most max_parallel in flight
+static bool compile_sections(section_t *sections, size_t count, const char *target_language, int max_parallel) {
+    driver_t *driver = driver_new(max_parallel);
+    if (driver == NULL) {
+        return false;
+    }
+    
+    size_t next = 0;
+    for (;;) {
+        while (driver_has_room(driver) && next < count) {
+            section_t *section = &sections[next++];
+            if (!section->reused) {
+                start_section(section, target_language, driver);
+            }
+        }
+        
+        section_t *section = driver_next(driver);
+        if (section == NULL) {
+            break;
+        }
+        complete_section(section);
+    }
+    
+    driver_free(driver);
+    
+    for (size_t i = 0; i < count; i++) {
+        if (sections[i].code == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Join the fragments in section order into the output file
+static bool write_output(const char *output_file, const section_t *sections, size_t count) {
+    FILE *output_fp = fopen(output_file, "w");
+    if (output_fp == NULL) {
+        fprintf(stderr, "Error: Could not open output file %s\n", output_file);
+        return false;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        // Trailing newlines would widen the gap between fragments
+        size_t length = sections[i].code_length;
+        while (length > 0 && sections[i].code[length - 1] == '\n') {
+            length--;
+        }
+        
+        if (i > 0) {
+            fputs(FRAGMENT_SEPARATOR, output_fp);
+        }
+        fwrite(sections[i].code, 1, length, output_fp);
+    }
+    fputc('\n', output_fp);
+    
+    if (fclose(output_fp) != 0) {
+        fprintf(stderr, "Error: Could not write output file %s\n", output_file);
+        return false;
+    }
+    return true;
+}
+
+bool incremental_compile(const char *english_text, size_t length, const char *target_language,
+                         const char *output_file, int max_parallel) {
+    char manifest_path[MAX_PATH_LENGTH];
+    if (snprintf(manifest_path, sizeof(manifest_path), "%s%s", output_file, INCREMENTAL_MANIFEST_SUFFIX) >=
+        (int)sizeof(manifest_path)) {
+        fprintf(stderr, "Error: Output path %s is too long\n", output_file);
+        return false;
+    }
+    
+    size_t count;
+    section_t *sections = split_sections(english_text, length, &count);
+    if (sections == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+    
+    manifest_entry_t *entries;
+    size_t entry_count;
+    load_manifest(manifest_path, &entries, &entry_count);
+    
+    // Reuse the code of every section whose hash the previous build already saw
+    const char *model = config_get_model();
+    size_t reused = 0;
+    for (size_t i = 0; i < count; i++) {
+        section_t *section = &sections[i];
+        hash_section(section, model, target_language);
+        
+        for (size_t j = 0; j < entry_count; j++) {
+            if (strcmp(entries[j].hash, section->hash) == 0) {
+                section->code = strndup(entries[j].code, entries[j].code_length);
+                section->code_length = entries[j].code_length;
+                section->reused = section->code != NULL;
+                break;
+            }
+        }
+        
+        if (english_is_verbose()) {
+            fprintf(stderr, "Verbose mode: Section %zu (%zu bytes) %s\n", i + 1, section->length,
+                    section->reused ? "unchanged" : "will be compiled");
+        }
+        reused += section->reused;
+    }
+    
+    free_manifest(entries, entry_count);
+    
+    bool success = compile_sections(sections, count, target_language, max_parallel > 0 ? max_parallel : 1);
+    
+    // Keep what did compile, so a retry only repeats the sections that failed
+    save_manifest(manifest_path, sections, count);
+    
+    if (success) {
+        success = write_output(output_file, sections, count);
+    } else {
+        fprintf(stderr, "Error: Failed to compile English to %s\n", target_language);
+    }
+    
+    if (success) {
+        printf("%zu sections, %zu recompiled, %zu unchanged\n", count, count - reused, reused);
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        free(sections[i].code);
+    }
+    free(sections);
+    return success;
+}
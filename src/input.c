@@ -0,0 +1,130 @@
+#define _DEFAULT_SOURCE
+
+#include "../include/input.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Initial size of the buffer for input that cannot be mapped
+#define INPUT_CHUNK_SIZE 65536
+
+// Map a regular file so that a zero byte follows its last byte
+static bool map_file(int fd, size_t size, input_t *input) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t length = (size + 1 + page - 1) / page * page;
+    
+    // Reserve zeroed pages one byte longer than the file, then map the file
+    // over the start of the reservation; the rest of it terminates the text
+    char *base = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    if (size > 0 && mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, length);
+        return false;
+    }
+    
+    // The prompt builder reads the text once from start to end
+    madvise(base, length, MADV_SEQUENTIAL);
+    
+    input->data = base;
+    input->size = size;
+    input->mapped = length;
+    return true;
+}
+
+// Read a pipe, a terminal or a file that may change into a growing heap buffer
+static bool read_stream(int fd, input_t *input) {
+    size_t size = 0;
+    size_t capacity = INPUT_CHUNK_SIZE;
+    char *data = malloc(capacity);
+    
+    while (data != NULL) {
+        ssize_t count = read(fd, data + size, capacity - size - 1);
+        if (count < 0) {
+            free(data);
+            return false;
+        }
+        if (count == 0) {
+            break;
+        }
+        size += (size_t)count;
+        if (size == capacity - 1) {
+            capacity *= 2;
+            char *grown = realloc(data, capacity);
+            if (grown == NULL) {
+                free(data);
+            }
+            data = grown;
+        }
+    }
+    
+    if (data == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+    
+    data[size] = '\0';
+    input->data = data;
+    input->size = size;
+    input->mapped = 0;
+    return true;
+}
+
+static bool open_input(const char *path, bool map, input_t *input) {
+    int fd = STDIN_FILENO;
+    
+    if (path != NULL) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Error: Could not open input file %s\n", path);
+            return false;
+        }
+    }
+    
+    // Regular files, including redirected stdin, are mapped instead of copied
+    struct stat st;
+    bool success;
+    if (map && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        success = map_file(fd, (size_t)st.st_size, input);
+    } else {
+        success = read_stream(fd, input);
+    }
+    
+    if (path != NULL) {
+        close(fd);
+    }
+    if (!success) {
+        fprintf(stderr, "Error: Could not read input %s\n", path != NULL ? path : "from stdin");
+    }
+    return success;
+}
+
+bool input_open(const char *path, input_t *input) {
+    return open_input(path, true, input);
+}
+
+bool input_read(const char *path, input_t *input) {
+    // A mapped file that is truncated while mapped raises SIGBUS on access
+    return open_input(path, false, input);
+}
+
+void input_close(input_t *input) {
+    if (input->data == NULL) {
+        return;
+    }
+    
+    if (input->mapped > 0) {
+        munmap((void *)input->data, input->mapped);
+    } else {
+        free((void *)input->data);
+    }
+    input->data = NULL;
+    input->size = 0;
+    input->mapped = 0;
+}
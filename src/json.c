@@ -0,0 +1,497 @@
+#include "../include/json.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Where the decoder is in the text
+enum {
+    STATE_TOP,           // Between top-level objects
+    STATE_VALUE,         // Before a value
+    STATE_FIRST_MEMBER,  // After '{': a member name or '}'
+    STATE_MEMBER,        // After ',' in an object: a member name
+    STATE_KEY,           // In a member name
+    STATE_KEY_ESCAPE,    // After a backslash in a member name
+    STATE_COLON,         // After a member name
+    STATE_FIRST_ELEMENT, // After '[': a value or ']'
+    STATE_AFTER_VALUE,   // After a value: ',' or the end of its container
+    STATE_STRING,        // In a string
+    STATE_ESCAPE,        // After a backslash in a string
+    STATE_UNICODE,       // In the hex digits of a \u escape
+    STATE_NUMBER,
+    STATE_LITERAL,
+    STATE_ERROR
+};
+
+// Replacement character for a surrogate without its other half
+#define REPLACEMENT_CHARACTER 0xFFFD
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static bool is_number_char(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Hand a value to the callback, with the names it sits under
+static bool emit(json_decoder_t *decoder, json_kind_t kind, int depth, const char *data, size_t length,
+                 bool first, bool last) {
+    json_value_t value = {
+        .kind = kind,
+        .depth = depth,
+        .key = decoder->keys[depth],
+        .top_key = depth >= 1 ? decoder->keys[1] : "",
+        .data = data,
+        .length = length,
+        .first = first,
+        .last = last
+    };
+    if (!decoder->on_value(&value, decoder->userdata)) {
+        decoder->state = STATE_ERROR;
+        return false;
+    }
+    return true;
+}
+
+// Hand over the decoded string bytes gathered so far
+static bool flush_string(json_decoder_t *decoder, bool last) {
+    if (decoder->scratch_length == 0 && !last) {
+        return true;
+    }
+    bool first = !decoder->string_started;
+    decoder->string_started = true;
+    size_t length = decoder->scratch_length;
+    decoder->scratch_length = 0;
+    return emit(decoder, JSON_STRING, decoder->depth, decoder->scratch, length, first, last);
+}
+
+static bool append_string(json_decoder_t *decoder, const char *data, size_t length) {
+    if (decoder->scratch_length + length > sizeof(decoder->scratch) && !flush_string(decoder, false)) {
+        return false;
+    }
+    if (length >= sizeof(decoder->scratch)) {
+        // A long run goes straight from the input to the callback
+        bool first = !decoder->string_started;
+        decoder->string_started = true;
+        return emit(decoder, JSON_STRING, decoder->depth, data, length, first, false);
+    }
+    memcpy(decoder->scratch + decoder->scratch_length, data, length);
+    decoder->scratch_length += length;
+    return true;
+}
+
+static bool append_code_point(json_decoder_t *decoder, uint32_t code_point) {
+    char bytes[4];
+    size_t length;
+    if (code_point < 0x80) {
+        bytes[0] = (char)code_point;
+        length = 1;
+    } else if (code_point < 0x800) {
+        bytes[0] = (char)(0xC0 | (code_point >> 6));
+        bytes[1] = (char)(0x80 | (code_point & 0x3F));
+        length = 2;
+    } else if (code_point < 0x10000) {
+        bytes[0] = (char)(0xE0 | (code_point >> 12));
+        bytes[1] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+        bytes[2] = (char)(0x80 | (code_point & 0x3F));
+        length = 3;
+    } else {
+        bytes[0] = (char)(0xF0 | (code_point >> 18));
+        bytes[1] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+        bytes[2] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+        bytes[3] = (char)(0x80 | (code_point & 0x3F));
+        length = 4;
+    }
+    return append_string(decoder, bytes, length);
+}
+
+// A surrogate pair is two escapes; a first half not followed by its second is replaced
+static bool finish_surrogate(json_decoder_t *decoder) {
+    if (decoder->high_surrogate == 0) {
+        return true;
+    }
+    decoder->high_surrogate = 0;
+    return append_code_point(decoder, REPLACEMENT_CHARACTER);
+}
+
+static bool unicode_escape(json_decoder_t *decoder, uint32_t code_point) {
+    if (code_point >= 0xDC00 && code_point <= 0xDFFF && decoder->high_surrogate != 0) {
+        uint32_t high = decoder->high_surrogate;
+        decoder->high_surrogate = 0;
+        return append_code_point(decoder, 0x10000 + ((high - 0xD800) << 10) + (code_point - 0xDC00));
+    }
+    if (!finish_surrogate(decoder)) {
+        return false;
+    }
+    if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+        decoder->high_surrogate = code_point;
+        return true;
+    }
+    if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
+        code_point = REPLACEMENT_CHARACTER;
+    }
+    return append_code_point(decoder, code_point);
+}
+
+// A value ended; the decoder moves on to what may follow it
+static void value_done(json_decoder_t *decoder) {
+    decoder->state = decoder->depth == 0 ? STATE_TOP : STATE_AFTER_VALUE;
+}
+
+static bool open_container(json_decoder_t *decoder, bool array) {
+    if (decoder->depth >= JSON_MAX_DEPTH) {
+        decoder->state = STATE_ERROR;
+        return false;
+    }
+    if (!emit(decoder, array ? JSON_BEGIN_ARRAY : JSON_BEGIN_OBJECT, decoder->depth, NULL, 0, false, false)) {
+        return false;
+    }
+    decoder->depth++;
+    decoder->keys[decoder->depth][0] = '\0';
+    if (array) {
+        decoder->arrays |= 1u << decoder->depth;
+        decoder->state = STATE_FIRST_ELEMENT;
+    } else {
+        decoder->arrays &= ~(1u << decoder->depth);
+        decoder->state = STATE_FIRST_MEMBER;
+    }
+    return true;
+}
+
+static bool close_container(json_decoder_t *decoder, bool array) {
+    bool is_array = (decoder->arrays & (1u << decoder->depth)) != 0;
+    if (is_array != array) {
+        decoder->state = STATE_ERROR;
+        return false;
+    }
+    decoder->depth--;
+    if (!emit(decoder, array ? JSON_END_ARRAY : JSON_END_OBJECT, decoder->depth, NULL, 0, false, false)) {
+        return false;
+    }
+    value_done(decoder);
+    return true;
+}
+
+// The first character of a value
+static bool begin_value(json_decoder_t *decoder, char c) {
+    switch (c) {
+        case '{':
+            return open_container(decoder, false);
+        case '[':
+            return open_container(decoder, true);
+        case '"':
+            decoder->state = STATE_STRING;
+            decoder->scratch_length = 0;
+            decoder->string_started = false;
+            decoder->high_surrogate = 0;
+            return true;
+        case 't':
+            decoder->literal = "true";
+            break;
+        case 'f':
+            decoder->literal = "false";
+            break;
+        case 'n':
+            decoder->literal = "null";
+            break;
+        default:
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                decoder->state = STATE_NUMBER;
+                decoder->number[0] = c;
+                decoder->number_length = 1;
+                return true;
+            }
+            decoder->state = STATE_ERROR;
+            return false;
+    }
+    decoder->state = STATE_LITERAL;
+    decoder->literal_index = 1;
+    return true;
+}
+
+static bool end_number(json_decoder_t *decoder) {
+    decoder->number[decoder->number_length] = '\0';
+    if (!emit(decoder, JSON_NUMBER, decoder->depth, decoder->number, decoder->number_length, false, false)) {
+        return false;
+    }
+    value_done(decoder);
+    return true;
+}
+
+void json_decoder_init(json_decoder_t *decoder, json_value_callback on_value, void *userdata) {
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->on_value = on_value;
+    decoder->userdata = userdata;
+    decoder->state = STATE_TOP;
+}
+
+bool json_decoder_feed(json_decoder_t *decoder, const char *data, size_t length) {
+    const char *p = data;
+    const char *end = data + length;
+    
+    while (p < end) {
+        char c = *p;
+        switch (decoder->state) {
+            case STATE_TOP:
+                if (c == '{') {
+                    if (!open_container(decoder, false)) return false;
+                } else if (!is_space(c)) {
+                    decoder->state = STATE_ERROR;
+                    return false;
+                }
+                p++;
+                break;
+            
+            case STATE_VALUE:
+                if (!is_space(c) && !begin_value(decoder, c)) return false;
+                p++;
+                break;
+            
+            case STATE_FIRST_ELEMENT:
+                if (c == ']') {
+                    if (!close_container(decoder, true)) return false;
+                } else if (!is_space(c) && !begin_value(decoder, c)) {
+                    return false;
+                }
+                p++;
+                break;
+            
+            case STATE_FIRST_MEMBER:
+            case STATE_MEMBER:
+                if (c == '"') {
+                    decoder->state = STATE_KEY;
+                    decoder->key_length = 0;
+                } else if (c == '}' && decoder->state == STATE_FIRST_MEMBER) {
+                    if (!close_container(decoder, false)) return false;
+                } else if (!is_space(c)) {
+                    decoder->state = STATE_ERROR;
+                    return false;
+                }
+                p++;
+                break;
+            
+            case STATE_KEY:
+            case STATE_KEY_ESCAPE:
+                // Names are compared as written; escapes in them are kept, not decoded
+                if (c == '"' && decoder->state == STATE_KEY) {
+                    decoder->keys[decoder->depth][decoder->key_length] = '\0';
+                    decoder->state = STATE_COLON;
+                } else {
+                    decoder->state = c == '\\' && decoder->state == STATE_KEY ? STATE_KEY_ESCAPE : STATE_KEY;
+                    if (decoder->key_length < JSON_MAX_KEY - 1) {
+                        decoder->keys[decoder->depth][decoder->key_length++] = c;
+                    }
+                }
+                p++;
+                break;
+            
+            case STATE_COLON:
+                if (c == ':') {
+                    decoder->state = STATE_VALUE;
+                } else if (!is_space(c)) {
+                    decoder->state = STATE_ERROR;
+                    return false;
+                }
+                p++;
+                break;
+            
+            case STATE_AFTER_VALUE:
+                if (c == ',') {
+                    if (decoder->arrays & (1u << decoder->depth)) {
+                        decoder->state = STATE_VALUE;
+                    } else {
+                        decoder->state = STATE_MEMBER;
+                    }
+                } else if (c == '}' || c == ']') {
+                    if (!close_container(decoder, c == ']')) return false;
+                } else if (!is_space(c)) {
+                    decoder->state = STATE_ERROR;
+                    return false;
+                }
+                p++;
+                break;
+            
+            case STATE_STRING: {
+                // Take the whole run up to the next quote or backslash at once
+                const char *run = p;
+                while (p < end && *p != '"' && *p != '\\') {
+                    p++;
+                }
+                if (p > run) {
+                    if (!finish_surrogate(decoder) || !append_string(decoder, run, p - run)) return false;
+                }
+                if (p == end) {
+                    break;
+                }
+                if (*p == '"') {
+                    if (!finish_surrogate(decoder) || !flush_string(decoder, true)) return false;
+                    value_done(decoder);
+                } else {
+                    decoder->state = STATE_ESCAPE;
+                }
+                p++;
+                break;
+            }
+            
+            case STATE_ESCAPE: {
+                char decoded;
+                switch (c) {
+                    case 'n': decoded = '\n'; break;
+                    case 't': decoded = '\t'; break;
+                    case 'r': decoded = '\r'; break;
+                    case 'b': decoded = '\b'; break;
+                    case 'f': decoded = '\f'; break;
+                    case '"': decoded = '"'; break;
+                    case '\\': decoded = '\\'; break;
+                    case '/': decoded = '/'; break;
+                    case 'u':
+                        decoder->state = STATE_UNICODE;
+                        decoder->code_point = 0;
+                        decoder->hex_digits = 0;
+                        p++;
+                        continue;
+                    default:
+                        decoder->state = STATE_ERROR;
+                        return false;
+                }
+                if (!finish_surrogate(decoder) || !append_string(decoder, &decoded, 1)) return false;
+                decoder->state = STATE_STRING;
+                p++;
+                break;
+            }
+            
+            case STATE_UNICODE: {
+                int digit = hex_value(c);
+                if (digit < 0) {
+                    decoder->state = STATE_ERROR;
+                    return false;
+                }
+                decoder->code_point = (decoder->code_point << 4) | (uint32_t)digit;
+                if (++decoder->hex_digits == 4) {
+                    if (!unicode_escape(decoder, decoder->code_point)) return false;
+                    decoder->state = STATE_STRING;
+                }
+                p++;
+                break;
+            }
+            
+            case STATE_NUMBER: {
+                const char *run = p;
+                while (p < end && is_number_char(*p)) {
+                    p++;
+                }
+                if ((size_t)(p - run) >= sizeof(decoder->number) - decoder->number_length) {
+                    decoder->state = STATE_ERROR;
+                    return false;
+                }
+                memcpy(decoder->number + decoder->number_length, run, p - run);
+                decoder->number_length += p - run;
+                
+                // The character after the number is read again as what follows the value
+                if (p < end && !end_number(decoder)) {
+                    return false;
+                }
+                break;
+            }
+            
+            case STATE_LITERAL:
+                if (c != decoder->literal[decoder->literal_index]) {
+                    decoder->state = STATE_ERROR;
+                    return false;
+                }
+                p++;
+                if (decoder->literal[++decoder->literal_index] == '\0') {
+                    json_kind_t kind = decoder->literal[0] == 't' ? JSON_TRUE
+                                     : decoder->literal[0] == 'f' ? JSON_FALSE : JSON_NULL;
+                    if (!emit(decoder, kind, decoder->depth, NULL, 0, false, false)) return false;
+                    value_done(decoder);
+                }
+                break;
+            
+            default:
+                return false;
+        }
+    }
+    
+    // The part of a string read so far is handed over now rather than held until more arrives
+    if (decoder->state == STATE_STRING || decoder->state == STATE_ESCAPE || decoder->state == STATE_UNICODE) {
+        return flush_string(decoder, false);
+    }
+    return true;
+}
+
+bool json_decoder_finish(const json_decoder_t *decoder) {
+    return decoder->state == STATE_TOP;
+}
+
+bool json_decode(const char *data, size_t length, json_value_callback on_value, void *userdata) {
+    json_decoder_t decoder;
+    json_decoder_init(&decoder, on_value, userdata);
+    return json_decoder_feed(&decoder, data, length) && json_decoder_finish(&decoder);
+}
+
+int64_t json_get_int(const json_value_t *value) {
+    return strtoll(value->data, NULL, 10);
+}
+
+double json_get_double(const json_value_t *value) {
+    return strtod(value->data, NULL);
+}
+
+bool json_is_key(const json_value_t *value, const char *key) {
+    return strcmp(value->key, key) == 0;
+}
+
+bool json_write_string(const char *text, size_t length, json_write_callback write, void *target) {
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *)text;
+    const unsigned char *end = p + length;
+    
+    if (!write("\"", 1, target)) {
+        return false;
+    }
+    while (p < end) {
+        const unsigned char *run = p;
+        while (p < end && *p >= 0x20 && *p != '"' && *p != '\\') {
+            p++;
+        }
+        if (p > run && !write((const char *)run, p - run, target)) {
+            return false;
+        }
+        if (p == end) {
+            break;
+        }
+        
+        char escape[6] = { '\\', 0, 0, 0, 0, 0 };
+        size_t escape_length = 2;
+        switch (*p) {
+            case '"': escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = hex[*p >> 4];
+                escape[5] = hex[*p & 0x0F];
+                escape_length = 6;
+                break;
+        }
+        if (!write(escape, escape_length, target)) {
+            return false;
+        }
+        p++;
+    }
+    return write("\"", 1, target);
+}
@@ -1,26 +1,152 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "../include/english.h"
-
-#define MAX_INPUT_SIZE 4096
-#define MAX_OUTPUT_SIZE 8192
+#include "../include/cache.h"
+#include "../include/semcache.h"
+#include "../include/config.h"
+#include "../include/batch.h"
+#include "../include/build.h"
+#include "../include/server.h"
+#include "../include/input.h"
+#include "../include/incremental.h"
+#include "../include/chunk.h"
+#include "../include/fence.h"
+#include "../include/stats.h"
+#include "../include/watch.h"
 
 static void print_usage(void) {
     printf("Usage: english <command> [options]\n\n");
     printf("Commands:\n");
     printf("  set model MODEL        Set the model to use (e.g., llama3, codellama, mistral, gemma)\n");
-    printf("  set endpoint URL       Set the Ollama API endpoint URL\n");
+    printf("  set endpoint URL[,URL] Set the Ollama API endpoint URL (several to balance over)\n");
     printf("  get model              Get the current model\n");
     printf("  get endpoint           Get the current Ollama API endpoint URL\n");
+    printf("  set keep_alive TIME    Keep the model loaded this long after each request (e.g. 30m, -1)\n");
+    printf("  get keep_alive         Get the current keep_alive\n");
+    printf("  warm                   Load the model on every endpoint before the first compile\n");
     printf("  compile LANGUAGE       Compile English to the specified programming language\n");
+    printf("  compile LANG,LANG,...  Compile English to several languages at once (needs -o DIR)\n");
+    printf("  serve                  Run a daemon that keeps connections and caches warm\n");
+    printf("  batch JOBS             Compile every job in a JSON Lines file concurrently\n");
+    printf("  build [TARGET...]      Build the stale targets of a project, dependencies first\n");
+    printf("  watch LANGUAGE         Recompile -f FILE to -o FILE, or -f DIR to -o DIR, on every change\n");
+    printf("  cache stats            Show compile cache usage\n");
+    printf("  cache clear            Remove all cached compiles\n");
+    printf("  stats                  Show latency percentiles per model and language\n");
+    printf("  stats clear            Remove all recorded latencies\n");
     printf("\n");
     printf("Options:\n");
     printf("  -v, --verbose          Enable verbose mode for debugging\n");
     printf("\n");
     printf("Options for 'compile':\n");
     printf("  -f, --file FILE        Read English description from a file\n");
-    printf("  -o, --output FILE      Write output to a file (default: stdout)\n");
+    printf("  -o, --output FILE      Write output to a file (default: stdout), or to a directory for several languages\n");
+    printf("  -s, --stream           Write code as it is generated\n");
+    printf("  --no-cache             Always send the request to Ollama\n");
+    printf("  --no-daemon            Compile in this process even if a daemon is running\n");
+    printf("  --incremental          Recompile only the sections that changed since the last build (needs -o)\n");
+    printf("  --all-blocks           Keep every fenced code block of the answer, not just the first\n");
+    printf("  --split DIR            Write each fenced code block to its own file in DIR\n");
+    printf("  --stats                Print where the time of the compile went (compiles in this process)\n");
+    printf("  --timeout SECONDS      Give up on the compile after SECONDS, retries included\n");
+    printf("  --retries N            Retry transient failures N times (default: 2)\n");
+    printf("  --candidates N         Sample N answers at once and keep the first that passes the validator\n");
+    printf("  --chunked              Compile a long description in parts of at most %d tokens, concurrently\n",
+           CHUNK_DEFAULT_TOKENS);
+    printf("  --chunk-tokens N       Compile in parts of at most N tokens (implies --chunked)\n");
+    printf("  --merge join|model     Join the parts' code in order (default), or have the model merge it\n");
+    printf("\n");
+    printf("Options for 'serve':\n");
+    printf("  --socket PATH          Listen on PATH (default: ~/.english/english.sock)\n");
+    printf("\n");
+    printf("Options for 'batch':\n");
+    printf("  -j, --jobs N           Number of requests in flight (default: $OLLAMA_NUM_PARALLEL or %d)\n", BATCH_DEFAULT_PARALLEL);
+    printf("  --no-cache             Always send the requests to Ollama\n");
+    printf("  --timeout SECONDS      Give up on each job after SECONDS, retries included\n");
+    printf("  --retries N            Retry transient failures N times per job (default: 2)\n");
+    printf("  --session              Carry the model's context from each job to the next (use with -j 1)\n");
+    printf("\n");
+    printf("Options for 'build':\n");
+    printf("  -f, --file PROJECT     Read the targets from PROJECT (default: %s)\n", BUILD_DEFAULT_PROJECT);
+    printf("  -j, --jobs N           Number of targets compiling at once (default: $OLLAMA_NUM_PARALLEL or %d)\n",
+           BATCH_DEFAULT_PARALLEL);
+    printf("  --force                Rebuild every target, even those that are up to date\n");
+    printf("  --no-cache             Always send the requests to Ollama\n");
+    printf("  --timeout SECONDS      Give up on each target after SECONDS, retries included\n");
+    printf("  --retries N            Retry transient failures N times per target (default: 2)\n");
+    printf("\n");
+    printf("Options for 'watch':\n");
+    printf("  -f, --file FILE|DIR    The description to watch, or a directory of *.eng descriptions\n");
+    printf("  -o, --output FILE|DIR  Where its code goes (a directory for a directory of descriptions)\n");
+    printf("  --debounce MS          Wait until the input is quiet this long before compiling (default: %d)\n",
+           WATCH_DEFAULT_DEBOUNCE_MS);
+    printf("  --no-cache             Always send the requests to Ollama\n");
+    printf("  --timeout SECONDS      Give up on each compile after SECONDS, retries included\n");
+    printf("  --retries N            Retry transient failures N times per compile (default: 2)\n");
+    printf("\n");
+    printf("Options for 'warm':\n");
+    printf("  --keep-alive DURATION  Keep the model loaded this long instead of the configured keep_alive\n");
+}
+
+// Exit status of a compile stopped with Ctrl+C
+#define EXIT_CANCELLED 130
+
+// The first Ctrl+C cancels the compiles in flight; a second one kills the process
+static void handle_interrupt(int signal_number) {
+    (void)signal_number;
+    english_cancel();
+}
+
+static void install_interrupt_handler(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_interrupt;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+}
+
+// Parse the argument of --timeout, in seconds
+static bool parse_timeout(const char *value, long *timeout_ms) {
+    char *end;
+    double seconds = strtod(value, &end);
+    if (end == value || *end != '\0' || seconds <= 0) {
+        fprintf(stderr, "Error: Invalid timeout %s\n", value);
+        return false;
+    }
+    *timeout_ms = (long)(seconds * 1000 + 0.5);
+    return true;
+}
+
+// Parse the argument of --candidates
+static bool parse_candidates(const char *value, int *candidates) {
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || parsed < 1 || parsed > ENGLISH_MAX_CANDIDATES) {
+        fprintf(stderr, "Error: Invalid number of candidates %s (1 to %d)\n", value, ENGLISH_MAX_CANDIDATES);
+        return false;
+    }
+    *candidates = (int)parsed;
+    return true;
+}
+
+// Parse the argument of --retries
+static bool parse_retries(const char *value, int *retries) {
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || parsed < 0 || parsed > 100) {
+        fprintf(stderr, "Error: Invalid number of retries %s\n", value);
+        return false;
+    }
+    *retries = (int)parsed;
+    return true;
 }
 
 static int handle_set_endpoint(const char *endpoint) {
@@ -29,6 +155,12 @@ static int handle_set_endpoint(const char *endpoint) {
         return 1;
     }
     
+    if (!config_set_endpoint(endpoint)) {
+        fprintf(stderr, "Error: Failed to set endpoint\n");
+        english_cleanup();
+        return 1;
+    }
+    
     english_set_ollama_endpoint(endpoint);
     printf("Ollama endpoint set to: %s\n", endpoint);
     english_cleanup();
@@ -78,56 +210,491 @@ static int handle_get_model(void) {
     return 0;
 }
 
-static int handle_compile(const char *target_language, const char *input_file, const char *output_file, bool verbose) {
+static int handle_set_keep_alive(const char *keep_alive_value) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    if (!config_set_keep_alive(keep_alive_value)) {
+        fprintf(stderr, "Error: Failed to set keep_alive\n");
+        english_cleanup();
+        return 1;
+    }
+    
+    printf("keep_alive set to '%s' successfully.\n", keep_alive_value);
+    english_cleanup();
+    return 0;
+}
+
+static int handle_get_keep_alive(void) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    const char *keep_alive = config_get_keep_alive();
+    printf("Current keep_alive: %s\n", keep_alive != NULL ? keep_alive : "(Ollama default)");
+    
+    english_cleanup();
+    return 0;
+}
+
+static int handle_warm(const char *keep_alive, bool verbose) {
     if (!english_init()) {
         fprintf(stderr, "Error: Could not initialize English compiler\n");
         return 1;
     }
     
-    // Set verbose mode if requested
     english_set_verbose(verbose);
     
-    if (verbose) {
-        fprintf(stderr, "Verbose mode: Using Ollama for code generation\n");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool success = english_warm(keep_alive);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    if (success) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("Warmed %s in %.2f s\n", english_config_get_model(), seconds);
+    }
+    
+    english_cleanup();
+    return success ? 0 : 1;
+}
+
+static int handle_cache_stats(void) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    cache_stats_t stats;
+    if (!cache_get_stats(&stats)) {
+        fprintf(stderr, "Error: Could not read the compile cache\n");
+        english_cleanup();
+        return 1;
     }
     
-    // Read input from file or stdin
-    char input_buffer[MAX_INPUT_SIZE];
-    FILE *input_fp = stdin;
+    uint64_t lookups = stats.hits + stats.misses;
+    printf("Entries:   %zu\n", stats.entries);
+    printf("Size:      %.1f KB of %.1f MB\n", stats.bytes / 1024.0, stats.max_bytes / (1024.0 * 1024.0));
+    printf("Hits:      %llu\n", (unsigned long long)stats.hits);
+    printf("Misses:    %llu\n", (unsigned long long)stats.misses);
+    printf("Hit rate:  %.1f%%\n", lookups > 0 ? 100.0 * stats.hits / lookups : 0.0);
+    printf("Stores:    %llu\n", (unsigned long long)stats.stores);
+    printf("Evictions: %llu\n", (unsigned long long)stats.evictions);
     
-    if (input_file != NULL) {
-        input_fp = fopen(input_file, "r");
-        if (input_fp == NULL) {
-            fprintf(stderr, "Error: Could not open input file %s\n", input_file);
+    // The semantic cache only has something to report once it was enabled
+    semcache_stats_t semantic;
+    if (config_get_semantic_model() != NULL && semcache_get_stats(&semantic)) {
+        lookups = semantic.hits + semantic.misses + semantic.near_misses;
+        printf("\nSemantic cache (%s, threshold %.2f):\n", config_get_semantic_model(),
+               config_get_semantic_threshold());
+        printf("Entries:      %zu (%zu dimensions)\n", semantic.entries, semantic.dimensions);
+        printf("Hits:         %llu\n", (unsigned long long)semantic.hits);
+        printf("Near misses:  %llu\n", (unsigned long long)semantic.near_misses);
+        printf("Misses:       %llu\n", (unsigned long long)semantic.misses);
+        printf("Hit rate:     %.1f%%\n", lookups > 0 ? 100.0 * semantic.hits / lookups : 0.0);
+        printf("Stores:       %llu\n", (unsigned long long)semantic.stores);
+    }
+    
+    english_cleanup();
+    return 0;
+}
+
+static int handle_cache_clear(void) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    if (!cache_clear() || !semcache_clear()) {
+        fprintf(stderr, "Error: Failed to clear the compile cache\n");
+        english_cleanup();
+        return 1;
+    }
+    
+    printf("Compile cache cleared.\n");
+    english_cleanup();
+    return 0;
+}
+
+static int handle_stats(void) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    stats_summary_t *summaries;
+    size_t count;
+    if (!stats_summarize(&summaries, &count)) {
+        fprintf(stderr, "Error: Could not read the latency statistics\n");
+        english_cleanup();
+        return 1;
+    }
+    
+    if (count == 0) {
+        printf("No compiles recorded yet.\n");
+    } else {
+        printf("%-24s %-12s %8s %8s %9s %9s %9s %9s %9s %8s\n", "MODEL", "LANGUAGE", "REQUESTS", "FAILURES",
+               "P50 MS", "P95 MS", "P99 MS", "TTFB P50", "TTFB P95", "TOKENS/S");
+        for (size_t i = 0; i < count; i++) {
+            const stats_summary_t *summary = &summaries[i];
+            printf("%-24s %-12s %8llu %8llu %9.1f %9.1f %9.1f %9.1f %9.1f %8.1f\n", summary->model,
+                   summary->language, (unsigned long long)summary->requests,
+                   (unsigned long long)summary->failures, summary->total_p50_ms, summary->total_p95_ms,
+                   summary->total_p99_ms, summary->first_byte_p50_ms, summary->first_byte_p95_ms,
+                   summary->tokens_per_second);
+        }
+    }
+    
+    free(summaries);
+    english_cleanup();
+    return 0;
+}
+
+static int handle_stats_clear(void) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    if (!stats_clear()) {
+        fprintf(stderr, "Error: Failed to clear the latency statistics\n");
+        english_cleanup();
+        return 1;
+    }
+    
+    printf("Latency statistics cleared.\n");
+    english_cleanup();
+    return 0;
+}
+
+// Print the breakdown of the compile that just finished
+static void print_compile_stats(void) {
+    english_stats_t stats;
+    if (!english_get_last_stats(&stats)) {
+        return;
+    }
+    
+    fprintf(stderr, "\nTiming%s:\n", stats.cached ? " (served from cache)" : "");
+    fprintf(stderr, "  Config load:   %9.2f ms\n", stats.config_ms);
+    fprintf(stderr, "  Request build: %9.2f ms\n", stats.build_ms);
+    if (stats.embed_ms > 0) {
+        fprintf(stderr, "  Embedding:     %9.2f ms (semantic cache)\n", stats.embed_ms);
+    }
+    fprintf(stderr, "  DNS lookup:    %9.2f ms\n", stats.dns_ms);
+    fprintf(stderr, "  TCP connect:   %9.2f ms\n", stats.connect_ms);
+    fprintf(stderr, "  TLS handshake: %9.2f ms\n", stats.tls_ms);
+    fprintf(stderr, "  First byte:    %9.2f ms\n", stats.first_byte_ms);
+    fprintf(stderr, "  Transfer:      %9.2f ms\n", stats.transfer_ms);
+    fprintf(stderr, "  JSON parse:    %9.2f ms\n", stats.parse_ms);
+    fprintf(stderr, "  Code extract:  %9.2f ms\n", stats.extract_ms);
+    fprintf(stderr, "  Total:         %9.2f ms\n", stats.total_ms);
+    if (stats.attempts > 1) {
+        fprintf(stderr, "  Attempts:      %9u (hedged, failed over or retried)\n", stats.attempts);
+    }
+    if (stats.escalations > 0) {
+        fprintf(stderr, "  Escalations:   %9u (routed to a larger model)\n", stats.escalations);
+    }
+    fprintf(stderr, "Memory:\n");
+    fprintf(stderr, "  Arena:         %llu allocations, %.1f KB\n", stats.arena_allocations,
+            stats.arena_bytes / 1024.0);
+    fprintf(stderr, "  Heap blocks:   %llu\n", stats.heap_allocations);
+    
+    if (stats.cached) {
+        return;
+    }
+    
+    fprintf(stderr, "Ollama:\n");
+    fprintf(stderr, "  Model load:    %9.2f ms\n", stats.load_duration_ns / 1e6);
+    fprintf(stderr, "  Prompt eval:   %9.2f ms (%llu tokens)\n", stats.prompt_eval_duration_ns / 1e6,
+            stats.prompt_eval_count);
+    fprintf(stderr, "  Generation:    %9.2f ms (%llu tokens", stats.eval_duration_ns / 1e6, stats.eval_count);
+    if (stats.eval_duration_ns > 0) {
+        fprintf(stderr, ", %.1f tokens/s", stats.eval_count * 1e9 / stats.eval_duration_ns);
+    }
+    fprintf(stderr, ")\n");
+}
+
+static int handle_serve(const char *socket_path, bool verbose) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    english_set_verbose(verbose);
+    
+    char default_path[1024];
+    if (socket_path == NULL) {
+        if (!server_default_socket(default_path, sizeof(default_path))) {
+            fprintf(stderr, "Error: Could not determine the socket path\n");
             english_cleanup();
             return 1;
         }
-    } else {
-        printf("Enter English description (Ctrl+D to end):\n");
+        socket_path = default_path;
+    }
+    
+    int status = server_run(socket_path);
+    
+    english_cleanup();
+    return status;
+}
+
+static int handle_batch(const char *jobs_file, int max_parallel, bool use_cache, long timeout_ms, int retries,
+                        bool session, bool verbose) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    english_set_verbose(verbose);
+    english_set_cache_enabled(use_cache);
+    english_set_timeout(timeout_ms);
+    english_set_max_retries(retries);
+    english_set_session(session);
+    install_interrupt_handler();
+    
+    int failed = batch_run(jobs_file, max_parallel);
+    
+    english_cleanup();
+    if (english_is_cancelled()) {
+        return EXIT_CANCELLED;
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+static int handle_build(const char *project_file, const char *const *names, int name_count, int max_parallel,
+                        bool force, bool use_cache, long timeout_ms, int retries, bool verbose) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    english_set_verbose(verbose);
+    english_set_cache_enabled(use_cache);
+    english_set_timeout(timeout_ms);
+    english_set_max_retries(retries);
+    install_interrupt_handler();
+    
+    int failed = build_run(project_file, names, name_count, max_parallel, force);
+    
+    english_cleanup();
+    if (english_is_cancelled()) {
+        return EXIT_CANCELLED;
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+static int handle_watch(const char *target_language, const char *input_path, const char *output_path,
+                        long debounce_ms, bool use_cache, long timeout_ms, int retries, bool verbose) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    english_set_verbose(verbose);
+    english_set_cache_enabled(use_cache);
+    english_set_timeout(timeout_ms);
+    english_set_max_retries(retries);
+    install_interrupt_handler();
+    
+    // Ctrl+C is how watching ends, so it is not an error
+    int status = watch_run(input_path, output_path, target_language, debounce_ms);
+    
+    english_cleanup();
+    return status;
+}
+
+// How to run a compile, from the options of 'compile'
+typedef struct {
+    const char *output_file;
+    const char *split_dir;
+    bool stream;
+    bool incremental;
+    english_extract_t extract_mode;
+    bool use_cache;
+    bool use_daemon;
+    bool show_stats;
+    long timeout_ms;
+    int retries;
+    bool verbose;
+    int candidates;
+    size_t chunk_tokens;      // Token budget of one part, 0 to compile the description whole
+    chunk_merge_t merge;
+} compile_options_t;
+
+// Write each streamed chunk straight through to the output
+static bool write_stream_chunk(const char *chunk, size_t length, void *userdata) {
+    FILE *output_fp = (FILE *)userdata;
+    
+    if (fwrite(chunk, 1, length, output_fp) != length) {
+        return false;
+    }
+    return fflush(output_fp) == 0;
+}
+
+// Write every fenced block of a response to its own file in a directory
+static int write_split_blocks(const char *response, size_t length, const char *target_language, const char *split_dir) {
+    if (mkdir(split_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create directory %s\n", split_dir);
+        return 1;
+    }
+    
+    size_t offset = 0;
+    size_t count = 0;
+    fence_block_t block;
+    bool found = fence_next(response, length, &offset, &block);
+    if (!found) {
+        // An unfenced response is a single block in the target language
+        block.language = target_language;
+        block.language_length = strlen(target_language);
+        block.info_length = 0;
+        block.code = fence_extract(response, length, &block.code_length);
+    }
+    
+    do {
+        count++;
+        
+        // A file name after the language tag ("```python app.py") is used as is
+        char path[1024];
+        const char *name = block.info;
+        size_t name_length = 0;
+        while (name_length < block.info_length && name[name_length] != ' ' && name[name_length] != '\t') {
+            name_length++;
+        }
+        if (name_length > 0 && name[0] != '.' && memchr(name, '.', name_length) != NULL &&
+            memchr(name, '/', name_length) == NULL && memchr(name, '\\', name_length) == NULL) {
+            snprintf(path, sizeof(path), "%s/%.*s", split_dir, (int)name_length, name);
+        } else {
+            const char *language = block.language_length > 0 ? block.language : target_language;
+            size_t language_length = block.language_length > 0 ? block.language_length : strlen(target_language);
+            snprintf(path, sizeof(path), "%s/block-%zu.%s", split_dir, count,
+                     fence_file_extension(language, language_length));
+        }
+        
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "Error: Could not open output file %s\n", path);
+            return 1;
+        }
+        fwrite(block.code, 1, block.code_length, fp);
+        if (block.code_length > 0 && block.code[block.code_length - 1] != '\n') {
+            fputc('\n', fp);
+        }
+        fclose(fp);
+        printf("%s\n", path);
+    } while (found && fence_next(response, length, &offset, &block));
+    
+    return 0;
+}
+
+// Report a compile that produced no code; returns the exit status
+static int compile_failed(const char *target_language) {
+    if (english_is_cancelled()) {
+        fprintf(stderr, "Error: Cancelled\n");
+        return EXIT_CANCELLED;
     }
+    fprintf(stderr, "Error: Failed to compile English to %s\n", target_language);
+    return 1;
+}
+
+static int compile_text(const char *input_text, const char *target_language, const compile_options_t *options) {
+    const char *output_file = options->output_file;
+    bool stream = options->stream;
+    bool verbose = options->verbose;
     
-    size_t input_size = 0;
-    char line[1024];
-    while (fgets(line, sizeof(line), input_fp) != NULL && input_size < MAX_INPUT_SIZE - 1) {
-        size_t line_len = strlen(line);
-        if (input_size + line_len >= MAX_INPUT_SIZE - 1) {
-            break;
+    // Hand the compile to a running daemon, which skips all of the startup work below
+    char socket_path[1024];
+    install_interrupt_handler();
+    if (options->use_daemon && server_default_socket(socket_path, sizeof(socket_path))) {
+        int status = server_client_compile(socket_path, input_text, target_language, stream, output_file,
+                                           options->timeout_ms);
+        if (status >= 0) {
+            if (english_is_cancelled()) {
+                return compile_failed(target_language);
+            }
+            if (verbose) {
+                fprintf(stderr, "Verbose mode: Compiled by the daemon at %s\n", socket_path);
+            }
+            return status;
         }
-        strcpy(input_buffer + input_size, line);
-        input_size += line_len;
     }
-    input_buffer[input_size] = '\0';
     
-    if (input_file != NULL) {
-        fclose(input_fp);
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    // Set verbose mode if requested
+    english_set_verbose(verbose);
+    english_set_cache_enabled(options->use_cache);
+    english_set_extract_mode(options->extract_mode);
+    english_set_timeout(options->timeout_ms);
+    english_set_max_retries(options->retries);
+    
+    if (verbose) {
+        fprintf(stderr, "Verbose mode: Using Ollama for code generation\n");
+    }
+    
+    // In streaming mode code goes to the output as soon as Ollama produces it
+    if (stream) {
+        FILE *output_fp = stdout;
+        if (output_file != NULL) {
+            output_fp = fopen(output_file, "w");
+            if (output_fp == NULL) {
+                fprintf(stderr, "Error: Could not open output file %s\n", output_file);
+                english_cleanup();
+                return 1;
+            }
+        }
+        
+        bool success = english_compile_stream(input_text, target_language, write_stream_chunk, output_fp);
+        if (success) {
+            fputc('\n', output_fp);
+        }
+        if (options->show_stats) {
+            print_compile_stats();
+        }
+        
+        if (output_file != NULL) {
+            fclose(output_fp);
+        }
+        
+        if (!success) {
+            english_cleanup();
+            return compile_failed(target_language);
+        }
+        
+        english_cleanup();
+        return 0;
     }
     
     // Compile the English text to code
-    char output_buffer[MAX_OUTPUT_SIZE];
-    if (!english_compile(input_buffer, target_language, output_buffer, sizeof(output_buffer))) {
-        fprintf(stderr, "Error: Failed to compile English to %s\n", target_language);
+    size_t output_length;
+    char *output;
+    if (options->chunk_tokens > 0) {
+        output = chunk_compile(input_text, strlen(input_text), target_language, options->chunk_tokens,
+                               options->merge, batch_default_parallel(), &output_length);
+    } else if (options->candidates > 1) {
+        output = english_compile_candidates(input_text, target_language, options->candidates, &output_length);
+    } else {
+        output = english_compile(input_text, target_language, &output_length);
+    }
+    if (options->show_stats) {
+        print_compile_stats();
+    }
+    if (output == NULL) {
         english_cleanup();
-        return 1;
+        return compile_failed(target_language);
+    }
+    
+    // The whole response came back, to be cut into one file per block
+    if (options->split_dir != NULL) {
+        int status = write_split_blocks(output, output_length, target_language, options->split_dir);
+        free(output);
+        english_cleanup();
+        return status;
     }
     
     // Write output to file or stdout
@@ -136,12 +703,15 @@ static int handle_compile(const char *target_language, const char *input_file, c
         output_fp = fopen(output_file, "w");
         if (output_fp == NULL) {
             fprintf(stderr, "Error: Could not open output file %s\n", output_file);
+            free(output);
             english_cleanup();
             return 1;
         }
     }
     
-    fprintf(output_fp, "%s\n", output_buffer);
+    fwrite(output, 1, output_length, output_fp);
+    fputc('\n', output_fp);
+    free(output);
     
     if (output_file != NULL) {
         fclose(output_fp);
@@ -151,6 +721,91 @@ static int handle_compile(const char *target_language, const char *input_file, c
     return 0;
 }
 
+// Compile section by section, reusing the sections recorded next to the output
+static int compile_incremental(const char *input_text, size_t input_length, const char *target_language,
+                               const compile_options_t *options) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    english_set_verbose(options->verbose);
+    english_set_cache_enabled(options->use_cache);
+    english_set_timeout(options->timeout_ms);
+    english_set_max_retries(options->retries);
+    install_interrupt_handler();
+    
+    bool success = incremental_compile(input_text, input_length, target_language, options->output_file,
+                                       batch_default_parallel());
+    
+    english_cleanup();
+    if (!success && english_is_cancelled()) {
+        fprintf(stderr, "Error: Cancelled\n");
+        return EXIT_CANCELLED;
+    }
+    return success ? 0 : 1;
+}
+
+// Compile to several languages at once, one file per language in the output directory
+static int compile_targets(const char *input_text, const char *languages, const char *input_file,
+                           const compile_options_t *options) {
+    if (!english_init()) {
+        fprintf(stderr, "Error: Could not initialize English compiler\n");
+        return 1;
+    }
+    
+    english_set_verbose(options->verbose);
+    english_set_cache_enabled(options->use_cache);
+    english_set_timeout(options->timeout_ms);
+    english_set_max_retries(options->retries);
+    install_interrupt_handler();
+    
+    // The output files are named after the input file, without its extension
+    char name[256] = "main";
+    if (input_file != NULL) {
+        const char *base = strrchr(input_file, '/');
+        base = base != NULL ? base + 1 : input_file;
+        const char *dot = strrchr(base, '.');
+        size_t length = dot != NULL && dot != base ? (size_t)(dot - base) : strlen(base);
+        if (length > 0 && length < sizeof(name)) {
+            memcpy(name, base, length);
+            name[length] = '\0';
+        }
+    }
+    
+    int failed = batch_fan_out(input_text, languages, options->output_file, name);
+    
+    english_cleanup();
+    if (english_is_cancelled()) {
+        return EXIT_CANCELLED;
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+static int handle_compile(const char *target_language, const char *input_file, const compile_options_t *options) {
+    // Read input from file or stdin; files are mapped rather than copied
+    if (input_file == NULL) {
+        printf("Enter English description (Ctrl+D to end):\n");
+    }
+    
+    input_t input;
+    if (!input_open(input_file, &input)) {
+        return 1;
+    }
+    
+    int status;
+    if (strchr(target_language, ',') != NULL) {
+        status = compile_targets(input.data, target_language, input_file, options);
+    } else if (options->incremental) {
+        status = compile_incremental(input.data, input.size, target_language, options);
+    } else {
+        status = compile_text(input.data, target_language, options);
+    }
+    
+    input_close(&input);
+    return status;
+}
+
 int main(int argc, char *argv[]) {
     // Check if we have enough arguments
     if (argc < 2) {
@@ -198,6 +853,15 @@ int main(int argc, char *argv[]) {
             return handle_set_model(argv[3]);
         }
         
+        // Handle 'set keep_alive' command
+        if (argc >= 3 && strcmp(argv[2], "keep_alive") == 0) {
+            if (argc < 4) {
+                fprintf(stderr, "Error: Missing keep_alive duration\n");
+                return 1;
+            }
+            return handle_set_keep_alive(argv[3]);
+        }
+        
         fprintf(stderr, "Error: Unknown set parameter '%s'\n", argv[2]);
         print_usage();
         return 1;
@@ -220,11 +884,224 @@ int main(int argc, char *argv[]) {
             return handle_get_model();
         }
         
+        // Handle 'get keep_alive' command
+        if (strcmp(argv[2], "keep_alive") == 0) {
+            return handle_get_keep_alive();
+        }
+        
         fprintf(stderr, "Error: Unknown get parameter '%s'\n", argv[2]);
         print_usage();
         return 1;
     }
     
+    // Handle cache commands
+    if (strcmp(argv[1], "cache") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Error: Missing cache command (stats or clear)\n");
+            return 1;
+        }
+        
+        if (strcmp(argv[2], "stats") == 0) {
+            return handle_cache_stats();
+        }
+        
+        if (strcmp(argv[2], "clear") == 0) {
+            return handle_cache_clear();
+        }
+        
+        fprintf(stderr, "Error: Unknown cache command '%s'\n", argv[2]);
+        print_usage();
+        return 1;
+    }
+    
+    // Handle stats commands
+    if (strcmp(argv[1], "stats") == 0) {
+        if (argc < 3) {
+            return handle_stats();
+        }
+        
+        if (strcmp(argv[2], "clear") == 0) {
+            return handle_stats_clear();
+        }
+        
+        fprintf(stderr, "Error: Unknown stats command '%s'\n", argv[2]);
+        print_usage();
+        return 1;
+    }
+    
+    // Handle 'serve' command
+    if (strcmp(argv[1], "serve") == 0) {
+        const char *socket_path = NULL;
+        
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+                socket_path = argv[++i];
+            } else {
+                fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+                return 1;
+            }
+        }
+        
+        return handle_serve(socket_path, verbose);
+    }
+    
+    // Handle 'warm' command
+    if (strcmp(argv[1], "warm") == 0) {
+        const char *keep_alive = NULL;
+        
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--keep-alive") == 0 && i + 1 < argc) {
+                keep_alive = argv[++i];
+            } else {
+                fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+                return 1;
+            }
+        }
+        
+        return handle_warm(keep_alive, verbose);
+    }
+    
+    // Handle 'batch' command
+    if (strcmp(argv[1], "batch") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Error: Missing job file\n");
+            return 1;
+        }
+        
+        const char *jobs_file = argv[2];
+        int max_parallel = batch_default_parallel();
+        bool use_cache = true;
+        long timeout_ms = 0;
+        int retries = english_get_max_retries();
+        bool session = false;
+        
+        // Parse options
+        for (int i = 3; i < argc; i++) {
+            if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i + 1 < argc) {
+                max_parallel = atoi(argv[++i]);
+                if (max_parallel < 1) {
+                    fprintf(stderr, "Error: Invalid number of jobs %s\n", argv[i]);
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--no-cache") == 0) {
+                use_cache = false;
+            } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+                if (!parse_timeout(argv[++i], &timeout_ms)) {
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--retries") == 0 && i + 1 < argc) {
+                if (!parse_retries(argv[++i], &retries)) {
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--session") == 0) {
+                session = true;
+            } else {
+                fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+                return 1;
+            }
+        }
+        
+        return handle_batch(jobs_file, max_parallel, use_cache, timeout_ms, retries, session, verbose);
+    }
+    
+    // Handle 'build' command; targets to build may be named among the options
+    if (strcmp(argv[1], "build") == 0) {
+        const char *project_file = BUILD_DEFAULT_PROJECT;
+        const char **names = calloc(argc, sizeof(const char *));
+        int name_count = 0;
+        int max_parallel = batch_default_parallel();
+        bool force = false;
+        bool use_cache = true;
+        long timeout_ms = 0;
+        int retries = english_get_max_retries();
+        if (names == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        
+        // Parse options
+        bool valid = true;
+        for (int i = 2; valid && i < argc; i++) {
+            if ((strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--file") == 0) && i + 1 < argc) {
+                project_file = argv[++i];
+            } else if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i + 1 < argc) {
+                max_parallel = atoi(argv[++i]);
+                if (max_parallel < 1) {
+                    fprintf(stderr, "Error: Invalid number of jobs %s\n", argv[i]);
+                    valid = false;
+                }
+            } else if (strcmp(argv[i], "--force") == 0) {
+                force = true;
+            } else if (strcmp(argv[i], "--no-cache") == 0) {
+                use_cache = false;
+            } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+                valid = parse_timeout(argv[++i], &timeout_ms);
+            } else if (strcmp(argv[i], "--retries") == 0 && i + 1 < argc) {
+                valid = parse_retries(argv[++i], &retries);
+            } else if (argv[i][0] != '-') {
+                names[name_count++] = argv[i];
+            } else {
+                fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+                valid = false;
+            }
+        }
+        
+        int status = valid ? handle_build(project_file, names, name_count, max_parallel, force, use_cache,
+                                          timeout_ms, retries, verbose) : 1;
+        free(names);
+        return status;
+    }
+    
+    // Handle 'watch' command; the language may come before or after the options
+    if (strcmp(argv[1], "watch") == 0) {
+        const char *target_language = NULL;
+        const char *input_path = NULL;
+        const char *output_path = NULL;
+        long debounce_ms = WATCH_DEFAULT_DEBOUNCE_MS;
+        bool use_cache = true;
+        long timeout_ms = 0;
+        int retries = english_get_max_retries();
+        
+        // Parse options
+        for (int i = 2; i < argc; i++) {
+            if ((strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--file") == 0) && i + 1 < argc) {
+                input_path = argv[++i];
+            } else if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) && i + 1 < argc) {
+                output_path = argv[++i];
+            } else if (strcmp(argv[i], "--debounce") == 0 && i + 1 < argc) {
+                char *end;
+                debounce_ms = strtol(argv[++i], &end, 10);
+                if (end == argv[i] || *end != '\0' || debounce_ms < 0) {
+                    fprintf(stderr, "Error: Invalid debounce %s\n", argv[i]);
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--no-cache") == 0) {
+                use_cache = false;
+            } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+                if (!parse_timeout(argv[++i], &timeout_ms)) {
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--retries") == 0 && i + 1 < argc) {
+                if (!parse_retries(argv[++i], &retries)) {
+                    return 1;
+                }
+            } else if (argv[i][0] != '-' && target_language == NULL) {
+                target_language = argv[i];
+            } else {
+                fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+                return 1;
+            }
+        }
+        
+        if (target_language == NULL || input_path == NULL || output_path == NULL) {
+            fprintf(stderr, "Error: watch needs a target language, --file and --output\n");
+            return 1;
+        }
+        
+        return handle_watch(target_language, input_path, output_path, debounce_ms, use_cache, timeout_ms,
+                            retries, verbose);
+    }
+    
     // Handle 'compile' command
     if (strcmp(argv[1], "compile") == 0) {
         if (argc < 3) {
@@ -234,21 +1111,113 @@ int main(int argc, char *argv[]) {
         
         const char *target_language = argv[2];
         const char *input_file = NULL;
-        const char *output_file = NULL;
+        compile_options_t options = { NULL, NULL, false, false, ENGLISH_EXTRACT_FIRST, true, true, false, 0,
+                                      english_get_max_retries(), verbose, 1, 0, CHUNK_MERGE_JOIN };
         
         // Parse options
         for (int i = 3; i < argc; i++) {
             if ((strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--file") == 0) && i + 1 < argc) {
                 input_file = argv[++i];
             } else if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) && i + 1 < argc) {
-                output_file = argv[++i];
+                options.output_file = argv[++i];
+            } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--stream") == 0) {
+                options.stream = true;
+            } else if (strcmp(argv[i], "--no-cache") == 0) {
+                options.use_cache = false;
+            } else if (strcmp(argv[i], "--no-daemon") == 0) {
+                options.use_daemon = false;
+            } else if (strcmp(argv[i], "--incremental") == 0) {
+                options.incremental = true;
+            } else if (strcmp(argv[i], "--stats") == 0) {
+                options.show_stats = true;
+            } else if (strcmp(argv[i], "--all-blocks") == 0) {
+                options.extract_mode = ENGLISH_EXTRACT_ALL;
+            } else if (strcmp(argv[i], "--split") == 0 && i + 1 < argc) {
+                options.split_dir = argv[++i];
+                options.extract_mode = ENGLISH_EXTRACT_NONE;
+            } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+                if (!parse_timeout(argv[++i], &options.timeout_ms)) {
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--retries") == 0 && i + 1 < argc) {
+                if (!parse_retries(argv[++i], &options.retries)) {
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--candidates") == 0 && i + 1 < argc) {
+                if (!parse_candidates(argv[++i], &options.candidates)) {
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--chunked") == 0) {
+                options.chunk_tokens = options.chunk_tokens > 0 ? options.chunk_tokens : CHUNK_DEFAULT_TOKENS;
+            } else if (strcmp(argv[i], "--chunk-tokens") == 0 && i + 1 < argc) {
+                char *end;
+                long tokens = strtol(argv[++i], &end, 10);
+                if (end == argv[i] || *end != '\0' || tokens < CHUNK_MIN_TOKENS) {
+                    fprintf(stderr, "Error: Invalid chunk size %s (at least %d tokens)\n", argv[i], CHUNK_MIN_TOKENS);
+                    return 1;
+                }
+                options.chunk_tokens = (size_t)tokens;
+            } else if (strcmp(argv[i], "--merge") == 0 && i + 1 < argc) {
+                i++;
+                if (strcmp(argv[i], "join") == 0) {
+                    options.merge = CHUNK_MERGE_JOIN;
+                } else if (strcmp(argv[i], "model") == 0) {
+                    options.merge = CHUNK_MERGE_MODEL;
+                } else {
+                    fprintf(stderr, "Error: Invalid merge %s (join or model)\n", argv[i]);
+                    return 1;
+                }
             } else {
                 fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
                 return 1;
             }
         }
         
-        return handle_compile(target_language, input_file, output_file, verbose);
+        // The manifest of an incremental build lives next to its output
+        if (options.incremental && (options.output_file == NULL || options.stream)) {
+            fprintf(stderr, "Error: --incremental needs --output and cannot be combined with --stream\n");
+            return 1;
+        }
+        if (options.incremental && (options.show_stats || options.extract_mode != ENGLISH_EXTRACT_FIRST)) {
+            fprintf(stderr, "Error: --stats, --all-blocks and --split cannot be combined with --incremental\n");
+            return 1;
+        }
+        // Several targets get one file each in the output directory
+        if (strchr(target_language, ',') != NULL &&
+            (options.output_file == NULL || options.stream || options.incremental || options.show_stats ||
+             options.extract_mode != ENGLISH_EXTRACT_FIRST)) {
+            fprintf(stderr, "Error: Several languages need --output DIR and cannot be combined with "
+                    "--stream, --incremental, --stats, --all-blocks or --split\n");
+            return 1;
+        }
+        if (options.split_dir != NULL && (options.stream || options.output_file != NULL)) {
+            fprintf(stderr, "Error: --split cannot be combined with --stream or --output\n");
+            return 1;
+        }
+        // Candidates are validated whole, before any of them reaches the output
+        if (options.candidates > 1 && (options.stream || options.incremental || options.split_dir != NULL ||
+                                       strchr(target_language, ',') != NULL)) {
+            fprintf(stderr, "Error: --candidates cannot be combined with --stream, --incremental, --split "
+                    "or several languages\n");
+            return 1;
+        }
+        
+        // The parts are merged once all of them are in
+        if (options.chunk_tokens > 0 && (options.stream || options.incremental || options.candidates > 1 ||
+                                         options.split_dir != NULL || strchr(target_language, ',') != NULL)) {
+            fprintf(stderr, "Error: --chunked cannot be combined with --stream, --incremental, --candidates, "
+                    "--split or several languages\n");
+            return 1;
+        }
+        
+        // The daemon always uses its cache, returns the first block of one answer and retries by
+        // default, so anything else means compiling here; the timings of --stats are only known to
+        // the process that ran the compile. A timeout is kept by waiting no longer for the daemon.
+        options.use_daemon = options.use_daemon && options.use_cache && !options.show_stats &&
+                             options.candidates == 1 && options.chunk_tokens == 0 &&
+                             options.extract_mode == ENGLISH_EXTRACT_FIRST &&
+                             options.retries == english_get_max_retries();
+        return handle_compile(target_language, input_file, &options);
     }
     
     // Unknown command
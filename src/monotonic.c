@@ -0,0 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/monotonic.h"
+
+#include <time.h>
+
+double monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
@@ -0,0 +1,2041 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/request.h"
+#include "../include/arena.h"
+#include "../include/balancer.h"
+#include "../include/config.h"
+#include "../include/cache.h"
+#include "../include/context.h"
+#include "../include/fence.h"
+#include "../include/json.h"
+#include "../include/monotonic.h"
+#include "../include/router.h"
+#include "../include/semcache.h"
+#include "../include/stats.h"
+#include "../include/tokens.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A growable buffer in the request's arena
+typedef struct {
+    arena_t *arena;
+    char *data;
+    size_t size;
+    size_t capacity;
+} response_data_t;
+
+// Where the streaming fence filter is within the generated text
+typedef enum {
+    STREAM_START,        // Before the first line of code has been identified
+    STREAM_IN_FENCE,     // Inside a ``` block, emitting code until the closing fence
+    STREAM_PASSTHROUGH,  // Unfenced response, emitting everything as code
+    STREAM_BETWEEN,      // Past a closing fence, looking for the next block (ENGLISH_EXTRACT_ALL)
+    STREAM_DONE          // Past the closing fence, discarding commentary
+} stream_filter_t;
+
+// State carried across CURL callbacks for a streaming compile
+typedef struct {
+    english_stream_callback callback;
+    void *userdata;
+    response_data_t line;     // Partial line of generated text (STREAM_START and STREAM_BETWEEN)
+    response_data_t pending;  // Held-back preamble lines (STREAM_START only)
+    response_data_t code;     // Everything emitted so far
+    stream_filter_t filter;
+    english_extract_t extract_mode;
+    int backticks;            // Backticks held back inside a fence
+    bool line_blank;          // Only blanks so far on the current line of code; they are held in line
+    bool closing;             // Three backticks ended mid-line; a fence if the line ends after them
+    bool received;
+    bool done;
+    bool failed;
+    bool aborted;
+} stream_state_t;
+
+// Longest wait for an embedding; the semantic cache is skipped rather than hold up the compile
+#define EMBED_TIMEOUT_MS 5000L
+
+// Longest description the semantic cache embeds; longer ones only use the exact cache
+#define MAX_EMBED_LENGTH 32768
+
+// Longest routing hint a description can give
+#define MAX_HINT_LENGTH 64
+
+// Sampling temperature sent with every request
+#define TEMPERATURE 0.1
+
+// How much hotter each further candidate samples, up to the cap
+#define CANDIDATE_TEMPERATURE_STEP 0.2
+#define CANDIDATE_MAX_TEMPERATURE 1.0
+
+// Sampling options as they enter the cache key, with the extraction mode
+// unless it is the default; indexed by english_extract_t
+static const char *const cache_options[] = {
+    "temperature=0.1",
+    "temperature=0.1;extract=all",
+    "temperature=0.1;extract=none"
+};
+
+// Most tokens an answer cut off at the automatic num_predict is given when it
+// is asked for again; each attempt doubles the limit
+#define MAX_GROWN_PREDICT 65536
+
+// Most transfers one request makes: the first attempt, a hedge, failovers and retries
+#define REQUEST_MAX_TRANSFERS (BALANCER_MAX_ENDPOINTS + 8)
+
+// Longest wait for a connection, so an unreachable server fails over in time
+#define CONNECT_TIMEOUT_MS 10000L
+
+// Backoff before the first retry, doubling for each further one up to the cap
+#define RETRY_BASE_MS 250.0
+#define RETRY_MAX_MS 8000.0
+
+// One attempt at a request, against one endpoint
+typedef struct {
+    struct english_request *request;
+    CURL *curl;                // NULL once the transfer has ended
+    int endpoint;
+    const char *url;           // The endpoint's URL when the transfer started, in the arena
+    double started_ms;
+    double first_byte_ms;      // Time to the first byte, if this transfer delivered the answer
+    bool overloaded;           // Answered with HTTP 429 or 5xx
+    response_data_t body;      // An overloaded server's error, or the raw answer in verbose mode
+} transfer_t;
+
+// A compile request; it lives in its own arena together with everything it
+// allocates, apart from the code handed to the caller
+struct english_request {
+    english_context_t *context;
+    balancer_t *balancer;      // The context's endpoints
+    bool verbose;              // The context's verbosity
+    arena_t *arena;
+    CURLM *multi;              // Where the transfers run
+    void *owner;               // CURLOPT_PRIVATE of every transfer
+    transfer_t transfers[REQUEST_MAX_TRANSFERS];
+    int transfer_count;
+    int active_count;          // Transfers still attached to the multi handle
+    int winner;                // The transfer whose answer is used, -1 until one answers
+    int final;                 // The transfer whose result is reported, -1 before any ended
+    CURLcode result;           // Result of the final transfer
+    double hedge_at_ms;        // When to send a hedged duplicate, negative for never
+    double retry_at_ms;        // When to retry after a failure, negative for never
+    double deadline_ms;        // When to give up, 0 for never
+    long timeout_ms;           // The timeout the deadline came from
+    int retries;
+    unsigned int jitter_seed;
+    bool cancelled;
+    response_data_t payload;   // Request JSON
+    const char *model_name;
+    double temperature;
+    unsigned int seed;         // Sampling seed, 0 to let the server pick one
+    size_t num_ctx;            // Context window to ask for, 0 for the server's default
+    size_t num_predict;        // Most tokens to generate, 0 for no limit
+    const char *options;       // Options as they enter cache keys
+    router_route_t route;      // The models to try, smallest first
+    size_t route_index;        // Which of them model_name is
+    double model_started_ms;   // When the current model was first asked
+    bool checked;              // The answer was parsed early to decide on escalating
+    bool checked_success;      // Whether that parse succeeded
+    char *fallback;            // Code of a smaller model that failed the check, kept in case the larger ones fail
+    size_t fallback_length;
+    const char *fallback_model;
+    char *target_language;
+    char *system;
+    char *prompt;
+    char *session_key;         // Model and language, when continuing a conversation
+    char *session;             // Conversation state sent with the request, as JSON
+    response_data_t session_reply;  // Conversation state returned with the response
+    uint8_t cache_key[SHA256_DIGEST_SIZE];
+    uint8_t semantic_scope[SHA256_DIGEST_SIZE];
+    float *embedding;          // The description's embedding, kept to store with the result
+    size_t embedding_length;
+    bool use_cache;
+    bool cache_on_keep;        // A candidate, stored in the cache only if the caller keeps it
+    bool cached;
+    bool streaming;
+    english_extract_t extract_mode;
+    stream_state_t stream;     // Filter state (streaming only)
+    json_decoder_t decoder;    // Reads the winner's answer as it arrives
+    response_data_t answer;    // The generated text of a non-streaming answer
+    response_data_t error;     // Ollama's error message, if it sent one
+    int answer_objects;        // Complete JSON objects read so far
+    bool has_answer;
+    bool has_error;
+    bool decode_failed;        // The answer is not JSON; the rest of it is ignored
+    char done_reason[16];      // Why the generation stopped, cut short if long
+    size_t done_reason_length;
+    bool truncated;            // The generation stopped at num_predict
+    char *output;              // Extracted code (non-streaming or cached), on the heap
+    size_t output_length;
+    double started_ms;         // When request_new was called
+    english_stats_t stats;     // Where the time went
+};
+
+// Make room for length more bytes and the NUL; capacity doubles so large
+// responses are copied O(log n) times rather than once per chunk
+static bool response_reserve(response_data_t *buffer, size_t length) {
+    if (buffer->size + length + 1 <= buffer->capacity) {
+        return true;
+    }
+    
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 256;
+    while (capacity < buffer->size + length + 1) {
+        capacity *= 2;
+    }
+    
+    char *grown = arena_grow(buffer->arena, buffer->data, buffer->capacity, capacity);
+    if (grown == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+    buffer->data = grown;
+    buffer->capacity = capacity;
+    return true;
+}
+
+// Append to a buffer, keeping it NUL-terminated
+static bool response_append(response_data_t *buffer, const char *data, size_t length) {
+    if (!response_reserve(buffer, length)) {
+        return false;
+    }
+    
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+    buffer->data[buffer->size] = '\0';
+    return true;
+}
+
+// Callback function for CURL to handle response data
+static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t real_size = size * nmemb;
+    response_data_t *resp = (response_data_t *)userp;
+    
+    return response_append(resp, contents, real_size) ? real_size : 0;
+}
+
+// Most strings join_parts takes
+#define MAX_PARTS 8
+
+// Join strings into one exactly-sized buffer in the arena
+static char *join_parts(arena_t *arena, const char *const *parts, size_t count) {
+    size_t lengths[MAX_PARTS];
+    
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        lengths[i] = strlen(parts[i]);
+        total += lengths[i];
+    }
+    
+    char *text = arena_alloc(arena, total + 1);
+    if (text == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    
+    char *end = text;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(end, parts[i], lengths[i]);
+        end += lengths[i];
+    }
+    *end = '\0';
+    
+    return text;
+}
+
+// The instructions, sent as the system message. They only depend on the
+// language, so Ollama can reuse its evaluation of them from one compile to the next.
+static char *build_system(arena_t *arena, const char *target_language) {
+    const char *parts[] = {
+        "You are a compiler that translates English to ", target_language,
+        " code. IMPORTANT: Generate ONLY code with NO explanations, comments, or any other text.\n\n"
+        "Your response must ONLY contain valid ", target_language,
+        " code and nothing else. Do not include any explanations before or after the code.\n\n"
+        "Translate the English description the user gives you into ", target_language, " code."
+    };
+    return join_parts(arena, parts, sizeof(parts) / sizeof(parts[0]));
+}
+
+// The description itself, sent as the prompt
+static char *build_prompt(arena_t *arena, const char *english_text) {
+    const char *parts[] = { english_text, "\n\nCode:" };
+    return join_parts(arena, parts, sizeof(parts) / sizeof(parts[0]));
+}
+
+// Hand encoded JSON to a buffer
+static bool write_buffer(const char *data, size_t length, void *target) {
+    return response_append((response_data_t *)target, data, length);
+}
+
+// Append a JSON string literal, escaping what JSON requires
+static bool append_json_string(response_data_t *buffer, const char *text) {
+    return json_write_string(text, strlen(text), write_buffer, buffer);
+}
+
+// Append Ollama's keep_alive: a number of seconds, or a duration string such as "30m"
+static bool append_keep_alive(response_data_t *payload, const char *keep_alive) {
+    const char *digits = keep_alive[0] == '-' ? keep_alive + 1 : keep_alive;
+    bool number = digits[0] != '\0' && strspn(digits, "0123456789") == strlen(digits);
+    
+    return response_append(payload, ", \"keep_alive\": ", 16) &&
+           (number ? response_append(payload, keep_alive, strlen(keep_alive)) : append_json_string(payload, keep_alive));
+}
+
+// Build the JSON request payload sent to Ollama's /api/generate endpoint; it is
+// written straight into the arena, the prompt escaped on the way
+static bool build_request(response_data_t *payload, const english_request_t *request, const char *keep_alive) {
+    char tail[192];
+    
+    // Sampling and sizes go under "options", where Ollama reads them; then
+    // whether Ollama answers with NDJSON chunks
+    int tail_length = snprintf(tail, sizeof(tail), ", \"options\": { \"temperature\": %.1f", request->temperature);
+    if (request->seed != 0) {
+        tail_length += snprintf(tail + tail_length, sizeof(tail) - tail_length, ", \"seed\": %u", request->seed);
+    }
+    if (request->num_ctx > 0) {
+        tail_length += snprintf(tail + tail_length, sizeof(tail) - tail_length, ", \"num_ctx\": %zu",
+                                request->num_ctx);
+    }
+    if (request->num_predict > 0) {
+        tail_length += snprintf(tail + tail_length, sizeof(tail) - tail_length, ", \"num_predict\": %zu",
+                                request->num_predict);
+    }
+    tail_length += snprintf(tail + tail_length, sizeof(tail) - tail_length, " }, \"stream\": %s }",
+                            request->streaming ? "true" : "false");
+    
+    // Sized for the text as it is, plus room for a few escapes, so it is not copied as it grows
+    size_t text_length = strlen(request->system) + strlen(request->prompt) +
+                         (request->session != NULL ? strlen(request->session) : 0);
+    return response_reserve(payload, text_length + text_length / 16 + 256) &&
+           response_append(payload, "{ \"model\": ", 11) &&
+           append_json_string(payload, request->model_name) &&
+           response_append(payload, ", \"system\": ", 12) &&
+           append_json_string(payload, request->system) &&
+           response_append(payload, ", \"prompt\": ", 12) &&
+           append_json_string(payload, request->prompt) &&
+           (request->session == NULL ||
+            (response_append(payload, ", \"context\": ", 13) &&
+             response_append(payload, request->session, strlen(request->session)))) &&
+           (keep_alive == NULL || append_keep_alive(payload, keep_alive)) &&
+           response_append(payload, tail, tail_length);
+}
+
+// The options that enter cache keys: sampling, extraction, and the window and
+// answer length when the config file fixes them, since a smaller num_predict
+// can cut off an answer a larger one would finish
+static const char *build_options(arena_t *arena, english_extract_t extract_mode) {
+    char options[128];
+    int length = snprintf(options, sizeof(options), "%s", cache_options[extract_mode]);
+    if (config_get_num_ctx() >= 0) {
+        length += snprintf(options + length, sizeof(options) - (size_t)length, ";num_ctx=%ld",
+                           config_get_num_ctx());
+    }
+    if (config_get_num_predict() != CONFIG_AUTO) {
+        snprintf(options + length, sizeof(options) - (size_t)length, ";num_predict=%ld",
+                 config_get_num_predict());
+    }
+    return arena_strdup(arena, options);
+}
+
+// The context window that matches config_get_num_ctx, at least window when it is sized automatically
+static size_t configured_window(english_context_t *context, size_t window) {
+    long configured = config_get_num_ctx();
+    if (configured >= 0) {
+        return (size_t)configured;
+    }
+    return configured == CONFIG_GROW ? context_fit_window(context, tokens_window(window)) : tokens_window(window);
+}
+
+// Fill in num_ctx and num_predict from estimates of the prompt and the answer,
+// unless the config file sets them
+static void size_request(english_request_t *request) {
+    double started = monotonic_ms();
+    size_t prompt_tokens = tokens_estimate(request->prompt, strlen(request->prompt));
+    size_t needed = tokens_estimate(request->system, strlen(request->system)) + prompt_tokens;
+    
+    // A session's earlier conversation takes its place in the window too
+    if (request->session != NULL) {
+        needed++;
+        for (const char *p = request->session; *p != '\0'; p++) {
+            needed += *p == ',';
+        }
+    }
+    
+    size_t expected = tokens_expected_output(request->target_language, prompt_tokens);
+    long predict = config_get_num_predict();
+    request->num_predict = predict == CONFIG_AUTO ? expected : (size_t)predict;
+    needed += request->num_predict > 0 ? request->num_predict : expected;
+    request->num_ctx = configured_window(request->context, needed);
+    
+    // The largest window still cuts off the beginning of a longer prompt
+    if (config_get_num_ctx() < 0 && needed > TOKENS_MAX_WINDOW) {
+        fprintf(stderr, "Warning: The compile needs about %zu tokens, more than the largest context window of %d; "
+                "compile the description in parts with --chunked\n", needed, TOKENS_MAX_WINDOW);
+    }
+    
+    if (request->verbose) {
+        fprintf(stderr, "Verbose mode: Estimated %zu prompt tokens in %.3f ms; num_ctx %zu, num_predict %zu\n",
+                prompt_tokens, monotonic_ms() - started, request->num_ctx, request->num_predict);
+    }
+}
+
+// Copy a field of Ollama's own accounting of the generation into the stats
+static void read_ollama_metric(const json_value_t *value, english_stats_t *stats) {
+    if (json_is_key(value, "eval_count")) {
+        stats->eval_count = json_get_int(value);
+    } else if (json_is_key(value, "eval_duration")) {
+        stats->eval_duration_ns = json_get_int(value);
+    } else if (json_is_key(value, "prompt_eval_count")) {
+        stats->prompt_eval_count = json_get_int(value);
+    } else if (json_is_key(value, "prompt_eval_duration")) {
+        stats->prompt_eval_duration_ns = json_get_int(value);
+    } else if (json_is_key(value, "load_duration")) {
+        stats->load_duration_ns = json_get_int(value);
+    }
+}
+
+// Keep the conversation state a response returned, a list of numbers, as JSON
+static bool read_session(const json_value_t *value, response_data_t *session_reply) {
+    if (value->kind == JSON_BEGIN_ARRAY && value->depth == 1) {
+        session_reply->size = 0;
+        return response_append(session_reply, "[", 1);
+    }
+    if (value->kind == JSON_END_ARRAY && value->depth == 1) {
+        return response_append(session_reply, "]", 1);
+    }
+    if (value->kind == JSON_NUMBER && value->depth == 2) {
+        return (session_reply->size <= 1 || response_append(session_reply, ",", 1)) &&
+               response_append(session_reply, value->data, value->length);
+    }
+    return true;
+}
+
+// Split the transfer into the phases CURL timed; its timestamps are cumulative
+static void read_network_times(CURL *curl, english_stats_t *stats) {
+    curl_off_t name_lookup = 0;
+    curl_off_t connect = 0;
+    curl_off_t app_connect = 0;
+    curl_off_t pre_transfer = 0;
+    curl_off_t start_transfer = 0;
+    curl_off_t total = 0;
+    
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &name_lookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &app_connect);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pre_transfer);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &start_transfer);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    
+    // A reused connection reports zero for the phases it skipped
+    stats->dns_ms = name_lookup / 1000.0;
+    stats->connect_ms = connect > name_lookup ? (connect - name_lookup) / 1000.0 : 0;
+    stats->tls_ms = app_connect > connect ? (app_connect - connect) / 1000.0 : 0;
+    stats->first_byte_ms = start_transfer > pre_transfer ? (start_transfer - pre_transfer) / 1000.0 : 0;
+    stats->transfer_ms = total > start_transfer ? (total - start_transfer) / 1000.0 : 0;
+}
+
+// Print an error returned by Ollama, with hints for the common cases
+static void report_ollama_error(const char *error_str, const char *model_name) {
+    fprintf(stderr, "Error from Ollama: %s\n", error_str);
+    
+    // Provide more helpful error message for common errors
+    if (strstr(error_str, "model not found") != NULL) {
+        fprintf(stderr, "The model '%s' is not available in your Ollama installation.\n", model_name);
+        fprintf(stderr, "Try setting a different model with 'english set model MODEL_NAME'\n");
+        fprintf(stderr, "Common Ollama models include: llama3, codellama, mistral, gemma\n");
+    }
+}
+
+// Copy the code a response holds, as the extraction mode asks, into an exactly-sized heap buffer
+static char *extract_output(english_request_t *request, const char *text, size_t length, size_t *output_length) {
+    const char *code = text;
+    size_t code_length = length;
+    
+    if (request->extract_mode == ENGLISH_EXTRACT_ALL) {
+        // Note every block in one scan, then join them with a blank line between
+        fence_block_t *blocks = NULL;
+        size_t count = 0;
+        size_t capacity = 0;
+        size_t total = 0;
+        size_t offset = 0;
+        fence_block_t block;
+        while (fence_next(text, length, &offset, &block)) {
+            // An empty block adds nothing but a separator, so every kept
+            // block ends with a byte the next separator can look back at
+            if (block.code_length == 0) {
+                continue;
+            }
+            if (count == capacity) {
+                size_t grown_capacity = capacity > 0 ? capacity * 2 : 8;
+                fence_block_t *grown = arena_grow(request->arena, blocks, capacity * sizeof(fence_block_t),
+                                                  grown_capacity * sizeof(fence_block_t));
+                if (grown == NULL) {
+                    fprintf(stderr, "Error: Out of memory\n");
+                    return NULL;
+                }
+                blocks = grown;
+                capacity = grown_capacity;
+            }
+            blocks[count++] = block;
+            total += block.code_length + 2;
+        }
+        
+        if (count > 0) {
+            char *output = malloc(total + 1);
+            if (output == NULL) {
+                fprintf(stderr, "Error: Out of memory\n");
+                return NULL;
+            }
+            
+            char *end = output;
+            for (size_t i = 0; i < count; i++) {
+                if (i > 0) {
+                    if (end[-1] != '\n') {
+                        *end++ = '\n';
+                    }
+                    *end++ = '\n';
+                }
+                memcpy(end, blocks[i].code, blocks[i].code_length);
+                end += blocks[i].code_length;
+            }
+            *end = '\0';
+            *output_length = end - output;
+            return output;
+        }
+    }
+    
+    if (request->extract_mode != ENGLISH_EXTRACT_NONE) {
+        code = fence_extract(text, length, &code_length);
+    }
+    
+    char *output = malloc(code_length + 1);
+    if (output == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    memcpy(output, code, code_length);
+    output[code_length] = '\0';
+    *output_length = code_length;
+    return output;
+}
+
+// Emit a run of code to the stream callback, remembering a failed write
+static void stream_emit(stream_state_t *state, const char *text, size_t length) {
+    if (length == 0 || state->aborted) {
+        return;
+    }
+    
+    if (!state->callback(text, length, state->userdata)) {
+        state->aborted = true;
+    }
+    
+    // Keep a copy of the emitted code for the cache and request_get_output
+    response_append(&state->code, text, length);
+}
+
+// Handle one complete line of response text while looking for the opening fence
+static void stream_filter_line(stream_state_t *state, const char *line, size_t length) {
+    const char *p = line;
+    const char *end = line + length;
+    
+    // Skip leading whitespace to classify the line
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    
+    // Blank lines before any code carry nothing worth emitting
+    if (p == end) {
+        return;
+    }
+    
+    // An opening fence: drop it together with its language tag and any preamble
+    if (end - p >= 3 && strncmp(p, "```", 3) == 0) {
+        state->pending.size = 0;
+        state->filter = STREAM_IN_FENCE;
+        state->line_blank = true;
+        return;
+    }
+    
+    // A 'Code:' marker: the code follows it directly
+    if (end - p >= 5 && strncmp(p, "Code:", 5) == 0) {
+        p += 5;
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+            p++;
+        }
+        state->pending.size = 0;
+        state->filter = STREAM_PASSTHROUGH;
+        stream_emit(state, p, end - p);
+        return;
+    }
+    
+    // A line ending in ':' is most likely a preamble ("Here is the code:"), so
+    // hold it back until we know whether a fence follows
+    const char *last = end - 1;
+    while (last > p && (*last == ' ' || *last == '\t' || *last == '\r' || *last == '\n')) {
+        last--;
+    }
+    if (*last == ':') {
+        response_append(&state->pending, line, length);
+        return;
+    }
+    
+    // Anything else is code without a fence: release what was held and pass through
+    state->filter = STREAM_PASSTHROUGH;
+    stream_emit(state, state->pending.data, state->pending.size);
+    state->pending.size = 0;
+    stream_emit(state, line, length);
+}
+
+// Leave a fenced block, dropping whatever was held back for the closing fence
+static void stream_close_fence(stream_state_t *state) {
+    state->line.size = 0;
+    state->backticks = 0;
+    state->closing = false;
+    state->filter = state->extract_mode == ENGLISH_EXTRACT_ALL ? STREAM_BETWEEN : STREAM_DONE;
+}
+
+// Emit code inside a fence up to the closing fence, which like in fence_next is
+// three backticks that start or end a line. Indentation and backticks are held
+// back until it is clear whether they belong to the closing fence.
+static size_t stream_fence_text(stream_state_t *state, const char *text, size_t length) {
+    size_t run_start = 0;
+    size_t i = 0;
+    
+    while (i < length && state->filter == STREAM_IN_FENCE) {
+        char c = text[i];
+        bool blank = c == ' ' || c == '\t' || c == '\r';
+        
+        if (state->closing) {
+            if (blank) {
+                response_append(&state->line, &c, 1);
+                run_start = ++i;
+                continue;
+            }
+            if (c == '\n') {
+                stream_close_fence(state);
+                run_start = ++i;
+                break;
+            }
+            
+            // More code follows on the line, so the backticks were code too
+            stream_emit(state, "```", 3);
+            stream_emit(state, state->line.data, state->line.size);
+            state->line.size = 0;
+            state->closing = false;
+        }
+        
+        if (c == '`') {
+            stream_emit(state, text + run_start, i - run_start);
+            run_start = ++i;
+            if (++state->backticks == 3) {
+                state->backticks = 0;
+                if (state->line_blank) {
+                    stream_close_fence(state);
+                } else {
+                    state->closing = true;
+                }
+            }
+            continue;
+        }
+        
+        if (state->backticks > 0) {
+            // Fewer than three backticks are code, with the indentation before them
+            stream_emit(state, state->line.data, state->line.size);
+            state->line.size = 0;
+            stream_emit(state, "```", state->backticks);
+            state->backticks = 0;
+            state->line_blank = false;
+        }
+        
+        if (state->line_blank) {
+            stream_emit(state, text + run_start, i - run_start);
+            run_start = i;
+            if (blank) {
+                response_append(&state->line, &c, 1);
+                run_start = ++i;
+                continue;
+            }
+            stream_emit(state, state->line.data, state->line.size);
+            state->line.size = 0;
+            state->line_blank = false;
+        }
+        
+        if (c == '\n') {
+            state->line_blank = true;
+        }
+        i++;
+    }
+    
+    if (state->filter == STREAM_IN_FENCE) {
+        stream_emit(state, text + run_start, i - run_start);
+    }
+    return i;
+}
+
+// Handle one complete line of response text between fenced blocks
+static void stream_between_line(stream_state_t *state, const char *line, size_t length) {
+    const char *p = line;
+    const char *end = line + length;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    
+    // Only the next opening fence matters; separate its code from the last block's
+    if (end - p >= 3 && strncmp(p, "```", 3) == 0) {
+        if (state->code.size > 0) {
+            if (state->code.data[state->code.size - 1] != '\n') {
+                stream_emit(state, "\n", 1);
+            }
+            stream_emit(state, "\n", 1);
+        }
+        state->filter = STREAM_IN_FENCE;
+        state->line_blank = true;
+    }
+}
+
+// Feed a piece of generated text through the fence-stripping filter
+static void stream_filter(stream_state_t *state, const char *text, size_t length) {
+    size_t i = 0;
+    
+    while (i < length && !state->aborted) {
+        switch (state->filter) {
+            case STREAM_START:
+            case STREAM_BETWEEN: {
+                // Collect text until a full line is available for classification
+                const char *newline = memchr(text + i, '\n', length - i);
+                size_t take = newline ? (size_t)(newline - (text + i)) + 1 : length - i;
+                response_append(&state->line, text + i, take);
+                i += take;
+                
+                if (newline) {
+                    response_data_t line = state->line;
+                    state->line.size = 0;
+                    if (state->filter == STREAM_START) {
+                        stream_filter_line(state, line.data, line.size);
+                    } else {
+                        stream_between_line(state, line.data, line.size);
+                    }
+                }
+                break;
+            }
+            
+            case STREAM_IN_FENCE:
+                i += stream_fence_text(state, text + i, length - i);
+                break;
+            
+            case STREAM_PASSTHROUGH:
+                stream_emit(state, text + i, length - i);
+                i = length;
+                break;
+            
+            case STREAM_DONE:
+                // Everything after the closing fence is commentary
+                i = length;
+                break;
+        }
+    }
+}
+
+// Flush whatever the filter is still holding once the generation is complete
+static void stream_filter_finish(stream_state_t *state) {
+    if (state->filter == STREAM_START) {
+        // Classify a final unterminated line, then release any held preamble
+        if (state->line.size > 0) {
+            response_data_t line = state->line;
+            state->line.size = 0;
+            stream_filter_line(state, line.data, line.size);
+        }
+        stream_emit(state, state->pending.data, state->pending.size);
+        state->pending.size = 0;
+    } else if (state->filter == STREAM_IN_FENCE) {
+        // The end of the text also ends a line, so pending backticks close the fence
+        if (state->closing) {
+            stream_close_fence(state);
+            return;
+        }
+        stream_emit(state, state->line.data, state->line.size);
+        state->line.size = 0;
+        if (state->backticks > 0) {
+            stream_emit(state, "```", state->backticks);
+            state->backticks = 0;
+        }
+    } else if (state->filter == STREAM_BETWEEN) {
+        // A trailing line without a newline cannot open another block
+        state->line.size = 0;
+    }
+}
+
+// A piece of the generated text: a stream filters it at once, otherwise it
+// is kept for extraction
+static bool read_response(english_request_t *request, const json_value_t *value) {
+    if (!request->streaming) {
+        request->has_answer = true;
+        return response_append(&request->answer, value->data, value->length);
+    }
+    
+    double started = monotonic_ms();
+    stream_filter(&request->stream, value->data, value->length);
+    request->stats.extract_ms += monotonic_ms() - started;
+    request->stream.received = true;
+    return true;
+}
+
+// Take what the request needs from its answer as the decoder reads it: the
+// generated text, an error, Ollama's metrics and the session's context
+static bool decode_value(const json_value_t *value, void *userdata) {
+    english_request_t *request = (english_request_t *)userdata;
+    
+    if (value->depth == 0) {
+        // One object is complete; a stream reports an error as soon as it arrives
+        if (value->kind == JSON_END_OBJECT) {
+            request->answer_objects++;
+            if (request->streaming && request->has_error) {
+                report_ollama_error(request->error.data, request->model_name);
+                request->stream.failed = true;
+                request->has_error = false;
+                request->error.size = 0;
+            }
+        }
+        return true;
+    }
+    if (strcmp(value->top_key, "context") == 0) {
+        return request->session_key == NULL || read_session(value, &request->session_reply);
+    }
+    if (value->depth > 1) {
+        return true;
+    }
+    
+    switch (value->kind) {
+        case JSON_STRING:
+            if (json_is_key(value, "response")) {
+                return read_response(request, value);
+            }
+            if (json_is_key(value, "error")) {
+                request->has_error = true;
+                return response_append(&request->error, value->data, value->length);
+            }
+            if (json_is_key(value, "done_reason")) {
+                // "length" means the answer was cut off at num_predict
+                if (value->first) {
+                    request->done_reason_length = 0;
+                }
+                size_t room = sizeof(request->done_reason) - 1 - request->done_reason_length;
+                size_t length = value->length < room ? value->length : room;
+                memcpy(request->done_reason + request->done_reason_length, value->data, length);
+                request->done_reason_length += length;
+                request->done_reason[request->done_reason_length] = '\0';
+                request->truncated = strcmp(request->done_reason, "length") == 0;
+            }
+            return true;
+        case JSON_NUMBER:
+            read_ollama_metric(value, &request->stats);
+            return true;
+        case JSON_TRUE:
+            if (json_is_key(value, "done")) {
+                request->stream.done = true;
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+// Start reading an answer afresh
+static void reset_answer(english_request_t *request) {
+    json_decoder_init(&request->decoder, decode_value, request);
+    request->answer.size = 0;
+    request->error.size = 0;
+    request->answer_objects = 0;
+    request->has_answer = false;
+    request->has_error = false;
+    request->decode_failed = false;
+    request->done_reason_length = 0;
+    request->truncated = false;
+}
+
+// Decode the next bytes of an answer, timing the decoding apart from the
+// stream filter it feeds
+static void decode_answer(english_request_t *request, const char *data, size_t length) {
+    if (request->decode_failed) {
+        return;
+    }
+    
+    double started = monotonic_ms();
+    double extract_ms = request->stats.extract_ms;
+    if (!json_decoder_feed(&request->decoder, data, length)) {
+        request->decode_failed = true;
+    }
+    request->stats.parse_ms += monotonic_ms() - started - (request->stats.extract_ms - extract_ms);
+}
+
+// Callback function for CURL to handle the response of one transfer. The first
+// transfer to answer wins; the others are cancelled by failing their next write.
+static size_t transfer_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t real_size = size * nmemb;
+    transfer_t *transfer = (transfer_t *)userp;
+    english_request_t *request = transfer->request;
+    int index = (int)(transfer - request->transfers);
+    
+    if (request->winner >= 0 && request->winner != index) {
+        return 0;
+    }
+    
+    if (request->winner < 0) {
+        // An overloaded server's error is kept in case no other endpoint answers
+        long status = 0;
+        curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &status);
+        if (status == 429 || status >= 500) {
+            transfer->overloaded = true;
+            return write_callback(contents, size, nmemb, &transfer->body);
+        }
+        
+        request->winner = index;
+        transfer->first_byte_ms = monotonic_ms() - transfer->started_ms;
+        if (request->verbose && request->transfer_count > 1) {
+            fprintf(stderr, "Verbose mode: Answer from %s\n", transfer->url);
+        }
+    }
+    
+    // The raw answer is only kept, or shown as it arrives, in verbose mode
+    if (request->verbose && request->streaming) {
+        fprintf(stderr, "Verbose mode: Raw response chunk: %.*s\n", (int)real_size, (const char *)contents);
+    } else if (request->verbose && !response_append(&transfer->body, contents, real_size)) {
+        return 0;
+    }
+    decode_answer(request, contents, real_size);
+    
+    // Returning short aborts the transfer when the consumer stopped accepting code
+    return request->stream.aborted ? 0 : real_size;
+}
+
+// Send the request to an endpoint other than exclude
+static bool start_transfer(english_request_t *request, int exclude) {
+    if (request->transfer_count == REQUEST_MAX_TRANSFERS) {
+        return false;
+    }
+    
+    // No transfer starts past the deadline, and none runs beyond it
+    long remaining = 0;
+    if (request->deadline_ms > 0) {
+        remaining = (long)(request->deadline_ms - monotonic_ms());
+        if (remaining < 1) {
+            return false;
+        }
+    }
+    
+    int endpoint = balancer_acquire(request->balancer, exclude);
+    if (endpoint < 0) {
+        return false;
+    }
+    
+    // The URL is copied, since the endpoints may be replaced while this runs
+    char url[BALANCER_MAX_URL_LENGTH];
+    const char *endpoint_url = arena_strdup(request->arena, balancer_url(request->balancer, endpoint, url));
+    
+    // Borrow a pooled handle that can reuse earlier connections
+    CURL *curl = endpoint_url != NULL ? context_acquire_handle(request->context) : NULL;
+    if (curl == NULL) {
+        balancer_release(request->balancer, endpoint, BALANCER_CANCELLED, 0);
+        return false;
+    }
+    
+    transfer_t *transfer = &request->transfers[request->transfer_count++];
+    memset(transfer, 0, sizeof(transfer_t));
+    transfer->request = request;
+    transfer->curl = curl;
+    transfer->endpoint = endpoint;
+    transfer->url = endpoint_url;
+    transfer->started_ms = monotonic_ms();
+    transfer->body.arena = request->arena;
+    
+    if (request->verbose) {
+        fprintf(stderr, "Verbose mode: Sending request to %s\n", transfer->url);
+    }
+    
+    // Set up CURL options for Ollama
+    curl_easy_setopt(curl, CURLOPT_URL, transfer->url);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, context_get_headers(request->context));
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)request->payload.size);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->payload.data);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, transfer_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)transfer);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, request->owner);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, remaining);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+                     remaining > 0 && remaining < CONNECT_TIMEOUT_MS ? remaining : CONNECT_TIMEOUT_MS);
+    
+    request->stats.attempts++;
+    curl_multi_add_handle(request->multi, curl);
+    request->active_count++;
+    return true;
+}
+
+// Detach a transfer and report its outcome to the balancer
+static void stop_transfer(english_request_t *request, transfer_t *transfer, balancer_outcome_t outcome) {
+    curl_multi_remove_handle(request->multi, transfer->curl);
+    context_release_handle(request->context, transfer->curl);
+    transfer->curl = NULL;
+    request->active_count--;
+    balancer_release(request->balancer, transfer->endpoint, outcome, transfer->first_byte_ms);
+}
+
+// Detach every transfer still running, e.g. the losers of a hedged race
+static void stop_all_transfers(english_request_t *request) {
+    for (int i = 0; i < request->transfer_count; i++) {
+        if (request->transfers[i].curl != NULL) {
+            stop_transfer(request, &request->transfers[i], BALANCER_CANCELLED);
+        }
+    }
+}
+
+// Whether a transfer failed in a way that may go away by itself
+static bool is_transient(CURLcode result) {
+    return result == CURLE_COULDNT_CONNECT || result == CURLE_OPERATION_TIMEDOUT || result == CURLE_SEND_ERROR ||
+           result == CURLE_RECV_ERROR || result == CURLE_GOT_NOTHING || result == CURLE_PARTIAL_FILE;
+}
+
+// Plan another attempt after a failure that may go away by itself; returns
+// false if the request should fail now
+static bool schedule_retry(english_request_t *request, const transfer_t *failed, CURLcode result) {
+    bool transient = failed->overloaded || is_transient(result);
+    if (!transient || request->retries >= context_get_max_retries(request->context) ||
+        request->transfer_count == REQUEST_MAX_TRANSFERS) {
+        return false;
+    }
+    
+    // Exponential backoff; the jitter keeps clients that failed together from
+    // coming back together
+    double backoff = RETRY_BASE_MS;
+    for (int i = 0; i < request->retries && backoff < RETRY_MAX_MS; i++) {
+        backoff *= 2;
+    }
+    if (backoff > RETRY_MAX_MS) {
+        backoff = RETRY_MAX_MS;
+    }
+    double delay = backoff / 2 + backoff / 2 * rand_r(&request->jitter_seed) / RAND_MAX;
+    
+    // A retry that cannot finish before the deadline is not worth starting
+    double now = monotonic_ms();
+    if (request->deadline_ms > 0 && now + delay >= request->deadline_ms) {
+        return false;
+    }
+    
+    request->retries++;
+    request->retry_at_ms = now + delay;
+    if (request->verbose) {
+        fprintf(stderr, "Verbose mode: Retrying in %.0f ms (retry %d of %d)\n", delay, request->retries,
+                context_get_max_retries(request->context));
+    }
+    return true;
+}
+
+// Lowercase the description and collapse its whitespace, so the embedding
+// only sees differences in wording
+static char *normalize_text(arena_t *arena, const char *text, size_t length) {
+    char *normalized = arena_alloc(arena, length + 1);
+    if (normalized == NULL) {
+        return NULL;
+    }
+    
+    size_t size = 0;
+    bool space = false;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (isspace(c)) {
+            space = size > 0;
+            continue;
+        }
+        if (space) {
+            normalized[size++] = ' ';
+            space = false;
+        }
+        normalized[size++] = (char)tolower(c);
+    }
+    normalized[size] = '\0';
+    return normalized;
+}
+
+// The numbers of an embedding as they are decoded
+typedef struct {
+    response_data_t values;    // The floats, one after another
+    int lists;                 // Embeddings seen in an "embeddings" list
+} embedding_reader_t;
+
+// Keep the numbers of "embedding", or of the first of "embeddings" as the newer /api/embed answers
+static bool read_embedding(const json_value_t *value, void *userdata) {
+    embedding_reader_t *reader = (embedding_reader_t *)userdata;
+    bool listed = strcmp(value->top_key, "embeddings") == 0;
+    if (listed && value->kind == JSON_BEGIN_ARRAY && value->depth == 2) {
+        reader->lists++;
+    }
+    
+    bool wanted = listed ? value->depth == 3 && reader->lists == 1 :
+                  strcmp(value->top_key, "embedding") == 0 && value->depth == 2;
+    if (!wanted || value->kind != JSON_NUMBER) {
+        return true;
+    }
+    float number = (float)json_get_double(value);
+    return response_append(&reader->values, (const char *)&number, sizeof(number));
+}
+
+// Ask Ollama's embeddings API, next to the generate API of an endpoint, for
+// the embedding of a text; returns it in the arena, or NULL
+static float *embed_text(english_request_t *request, const char *model, const char *text, size_t *dimensions) {
+    int endpoint = balancer_acquire(request->balancer, -1);
+    if (endpoint < 0) {
+        return NULL;
+    }
+    
+    char generate_url[BALANCER_MAX_URL_LENGTH];
+    balancer_url(request->balancer, endpoint, generate_url);
+    const char *api = strstr(generate_url, "/api/");
+    int base_length = api != NULL ? (int)(api - generate_url) : (int)strlen(generate_url);
+    while (base_length > 0 && generate_url[base_length - 1] == '/') {
+        base_length--;
+    }
+    char url[1100];
+    snprintf(url, sizeof(url), "%.*s/api/embeddings", base_length, generate_url);
+    
+    response_data_t payload = { request->arena, NULL, 0, 0 };
+    response_data_t body = { request->arena, NULL, 0, 0 };
+    CURL *curl = context_acquire_handle(request->context);
+    if (curl == NULL ||
+        !response_append(&payload, "{ \"model\": ", 11) || !append_json_string(&payload, model) ||
+        !response_append(&payload, ", \"prompt\": ", 12) || !append_json_string(&payload, text) ||
+        !response_append(&payload, " }", 2)) {
+        if (curl != NULL) {
+            context_release_handle(request->context, curl);
+        }
+        balancer_release(request->balancer, endpoint, BALANCER_CANCELLED, 0);
+        return NULL;
+    }
+    
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, context_get_headers(request->context));
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)payload.size);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload.data);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&body);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, EMBED_TIMEOUT_MS);
+    
+    CURLcode result = curl_easy_perform(curl);
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    context_release_handle(request->context, curl);
+    
+    // Embedding times say nothing about generation times, so they are kept
+    // out of the latencies hedging is based on
+    balancer_release(request->balancer, endpoint, result == CURLE_OK ? BALANCER_CANCELLED : BALANCER_FAILURE, 0);
+    if (result != CURLE_OK || status != 200 || body.data == NULL) {
+        if (request->verbose) {
+            fprintf(stderr, "Verbose mode: Could not embed the description: %s\n",
+                    result != CURLE_OK ? curl_easy_strerror(result) : body.data != NULL ? body.data : "no answer");
+        }
+        return NULL;
+    }
+    
+    embedding_reader_t reader = { { request->arena, NULL, 0, 0 }, 0 };
+    if (!json_decode(body.data, body.size, read_embedding, &reader) || reader.values.size == 0) {
+        return NULL;
+    }
+    *dimensions = reader.values.size / sizeof(float);
+    return (float *)reader.values.data;
+}
+
+// Look for a stored compile of a description worded differently; on a miss,
+// the embedding is kept so the result can be stored under it
+static bool semantic_lookup(english_request_t *request, const char *english_text, const char *endpoint) {
+    const char *model = config_get_semantic_model();
+    size_t length = strlen(english_text);
+    if (model == NULL || length > MAX_EMBED_LENGTH) {
+        return false;
+    }
+    
+    double started = monotonic_ms();
+    const char *normalized = normalize_text(request->arena, english_text, length);
+    size_t dimensions = 0;
+    float *vector = normalized != NULL ? embed_text(request, model, normalized, &dimensions) : NULL;
+    request->stats.embed_ms = monotonic_ms() - started;
+    if (vector == NULL) {
+        return false;
+    }
+    
+    // Only compiles for the same model, endpoint, language and options can
+    // match; the scope hashes like a cache key, with the embedding model in
+    // place of the prompt
+    cache_make_key(request->model_name, endpoint, request->target_language, model, request->options,
+                   request->semantic_scope);
+    
+    uint8_t key[SHA256_DIGEST_SIZE];
+    double similarity;
+    double threshold = config_get_semantic_threshold();
+    bool found = semcache_lookup(request->semantic_scope, vector, dimensions, key, &similarity);
+    if (found && similarity >= threshold) {
+        request->output = cache_lookup(key, &request->output_length);
+    }
+    
+    semcache_outcome_t outcome = request->output != NULL ? SEMCACHE_HIT :
+                                 found && similarity >= threshold - SEMCACHE_NEAR_MISS_MARGIN ? SEMCACHE_NEAR_MISS :
+                                 SEMCACHE_MISS;
+    semcache_record(outcome);
+    if (request->verbose && !found) {
+        fprintf(stderr, "Verbose mode: Semantic cache miss (nothing stored yet) in %.1f ms\n", monotonic_ms() - started);
+    } else if (request->verbose) {
+        fprintf(stderr, "Verbose mode: Semantic cache %s (best similarity %.3f, threshold %.3f) in %.1f ms\n",
+                outcome == SEMCACHE_HIT ? "hit" : outcome == SEMCACHE_NEAR_MISS ? "near miss" : "miss",
+                similarity, threshold, monotonic_ms() - started);
+    }
+    
+    if (outcome != SEMCACHE_HIT) {
+        request->embedding = vector;
+        request->embedding_length = dimensions;
+    }
+    return outcome == SEMCACHE_HIT;
+}
+
+// Cache a result, and remember its embedding for the semantic cache
+static void store_result(english_request_t *request, const char *code, size_t length) {
+    if (cache_store(request->cache_key, code, length) && request->embedding != NULL) {
+        semcache_store(request->semantic_scope, request->embedding, request->embedding_length, request->cache_key);
+    }
+}
+
+static bool finish_response(english_request_t *request, CURLcode result);
+
+// Send the payload afresh, with fresh attempts; returns true if a transfer started
+static bool restart_request(english_request_t *request) {
+    reset_answer(request);
+    request->transfer_count = 0;
+    request->winner = -1;
+    request->final = -1;
+    request->retries = 0;
+    request->retry_at_ms = -1;
+    
+    double hedge_delay = balancer_hedge_delay_ms(request->balancer);
+    if (!start_transfer(request, -1)) {
+        fprintf(stderr, "Error: No Ollama endpoint available\n");
+        request->result = CURLE_FAILED_INIT;
+        return false;
+    }
+    request->hedge_at_ms = hedge_delay >= 0 ? request->transfers[0].started_ms + hedge_delay : -1;
+    return true;
+}
+
+// Hand the request to the next, larger model of its route after the current
+// one failed or gave unusable code; returns true if the request continues
+static bool escalate(english_request_t *request, const char *reason) {
+    if (request->route_index + 1 >= request->route.count || english_is_cancelled() ||
+        (request->deadline_ms > 0 && monotonic_ms() >= request->deadline_ms)) {
+        return false;
+    }
+    
+    const char *next = request->route.models[request->route_index + 1];
+    double now = monotonic_ms();
+    if (request->verbose) {
+        fprintf(stderr, "Verbose mode: %s %s after %.0f ms, escalating to %s\n", request->model_name, reason,
+                now - request->model_started_ms, next);
+    }
+    
+    request->route_index++;
+    request->model_name = next;
+    request->model_started_ms = now;
+    request->stats.escalations++;
+    
+    request->payload.size = 0;
+    if (!build_request(&request->payload, request, config_get_keep_alive())) {
+        return false;
+    }
+    
+    // The new model starts over with fresh attempts. Code that only failed
+    // the check is kept, and used if no larger model gives anything better.
+    if (request->output != NULL && request->output_length > 0) {
+        free(request->fallback);
+        request->fallback = request->output;
+        request->fallback_length = request->output_length;
+        request->fallback_model = request->route.models[request->route_index - 1];
+    } else {
+        free(request->output);
+    }
+    request->output = NULL;
+    request->output_length = 0;
+    request->checked = false;
+    return restart_request(request);
+}
+
+// Ask for an answer that was cut off at the automatic num_predict again, with
+// twice the room; returns true if the request continues
+static bool extend_answer(english_request_t *request) {
+    if (config_get_num_predict() != CONFIG_AUTO || request->num_predict == 0 ||
+        request->num_predict >= MAX_GROWN_PREDICT || english_is_cancelled() ||
+        (request->deadline_ms > 0 && monotonic_ms() >= request->deadline_ms)) {
+        return false;
+    }
+    
+    size_t previous = request->num_predict;
+    request->num_predict = previous * 2 < MAX_GROWN_PREDICT ? previous * 2 : MAX_GROWN_PREDICT;
+    request->num_ctx = configured_window(request->context, request->num_ctx + request->num_predict - previous);
+    if (request->verbose) {
+        fprintf(stderr, "Verbose mode: %s was cut off at num_predict %zu, asking again with num_predict %zu\n",
+                request->model_name, previous, request->num_predict);
+    }
+    
+    request->payload.size = 0;
+    if (!build_request(&request->payload, request, config_get_keep_alive())) {
+        return false;
+    }
+    return restart_request(request);
+}
+
+// Parse the answer of a model that has a larger one behind it, and escalate
+// if it failed, has no code or fails the quick check; returns true if the
+// request continues with the next model
+static bool reject_answer(english_request_t *request) {
+    request->checked = true;
+    request->checked_success = finish_response(request, request->result);
+    
+    char reason[128];
+    if (!request->checked_success) {
+        snprintf(reason, sizeof(reason), "failed");
+    } else if (request->output_length == 0) {
+        snprintf(reason, sizeof(reason), "returned no code");
+    } else {
+        const char *problem = router_check_code(request->output, request->output_length, request->target_language);
+        if (problem == NULL) {
+            return false;
+        }
+        snprintf(reason, sizeof(reason), "failed the code check (%s)", problem);
+    }
+    
+    return escalate(request, reason);
+}
+
+// Prepare a request; candidate is -1 for an ordinary compile, or which of
+// several samples of the same compile this is
+static english_request_t *create_request(english_context_t *context, const char *english_text,
+                                         const char *target_language, english_stream_callback callback,
+                                         void *userdata, int candidate) {
+    // The request and all of its working memory come from one pooled arena
+    double started = monotonic_ms();
+    arena_t *arena = context_acquire_arena(context);
+    if (arena == NULL) {
+        return NULL;
+    }
+    english_request_t *request = arena_alloc(arena, sizeof(english_request_t));
+    if (request == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        context_release_arena(context, arena);
+        return NULL;
+    }
+    memset(request, 0, sizeof(english_request_t));
+    request->context = context;
+    request->balancer = context_get_balancer(context);
+    request->verbose = context_is_verbose(context);
+    request->arena = arena;
+    request->started_ms = started;
+    request->payload.arena = arena;
+    request->winner = -1;
+    request->final = -1;
+    request->hedge_at_ms = -1;
+    request->retry_at_ms = -1;
+    request->answer.arena = arena;
+    request->error.arena = arena;
+    reset_answer(request);
+    request->stream.line.arena = arena;
+    request->stream.pending.arena = arena;
+    request->stream.code.arena = arena;
+    
+    // Route to a model (no API key needed for Ollama); a session's context
+    // belongs to one model, so sessions always use the context's own
+    const char *endpoint = context_get_endpoint(context);
+    bool session = context_is_session(context);
+    char hint[MAX_HINT_LENGTH];
+    english_text = router_read_hint(english_text, hint, sizeof(hint));
+    if (session) {
+        memset(&request->route, 0, sizeof(router_route_t));
+        request->route.models[0] = context_get_model(context);
+        request->route.count = 1;
+        request->route.rule = -1;
+    } else {
+        router_route(arena, english_text, strlen(english_text), target_language, hint, context_get_model(context),
+                     &request->route);
+    }
+    request->model_name = request->route.models[0];
+    request->model_started_ms = started;
+    request->use_cache = context_is_cache_enabled(context);
+    request->streaming = callback != NULL;
+    request->temperature = TEMPERATURE;
+    if (candidate > 0) {
+        // Further candidates sample hotter, each from a seed of its own
+        request->temperature = TEMPERATURE + CANDIDATE_TEMPERATURE_STEP * candidate;
+        if (request->temperature > CANDIDATE_MAX_TEMPERATURE) {
+            request->temperature = CANDIDATE_MAX_TEMPERATURE;
+        }
+        request->seed = (unsigned int)candidate;
+    }
+    request->extract_mode = context_get_extract_mode(context);
+    request->timeout_ms = context_get_timeout(context);
+    request->deadline_ms = request->timeout_ms > 0 ? started + request->timeout_ms : 0;
+    request->jitter_seed = (unsigned int)((uintptr_t)request ^ (uintptr_t)(started * 1000));
+    
+    if (request->verbose && request->route.rule >= 0) {
+        fprintf(stderr, "Verbose mode: Routing rule %d matched (%s, ~%zu tokens%s%s) in %.3f ms; trying",
+                request->route.rule + 1, target_language, request->route.estimated_tokens,
+                hint[0] != '\0' ? ", hint " : "", hint, monotonic_ms() - started);
+        for (size_t i = 0; i < request->route.count; i++) {
+            fprintf(stderr, "%s %s", i > 0 ? ", then" : "", request->route.models[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+    
+    if (request->verbose) {
+        fprintf(stderr, "Verbose mode: Using Ollama model: %s\n", request->model_name);
+        fprintf(stderr, "Verbose mode: Using Ollama endpoint: %s\n", endpoint);
+    }
+    
+    request->target_language = arena_strdup(arena, target_language);
+    request->system = build_system(arena, target_language);
+    request->prompt = build_prompt(arena, english_text);
+    request->options = build_options(arena, request->extract_mode);
+    if (request->target_language == NULL || request->system == NULL || request->prompt == NULL ||
+        request->options == NULL) {
+        request_free(request);
+        return NULL;
+    }
+    
+    // A follow-up compile continues the conversation, so the cache cannot answer it
+    if (session) {
+        const char *parts[] = { request->model_name, "\n", target_language };
+        request->session_key = join_parts(arena, parts, sizeof(parts) / sizeof(parts[0]));
+        if (request->session_key == NULL) {
+            request_free(request);
+            return NULL;
+        }
+        request->session = context_get_session(context, request->session_key, arena);
+        request->session_reply.arena = arena;
+        request->use_cache = false;
+        if (request->verbose) {
+            fprintf(stderr, "Verbose mode: %s the session\n", request->session != NULL ? "Continuing" : "Starting");
+        }
+    }
+    
+    // Serve repeated compiles from the cache without touching the network;
+    // further candidates are fresh samples and only need the key to store under
+    if (request->use_cache) {
+        cache_make_key(request->model_name, endpoint, target_language, request->prompt, request->options,
+                       request->cache_key);
+    }
+    if (request->use_cache && candidate <= 0) {
+        request->output = cache_lookup(request->cache_key, &request->output_length);
+        if (request->output != NULL && request->verbose) {
+            fprintf(stderr, "Verbose mode: Served from cache\n");
+        }
+        
+        // Descriptions worded differently can still match a stored compile
+        if (request->output != NULL || semantic_lookup(request, english_text, endpoint)) {
+            request->cached = true;
+            request->stats.cached = true;
+            request->stats.build_ms = monotonic_ms() - request->started_ms - request->stats.embed_ms;
+            request->stream.callback = callback;
+            request->stream.userdata = userdata;
+            return request;
+        }
+    }
+    
+    // The code the caller keeps is stored under the key of the plain compile
+    if (candidate >= 0) {
+        request->cache_on_keep = request->use_cache;
+        request->use_cache = false;
+    }
+    
+    // Ask for a context window that just holds the request, and bound the answer
+    size_request(request);
+    
+    // Create the request payload for Ollama
+    if (!build_request(&request->payload, request, config_get_keep_alive())) {
+        request_free(request);
+        return NULL;
+    }
+    
+    if (request->verbose) {
+        fprintf(stderr, "Verbose mode: Request payload: %s\n", request->payload.data);
+    }
+    
+    request->stats.build_ms = monotonic_ms() - request->started_ms - request->stats.embed_ms;
+    
+    if (request->streaming) {
+        request->stream.callback = callback;
+        request->stream.userdata = userdata;
+        request->stream.extract_mode = request->extract_mode;
+        request->stream.filter = request->extract_mode == ENGLISH_EXTRACT_NONE ? STREAM_PASSTHROUGH : STREAM_START;
+    }
+    
+    return request;
+}
+
+english_request_t *request_new(english_context_t *context, const char *english_text, const char *target_language,
+                               english_stream_callback callback, void *userdata) {
+    return create_request(context, english_text, target_language, callback, userdata, -1);
+}
+
+english_request_t *request_new_candidate(english_context_t *context, const char *english_text,
+                                         const char *target_language, int candidate) {
+    return create_request(context, english_text, target_language, NULL, NULL, candidate);
+}
+
+double request_get_temperature(const english_request_t *request) {
+    return request->temperature;
+}
+
+bool request_is_cached(const english_request_t *request) {
+    return request->cached;
+}
+
+bool request_start(english_request_t *request, CURLM *multi, void *owner) {
+    request->multi = multi;
+    request->owner = owner;
+    
+    if (english_is_cancelled()) {
+        request->cancelled = true;
+        return false;
+    }
+    
+    // Hedge once the first attempt is slower than most earlier ones
+    double hedge_delay = balancer_hedge_delay_ms(request->balancer);
+    if (!start_transfer(request, -1)) {
+        fprintf(stderr, "Error: No Ollama endpoint available\n");
+        request->result = CURLE_FAILED_INIT;
+        return false;
+    }
+    request->hedge_at_ms = hedge_delay >= 0 ? request->transfers[0].started_ms + hedge_delay : -1;
+    return true;
+}
+
+bool request_poll(english_request_t *request, long *timeout_ms) {
+    *timeout_ms = -1;
+    
+    if (english_is_cancelled()) {
+        request->cancelled = true;
+        stop_all_transfers(request);
+        return true;
+    }
+    
+    double now = monotonic_ms();
+    int last = request->transfers[request->transfer_count - 1].endpoint;
+    
+    // A retry waits out its backoff; the request is over if it cannot start
+    if (request->retry_at_ms >= 0) {
+        if (now < request->retry_at_ms) {
+            *timeout_ms = (long)(request->retry_at_ms - now) + 1;
+            return false;
+        }
+        request->retry_at_ms = -1;
+        return !start_transfer(request, balancer_count(request->balancer) > 1 ? last : -1);
+    }
+    
+    if (request->hedge_at_ms < 0 || request->winner >= 0 || request->active_count != 1) {
+        return false;
+    }
+    
+    if (now < request->hedge_at_ms) {
+        *timeout_ms = (long)(request->hedge_at_ms - now) + 1;
+        return false;
+    }
+    
+    // No first byte yet: race a duplicate on another endpoint
+    request->hedge_at_ms = -1;
+    if (request->verbose) {
+        fprintf(stderr, "Verbose mode: No answer after %.0f ms, sending a hedged request\n",
+                now - request->transfers[request->transfer_count - 1].started_ms);
+    }
+    start_transfer(request, last);
+    return false;
+}
+
+bool request_complete_transfer(english_request_t *request, CURL *handle, CURLcode result) {
+    int index = -1;
+    for (int i = 0; i < request->transfer_count; i++) {
+        if (request->transfers[i].curl == handle) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        return false;
+    }
+    
+    transfer_t *transfer = &request->transfers[index];
+    
+    // A transfer that lost the race was cancelled; the winner is still running
+    if (request->winner >= 0 && request->winner != index) {
+        stop_transfer(request, transfer, BALANCER_CANCELLED);
+        return false;
+    }
+    
+    request->final = index;
+    request->result = result;
+    read_network_times(transfer->curl, &request->stats);
+    
+    // A whole answer that broke off has reached nobody yet, so it fails over
+    // and is retried like a failure before the first byte; a stream's code
+    // has already been handed out, so its winner is final
+    if (request->winner == index && !request->streaming && is_transient(result) && !english_is_cancelled()) {
+        if (request->verbose) {
+            fprintf(stderr, "Verbose mode: Answer from %s broke off (%s)\n",
+                    transfer->url, curl_easy_strerror(result));
+        }
+        request->winner = -1;
+        reset_answer(request);
+    }
+    
+    if (request->winner == index || (result == CURLE_OK && !transfer->overloaded)) {
+        // The answer is in; anything still racing it is cancelled
+        balancer_outcome_t outcome = result == CURLE_OK ? BALANCER_SUCCESS :
+                                     request->stream.aborted ? BALANCER_CANCELLED : BALANCER_FAILURE;
+        stop_transfer(request, transfer, outcome);
+        stop_all_transfers(request);
+        
+        // An answer cut off at num_predict is asked for again with more room
+        if (!request->streaming && result == CURLE_OK && request->truncated && extend_answer(request)) {
+            return false;
+        }
+        
+        // A model with a larger one behind it has its answer checked while
+        // the larger one can still take over
+        if (!request->streaming && request->route_index + 1 < request->route.count) {
+            return !reject_answer(request);
+        }
+        return true;
+    }
+    
+    // The endpoint failed before answering: it leaves the rotation for a while
+    stop_transfer(request, transfer, BALANCER_FAILURE);
+    if (request->active_count > 0) {
+        return false;
+    }
+    
+    // Nothing reached the caller yet, so another endpoint can take over
+    if (request->transfer_count < (int)balancer_count(request->balancer)) {
+        if (request->verbose) {
+            fprintf(stderr, "Verbose mode: %s failed, trying another endpoint\n",
+                    transfer->url);
+        }
+        if (start_transfer(request, transfer->endpoint)) {
+            return false;
+        }
+    }
+    
+    // Then the same endpoints get another chance after a pause
+    if (schedule_retry(request, transfer, result)) {
+        return false;
+    }
+    
+    // Nothing reached the caller yet, so a larger model can still take over
+    char reason[128];
+    snprintf(reason, sizeof(reason), "failed (%s)",
+             transfer->overloaded ? "server overloaded" : curl_easy_strerror(result));
+    return !escalate(request, reason);
+}
+
+bool request_perform(english_request_t *request) {
+    if (request->cached) {
+        return true;
+    }
+    
+    // A pooled multi handle still holds the connections of earlier compiles
+    CURLM *multi = context_acquire_multi(request->context);
+    if (multi == NULL) {
+        request->result = CURLE_FAILED_INIT;
+        return false;
+    }
+    
+    bool done = !request_start(request, multi, NULL);
+    while (!done) {
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        
+        CURLMsg *message;
+        int queued;
+        while (!done && (message = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (message->msg == CURLMSG_DONE) {
+                done = request_complete_transfer(request, message->easy_handle, message->data.result);
+            }
+        }
+        
+        // A signal interrupts the wait, so cancellation takes effect at once
+        long wait;
+        if (!done && !(done = request_poll(request, &wait))) {
+            curl_multi_poll(multi, NULL, 0, wait >= 0 && wait < 1000 ? (int)wait : 1000, NULL);
+        }
+    }
+    
+    // The multi handle goes back to the pool empty
+    stop_all_transfers(request);
+    context_release_multi(request->context, multi);
+    return request->result == CURLE_OK && !request->cancelled;
+}
+
+// Report why the final transfer failed
+static void report_transfer_error(const english_request_t *request, CURLcode result) {
+    // CURL's own timer may fire a few milliseconds before the deadline
+    if (result == CURLE_OPERATION_TIMEDOUT && request->deadline_ms > 0 && monotonic_ms() >= request->deadline_ms - 20) {
+        fprintf(stderr, "Error: Request timed out after %ld ms\n", request->timeout_ms);
+    } else {
+        fprintf(stderr, "Error: CURL request failed: %s\n", curl_easy_strerror(result));
+    }
+}
+
+// The body of the transfer that ended the request, if it kept one
+static response_data_t *final_body(english_request_t *request) {
+    return request->final >= 0 ? &request->transfers[request->final].body : NULL;
+}
+
+// Finish a streaming request: flush the filter and report how the stream ended
+static bool finish_stream(english_request_t *request, CURLcode result) {
+    stream_state_t *state = &request->stream;
+    
+    // An overloaded server's error never went through the decoder
+    response_data_t *body = final_body(request);
+    if (result == CURLE_OK && request->winner < 0 && body != NULL && body->size > 0) {
+        decode_answer(request, body->data, body->size);
+    }
+    stream_filter_finish(state);
+    
+    bool success = false;
+    if (state->aborted) {
+        fprintf(stderr, "Error: Streaming output was aborted by the consumer\n");
+    } else if (result != CURLE_OK) {
+        report_transfer_error(request, result);
+    } else if (request->decode_failed || !json_decoder_finish(&request->decoder)) {
+        fprintf(stderr, "Error: Could not parse JSON response chunk\n");
+    } else if (request->truncated) {
+        // The code handed out so far is incomplete
+        fprintf(stderr, "Error: The answer was cut off at num_predict %zu\n", request->num_predict);
+    } else if (!state->failed) {
+        if (!state->received) {
+            fprintf(stderr, "Error: Unexpected response format from Ollama\n");
+        } else {
+            if (!state->done && request->verbose) {
+                fprintf(stderr, "Verbose mode: Stream ended without a final chunk\n");
+            }
+            success = true;
+        }
+    }
+    
+    // Only a complete generation is worth caching
+    if (success && state->done && request->use_cache) {
+        store_result(request, state->code.data != NULL ? state->code.data : "", state->code.size);
+    }
+    
+    return success;
+}
+
+// Finish a non-streaming request: parse the response and extract the code
+static bool finish_response(english_request_t *request, CURLcode result) {
+    if (result != CURLE_OK) {
+        report_transfer_error(request, result);
+        return false;
+    }
+    
+    response_data_t *body = final_body(request);
+    if (request->verbose) {
+        fprintf(stderr, "Verbose mode: Received response from Ollama API\n");
+        fprintf(stderr, "Verbose mode: Raw response: %s\n", body != NULL && body->data != NULL ? body->data : "");
+    }
+    
+    // The answer was decoded as it arrived; an overloaded server's error is decoded now
+    if (request->winner < 0 && body != NULL && body->size > 0) {
+        decode_answer(request, body->data, body->size);
+    }
+    if (request->decode_failed || request->answer_objects == 0 || !json_decoder_finish(&request->decoder)) {
+        fprintf(stderr, "Error: Could not parse JSON response\n");
+        return false;
+    }
+    
+    // Get the response content directly (Ollama format is different from OpenAI)
+    if (!request->has_answer) {
+        if (request->has_error) {
+            report_ollama_error(request->error.data, request->model_name);
+        } else {
+            fprintf(stderr, "Error: Unexpected response format from Ollama\n");
+        }
+        return false;
+    }
+    
+    // Code cut off at num_predict is incomplete, so it is neither used nor cached
+    if (request->truncated) {
+        fprintf(stderr, "Error: The answer was cut off at num_predict %zu\n", request->num_predict);
+        return false;
+    }
+    
+    // Copy just the code, into a buffer of exactly its size
+    double started = monotonic_ms();
+    request->output = extract_output(request, request->answer.data, request->answer.size, &request->output_length);
+    if (request->output == NULL) {
+        return false;
+    }
+    request->stats.extract_ms = monotonic_ms() - started;
+    
+    if (request->verbose) {
+        fprintf(stderr, "Verbose mode: Successfully parsed response\n");
+    }
+    return true;
+}
+
+bool request_finish(english_request_t *request) {
+    bool success;
+    
+    if (request->cached) {
+        // A cache hit is delivered to a streaming consumer as a single chunk
+        success = !request->streaming ||
+                  request->stream.callback(request->output, request->output_length, request->stream.userdata);
+    } else if (request->cancelled || request->final < 0) {
+        // No response to look at, or nobody waiting for it
+        success = false;
+    } else if (request->checked) {
+        // Parsed already, when deciding whether to escalate
+        success = request->checked_success;
+    } else {
+        success = request->streaming ? finish_stream(request, request->result) :
+                                       finish_response(request, request->result);
+    }
+    
+    // When the larger models gave nothing, the code a smaller one was
+    // escalated from is better than no code; it is not cached, so the next
+    // compile tries again
+    bool fallback = false;
+    if (request->fallback != NULL && !request->cancelled && (!success || request->output_length == 0)) {
+        if (request->verbose) {
+            fprintf(stderr, "Verbose mode: %s gave no usable code, keeping the answer of %s\n",
+                    request->model_name, request->fallback_model);
+        }
+        free(request->output);
+        request->output = request->fallback;
+        request->output_length = request->fallback_length;
+        request->fallback = NULL;
+        success = true;
+        fallback = true;
+    }
+    
+    // Streams cache themselves, once they know the generation was complete
+    if (success && !fallback && !request->cached && !request->streaming && request->use_cache) {
+        store_result(request, request->output, request->output_length);
+    }
+    
+    // The next compile of the session continues from this one
+    if (success && request->session_key != NULL && request->session_reply.size > 0) {
+        context_set_session(request->context, request->session_key, request->session_reply.data,
+                            request->session_reply.size);
+    }
+    
+    request->stats.total_ms = monotonic_ms() - request->started_ms;
+    
+    arena_usage_t usage;
+    arena_get_usage(request->arena, &usage);
+    request->stats.arena_allocations = usage.allocations;
+    request->stats.arena_bytes = usage.bytes;
+    request->stats.heap_allocations = usage.heap_allocations;
+    
+    stats_set_last(&request->stats);
+    if (!request->cancelled) {
+        stats_record(request->model_name, request->target_language, &request->stats, success);
+    }
+    
+    return success;
+}
+
+void request_keep(english_request_t *request) {
+    if (request->cache_on_keep && request->output != NULL) {
+        store_result(request, request->output, request->output_length);
+    }
+}
+
+const char *request_get_output(const english_request_t *request) {
+    if (request->output != NULL) {
+        return request->output;
+    }
+    if (request->stream.code.data != NULL) {
+        return request->stream.code.data;
+    }
+    return "";
+}
+
+size_t request_get_output_length(const english_request_t *request) {
+    return request->output != NULL ? request->output_length : request->stream.code.size;
+}
+
+char *request_take_output(english_request_t *request, size_t *length) {
+    char *output = request->output;
+    size_t output_length = request->output_length;
+    
+    if (output == NULL) {
+        // The streamed copy lives in the arena, so the caller gets its own exactly-sized one
+        output_length = request->stream.code.size;
+        output = malloc(output_length + 1);
+        if (output == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return NULL;
+        }
+        if (output_length > 0) {
+            memcpy(output, request->stream.code.data, output_length);
+        }
+        output[output_length] = '\0';
+    }
+    
+    request->output = NULL;
+    request->output_length = 0;
+    if (length != NULL) {
+        *length = output_length;
+    }
+    return output;
+}
+
+// One endpoint being asked to load the model
+typedef struct {
+    CURL *curl;
+    char url[BALANCER_MAX_URL_LENGTH];
+    response_data_t body;
+    double started_ms;
+    bool verbose;
+} warm_transfer_t;
+
+// Keep the "error" of an answer
+static bool read_error(const json_value_t *value, void *userdata) {
+    if (value->kind != JSON_STRING || value->depth != 1 || !json_is_key(value, "error")) {
+        return true;
+    }
+    return response_append((response_data_t *)userdata, value->data, value->length);
+}
+
+// Check how an endpoint answered the request to load the model
+static bool warm_finished(warm_transfer_t *warm, const char *model_name, CURLcode result) {
+    if (result != CURLE_OK) {
+        fprintf(stderr, "Error: Could not warm %s: %s\n", warm->url, curl_easy_strerror(result));
+        return false;
+    }
+    
+    response_data_t error = { warm->body.arena, NULL, 0, 0 };
+    if (warm->body.data == NULL || !json_decode(warm->body.data, warm->body.size, read_error, &error)) {
+        fprintf(stderr, "Error: Could not parse JSON response from %s\n", warm->url);
+        return false;
+    }
+    
+    bool success = error.data == NULL;
+    if (!success) {
+        report_ollama_error(error.data, model_name);
+    } else if (warm->verbose) {
+        fprintf(stderr, "Verbose mode: %s loaded %s in %.0f ms\n", warm->url, model_name, monotonic_ms() - warm->started_ms);
+    }
+    return success;
+}
+
+bool request_warm(english_context_t *context, const char *keep_alive) {
+    balancer_t *balancer = context_get_balancer(context);
+    
+    // A request without a prompt only loads the model
+    arena_t *arena = context_acquire_arena(context);
+    if (arena == NULL) {
+        return false;
+    }
+    const char *model_name = context_get_model(context);
+    response_data_t payload = { arena, NULL, 0, 0 };
+    // It loads the model with the smallest window, the one most compiles will ask for
+    char options[64] = "";
+    size_t window = configured_window(context, 0);
+    if (window > 0) {
+        snprintf(options, sizeof(options), ", \"options\": { \"num_ctx\": %zu }", window);
+    }
+    if (!response_append(&payload, "{ \"model\": ", 11) || !append_json_string(&payload, model_name) ||
+        (keep_alive != NULL && !append_keep_alive(&payload, keep_alive)) ||
+        !response_append(&payload, options, strlen(options)) ||
+        !response_append(&payload, ", \"stream\": false }", 19)) {
+        context_release_arena(context, arena);
+        return false;
+    }
+    
+    // The connections to each endpoint stay open for the compiles that follow
+    CURLM *multi = context_acquire_multi(context);
+    if (multi == NULL) {
+        context_release_arena(context, arena);
+        return false;
+    }
+    
+    // Every endpoint loads the model at the same time
+    warm_transfer_t warm[BALANCER_MAX_ENDPOINTS];
+    int endpoints[BALANCER_MAX_ENDPOINTS];
+    size_t count = balancer_list(balancer, endpoints);
+    size_t running = 0;
+    bool success = true;
+    memset(warm, 0, sizeof(warm));
+    for (size_t i = 0; i < count; i++) {
+        warm[i].curl = context_acquire_handle(context);
+        if (warm[i].curl == NULL) {
+            success = false;
+            continue;
+        }
+        balancer_url(balancer, endpoints[i], warm[i].url);
+        warm[i].body.arena = arena;
+        warm[i].started_ms = monotonic_ms();
+        warm[i].verbose = context_is_verbose(context);
+        if (warm[i].verbose) {
+            fprintf(stderr, "Verbose mode: Loading %s on %s\n", model_name, warm[i].url);
+        }
+        
+        curl_easy_setopt(warm[i].curl, CURLOPT_URL, warm[i].url);
+        curl_easy_setopt(warm[i].curl, CURLOPT_HTTPHEADER, context_get_headers(context));
+        curl_easy_setopt(warm[i].curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)payload.size);
+        curl_easy_setopt(warm[i].curl, CURLOPT_POSTFIELDS, payload.data);
+        curl_easy_setopt(warm[i].curl, CURLOPT_WRITEFUNCTION, write_callback);
+        curl_easy_setopt(warm[i].curl, CURLOPT_WRITEDATA, (void *)&warm[i].body);
+        curl_easy_setopt(warm[i].curl, CURLOPT_PRIVATE, (void *)&warm[i]);
+        curl_easy_setopt(warm[i].curl, CURLOPT_TIMEOUT_MS, context_get_timeout(context));
+        curl_easy_setopt(warm[i].curl, CURLOPT_CONNECTTIMEOUT_MS, CONNECT_TIMEOUT_MS);
+        curl_multi_add_handle(multi, warm[i].curl);
+        running++;
+    }
+    
+    while (running > 0 && !english_is_cancelled()) {
+        int active = 0;
+        curl_multi_perform(multi, &active);
+        
+        CURLMsg *message;
+        int queued;
+        while ((message = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
+            warm_transfer_t *done = NULL;
+            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char **)&done);
+            running--;
+            success = warm_finished(done, model_name, message->data.result) && success;
+        }
+        
+        if (running > 0) {
+            curl_multi_poll(multi, NULL, 0, 1000, NULL);
+        }
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        if (warm[i].curl != NULL) {
+            curl_multi_remove_handle(multi, warm[i].curl);
+            context_release_handle(context, warm[i].curl);
+        }
+    }
+    context_release_multi(context, multi);
+    context_release_arena(context, arena);
+    return success && running == 0;
+}
+
+void request_free(english_request_t *request) {
+    if (request == NULL) {
+        return;
+    }
+    
+    // Transfers still running are cancelled
+    stop_all_transfers(request);
+    
+    // Everything else goes with the arena, including the request itself
+    free(request->output);
+    free(request->fallback);
+    context_release_arena(request->context, request->arena);
+}
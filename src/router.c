@@ -0,0 +1,284 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/router.h"
+#include "../include/config.h"
+#include "../include/english.h"
+#include "../include/tokens.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Most brackets the code check tracks; deeper nesting is only counted
+#define MAX_NESTING 256
+
+// Languages whose valid code the bracket check misreads: shell case arms
+// close a parenthesis they never opened, and regex literals hold brackets
+// that need not balance
+static const char *const unchecked_languages[] = {
+    "bash", "sh", "shell", "zsh", "ksh", "fish",
+    "javascript", "js", "typescript", "ts", "jsx", "tsx",
+    "ruby", "rb", "perl", "pl", "awk",
+};
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char *router_read_hint(const char *text, char *hint, size_t hint_size) {
+    hint[0] = '\0';
+    if (strncmp(text, "@hint", 5) != 0 || !is_blank(text[5])) {
+        return text;
+    }
+    
+    const char *start = text + 5;
+    while (is_blank(*start)) {
+        start++;
+    }
+    const char *end = start + strcspn(start, "\n");
+    const char *next = *end == '\n' ? end + 1 : end;
+    while (end > start && is_blank(end[-1])) {
+        end--;
+    }
+    
+    size_t length = (size_t)(end - start) < hint_size ? (size_t)(end - start) : hint_size - 1;
+    memcpy(hint, start, length);
+    hint[length] = '\0';
+    return next;
+}
+
+// Whether a comma-separated list holds a value, ignoring case
+static bool list_contains(const char *list, size_t list_length, const char *value) {
+    size_t value_length = strlen(value);
+    const char *end = list + list_length;
+    while (list < end) {
+        const char *comma = memchr(list, ',', end - list);
+        const char *item_end = comma != NULL ? comma : end;
+        if ((size_t)(item_end - list) == value_length && strncasecmp(list, value, value_length) == 0) {
+            return true;
+        }
+        list = item_end + 1;
+    }
+    return false;
+}
+
+// Whether every condition of a rule holds; an unknown condition never does
+static bool rule_matches(const char *conditions, const char *end, size_t length, size_t tokens,
+                         const char *language, const char *hint, int rule) {
+    const char *p = conditions;
+    while (p < end) {
+        while (p < end && is_blank(*p)) {
+            p++;
+        }
+        const char *token_end = p;
+        while (token_end < end && !is_blank(*token_end)) {
+            token_end++;
+        }
+        if (token_end == p) {
+            break;
+        }
+        
+        const char *equals = memchr(p, '=', token_end - p);
+        if (equals == NULL) {
+            if (english_is_verbose()) {
+                fprintf(stderr, "Verbose mode: Ignoring routing rule %d: bad condition '%.*s'\n",
+                        rule + 1, (int)(token_end - p), p);
+            }
+            return false;
+        }
+        
+        size_t key_length = equals - p;
+        const char *value = equals + 1;
+        size_t value_length = token_end - value;
+        unsigned long number = strtoul(value, NULL, 10);
+        bool holds;
+        
+        if (key_length == 9 && strncmp(p, "max_bytes", 9) == 0) {
+            holds = length <= number;
+        } else if (key_length == 9 && strncmp(p, "min_bytes", 9) == 0) {
+            holds = length >= number;
+        } else if (key_length == 10 && strncmp(p, "max_tokens", 10) == 0) {
+            holds = tokens <= number;
+        } else if (key_length == 10 && strncmp(p, "min_tokens", 10) == 0) {
+            holds = tokens >= number;
+        } else if (key_length == 8 && strncmp(p, "language", 8) == 0) {
+            holds = list_contains(value, value_length, language);
+        } else if (key_length == 4 && strncmp(p, "hint", 4) == 0) {
+            holds = hint[0] != '\0' && list_contains(value, value_length, hint);
+        } else {
+            if (english_is_verbose()) {
+                fprintf(stderr, "Verbose mode: Ignoring routing rule %d: unknown condition '%.*s'\n",
+                        rule + 1, (int)key_length, p);
+            }
+            return false;
+        }
+        
+        if (!holds) {
+            return false;
+        }
+        p = token_end;
+    }
+    return true;
+}
+
+// Add a model to a route unless it is already there
+static void add_model(router_route_t *route, const char *model) {
+    if (model == NULL || route->count == ROUTER_MAX_MODELS) {
+        return;
+    }
+    for (size_t i = 0; i < route->count; i++) {
+        if (strcmp(route->models[i], model) == 0) {
+            return;
+        }
+    }
+    route->models[route->count++] = model;
+}
+
+// Add the comma-separated models after a rule's arrow
+static void add_models(arena_t *arena, router_route_t *route, const char *list) {
+    while (*list != '\0') {
+        size_t length = strcspn(list, ",");
+        const char *start = list;
+        const char *end = list + length;
+        while (start < end && is_blank(*start)) {
+            start++;
+        }
+        while (end > start && is_blank(end[-1])) {
+            end--;
+        }
+        
+        if (end > start) {
+            char *model = arena_alloc(arena, end - start + 1);
+            if (model != NULL) {
+                memcpy(model, start, end - start);
+                model[end - start] = '\0';
+                add_model(route, model);
+            }
+        }
+        
+        list += length;
+        if (*list == ',') {
+            list++;
+        }
+    }
+}
+
+void router_route(arena_t *arena, const char *text, size_t length, const char *language, const char *hint,
+                  const char *model, router_route_t *route) {
+    memset(route, 0, sizeof(router_route_t));
+    route->rule = -1;
+    route->estimated_tokens = tokens_estimate(text, length);
+    
+    size_t count = config_get_route_count();
+    for (size_t i = 0; i < count; i++) {
+        const char *rule = config_get_route(i);
+        const char *arrow = strstr(rule, "->");
+        if (arrow == NULL) {
+            if (english_is_verbose()) {
+                fprintf(stderr, "Verbose mode: Ignoring routing rule %zu: no '->' before its models\n", i + 1);
+            }
+            continue;
+        }
+        
+        if (rule_matches(rule, arrow, length, route->estimated_tokens, language, hint, (int)i)) {
+            add_models(arena, route, arrow + 2);
+            if (route->count > 0) {
+                route->rule = (int)i;
+                break;
+            }
+        }
+    }
+    
+    // The compile's own model is the last resort
+    add_model(route, model);
+}
+
+// End of the line p is on
+static const char *line_end(const char *p, const char *end) {
+    const char *newline = memchr(p, '\n', end - p);
+    return newline != NULL ? newline : end;
+}
+
+// Skip a string literal starting at p; returns where the code resumes
+static const char *skip_string(const char *p, const char *end) {
+    char quote = *p;
+    
+    // Triple-quoted strings span lines and end only at three quotes
+    if (end - p >= 3 && p[1] == quote && p[2] == quote) {
+        for (p += 3; p + 2 < end; p++) {
+            if (*p == '\\') {
+                p++;
+            } else if (p[0] == quote && p[1] == quote && p[2] == quote) {
+                return p + 3;
+            }
+        }
+        return end;
+    }
+    
+    // Other strings end at their quote, or at the end of the line unless
+    // they are backtick strings
+    for (p++; p < end; p++) {
+        if (*p == '\\') {
+            p++;
+        } else if (*p == quote) {
+            return p + 1;
+        } else if (*p == '\n' && quote != '`') {
+            return p;
+        }
+    }
+    return end;
+}
+
+const char *router_check_code(const char *code, size_t length, const char *language) {
+    for (size_t i = 0; i < sizeof(unchecked_languages) / sizeof(unchecked_languages[0]); i++) {
+        if (strcasecmp(unchecked_languages[i], language) == 0) {
+            return NULL;
+        }
+    }
+    
+    char expected[MAX_NESTING];
+    size_t depth = 0;
+    const char *end = code + length;
+    bool lifetimes = strcasecmp(language, "rust") == 0 || strcasecmp(language, "rs") == 0;
+    
+    for (const char *p = code; p < end; p++) {
+        char c = *p;
+        if (c == '"' || c == '`') {
+            p = skip_string(p, end) - 1;
+        } else if (c == '\'') {
+            // A quote that does not close on its line is an apostrophe, not a
+            // string; in Rust, a quote before a name is a lifetime unless it
+            // is a one-character literal
+            bool lifetime = lifetimes && p + 2 < end && p[2] != '\'' && (isalpha((unsigned char)p[1]) || p[1] == '_');
+            const char *close = lifetime ? p + 1 : skip_string(p, end);
+            if (close > p + 1 && close[-1] == '\'') {
+                p = close - 1;
+            }
+        } else if (c == '/' && p + 1 < end && p[1] == '/') {
+            p = line_end(p, end) - 1;
+        } else if (c == '/' && p + 1 < end && p[1] == '*') {
+            const char *close = p + 2;
+            while (close + 1 < end && !(close[0] == '*' && close[1] == '/')) {
+                close++;
+            }
+            p = close + 1 < end ? close + 1 : end - 1;
+        } else if (c == '#' && (p + 1 == end || is_blank(p[1]) || p[1] == '\n' || p[1] == '!')) {
+            // Shell and Python comments; #include, #define and CSS ids are code
+            p = line_end(p, end) - 1;
+        } else if (c == '(' || c == '[' || c == '{') {
+            if (depth < MAX_NESTING) {
+                expected[depth] = c == '(' ? ')' : c == '[' ? ']' : '}';
+            }
+            depth++;
+        } else if (c == ')' || c == ']' || c == '}') {
+            if (depth == 0 || (depth <= MAX_NESTING && expected[depth - 1] != c)) {
+                return "unbalanced brackets";
+            }
+            depth--;
+        }
+    }
+    
+    return depth == 0 ? NULL : "unclosed brackets";
+}
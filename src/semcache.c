@@ -0,0 +1,403 @@
+#define _DEFAULT_SOURCE
+
+#include "../include/semcache.h"
+#include "../include/config.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SEMCACHE_DIR_NAME "semantic"
+#define SEMCACHE_INDEX_NAME "index"
+#define SEMCACHE_MAGIC "ENGSEM01"
+#define MAX_PATH_LENGTH 1024
+
+// Embeddings kept; once full, each store overwrites the oldest
+#define SEMCACHE_CAPACITY 65536
+
+// Longest embedding accepted
+#define MAX_DIMENSIONS 8192
+
+// Up to this many embeddings are compared one by one; beyond it, only those
+// whose hash is close to the query's
+#define EXACT_SEARCH_LIMIT 2048
+
+// Records the index file grows by at least, so it is not remapped on every store
+#define GROWTH_RECORDS 256
+
+// Header at the start of the memory-mapped index
+typedef struct {
+    char magic[8];
+    uint32_t dimensions;      // Length of every stored embedding, 0 while empty
+    uint32_t reserved;
+    uint64_t count;           // Records in use
+    uint64_t next;            // Sequence number of the next store; its record is next % SEMCACHE_CAPACITY
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t near_misses;
+    uint64_t stores;
+} semcache_header_t;
+
+// One stored embedding; the unit-length vector of floats follows it
+typedef struct {
+    uint8_t scope[SHA256_DIGEST_SIZE];
+    uint8_t key[SHA256_DIGEST_SIZE];
+    uint64_t signature;       // One bit per random hyperplane: the side the vector is on
+} semcache_record_t;
+
+// Threads of one process share the mapping, which a lookup may have to
+// replace, so they also take turns; flock only separates processes
+static pthread_mutex_t semcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char semcache_dir[MAX_PATH_LENGTH];
+static int index_fd = -1;
+static semcache_header_t *header = NULL;
+static size_t mapped_size = 0;
+
+// Bytes one record takes, keeping the next record 8-byte aligned
+static size_t record_size(size_t dimensions) {
+    return (sizeof(semcache_record_t) + dimensions * sizeof(float) + 7) & ~(size_t)7;
+}
+
+static semcache_record_t *record_at(size_t index) {
+    return (semcache_record_t *)((char *)(header + 1) + index * record_size(header->dimensions));
+}
+
+static const float *record_vector(const semcache_record_t *record) {
+    return (const float *)(record + 1);
+}
+
+// Bring the mapping in line with the file, which other processes may have
+// grown or cleared; the index lock must be held
+static bool map_file(void) {
+    struct stat st;
+    if (fstat(index_fd, &st) != 0 || (size_t)st.st_size < sizeof(semcache_header_t)) {
+        return false;
+    }
+    if ((size_t)st.st_size == mapped_size) {
+        return true;
+    }
+    
+    if (header != NULL) {
+        munmap(header, mapped_size);
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd, 0);
+    if (map == MAP_FAILED) {
+        header = NULL;
+        mapped_size = 0;
+        return false;
+    }
+    header = (semcache_header_t *)map;
+    mapped_size = (size_t)st.st_size;
+    return true;
+}
+
+// Drop every record, for embeddings of the given length from now on; the
+// counters are kept unless the index is reset entirely. The index lock must
+// be held.
+static bool reset_index(uint32_t dimensions, bool keep_counters) {
+    if (ftruncate(index_fd, sizeof(semcache_header_t)) != 0 || !map_file()) {
+        return false;
+    }
+    if (!keep_counters) {
+        memset(header, 0, sizeof(semcache_header_t));
+        memcpy(header->magic, SEMCACHE_MAGIC, sizeof(header->magic));
+    }
+    header->dimensions = dimensions;
+    header->count = 0;
+    header->next = 0;
+    return true;
+}
+
+static void close_index(void);
+
+// Open the index file, creating it on first use; it stays open for the process.
+// The thread lock must be held.
+static bool open_index(void) {
+    if (index_fd >= 0) {
+        return true;
+    }
+    
+    if (!config_get_subdir(SEMCACHE_DIR_NAME, semcache_dir, sizeof(semcache_dir))) {
+        return false;
+    }
+    
+    char index_path[MAX_PATH_LENGTH + 16];
+    snprintf(index_path, sizeof(index_path), "%s/%s", semcache_dir, SEMCACHE_INDEX_NAME);
+    
+    int fd = open(index_path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open semantic cache index %s\n", index_path);
+        return false;
+    }
+    index_fd = fd;
+    
+    // A new, truncated or foreign index starts out empty
+    flock(fd, LOCK_EX);
+    bool valid = map_file() && memcmp(header->magic, SEMCACHE_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->dimensions <= MAX_DIMENSIONS && header->count <= SEMCACHE_CAPACITY &&
+                 sizeof(semcache_header_t) + header->count * record_size(header->dimensions) <= mapped_size;
+    if (!valid && !reset_index(0, false)) {
+        fprintf(stderr, "Error: Could not initialize semantic cache index %s\n", index_path);
+        flock(fd, LOCK_UN);
+        close_index();
+        return false;
+    }
+    flock(fd, LOCK_UN);
+    return true;
+}
+
+// Take the thread lock and open the index, then the file lock; false if the
+// index is unavailable, in which case no lock is held
+static bool lock_index(int operation) {
+    pthread_mutex_lock(&semcache_lock);
+    if (!open_index()) {
+        pthread_mutex_unlock(&semcache_lock);
+        return false;
+    }
+    flock(index_fd, operation);
+    return true;
+}
+
+static void unlock_index(void) {
+    flock(index_fd, LOCK_UN);
+    pthread_mutex_unlock(&semcache_lock);
+}
+
+// Dot product, eight lanes at a time where the compiler offers vector types
+static double dot(const float *a, const float *b, size_t count) {
+    size_t i = 0;
+    double sum = 0;
+    
+#if defined(__GNUC__)
+    typedef float lanes_t __attribute__((vector_size(8 * sizeof(float))));
+    lanes_t total = { 0 };
+    for (; i + 8 <= count; i += 8) {
+        lanes_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        total += x * y;
+    }
+    for (int lane = 0; lane < 8; lane++) {
+        sum += total[lane];
+    }
+#endif
+    
+    for (; i < count; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static int count_bits(uint64_t bits) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(bits);
+#else
+    int count = 0;
+    for (; bits != 0; bits &= bits - 1) {
+        count++;
+    }
+    return count;
+#endif
+}
+
+// Which side of 64 fixed random hyperplanes a vector lies on. Vectors at an
+// angle t differ in about 64 * t / pi of these bits, so comparing signatures
+// rules out most distant vectors without reading them.
+static uint64_t make_signature(const float *vector, size_t dimensions) {
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    uint64_t signature = 0;
+    
+    for (int bit = 0; bit < 64; bit++) {
+        double projection = 0;
+        for (size_t i = 0; i < dimensions; i++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            
+            // The sum of two uniform values is closer to the normal distribution
+            // random hyperplanes are drawn from
+            double r = (int32_t)(uint32_t)state / 2147483648.0 + (int32_t)(uint32_t)(state >> 32) / 2147483648.0;
+            projection += r * vector[i];
+        }
+        if (projection >= 0) {
+            signature |= 1ULL << bit;
+        }
+    }
+    return signature;
+}
+
+// How many signature bits may differ for a similarity still worth comparing;
+// twice the expected number leaves room for the variance of the estimate
+static int signature_radius(double min_similarity) {
+    if (min_similarity <= -1) {
+        return 64;
+    }
+    double angle = acos(min_similarity < 1 ? min_similarity : 1);
+    int radius = (int)(2 * 64 * angle / M_PI) + 4;
+    return radius < 64 ? radius : 64;
+}
+
+bool semcache_lookup(const uint8_t scope[SHA256_DIGEST_SIZE], const float *vector, size_t dimensions,
+                     uint8_t key[SHA256_DIGEST_SIZE], double *similarity) {
+    *similarity = -1;
+    double norm = sqrt(dot(vector, vector, dimensions));
+    if (dimensions == 0 || norm == 0 || !lock_index(LOCK_SH)) {
+        return false;
+    }
+    
+    if (!map_file() || header->dimensions != dimensions || header->count == 0) {
+        unlock_index();
+        return false;
+    }
+    
+    // Past a few thousand embeddings, only those whose signature is close
+    // enough to reach the near-miss band are compared
+    size_t count = header->count;
+    bool approximate = count > EXACT_SEARCH_LIMIT;
+    uint64_t signature = approximate ? make_signature(vector, dimensions) : 0;
+    int radius = signature_radius(config_get_semantic_threshold() - SEMCACHE_NEAR_MISS_MARGIN);
+    
+    bool found = false;
+    for (size_t i = 0; i < count; i++) {
+        const semcache_record_t *record = record_at(i);
+        if (memcmp(record->scope, scope, SHA256_DIGEST_SIZE) != 0 ||
+            (approximate && count_bits(record->signature ^ signature) > radius)) {
+            continue;
+        }
+        
+        // Stored vectors have unit length, so only the query's needs dividing out
+        double cosine = dot(vector, record_vector(record), dimensions) / norm;
+        if (!found || cosine > *similarity) {
+            *similarity = cosine;
+            memcpy(key, record->key, SHA256_DIGEST_SIZE);
+            found = true;
+        }
+    }
+    
+    unlock_index();
+    return found;
+}
+
+bool semcache_store(const uint8_t scope[SHA256_DIGEST_SIZE], const float *vector, size_t dimensions,
+                    const uint8_t key[SHA256_DIGEST_SIZE]) {
+    double norm = sqrt(dot(vector, vector, dimensions));
+    if (dimensions == 0 || dimensions > MAX_DIMENSIONS || norm == 0 || !lock_index(LOCK_EX)) {
+        return false;
+    }
+    
+    // Embeddings of another length come from another model and cannot be compared
+    if (!map_file() || (header->dimensions != dimensions && !reset_index((uint32_t)dimensions, true))) {
+        unlock_index();
+        return false;
+    }
+    
+    // A compile stored again replaces its old embedding
+    size_t index = header->next % SEMCACHE_CAPACITY;
+    for (size_t i = 0; i < header->count; i++) {
+        if (memcmp(record_at(i)->key, key, SHA256_DIGEST_SIZE) == 0) {
+            index = i;
+            break;
+        }
+    }
+    
+    // Grow the file ahead of the records, up to the capacity
+    size_t needed = sizeof(semcache_header_t) + (index + 1) * record_size(dimensions);
+    if (needed > mapped_size) {
+        size_t records = index + GROWTH_RECORDS < SEMCACHE_CAPACITY ? index + GROWTH_RECORDS : SEMCACHE_CAPACITY;
+        if (ftruncate(index_fd, sizeof(semcache_header_t) + records * record_size(dimensions)) != 0 ||
+            !map_file()) {
+            unlock_index();
+            return false;
+        }
+    }
+    
+    semcache_record_t *record = record_at(index);
+    memcpy(record->scope, scope, SHA256_DIGEST_SIZE);
+    memcpy(record->key, key, SHA256_DIGEST_SIZE);
+    float *stored = (float *)(record + 1);
+    for (size_t i = 0; i < dimensions; i++) {
+        stored[i] = (float)(vector[i] / norm);
+    }
+    record->signature = make_signature(stored, dimensions);
+    
+    if (index == header->next % SEMCACHE_CAPACITY) {
+        header->next++;
+        if (header->count < SEMCACHE_CAPACITY) {
+            header->count++;
+        }
+    }
+    header->stores++;
+    
+    unlock_index();
+    return true;
+}
+
+void semcache_record(semcache_outcome_t outcome) {
+    if (!lock_index(LOCK_EX)) {
+        return;
+    }
+    
+    if (map_file()) {
+        if (outcome == SEMCACHE_HIT) {
+            header->hits++;
+        } else if (outcome == SEMCACHE_NEAR_MISS) {
+            header->near_misses++;
+        } else {
+            header->misses++;
+        }
+    }
+    unlock_index();
+}
+
+bool semcache_get_stats(semcache_stats_t *stats) {
+    if (stats == NULL || !lock_index(LOCK_SH)) {
+        return false;
+    }
+    
+    bool mapped = map_file();
+    if (mapped) {
+        stats->entries = header->count;
+        stats->dimensions = header->dimensions;
+        stats->hits = header->hits;
+        stats->misses = header->misses;
+        stats->near_misses = header->near_misses;
+        stats->stores = header->stores;
+    }
+    unlock_index();
+    return mapped;
+}
+
+bool semcache_clear(void) {
+    if (!lock_index(LOCK_EX)) {
+        return false;
+    }
+    
+    bool success = reset_index(0, false);
+    unlock_index();
+    return success;
+}
+
+static void close_index(void) {
+    if (header != NULL) {
+        munmap(header, mapped_size);
+        header = NULL;
+        mapped_size = 0;
+    }
+    if (index_fd >= 0) {
+        close(index_fd);
+        index_fd = -1;
+    }
+}
+
+void semcache_close(void) {
+    pthread_mutex_lock(&semcache_lock);
+    close_index();
+    pthread_mutex_unlock(&semcache_lock);
+}
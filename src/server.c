@@ -0,0 +1,587 @@
+#define _DEFAULT_SOURCE
+
+#include "../include/server.h"
+#include "../include/english.h"
+#include "../include/buffer.h"
+#include "../include/config.h"
+#include "../include/context.h"
+#include "../include/monotonic.h"
+#include "../include/request.h"
+#include "../include/balancer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <curl/curl.h>
+
+#define SOCKET_NAME ".english/english.sock"
+#define FRAME_HEADER_SIZE 5
+#define MAX_CLIENTS 1024
+
+// One connected client and the request it is waiting on
+typedef struct {
+    int fd;
+    buffer_t in;                  // Bytes received but not yet parsed
+    buffer_t out;                 // Frames queued for sending
+    size_t out_sent;              // Bytes of out already sent
+    english_request_t *request;   // In-flight request, if any
+    char language[64];
+    bool streaming;
+    bool finished;                // Response complete; close once out is flushed
+} server_client_t;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop_signal(int signal_number) {
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+// Queue a frame of the given type
+static bool buffer_append_frame(buffer_t *buffer, char type, const char *payload, size_t length) {
+    uint32_t frame_length = (uint32_t)length + 1;
+    unsigned char header[FRAME_HEADER_SIZE] = {
+        (unsigned char)(frame_length >> 24), (unsigned char)(frame_length >> 16),
+        (unsigned char)(frame_length >> 8), (unsigned char)frame_length, (unsigned char)type
+    };
+    
+    return buffer_append(buffer, header, sizeof(header)) && buffer_append(buffer, payload, length);
+}
+
+// Decode the length field of a frame header
+static uint32_t frame_length(const unsigned char *header) {
+    return ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+           ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+}
+
+bool server_default_socket(char *path, size_t path_size) {
+    const char *home_dir = getenv("HOME");
+    if (home_dir == NULL) {
+        return false;
+    }
+    
+    int written = snprintf(path, path_size, "%s/%s", home_dir, SOCKET_NAME);
+    return written > 0 && (size_t)written < path_size;
+}
+
+// Fill in a Unix-domain socket address
+static bool make_address(const char *socket_path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long\n", socket_path);
+        return false;
+    }
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+// Stream callback: forward each piece of code to the client as a data frame
+static bool queue_stream_chunk(const char *chunk, size_t length, void *userdata) {
+    server_client_t *client = (server_client_t *)userdata;
+    return buffer_append_frame(&client->out, SERVER_FRAME_DATA, chunk, length);
+}
+
+// Queue the final frames for a finished request and release it
+static void complete_client(server_client_t *client) {
+    bool success = request_finish(client->request);
+    
+    if (!success) {
+        char message[256];
+        snprintf(message, sizeof(message), "Failed to compile English to %s (see daemon log)", client->language);
+        buffer_append_frame(&client->out, SERVER_FRAME_ERROR, message, strlen(message));
+    } else {
+        if (!client->streaming) {
+            buffer_append_frame(&client->out, SERVER_FRAME_DATA, request_get_output(client->request),
+                                request_get_output_length(client->request));
+        }
+        buffer_append_frame(&client->out, SERVER_FRAME_END, "", 0);
+    }
+    
+    request_free(client->request);
+    client->request = NULL;
+    client->finished = true;
+}
+
+// Parse a complete request frame and start the compile
+static void start_client_request(server_client_t *client, CURLM *multi, char type,
+                                 const char *payload, size_t length) {
+    const char *separator = memchr(payload, '\0', length);
+    if ((type != SERVER_FRAME_COMPILE && type != SERVER_FRAME_STREAM) || separator == NULL ||
+        (size_t)(separator - payload) >= sizeof(client->language)) {
+        const char *message = "Malformed request";
+        buffer_append_frame(&client->out, SERVER_FRAME_ERROR, message, strlen(message));
+        client->finished = true;
+        return;
+    }
+    
+    // The English text is the rest of the payload
+    strcpy(client->language, payload);
+    char *text = malloc(length - (separator - payload));
+    if (text == NULL) {
+        client->finished = true;
+        return;
+    }
+    size_t text_length = length - (separator - payload) - 1;
+    memcpy(text, separator + 1, text_length);
+    text[text_length] = '\0';
+    
+    // Pick up 'english set' changes made while the daemon was running
+    config_refresh();
+    english_set_ollama_endpoint(config_get_endpoint());
+    balancer_set_hedge_percentile(balancer_get_default(), config_get_hedge_percentile());
+    
+    client->streaming = type == SERVER_FRAME_STREAM;
+    client->request = request_new(context_get_default(), text, client->language,
+                                  client->streaming ? queue_stream_chunk : NULL, client);
+    free(text);
+    
+    if (client->request == NULL) {
+        const char *message = "Could not create request";
+        buffer_append_frame(&client->out, SERVER_FRAME_ERROR, message, strlen(message));
+        client->finished = true;
+        return;
+    }
+    
+    if (english_is_verbose()) {
+        fprintf(stderr, "Verbose mode: Client %d requested %s%s\n", client->fd, client->language,
+                client->streaming ? " (streaming)" : "");
+    }
+    
+    // Cached results complete without a transfer
+    if (request_is_cached(client->request)) {
+        complete_client(client);
+        return;
+    }
+    
+    if (!request_start(client->request, multi, (void *)client)) {
+        complete_client(client);
+    }
+}
+
+// Read what the client sent; returns false if the connection should be dropped
+static bool read_client(server_client_t *client, CURLM *multi) {
+    char chunk[16384];
+    ssize_t received = read(client->fd, chunk, sizeof(chunk));
+    if (received == 0) {
+        return false;
+    }
+    if (received < 0) {
+        return errno == EAGAIN || errno == EINTR;
+    }
+    
+    // Only one request per connection; anything after it is ignored
+    if (client->request != NULL || client->finished) {
+        return true;
+    }
+    if (!buffer_append(&client->in, chunk, received)) {
+        return false;
+    }
+    
+    if (client->in.size < FRAME_HEADER_SIZE) {
+        return true;
+    }
+    
+    uint32_t length = frame_length((unsigned char *)client->in.data);
+    if (length == 0 || length > SERVER_MAX_FRAME) {
+        return false;
+    }
+    if (client->in.size < 4 + (size_t)length) {
+        return true;
+    }
+    
+    start_client_request(client, multi, client->in.data[4], client->in.data + FRAME_HEADER_SIZE, length - 1);
+    return true;
+}
+
+// Send queued frames; returns false if the connection should be dropped
+static bool flush_client(server_client_t *client) {
+    while (client->out_sent < client->out.size) {
+        ssize_t sent = write(client->fd, client->out.data + client->out_sent, client->out.size - client->out_sent);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        client->out_sent += sent;
+    }
+    
+    client->out.size = 0;
+    client->out_sent = 0;
+    return true;
+}
+
+static void close_client(server_client_t *client) {
+    // A client that hung up mid-request abandons its transfers
+    if (client->request != NULL) {
+        request_free(client->request);
+    }
+    
+    close(client->fd);
+    free(client->in.data);
+    free(client->out.data);
+    free(client);
+}
+
+// Drop closed (NULL) slots from the client list, keeping order
+static size_t compact_clients(server_client_t **clients, size_t count) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (clients[i] != NULL) {
+            clients[kept++] = clients[i];
+        }
+    }
+    return kept;
+}
+
+// Create the listening socket, replacing a stale socket file
+static int listen_on(const char *socket_path) {
+    struct sockaddr_un address;
+    if (!make_address(socket_path, &address)) {
+        return -1;
+    }
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not create socket\n");
+        return -1;
+    }
+    
+    // Refuse to start a second daemon on the same socket
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+        fprintf(stderr, "Error: A daemon is already listening on %s\n", socket_path);
+        close(fd);
+        return -1;
+    }
+    unlink(socket_path);
+    
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 128) != 0) {
+        fprintf(stderr, "Error: Could not listen on %s\n", socket_path);
+        close(fd);
+        return -1;
+    }
+    
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int server_run(const char *socket_path) {
+    int listen_fd = listen_on(socket_path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+    
+    CURLM *multi = curl_multi_init();
+    if (multi == NULL) {
+        fprintf(stderr, "Error: Could not initialize CURL\n");
+        close(listen_fd);
+        unlink(socket_path);
+        return 1;
+    }
+    
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    
+    server_client_t *clients[MAX_CLIENTS];
+    struct curl_waitfd fds[MAX_CLIENTS + 1];
+    size_t client_count = 0;
+    
+    printf("Listening on %s\n", socket_path);
+    fflush(stdout);
+    
+    while (!stop_requested) {
+        // Watch the listening socket and every client alongside CURL's sockets
+        fds[0].fd = listen_fd;
+        fds[0].events = client_count < MAX_CLIENTS ? CURL_WAIT_POLLIN : 0;
+        fds[0].revents = 0;
+        for (size_t i = 0; i < client_count; i++) {
+            fds[i + 1].fd = clients[i]->fd;
+            fds[i + 1].events = CURL_WAIT_POLLIN | (clients[i]->out.size > 0 ? CURL_WAIT_POLLOUT : 0);
+            fds[i + 1].revents = 0;
+        }
+        
+        // Wake up in time for any hedged request or retry that is due
+        long wait = 1000;
+        for (size_t i = 0; i < client_count; i++) {
+            long next;
+            if (clients[i]->request == NULL) {
+                continue;
+            }
+            if (request_poll(clients[i]->request, &next)) {
+                complete_client(clients[i]);
+                wait = 0;
+            } else if (next >= 0 && next < wait) {
+                wait = next;
+            }
+        }
+        
+        curl_multi_poll(multi, fds, (unsigned int)client_count + 1, (int)wait, NULL);
+        
+        // Service client sockets that were polled this round
+        size_t polled = client_count;
+        for (size_t i = 0; i < polled; i++) {
+            short revents = fds[i + 1].revents;
+            bool keep = true;
+            
+            if (revents & CURL_WAIT_POLLIN) {
+                keep = read_client(clients[i], multi);
+            }
+            if (keep && (revents & CURL_WAIT_POLLOUT)) {
+                keep = flush_client(clients[i]);
+            }
+            if (!keep) {
+                close_client(clients[i]);
+                clients[i] = NULL;
+            }
+        }
+        client_count = compact_clients(clients, client_count);
+        
+        // Accept new clients
+        if (fds[0].revents & CURL_WAIT_POLLIN) {
+            int fd;
+            while (client_count < MAX_CLIENTS && (fd = accept(listen_fd, NULL, NULL)) >= 0) {
+                server_client_t *client = calloc(1, sizeof(server_client_t));
+                if (client == NULL) {
+                    close(fd);
+                    break;
+                }
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                client->fd = fd;
+                
+                // The request usually arrives with the connection; don't wait a poll round for it
+                if (!read_client(client, multi)) {
+                    close_client(client);
+                    continue;
+                }
+                clients[client_count++] = client;
+            }
+        }
+        
+        // Drive transfers and hand finished ones back to their clients
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        
+        CURLMsg *message;
+        int queued;
+        while ((message = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
+            
+            server_client_t *client = NULL;
+            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char **)&client);
+            if (request_complete_transfer(client->request, message->easy_handle, message->data.result)) {
+                complete_client(client);
+            }
+        }
+        
+        // Send what is ready right away and retire finished clients
+        for (size_t i = 0; i < client_count; i++) {
+            bool keep = flush_client(clients[i]);
+            if (!keep || (clients[i]->finished && clients[i]->out.size == 0)) {
+                close_client(clients[i]);
+                clients[i] = NULL;
+            }
+        }
+        client_count = compact_clients(clients, client_count);
+    }
+    
+    for (size_t i = 0; i < client_count; i++) {
+        close_client(clients[i]);
+    }
+    curl_multi_cleanup(multi);
+    close(listen_fd);
+    unlink(socket_path);
+    
+    printf("Daemon stopped\n");
+    return 0;
+}
+
+static bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = write(fd, data, length);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// Read exactly length bytes; gives up with errno set to ETIMEDOUT at the
+// deadline (0 for none), or to ECANCELED once english_cancel was called
+static bool read_all(int fd, void *data, size_t length, double deadline_ms) {
+    char *bytes = (char *)data;
+    while (length > 0) {
+        if (english_is_cancelled()) {
+            errno = ECANCELED;
+            return false;
+        }
+        
+        if (deadline_ms > 0) {
+            double remaining = deadline_ms - monotonic_ms();
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            int ready = remaining > 0 ? poll(&pfd, 1, (int)remaining + 1) : 0;
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready == 0) {
+                errno = ETIMEDOUT;
+                return false;
+            }
+        }
+        
+        ssize_t received = read(fd, bytes, length);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        length -= received;
+    }
+    return true;
+}
+
+// Open the output on first use so a failed compile leaves no empty file behind
+static FILE *open_output(FILE **output_fp, const char *output_file) {
+    if (*output_fp == NULL) {
+        *output_fp = output_file != NULL ? fopen(output_file, "w") : stdout;
+        if (*output_fp == NULL) {
+            fprintf(stderr, "Error: Could not open output file %s\n", output_file);
+        }
+    }
+    return *output_fp;
+}
+
+int server_client_compile(const char *socket_path, const char *english_text, const char *target_language,
+                          bool stream, const char *output_file, long timeout_ms) {
+    double deadline_ms = timeout_ms > 0 ? monotonic_ms() + timeout_ms : 0;
+    
+    struct sockaddr_un address;
+    if (!make_address(socket_path, &address)) {
+        return -1;
+    }
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    
+    // Send the request frame
+    size_t language_length = strlen(target_language);
+    size_t text_length = strlen(english_text);
+    buffer_t request = { 0 };
+    buffer_t payload = { 0 };
+    bool built = buffer_append(&payload, target_language, language_length + 1) &&
+                 buffer_append(&payload, english_text, text_length) &&
+                 buffer_append_frame(&request, stream ? SERVER_FRAME_STREAM : SERVER_FRAME_COMPILE,
+                                     payload.data, payload.size);
+    bool sent = built && write_all(fd, request.data, request.size);
+    free(payload.data);
+    free(request.data);
+    if (!sent) {
+        close(fd);
+        return -1;
+    }
+    
+    // Read response frames until the end or an error
+    FILE *output_fp = NULL;
+    buffer_t code = { 0 };
+    bool received_any = false;
+    int status = 1;
+    
+    for (;;) {
+        unsigned char header[FRAME_HEADER_SIZE];
+        if (!read_all(fd, header, sizeof(header), deadline_ms)) {
+            // Hanging up on a timeout or cancellation also makes the daemon drop the
+            // request; the caller reports a cancellation
+            int error = errno;
+            if (error == ETIMEDOUT) {
+                fprintf(stderr, "Error: Request timed out after %ld ms\n", timeout_ms);
+            } else if (error != ECANCELED && !received_any) {
+                status = -1;  // The daemon went away before answering; compile locally
+            } else if (error != ECANCELED) {
+                fprintf(stderr, "Error: Lost connection to the daemon\n");
+            }
+            break;
+        }
+        received_any = true;
+        
+        uint32_t length = frame_length(header);
+        if (length == 0 || length > SERVER_MAX_FRAME) {
+            fprintf(stderr, "Error: Malformed response from the daemon\n");
+            break;
+        }
+        
+        char *frame = malloc(length);
+        if (frame == NULL || !read_all(fd, frame, length - 1, deadline_ms)) {
+            if (frame != NULL && errno == ETIMEDOUT) {
+                fprintf(stderr, "Error: Request timed out after %ld ms\n", timeout_ms);
+            } else if (frame == NULL || errno != ECANCELED) {
+                fprintf(stderr, "Error: Lost connection to the daemon\n");
+            }
+            free(frame);
+            break;
+        }
+        frame[length - 1] = '\0';
+        
+        char type = (char)header[4];
+        if (type == SERVER_FRAME_DATA) {
+            if (stream) {
+                if (open_output(&output_fp, output_file) == NULL) {
+                    free(frame);
+                    break;
+                }
+                fwrite(frame, 1, length - 1, output_fp);
+                fflush(output_fp);
+            } else {
+                buffer_append(&code, frame, length - 1);
+            }
+            free(frame);
+        } else if (type == SERVER_FRAME_END) {
+            free(frame);
+            if (open_output(&output_fp, output_file) != NULL) {
+                if (!stream && code.size > 0) {
+                    fwrite(code.data, 1, code.size, output_fp);
+                }
+                fputc('\n', output_fp);
+                status = 0;
+            }
+            break;
+        } else {
+            fprintf(stderr, "Error: %s\n", type == SERVER_FRAME_ERROR ? frame : "Malformed response from the daemon");
+            free(frame);
+            break;
+        }
+    }
+    
+    if (output_fp != NULL && output_fp != stdout) {
+        fclose(output_fp);
+    }
+    free(code.data);
+    close(fd);
+    return status;
+}
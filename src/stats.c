@@ -0,0 +1,296 @@
+#define _DEFAULT_SOURCE
+
+#include "../include/stats.h"
+#include "../include/config.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STATS_FILE_NAME "stats"
+#define STATS_MAGIC "ENGSTAT1"
+#define STATS_SLOTS 256
+#define MAX_PATH_LENGTH 1024
+
+// Latencies fall into log-scale buckets, four per doubling of the latency in
+// microseconds; 128 buckets reach past an hour
+#define STATS_BUCKETS 128
+#define BUCKETS_PER_DOUBLING 4
+
+// Header at the start of the memory-mapped store
+typedef struct {
+    char magic[8];
+    uint32_t slots;
+    uint32_t buckets;
+} stats_header_t;
+
+// Histograms of one model and target language
+typedef struct {
+    char model[STATS_MAX_MODEL];
+    char language[STATS_MAX_LANGUAGE];
+    uint64_t requests;
+    uint64_t failures;
+    uint64_t eval_count;
+    uint64_t eval_duration_ns;
+    uint32_t total[STATS_BUCKETS];
+    uint32_t first_byte[STATS_BUCKETS];
+} stats_slot_t;
+
+#define STATS_FILE_SIZE (sizeof(stats_header_t) + STATS_SLOTS * sizeof(stats_slot_t))
+
+// Bucket boundaries within one doubling: 2^(k/4) for k = 0..3
+static const double quarter_powers[BUCKETS_PER_DOUBLING] = { 1.0, 1.189207, 1.414214, 1.681793 };
+
+// flock only orders processes, so threads of one process also take this lock
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static int stats_fd = -1;
+static stats_header_t *header = NULL;
+static stats_slot_t *slots = NULL;
+
+static _Thread_local english_stats_t last_stats;
+static _Thread_local bool has_last_stats = false;
+
+void stats_set_last(const english_stats_t *stats) {
+    last_stats = *stats;
+    has_last_stats = true;
+}
+
+bool stats_get_last(english_stats_t *stats) {
+    if (!has_last_stats) {
+        return false;
+    }
+    *stats = last_stats;
+    return true;
+}
+
+// Map the store, creating it on first use; it stays mapped for the process
+static bool open_store(void) {
+    if (header != NULL) {
+        return true;
+    }
+    
+    char path[MAX_PATH_LENGTH];
+    if (snprintf(path, sizeof(path), "%s/%s", config_get_dir(), STATS_FILE_NAME) >= (int)sizeof(path)) {
+        return false;
+    }
+    
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open stats file %s\n", path);
+        return false;
+    }
+    
+    flock(fd, LOCK_EX);
+    
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || (size_t)st.st_size != STATS_FILE_SIZE;
+    if (fresh && ftruncate(fd, STATS_FILE_SIZE) != 0) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return false;
+    }
+    
+    void *map = mmap(NULL, STATS_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return false;
+    }
+    
+    header = (stats_header_t *)map;
+    slots = (stats_slot_t *)(header + 1);
+    
+    // A new or foreign file starts out empty
+    if (fresh || memcmp(header->magic, STATS_MAGIC, sizeof(header->magic)) != 0 ||
+        header->slots != STATS_SLOTS || header->buckets != STATS_BUCKETS) {
+        memset(header, 0, STATS_FILE_SIZE);
+        memcpy(header->magic, STATS_MAGIC, sizeof(header->magic));
+        header->slots = STATS_SLOTS;
+        header->buckets = STATS_BUCKETS;
+    }
+    
+    flock(fd, LOCK_UN);
+    stats_fd = fd;
+    return true;
+}
+
+// Find or claim the slot of a model and language; the store lock must be held
+static stats_slot_t *find_slot(const char *model, const char *language) {
+    // FNV-1a over both names picks the first probe
+    uint32_t hash = 2166136261u;
+    for (const char *p = model; *p != '\0'; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    hash *= 16777619u;  // The NUL between the two names
+    for (const char *p = language; *p != '\0'; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    
+    for (uint32_t i = 0; i < STATS_SLOTS; i++) {
+        stats_slot_t *slot = &slots[(hash + i) % STATS_SLOTS];
+        if (slot->model[0] == '\0') {
+            snprintf(slot->model, sizeof(slot->model), "%s", model);
+            snprintf(slot->language, sizeof(slot->language), "%s", language);
+            return slot;
+        }
+        if (strncmp(slot->model, model, sizeof(slot->model) - 1) == 0 &&
+            strncmp(slot->language, language, sizeof(slot->language) - 1) == 0) {
+            return slot;
+        }
+    }
+    
+    return NULL;
+}
+
+// Bucket of a latency in milliseconds
+static int bucket_of(double milliseconds) {
+    double microseconds = milliseconds * 1000.0;
+    if (microseconds < 1.0) {
+        return 0;
+    }
+    
+    uint64_t whole = (uint64_t)microseconds;
+    int doublings = 0;
+    while (whole >> (doublings + 1) != 0) {
+        doublings++;
+    }
+    
+    double mantissa = microseconds / (double)((uint64_t)1 << doublings);
+    int quarter = BUCKETS_PER_DOUBLING - 1;
+    while (quarter > 0 && mantissa < quarter_powers[quarter]) {
+        quarter--;
+    }
+    
+    int bucket = doublings * BUCKETS_PER_DOUBLING + quarter;
+    return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+// Representative latency of a bucket in milliseconds: the geometric middle of its range
+static double bucket_value(int bucket) {
+    double lower = (double)((uint64_t)1 << (bucket / BUCKETS_PER_DOUBLING)) * quarter_powers[bucket % BUCKETS_PER_DOUBLING];
+    return lower * 1.090508 / 1000.0;
+}
+
+// Latency below which a fraction of the samples fall
+static double histogram_percentile(const uint32_t *histogram, double fraction) {
+    uint64_t count = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        count += histogram[i];
+    }
+    if (count == 0) {
+        return 0;
+    }
+    
+    uint64_t rank = (uint64_t)(fraction * count + 0.999999);
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            return bucket_value(i);
+        }
+    }
+    return bucket_value(STATS_BUCKETS - 1);
+}
+
+void stats_record(const char *model, const char *target_language, const english_stats_t *stats, bool success) {
+    if (stats->cached) {
+        return;
+    }
+    
+    pthread_mutex_lock(&store_lock);
+    if (!open_store()) {
+        pthread_mutex_unlock(&store_lock);
+        return;
+    }
+    
+    flock(stats_fd, LOCK_EX);
+    stats_slot_t *slot = find_slot(model, target_language);
+    if (slot != NULL) {
+        slot->requests++;
+        if (!success) {
+            slot->failures++;
+        } else {
+            slot->total[bucket_of(stats->total_ms)]++;
+            slot->first_byte[bucket_of(stats->first_byte_ms)]++;
+            slot->eval_count += stats->eval_count;
+            slot->eval_duration_ns += stats->eval_duration_ns;
+        }
+    }
+    flock(stats_fd, LOCK_UN);
+    pthread_mutex_unlock(&store_lock);
+}
+
+bool stats_summarize(stats_summary_t **summaries, size_t *count) {
+    *summaries = calloc(STATS_SLOTS, sizeof(stats_summary_t));
+    *count = 0;
+    if (*summaries == NULL) {
+        return false;
+    }
+    
+    pthread_mutex_lock(&store_lock);
+    if (!open_store()) {
+        pthread_mutex_unlock(&store_lock);
+        free(*summaries);
+        *summaries = NULL;
+        return false;
+    }
+    
+    flock(stats_fd, LOCK_SH);
+    for (uint32_t i = 0; i < STATS_SLOTS; i++) {
+        const stats_slot_t *slot = &slots[i];
+        if (slot->model[0] == '\0') {
+            continue;
+        }
+        
+        stats_summary_t *summary = &(*summaries)[(*count)++];
+        memcpy(summary->model, slot->model, sizeof(summary->model));
+        memcpy(summary->language, slot->language, sizeof(summary->language));
+        summary->model[sizeof(summary->model) - 1] = '\0';
+        summary->language[sizeof(summary->language) - 1] = '\0';
+        summary->requests = slot->requests;
+        summary->failures = slot->failures;
+        summary->total_p50_ms = histogram_percentile(slot->total, 0.50);
+        summary->total_p95_ms = histogram_percentile(slot->total, 0.95);
+        summary->total_p99_ms = histogram_percentile(slot->total, 0.99);
+        summary->first_byte_p50_ms = histogram_percentile(slot->first_byte, 0.50);
+        summary->first_byte_p95_ms = histogram_percentile(slot->first_byte, 0.95);
+        summary->tokens_per_second = slot->eval_duration_ns > 0 ?
+                                     slot->eval_count * 1e9 / slot->eval_duration_ns : 0.0;
+    }
+    flock(stats_fd, LOCK_UN);
+    pthread_mutex_unlock(&store_lock);
+    
+    return true;
+}
+
+bool stats_clear(void) {
+    pthread_mutex_lock(&store_lock);
+    bool success = open_store();
+    if (success) {
+        flock(stats_fd, LOCK_EX);
+        memset(slots, 0, STATS_SLOTS * sizeof(stats_slot_t));
+        flock(stats_fd, LOCK_UN);
+    }
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+void stats_close(void) {
+    pthread_mutex_lock(&store_lock);
+    if (header != NULL) {
+        munmap(header, STATS_FILE_SIZE);
+        header = NULL;
+        slots = NULL;
+    }
+    if (stats_fd >= 0) {
+        close(stats_fd);
+        stats_fd = -1;
+    }
+    pthread_mutex_unlock(&store_lock);
+}
@@ -0,0 +1,105 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/tokens.h"
+
+#include <strings.h>
+
+// Letters of a word per token; common words are one token, longer ones are split
+#define LETTERS_PER_TOKEN 5
+
+// Digits per token; numbers are split into groups of up to three
+#define DIGITS_PER_TOKEN 3
+
+// Bytes of other scripts per token, about one character
+#define MULTIBYTE_PER_TOKEN 3
+
+// Room for the answer whatever the description's size, and the most it may take
+#define MIN_OUTPUT_TOKENS 1024
+#define MAX_OUTPUT_TOKENS 16384
+
+// The window is sized this much larger than the estimate, in percent
+#define WINDOW_MARGIN_PERCENT 10
+
+// Tokens of code per token of description; languages not listed get the default
+#define DEFAULT_OUTPUT_RATIO 5
+static const struct {
+    const char *language;
+    size_t ratio;
+} output_ratios[] = {
+    { "python", 4 }, { "py", 4 }, { "ruby", 4 }, { "rb", 4 }, { "perl", 4 }, { "lua", 4 },
+    { "bash", 3 }, { "shell", 3 }, { "sh", 3 }, { "zsh", 3 }, { "sql", 3 },
+    { "go", 6 }, { "golang", 6 }, { "c", 6 }, { "cpp", 6 }, { "c++", 6 }, { "cxx", 6 },
+    { "rust", 6 }, { "swift", 6 }, { "kotlin", 6 },
+    { "java", 7 }, { "csharp", 7 }, { "c#", 7 },
+};
+
+// The tokens a run of characters of one kind takes
+static size_t run_tokens(size_t length, size_t per_token) {
+    return (length + per_token - 1) / per_token;
+}
+
+size_t tokens_estimate(const char *text, size_t length) {
+    const unsigned char *p = (const unsigned char *)text;
+    const unsigned char *end = p + length;
+    size_t tokens = 0;
+    
+    while (p < end) {
+        const unsigned char *start = p;
+        unsigned char c = *p;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+            while (p < end && ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))) {
+                p++;
+            }
+            tokens += run_tokens(p - start, LETTERS_PER_TOKEN);
+        } else if (c >= '0' && c <= '9') {
+            while (p < end && *p >= '0' && *p <= '9') {
+                p++;
+            }
+            tokens += run_tokens(p - start, DIGITS_PER_TOKEN);
+        } else if (c >= 0x80) {
+            while (p < end && *p >= 0x80) {
+                p++;
+            }
+            tokens += run_tokens(p - start, MULTIBYTE_PER_TOKEN);
+        } else if (c == ' ') {
+            // A single space belongs to the word after it; indentation is one token
+            while (p < end && *p == ' ') {
+                p++;
+            }
+            tokens += p - start > 1;
+        } else if (c == '\n' || c == '\r' || c == '\t') {
+            while (p < end && (*p == '\n' || *p == '\r' || *p == '\t')) {
+                p++;
+            }
+            tokens++;
+        } else {
+            // Punctuation and operators, one token each
+            p++;
+            tokens++;
+        }
+    }
+    
+    return tokens;
+}
+
+size_t tokens_expected_output(const char *language, size_t description_tokens) {
+    size_t ratio = DEFAULT_OUTPUT_RATIO;
+    for (size_t i = 0; i < sizeof(output_ratios) / sizeof(output_ratios[0]); i++) {
+        if (strcasecmp(output_ratios[i].language, language) == 0) {
+            ratio = output_ratios[i].ratio;
+            break;
+        }
+    }
+    
+    size_t tokens = MIN_OUTPUT_TOKENS + ratio * description_tokens;
+    return tokens < MAX_OUTPUT_TOKENS ? tokens : MAX_OUTPUT_TOKENS;
+}
+
+size_t tokens_window(size_t tokens) {
+    size_t needed = tokens + tokens * WINDOW_MARGIN_PERCENT / 100;
+    size_t window = TOKENS_MIN_WINDOW;
+    while (window < needed && window < TOKENS_MAX_WINDOW) {
+        window *= 2;
+    }
+    return window;
+}
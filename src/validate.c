@@ -0,0 +1,270 @@
+#define _DEFAULT_SOURCE
+
+#include "../include/validate.h"
+#include "../include/config.h"
+#include "../include/fence.h"
+#include "../include/monotonic.h"
+#include "../include/router.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Longest a validator may run; it is killed after that and the code rejected
+#define VALIDATOR_TIMEOUT_SECONDS 10
+
+// What sh exits with when it cannot find the command
+#define EXIT_NOT_FOUND 127
+
+// What run_command returns when the validator could not be started
+#define RUN_FAILED -2
+
+#define MAX_PATH_LENGTH 1024
+#define MAX_COMMAND_LENGTH 4096
+
+// Most validator output kept for picking the reason of a rejection
+#define MAX_DIAGNOSTICS 4096
+
+// Syntax-only checks of the toolchains that have one; languages not listed
+// are only checked locally. perl -c is left out, since it runs BEGIN blocks
+// and use statements, which would execute the generated code.
+static const char *const builtin_validators[][2] = {
+    { "python", "python3 -c 'import ast, sys; ast.parse(open(sys.argv[1]).read(), sys.argv[1])'" },
+    { "py", "python3 -c 'import ast, sys; ast.parse(open(sys.argv[1]).read(), sys.argv[1])'" },
+    { "c", "cc -fsyntax-only -x c" }, { "h", "cc -fsyntax-only -x c" },
+    { "cpp", "c++ -fsyntax-only -x c++" }, { "c++", "c++ -fsyntax-only -x c++" },
+    { "cxx", "c++ -fsyntax-only -x c++" },
+    { "javascript", "node --check" }, { "js", "node --check" },
+    { "bash", "bash -n" }, { "shell", "bash -n" }, { "sh", "sh -n" }, { "zsh", "zsh -n" },
+    { "ruby", "ruby -c" }, { "rb", "ruby -c" }, { "php", "php -l" },
+    { "go", "gofmt -e" }, { "golang", "gofmt -e" },
+    { "json", "python3 -m json.tool" }, { "lua", "luac -p" },
+};
+
+const char *validate_command(const char *language) {
+    const char *command = config_get_validator(language);
+    if (command != NULL) {
+        return strcasecmp(command, "none") != 0 ? command : NULL;
+    }
+    
+    for (size_t i = 0; i < sizeof(builtin_validators) / sizeof(builtin_validators[0]); i++) {
+        if (strcasecmp(builtin_validators[i][0], language) == 0) {
+            return builtin_validators[i][1];
+        }
+    }
+    return NULL;
+}
+
+// Put the path of the code into the command, in place of every "{}" or at the end
+static bool build_command(const char *command, const char *path, char *buffer, size_t size) {
+    size_t length = 0;
+    bool placed = false;
+    
+    for (const char *p = command; *p != '\0'; p++) {
+        const char *text = p;
+        size_t text_length = 1;
+        if (p[0] == '{' && p[1] == '}') {
+            text = path;
+            text_length = strlen(path);
+            placed = true;
+            p++;
+        }
+        if (length + text_length >= size) {
+            return false;
+        }
+        memcpy(buffer + length, text, text_length);
+        length += text_length;
+    }
+    
+    if (!placed) {
+        if (length + strlen(path) + 1 >= size) {
+            return false;
+        }
+        buffer[length++] = ' ';
+        memcpy(buffer + length, path, strlen(path));
+        length += strlen(path);
+    }
+    buffer[length] = '\0';
+    return true;
+}
+
+// Run a command through the shell with its output captured; returns its exit
+// status, -1 if it was killed, or RUN_FAILED if it could not be run
+static int run_command(const char *command, char *output, size_t size) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        return RUN_FAILED;
+    }
+    
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return RUN_FAILED;
+    }
+    
+    if (pid == 0) {
+        // The alarm survives exec, so a validator that hangs is killed
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            close(null_fd);
+        }
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        dup2(pipe_fds[1], STDERR_FILENO);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        alarm(VALIDATOR_TIMEOUT_SECONDS);
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(EXIT_NOT_FOUND);
+    }
+    
+    // Keep the start of the output, and drain the rest so the child never blocks
+    close(pipe_fds[1]);
+    size_t length = 0;
+    char discard[1024];
+    for (;;) {
+        char *target = length + 1 < size ? output + length : discard;
+        size_t room = length + 1 < size ? size - 1 - length : sizeof(discard);
+        ssize_t count = read(pipe_fds[0], target, room);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        if (target != discard) {
+            length += (size_t)count;
+        }
+    }
+    output[length] = '\0';
+    close(pipe_fds[0]);
+    
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return RUN_FAILED;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Pick the line of a validator's output that says what is wrong: the first
+// one mentioning an error, or else the last one
+static void pick_reason(const char *output, char *reason, size_t reason_size) {
+    const char *chosen = NULL;
+    size_t chosen_length = 0;
+    
+    for (const char *line = output; *line != '\0';) {
+        size_t length = strcspn(line, "\n");
+        const char *start = line;
+        while (start < line + length && (*start == ' ' || *start == '\t')) {
+            start++;
+        }
+        size_t trimmed = line + length - start;
+        
+        if (trimmed > 0) {
+            bool error = false;
+            for (size_t i = 0; i + 5 <= trimmed && !error; i++) {
+                error = strncasecmp(start + i, "error", 5) == 0;
+            }
+            chosen = start;
+            chosen_length = trimmed;
+            if (error) {
+                break;
+            }
+        }
+        
+        line += length;
+        if (*line == '\n') {
+            line++;
+        }
+    }
+    
+    snprintf(reason, reason_size, "%.*s", (int)chosen_length, chosen != NULL ? chosen : "");
+}
+
+// The in-process bracket check, for code no validator could look at
+static bool check_locally(const char *code, size_t length, const char *language, char *reason, size_t reason_size) {
+    const char *problem = router_check_code(code, length, language);
+    if (problem != NULL) {
+        snprintf(reason, reason_size, "%s", problem);
+        return false;
+    }
+    return true;
+}
+
+bool validate_code(const char *code, size_t length, const char *language, bool verbose, char *reason,
+                   size_t reason_size) {
+    // The local check is a heuristic that misreads some valid code, so it
+    // only stands in for a validator the language does not have
+    const char *command = validate_command(language);
+    if (command == NULL) {
+        return check_locally(code, length, language, reason, reason_size);
+    }
+    
+    // The validator reads the code from a file named like a source file of the language
+    const char *directory = getenv("TMPDIR");
+    if (directory == NULL || directory[0] == '\0') {
+        directory = "/tmp";
+    }
+    const char *extension = fence_file_extension(language, strlen(language));
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/english-XXXXXX.%s", directory, extension);
+    int fd = mkstemps(path, (int)strlen(extension) + 1);
+    if (fd < 0) {
+        if (verbose) {
+            fprintf(stderr, "Verbose mode: Could not create a file for the validator, only checked locally\n");
+        }
+        return check_locally(code, length, language, reason, reason_size);
+    }
+    
+    bool written = true;
+    for (size_t offset = 0; offset < length && written;) {
+        ssize_t count = write(fd, code + offset, length - offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        written = count > 0;
+        offset += count > 0 ? (size_t)count : 0;
+    }
+    close(fd);
+    
+    char command_line[MAX_COMMAND_LENGTH];
+    char output[MAX_DIAGNOSTICS];
+    double started = monotonic_ms();
+    int status = written && build_command(command, path, command_line, sizeof(command_line)) ?
+                 run_command(command_line, output, sizeof(output)) : RUN_FAILED;
+    unlink(path);
+    
+    if (verbose) {
+        fprintf(stderr, "Verbose mode: Validator '%s' exited with %d in %.0f ms\n", command, status,
+                monotonic_ms() - started);
+    }
+    
+    if (status == 0) {
+        return true;
+    }
+    if (status == EXIT_NOT_FOUND || status == RUN_FAILED) {
+        // A missing toolchain must not reject every candidate
+        if (verbose) {
+            fprintf(stderr, "Verbose mode: Validator '%s' could not run, only checked locally\n", command);
+        }
+        return check_locally(code, length, language, reason, reason_size);
+    }
+    if (status < 0) {
+        snprintf(reason, reason_size, "validator did not finish");
+        return false;
+    }
+    
+    pick_reason(output, reason, reason_size);
+    if (reason[0] == '\0') {
+        snprintf(reason, reason_size, "validator exited with status %d", status);
+    }
+    return false;
+}
@@ -0,0 +1,420 @@
+#define _DEFAULT_SOURCE
+
+#include "../include/watch.h"
+#include "../include/english.h"
+#include "../include/context.h"
+#include "../include/fence.h"
+#include "../include/input.h"
+#include "../include/monotonic.h"
+#include "../include/request.h"
+#include "../include/sha256.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <curl/curl.h>
+
+#define MAX_PATH_LENGTH 1024
+
+// Events that mean a file was saved: written in place, or renamed over the old one
+#define SAVE_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+// One watched description and the output it compiles to
+typedef struct {
+    char *name;                    // File name within the watched directory
+    char *input;                   // Path of the description
+    char *output;                  // Path of the output
+    uint8_t hash[SHA256_DIGEST_SIZE];  // Contents of the last compile started
+    bool hashed;                   // hash is set, and that compile has not failed
+    double due_ms;                 // When a pending change is compiled, negative if none is
+    english_request_t *request;    // The compile in flight, if any
+    double started_ms;
+} watch_target_t;
+
+// Everything being watched
+typedef struct {
+    const char *language;
+    const char *output_dir;        // Where outputs go when a directory is watched, else NULL
+    const char *directory;         // The watched directory
+    watch_target_t **targets;      // Separately allocated, since they are CURLOPT_PRIVATE of their transfers
+    size_t count;
+    size_t capacity;
+    CURLM *multi;
+    long debounce_ms;
+} watch_t;
+
+// Whether a file name is a description of a watched directory
+static bool is_description(const char *name) {
+    size_t length = strlen(name);
+    size_t extension_length = strlen(WATCH_EXTENSION);
+    return name[0] != '.' && length > extension_length &&
+           strcmp(name + length - extension_length, WATCH_EXTENSION) == 0;
+}
+
+// Hash what a compile of the description depends on
+static void hash_input(const watch_t *watch, const input_t *input, uint8_t hash[SHA256_DIGEST_SIZE]) {
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, watch->language, strlen(watch->language) + 1);
+    sha256_update(&ctx, input->data, input->size);
+    sha256_final(&ctx, hash);
+}
+
+static watch_target_t *find_target(const watch_t *watch, const char *name) {
+    for (size_t i = 0; i < watch->count; i++) {
+        if (strcmp(watch->targets[i]->name, name) == 0) {
+            return watch->targets[i];
+        }
+    }
+    return NULL;
+}
+
+// Start watching a description; output is its output path, or NULL to derive
+// one in the output directory
+static watch_target_t *add_target(watch_t *watch, const char *name, const char *output) {
+    if (watch->count == watch->capacity) {
+        size_t capacity = watch->capacity > 0 ? watch->capacity * 2 : 8;
+        watch_target_t **targets = realloc(watch->targets, capacity * sizeof(watch_target_t *));
+        if (targets == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return NULL;
+        }
+        watch->targets = targets;
+        watch->capacity = capacity;
+    }
+    
+    watch_target_t *target = calloc(1, sizeof(watch_target_t));
+    char input_path[MAX_PATH_LENGTH];
+    char output_path[MAX_PATH_LENGTH];
+    snprintf(input_path, sizeof(input_path), "%s/%s", watch->directory, name);
+    if (output == NULL) {
+        snprintf(output_path, sizeof(output_path), "%s/%.*s.%s", watch->output_dir,
+                 (int)(strlen(name) - strlen(WATCH_EXTENSION)), name,
+                 fence_file_extension(watch->language, strlen(watch->language)));
+        output = output_path;
+    }
+    if (target != NULL) {
+        target->name = strdup(name);
+        target->input = strdup(input_path);
+        target->output = strdup(output);
+    }
+    if (target == NULL || target->name == NULL || target->input == NULL || target->output == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        if (target != NULL) {
+            free(target->name);
+            free(target->input);
+            free(target->output);
+            free(target);
+        }
+        return NULL;
+    }
+    
+    target->due_ms = -1;
+    watch->targets[watch->count++] = target;
+    return target;
+}
+
+// Replace the output atomically: written under a private name, then renamed over it
+static bool write_output(const char *path, const char *code, size_t length) {
+    char temp_path[MAX_PATH_LENGTH + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp.%ld", path, (long)getpid());
+    
+    FILE *file = fopen(temp_path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    bool written = fwrite(code, 1, length, file) == length && fputc('\n', file) != EOF;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
+
+// Drop a compile whose input changed; closing its connection stops the server generating
+static void cancel_target(watch_target_t *target) {
+    request_free(target->request);
+    target->request = NULL;
+    target->hashed = false;
+    printf("[cancelled] %s: input changed\n", target->name);
+    fflush(stdout);
+}
+
+// Write a finished compile's code and report it
+static void complete_target(watch_target_t *target) {
+    bool success = request_finish(target->request);
+    double seconds = (monotonic_ms() - target->started_ms) / 1000;
+    
+    if (success && write_output(target->output, request_get_output(target->request),
+                                request_get_output_length(target->request))) {
+        printf("[ok]     %s -> %s (%.2fs%s)\n", target->name, target->output, seconds,
+               request_is_cached(target->request) ? ", cached" : "");
+    } else {
+        // The same contents are compiled again on the next save
+        target->hashed = false;
+        if (success) {
+            printf("[failed] %s: could not write %s\n", target->name, target->output);
+        } else if (!english_is_cancelled()) {
+            printf("[failed] %s: compilation failed\n", target->name);
+        }
+    }
+    fflush(stdout);
+    
+    request_free(target->request);
+    target->request = NULL;
+}
+
+// Compile a target's current contents, unless they are what was last compiled
+static void start_target(watch_t *watch, watch_target_t *target) {
+    input_t input;
+    if (!input_read(target->input, &input)) {
+        // Deleted, or renamed away; a later save brings it back
+        return;
+    }
+    
+    // An empty file is usually an editor halfway through saving
+    if (input.size == 0) {
+        input_close(&input);
+        return;
+    }
+    
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    hash_input(watch, &input, hash);
+    if (target->hashed && memcmp(hash, target->hash, sizeof(hash)) == 0) {
+        if (english_is_verbose()) {
+            fprintf(stderr, "Verbose mode: %s is unchanged, not compiling it again\n", target->name);
+        }
+        input_close(&input);
+        return;
+    }
+    if (target->request != NULL) {
+        cancel_target(target);
+    }
+    
+    // The request copies what it needs of the description
+    target->request = request_new(context_get_default(), input.data, watch->language, NULL, NULL);
+    input_close(&input);
+    if (target->request == NULL) {
+        printf("[failed] %s: could not create request\n", target->name);
+        fflush(stdout);
+        return;
+    }
+    memcpy(target->hash, hash, sizeof(hash));
+    target->hashed = true;
+    target->started_ms = monotonic_ms();
+    
+    if (request_is_cached(target->request) || !request_start(target->request, watch->multi, (void *)target)) {
+        complete_target(target);
+    }
+}
+
+// A target's input was saved: compile it once the burst of saves is over,
+// and cancel right away a compile of contents that are no longer current
+static void input_changed(watch_t *watch, watch_target_t *target) {
+    target->due_ms = monotonic_ms() + watch->debounce_ms;
+    if (target->request == NULL) {
+        return;
+    }
+    
+    input_t input;
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    if (input_read(target->input, &input)) {
+        hash_input(watch, &input, hash);
+        input_close(&input);
+        if (memcmp(hash, target->hash, sizeof(hash)) == 0) {
+            return;
+        }
+    }
+    cancel_target(target);
+}
+
+// Handle the events read from inotify; returns false if the directory went away
+static bool read_events(watch_t *watch, int fd) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    
+    for (;;) {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            return length == 0 || errno == EAGAIN || errno == EINTR;
+        }
+        
+        for (char *p = buffer; p < buffer + length;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                fprintf(stderr, "Error: %s was removed\n", watch->directory);
+                return false;
+            }
+            if (event->len == 0 || !(event->mask & SAVE_EVENTS)) {
+                continue;
+            }
+            
+            // A watched directory picks up new descriptions
+            watch_target_t *target = find_target(watch, event->name);
+            if (target == NULL && watch->output_dir != NULL && is_description(event->name)) {
+                target = add_target(watch, event->name, NULL);
+            }
+            if (target != NULL) {
+                input_changed(watch, target);
+            }
+        }
+    }
+}
+
+// Add every description already in the watched directory
+static bool scan_directory(watch_t *watch) {
+    DIR *dir = opendir(watch->directory);
+    if (dir == NULL) {
+        fprintf(stderr, "Error: Could not open directory %s\n", watch->directory);
+        return false;
+    }
+    
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (is_description(entry->d_name) && add_target(watch, entry->d_name, NULL) == NULL) {
+            closedir(dir);
+            return false;
+        }
+    }
+    closedir(dir);
+    return true;
+}
+
+// Run the compiles that are due and collect the finished ones; returns how
+// long until something is next due
+static long step(watch_t *watch) {
+    int running = 0;
+    curl_multi_perform(watch->multi, &running);
+    
+    CURLMsg *message;
+    int queued;
+    while ((message = curl_multi_info_read(watch->multi, &queued)) != NULL) {
+        if (message->msg != CURLMSG_DONE) {
+            continue;
+        }
+        watch_target_t *target = NULL;
+        curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char **)&target);
+        if (request_complete_transfer(target->request, message->easy_handle, message->data.result)) {
+            complete_target(target);
+        }
+    }
+    
+    long wait = 1000;
+    double now = monotonic_ms();
+    for (size_t i = 0; i < watch->count; i++) {
+        watch_target_t *target = watch->targets[i];
+        long next;
+        
+        if (target->due_ms >= 0 && now >= target->due_ms) {
+            target->due_ms = -1;
+            start_target(watch, target);
+        } else if (target->due_ms >= 0 && target->due_ms - now < wait) {
+            wait = (long)(target->due_ms - now) + 1;
+        }
+        
+        if (target->request != NULL) {
+            if (request_poll(target->request, &next)) {
+                complete_target(target);
+            } else if (next >= 0 && next < wait) {
+                wait = next;
+            }
+        }
+    }
+    return wait;
+}
+
+int watch_run(const char *input_path, const char *output_path, const char *target_language, long debounce_ms) {
+    struct stat st;
+    if (stat(input_path, &st) != 0) {
+        fprintf(stderr, "Error: Could not open %s\n", input_path);
+        return 1;
+    }
+    
+    watch_t watch;
+    memset(&watch, 0, sizeof(watch));
+    watch.language = target_language;
+    watch.debounce_ms = debounce_ms;
+    
+    // A single file is watched through its directory, since editors often
+    // save by renaming a new file over the old one
+    char directory[MAX_PATH_LENGTH];
+    const char *name = NULL;
+    if (S_ISDIR(st.st_mode)) {
+        if (mkdir(output_path, 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Error: Could not create directory %s\n", output_path);
+            return 1;
+        }
+        snprintf(directory, sizeof(directory), "%s", input_path);
+        watch.output_dir = output_path;
+    } else {
+        const char *slash = strrchr(input_path, '/');
+        if (slash == NULL) {
+            snprintf(directory, sizeof(directory), ".");
+            name = input_path;
+        } else {
+            snprintf(directory, sizeof(directory), "%.*s", slash == input_path ? 1 : (int)(slash - input_path),
+                     input_path);
+            name = slash + 1;
+        }
+    }
+    watch.directory = directory;
+    
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, directory, SAVE_EVENTS | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+        fprintf(stderr, "Error: Could not watch %s: %s\n", directory, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    
+    watch.multi = curl_multi_init();
+    bool ready = watch.multi != NULL && (name != NULL ? add_target(&watch, name, output_path) != NULL :
+                                                         scan_directory(&watch));
+    if (watch.multi == NULL) {
+        fprintf(stderr, "Error: Could not initialize CURL\n");
+    }
+    
+    // Everything is compiled once at the start
+    for (size_t i = 0; i < watch.count; i++) {
+        watch.targets[i]->due_ms = 0;
+    }
+    if (ready) {
+        printf("Watching %s for changes (Ctrl+C to stop)\n", input_path);
+        fflush(stdout);
+    }
+    
+    while (ready && !english_is_cancelled()) {
+        long wait = step(&watch);
+        
+        // Wait for the network, a change to the input, or the next due compile
+        struct curl_waitfd waitfd = { fd, CURL_WAIT_POLLIN, 0 };
+        curl_multi_poll(watch.multi, &waitfd, 1, (int)wait, NULL);
+        if (waitfd.revents != 0) {
+            ready = read_events(&watch, fd);
+        }
+    }
+    
+    // Compiles still in flight are dropped with their connections
+    for (size_t i = 0; i < watch.count; i++) {
+        request_free(watch.targets[i]->request);
+        free(watch.targets[i]->name);
+        free(watch.targets[i]->input);
+        free(watch.targets[i]->output);
+        free(watch.targets[i]);
+    }
+    free(watch.targets);
+    if (watch.multi != NULL) {
+        curl_multi_cleanup(watch.multi);
+    }
+    close(fd);
+    return english_is_cancelled() ? 0 : 1;
+}